@@ -46,9 +46,11 @@
 #import "LDrawPart.h"
 #import "LDrawQuadrilateral.h"
 #import "LDrawStep.h"
+#import "LDrawStepExporter.h"
 #import "LDrawTriangle.h"
 #import "LDrawUtilities.h"
 #import "LDrawViewerContainer.h"
+#import "LDrawWriter.h"
 #import "LSynthConfiguration.h"
 #import "MacLDraw.h"
 #import "MinifigureDialogController.h"
@@ -442,7 +444,6 @@ void AppendChoicesToNewItem(
 			   ofType:(NSString *)typeName
 				error:(NSError **)outError
 {
-	NSString    *fileContents   = [LDrawUtilities stringFromFileData:data];
 	LDrawFile   *newFile        = nil;
 	BOOL        success         = NO;
 	
@@ -459,7 +460,9 @@ void AppendChoicesToNewItem(
 			CFAbsoluteTime  startTime   = CFAbsoluteTimeGetCurrent();
 			CFTimeInterval  parseTime   = 0;
 			
-			newFile     = [LDrawFile parseFromFileContents:fileContents];
+			// Submodels parse their steps the first time something looks 
+			// inside them, so big MPD files open without parsing it all. 
+			newFile     = [LDrawFile fileFromData:data deferringSubmodels:YES];
 			parseTime   = CFAbsoluteTimeGetCurrent() - startTime;
 			
 #if DEBUG
@@ -530,9 +533,16 @@ void AppendChoicesToNewItem(
 - (NSData *)dataOfType:(NSString *)typeName
 				 error:(NSError **)outError
 {
-    NSString *modelOutput = [[self documentContents] write];
+	// Stream the file straight into one UTF-8 buffer, which becomes the data 
+	// without being copied again.
+	LDrawWriter	*writer	= [[LDrawWriter alloc] init];
+	NSData		*output	= nil;
 	
-	return [modelOutput dataUsingEncoding:NSUTF8StringEncoding];
+	[[self documentContents] writeToStream:writer];
+	output = [writer takeData];
+	[writer release];
+	
+	return output;
 	
 }//end dataOfType:error:
 
@@ -861,15 +871,25 @@ void AppendChoicesToNewItem(
 	LDrawDirective  *currentObject      = nil;
 	NSInteger       counter             = 0;
 	
-	//find the nudgable items
-	for(counter = 0; counter < [selectedObjects count]; counter++)
+	// Moving a big selection would otherwise send an invalidation up the 
+	// tree for every part. 
+	[LDrawDirective beginInvalidationBatch];
+	@try
 	{
-		currentObject = [selectedObjects objectAtIndex:counter];
-		
-//		if([currentObject isKindOfClass:[LDrawDrawableElement class]])
-        if([currentObject conformsToProtocol:@protocol(LDrawMovableDirective)])
-			[self moveDirective: (LDrawDrawableElement*)currentObject
-					inDirection: movementVector];
+		//find the nudgable items
+		for(counter = 0; counter < [selectedObjects count]; counter++)
+		{
+			currentObject = [selectedObjects objectAtIndex:counter];
+			
+//			if([currentObject isKindOfClass:[LDrawDrawableElement class]])
+			if([currentObject conformsToProtocol:@protocol(LDrawMovableDirective)])
+				[self moveDirective: (LDrawDrawableElement*)currentObject
+						inDirection: movementVector];
+		}
+	}
+	@finally
+	{
+		[LDrawDirective commitInvalidationBatch];
 	}
 	
 }//end moveSelectionBy:
@@ -1049,20 +1069,28 @@ void AppendChoicesToNewItem(
 	}
 	
 	//rotate everything that can be rotated. That would be parts and only parts.
-	for(counter = 0; counter < [selectedObjects count]; counter++)
+	[LDrawDirective beginInvalidationBatch];
+	@try
 	{
-		currentObject = [selectedObjects objectAtIndex:counter];
-		
-		if([currentObject isKindOfClass:[LDrawPart class]])
+		for(counter = 0; counter < [selectedObjects count]; counter++)
 		{
-			if(mode == RotateAroundPartPositions)
-				rotationCenter = [(LDrawPart*)currentObject position];
-		
-			[self rotatePart:currentObject
-				   byDegrees:rotation
-				 aroundPoint:rotationCenter ];
+			currentObject = [selectedObjects objectAtIndex:counter];
+			
+			if([currentObject isKindOfClass:[LDrawPart class]])
+			{
+				if(mode == RotateAroundPartPositions)
+					rotationCenter = [(LDrawPart*)currentObject position];
+			
+				[self rotatePart:currentObject
+					   byDegrees:rotation
+					 aroundPoint:rotationCenter ];
+			}
 		}
 	}
+	@finally
+	{
+		[LDrawDirective commitInvalidationBatch];
+	}
 	
 }//end rotateSelection:mode:fixedCenter:
 
@@ -1595,22 +1623,12 @@ void AppendChoicesToNewItem(
 	 {
 		 // Do the save
 		 
-		 NSFileManager	 *fileManager		 = [[[NSFileManager alloc] init] autorelease];
-		 NSURL			 *saveURL			 = nil;
-		 NSString		 *saveName			 = nil;
-		 NSString		 *modelName 		 = nil;
-		 NSString		 *folderName		 = nil;
-		 NSString		 *modelnameFormat	 = NSLocalizedString(@"ExportedStepsFolderFormat", nil);
-		 NSString		 *filenameFormat	 = NSLocalizedString(@"ExportedStepsFileFormat", nil);
-		 NSString		 *fileString		 = nil;
-		 NSData 		 *fileOutputData	 = nil;
-		 NSString		 *outputName		 = nil;
-		 NSString		 *outputPath		 = nil;
-		 
-		 LDrawFile		 *fileCopy			 = nil;
-		 
-		 NSInteger		 modelCounter		 = 0;
-		 NSInteger		 counter			 = 0;
+		 NSFileManager		*fileManager		= [[[NSFileManager alloc] init] autorelease];
+		 NSURL				*saveURL			= nil;
+		 NSString			*saveName			= nil;
+		 NSString			*modelnameFormat	= NSLocalizedString(@"ExportedStepsFolderFormat", nil);
+		 NSString			*filenameFormat		= NSLocalizedString(@"ExportedStepsFileFormat", nil);
+		 LDrawStepExporter	*exporter			= nil;
 		 
 		 if(returnCode == NSModalResponseOK)
 		 {
@@ -1623,51 +1641,13 @@ void AppendChoicesToNewItem(
 			 
 			 [fileManager createDirectoryAtPath:saveName withIntermediateDirectories:YES attributes:nil error:NULL];
 			 
-			 //Output all the steps for all the submodels.
-			 for(modelCounter = 0; modelCounter < [[[self documentContents] submodels] count]; modelCounter++)
-			 {
-				 fileCopy = [[self documentContents] copy];
-				 
-				 //Move the target model to the top of the file. That way L3P will know to
-				 // render it!
-				 LDrawMPDModel *currentModel = [[fileCopy submodels] objectAtIndex:modelCounter];
-				 [currentModel retain];
-				 [fileCopy removeDirective:currentModel];
-				 [fileCopy insertDirective:currentModel atIndex:0];
-				 [fileCopy setActiveModel:currentModel];
-				 [currentModel release];
-				 
-				 //Make a new folder for the model's steps.
-				 modelName	= [NSString stringWithFormat:modelnameFormat, [currentModel modelName]];
-				 folderName	= [saveName stringByAppendingPathComponent:modelName];
-				 
-				 [fileManager createDirectoryAtPath:folderName withIntermediateDirectories:YES attributes:nil error:NULL];
-				 
-				 //Write out each step!
-				 for(counter = [[currentModel steps] count]-1; counter >= 0; counter--)
-				 {
-					 fileString		= [fileCopy write];
-					 fileOutputData	= [fileString dataUsingEncoding:NSUTF8StringEncoding];
-					 
-					 outputName = [NSString stringWithFormat: filenameFormat,
-								   [currentModel modelName],
-								   (long)counter+1 ];
-					 outputPath = [folderName stringByAppendingPathComponent:outputName];
-					 [fileManager createFileAtPath:outputPath
-										  contents:fileOutputData
-										attributes:nil ];
-					 
-					 //Remove the step we just wrote, so that the next cycle won't
-					 // include it. We can safely do this because we are working with
-					 // a copy of the file!
-					 [currentModel removeDirectiveAtIndex:counter];
-				 }
-				 
-				 
-				 [fileCopy release];
-				 
-			 }
-			 
+			 //Output all the steps for all the submodels, each in its own 
+			 // folder.
+			 exporter = [[LDrawStepExporter alloc] initWithFile:[self documentContents]];
+			 [exporter exportToFolder:saveName
+					modelFolderFormat:modelnameFormat
+					   stepFileFormat:filenameFormat];
+			 [exporter release];
 		 }
 	 }];
 
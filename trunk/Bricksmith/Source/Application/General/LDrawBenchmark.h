@@ -0,0 +1,83 @@
+//==============================================================================
+//
+// File:		LDrawBenchmark.h
+//
+// Purpose:		Headless load-and-analyse runs of the LDraw layer, reporting
+//				timings and memory use as JSON.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import <Foundation/Foundation.h>
+
+// Benchmark - THEORY OF OPERATION
+//
+// Launching the application binary with --benchmark as its first argument
+// runs this instead of NSApplicationMain: no windows, no documents, no menu
+// bar.  That way it exercises exactly the code the application ships -
+// LDrawFile, PartLibrary, PartReport and the mesh smoother - without a
+// second copy of the model layer to keep building.
+//
+//	Bricksmith.app/Contents/MacOS/Bricksmith --benchmark [options] path ...
+//
+//		--ldraw folder		LDraw folder; defaults to the one in preferences.
+//		--iterations n		Load each model n times (default 1).
+//		--optimize			Run -optimizeStructure on each model.
+//		--smooth			Smooth every library part the model uses, then
+//							reorder each mesh for the vertex cache and
+//							round-trip it through the packed vertex format.
+//		--threads			Bake the model's parts into one mesh and smooth it
+//							on one thread and on many; fail unless the two
+//							results are bit-identical.
+//		--welders			Smooth every part in the library with each way of
+//							welding vertices and compare the time it takes;
+//							fail unless the results are bit-identical.  No
+//							model paths are needed for this one.
+//		--lazy				Defer parsing submodels until first use.
+//		--serial			Parse on one thread, for less noisy timings.
+//		--output file		Write the JSON there instead of to stdout.
+//
+// Each path is a model, or a folder searched for .ldr, .mpd and .dat files.
+// Information/Samples/Benchmark in the source tree is the standard corpus.
+//
+// For every model and iteration, each stage reports its wall time, and the
+// change in malloc'd blocks and bytes still in use when it finishes, plus
+// the peak resident size of the process so far.  The load stage also
+// reports throughput in MB/s.  The first iteration of a model pays for
+// loading the library parts it uses; later ones find them cached.
+
+// The first argument which selects a benchmark run.
+#define LDRAW_BENCHMARK_ARGUMENT		"--benchmark"
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// class LDrawBenchmark
+//
+////////////////////////////////////////////////////////////////////////////////
+@interface LDrawBenchmark : NSObject
+{
+	NSMutableArray	*modelPaths;
+	NSString		*ldrawPath;
+	NSString		*outputPath;
+	NSUInteger		iterations;
+	BOOL			optimize;
+	BOOL			smooth;
+	BOOL			checkThreads;
+	BOOL			threadsMismatched;
+	BOOL			compareWeld;
+	BOOL			weldersMismatched;
+	BOOL			deferSubmodels;
+	BOOL			serialParsing;
+}
+
+// Running
++ (int) runWithArgumentCount:(int)argc arguments:(const char **)argv;
+
+// Initialization
+- (id) initWithArguments:(NSArray *)arguments;
+
+// Benchmark
+- (int) run;
+
+@end
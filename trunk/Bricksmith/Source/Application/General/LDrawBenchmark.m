@@ -0,0 +1,1211 @@
+//==============================================================================
+//
+// File:		LDrawBenchmark.m
+//
+// Purpose:		Headless load-and-analyse runs of the LDraw layer, reporting
+//				timings and memory use as JSON.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import "LDrawBenchmark.h"
+
+#import <malloc/malloc.h>
+#import <sys/resource.h>
+
+#import "LDrawApplication.h"
+#import "LDrawFile.h"
+#import "LDrawMPDModel.h"
+#import "LDrawParseScheduler.h"
+#import "LDrawPart.h"
+#import "LDrawPaths.h"
+#import "LDrawRenderer.h"
+#import "MacLDraw.h"
+#import "MeshSmooth.h"
+#import "PartLibrary.h"
+#import "PartReport.h"
+#import "PreferencesDialogController.h"
+
+// The mesh smoother's stages, in the order LDrawDisplayList runs them.
+enum
+{
+	smoothStageCollect = 0,
+	smoothStageSort,
+	smoothStageCreases,
+	smoothStageTJunctions,
+	smoothStageJoin,
+	smoothStageNormals,
+	smoothStageMerge,
+	smoothStageWrite,
+	smoothStageOptimize,
+	smoothStageCount
+};
+
+static const char *smoothStageNames[smoothStageCount] =
+{
+	"collect", "sort", "creases", "t_junctions", "join", "normals", "merge", "write", "optimize"
+};
+
+// The FIFO vertex cache size cache-miss ratios are measured with - about what
+// the GPUs we run on have.
+#define SIMULATED_VERTEX_CACHE_SIZE		16
+
+// The parts of the t_junctions stage the smoother times itself, by
+// MESH_TIMER_* index.
+static const char *tJunctionTimerNames[MESH_TIMER_COUNT] =
+{
+	"index", "search", "rebuild"
+};
+
+// Where a stage started.
+typedef struct
+{
+	CFAbsoluteTime				time;
+	malloc_statistics_t			memory;
+
+} StageStart;
+
+// What reordering and packing smoothed meshes did, added up over the parts.
+typedef struct
+{
+	double						missesBefore;		// Simulated vertex cache misses.
+	double						missesAfter;
+	unsigned long long			triangles;			// Quads count as two.
+	unsigned long long			floatBytes;			// 10-float vertices.
+	unsigned long long			packedBytes;		// Packed vertices, palette and bounds.
+	CFTimeInterval				packSeconds;
+	CFTimeInterval				unpackSeconds;
+	double						maxPositionError;	// LDU.
+	double						maxNormalError;		// Radians.
+	unsigned long long			exactMismatches;	// Colors, or lines' missing normals, that came back different.
+	NSUInteger					unpackableMeshes;	// Too many colors for a palette.
+
+} VertexFormatTotals;
+
+
+//========== startStage ========================================================
+//
+// Purpose:		Notes the time and heap use at the start of a stage.
+//
+//==============================================================================
+static void startStage(StageStart *start)
+{
+	malloc_zone_statistics(NULL, &start->memory);
+	start->time = CFAbsoluteTimeGetCurrent();
+}
+
+
+//========== finishStage =======================================================
+//
+// Purpose:		Returns the report for a stage begun with startStage. If bytes
+//				is non-zero, the throughput is included too.
+//
+//==============================================================================
+static NSMutableDictionary *finishStage(const char *name, StageStart *start, unsigned long long bytes)
+{
+	CFTimeInterval			seconds		= CFAbsoluteTimeGetCurrent() - start->time;
+	malloc_statistics_t		memory;
+	struct rusage			usage;
+	NSMutableDictionary		*report		= [NSMutableDictionary dictionary];
+
+	malloc_zone_statistics(NULL, &memory);
+	getrusage(RUSAGE_SELF, &usage);
+
+	[report setObject:[NSString stringWithUTF8String:name] forKey:@"stage"];
+	[report setObject:[NSNumber numberWithDouble:seconds] forKey:@"seconds"];
+	if(bytes > 0 && seconds > 0)
+	{
+		[report setObject:[NSNumber numberWithDouble:(bytes / (1024.0 * 1024.0)) / seconds] forKey:@"mb_per_sec"];
+	}
+	[report setObject:[NSNumber numberWithLongLong:(long long)memory.blocks_in_use - (long long)start->memory.blocks_in_use] forKey:@"live_blocks_delta"];
+	[report setObject:[NSNumber numberWithLongLong:(long long)memory.size_in_use - (long long)start->memory.size_in_use] forKey:@"live_bytes_delta"];
+
+	// ru_maxrss is in bytes on Mac OS X.
+	[report setObject:[NSNumber numberWithLong:usage.ru_maxrss] forKey:@"peak_rss_bytes"];
+
+	return report;
+}
+
+
+//========== resolveColor ======================================================
+//
+// Purpose:		Turns the renderer's magic color pointers into the RGBA values
+//				the display list builder would pass to the smoother.
+//
+//==============================================================================
+static void resolveColor(GLfloat *color, GLfloat storage[4])
+{
+	if(color == LDrawRenderCurrentColor)
+	{
+		storage[0] = storage[1] = storage[2] = storage[3] = 0;
+	}
+	else if(color == LDrawRenderComplimentColor)
+	{
+		storage[0] = storage[1] = storage[2] = 1;
+		storage[3] = 0;
+	}
+	else
+	{
+		memcpy(storage, color, sizeof(GLfloat) * 4);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// class BenchmarkMeshCollector
+//
+// Gathers a part's primitives for the smoother. Each record is its vertices
+// (always room for four) followed by its RGBA color.
+//
+////////////////////////////////////////////////////////////////////////////////
+#define COLLECTED_FACE_FLOATS	(4*3 + 4)
+
+@interface BenchmarkMeshCollector : NSObject <LDrawCollector>
+{
+@public
+	NSMutableData	*tris;
+	NSMutableData	*quads;
+	NSMutableData	*lines;
+}
+@end
+
+
+@implementation BenchmarkMeshCollector
+
+- (id) init
+{
+	self = [super init];
+
+	tris	= [[NSMutableData alloc] init];
+	quads	= [[NSMutableData alloc] init];
+	lines	= [[NSMutableData alloc] init];
+
+	return self;
+}
+
+- (void) addFace:(GLfloat *)vertices count:(int)count color:(GLfloat *)color to:(NSMutableData *)faces
+{
+	GLfloat	record[COLLECTED_FACE_FLOATS]	= {0};
+
+	memcpy(record, vertices, sizeof(GLfloat) * 3 * count);
+	resolveColor(color, record + 12);
+	[faces appendBytes:record length:sizeof(record)];
+}
+
+- (void) pushTexture:(struct LDrawTextureSpec *)tex_spec	{ }
+- (void) popTexture											{ }
+
+- (void) drawQuad:(GLfloat *)vertices normal:(GLfloat *)normal color:(GLfloat *)color
+{
+	[self addFace:vertices count:4 color:color to:quads];
+}
+
+- (void) drawTri:(GLfloat *)vertices normal:(GLfloat *)normal color:(GLfloat *)color
+{
+	[self addFace:vertices count:3 color:color to:tris];
+}
+
+- (void) drawLine:(GLfloat *)vertices normal:(GLfloat *)normal color:(GLfloat *)color
+{
+	[self addFace:vertices count:2 color:color to:lines];
+}
+
+- (void) dealloc
+{
+	[tris	release];
+	[quads	release];
+	[lines	release];
+
+	[super dealloc];
+}
+
+@end
+
+
+//========== addFaces ==========================================================
+//
+// Purpose:		Feeds one kind of collected face to the mesh.
+//
+//==============================================================================
+static void addFaces(struct Mesh *mesh, NSData *faces, int vertexCount)
+{
+	const GLfloat	*record		= [faces bytes];
+	NSUInteger		count		= [faces length] / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS);
+	NSUInteger		counter		= 0;
+
+	for(counter = 0; counter < count; counter++, record += COLLECTED_FACE_FLOATS)
+	{
+		add_face(mesh,
+				 record,
+				 record + 3,
+				 vertexCount > 2 ? record + 6 : NULL,
+				 vertexCount > 3 ? record + 9 : NULL,
+				 record + 12,
+				 0);
+	}
+}
+
+
+//========== addTransformedFaces ===============================================
+//
+// Purpose:		Appends collected faces to baked, each vertex moved by
+//				transform.
+//
+//==============================================================================
+static void addTransformedFaces(NSMutableData *baked, NSData *faces, int vertexCount, Matrix4 transform)
+{
+	const GLfloat	*record		= [faces bytes];
+	NSUInteger		count		= [faces length] / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS);
+	NSUInteger		counter		= 0;
+	GLfloat			moved[COLLECTED_FACE_FLOATS];
+	Point3			point;
+	int				vertex		= 0;
+
+	for(counter = 0; counter < count; counter++, record += COLLECTED_FACE_FLOATS)
+	{
+		memcpy(moved, record, sizeof(moved));
+		for(vertex = 0; vertex < vertexCount; vertex++)
+		{
+			point		= V3Make(record[vertex*3], record[vertex*3 + 1], record[vertex*3 + 2]);
+			point		= V3MulPointByProjMatrix(point, transform);
+			moved[vertex*3]		= point.x;
+			moved[vertex*3 + 1]	= point.y;
+			moved[vertex*3 + 2]	= point.z;
+		}
+		[baked appendBytes:moved length:sizeof(moved)];
+	}
+}
+
+
+//========== smoothFaces =======================================================
+//
+// Purpose:		Runs collected faces through every stage of the smoother with
+//				the given threading and welder, and returns the vertex table
+//				followed by the index table.
+//
+// Notes:		If weldSeconds isn't NULL, it gets the time spent in
+//				finish_faces_and_sort, which is where the welding happens.
+//
+//==============================================================================
+static NSData *smoothFaces(NSData *tris, NSData *quads, NSData *lines, int threading, int welder, CFTimeInterval *seconds, CFTimeInterval *weldSeconds)
+{
+	CFAbsoluteTime	start		= CFAbsoluteTimeGetCurrent();
+	CFAbsoluteTime	weldStart	= 0;
+	struct Mesh		*mesh		= NULL;
+	NSMutableData	*output		= nil;
+	int				totalVerts	= 0;
+	int				totalIndices	= 0;
+	int				lineStart	= 0;
+	int				lineTotal	= 0;
+	int				triStart	= 0;
+	int				triTotal	= 0;
+	int				quadStart	= 0;
+	int				quadTotal	= 0;
+
+	mesh = create_mesh((int)([tris  length] / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS)),
+					   (int)([quads length] / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS)),
+					   (int)([lines length] / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS)) );
+	set_mesh_threading(mesh, threading);
+	set_mesh_welder(mesh, welder);
+	addFaces(mesh, tris,  3);
+	addFaces(mesh, quads, 4);
+	addFaces(mesh, lines, 2);
+
+	weldStart = CFAbsoluteTimeGetCurrent();
+	finish_faces_and_sort(mesh);
+	if(weldSeconds)
+		*weldSeconds = CFAbsoluteTimeGetCurrent() - weldStart;
+	add_creases(mesh);
+	find_and_remove_t_junctions(mesh);
+	finish_creases_and_join(mesh);
+	smooth_vertices(mesh);
+	merge_vertices(mesh);
+
+	get_final_mesh_counts(mesh, &totalVerts, &totalIndices);
+	output = [NSMutableData dataWithLength:sizeof(float) * 10 * totalVerts + sizeof(unsigned int) * totalIndices];
+	write_indexed_mesh(mesh, totalVerts, [output mutableBytes],
+					   totalIndices, (unsigned int *)((float *)[output mutableBytes] + 10 * totalVerts), 0,
+					   &lineStart, &lineTotal, &triStart, &triTotal, &quadStart, &quadTotal);
+	destroy_mesh(mesh);
+
+	*seconds = CFAbsoluteTimeGetCurrent() - start;
+
+	return output;
+}
+
+
+//========== measureVertexCacheMisses ==========================================
+//
+// Purpose:		Adds up the simulated vertex cache misses of every run of tris
+//				and quads in a smoothed mesh.
+//
+//==============================================================================
+static double measureVertexCacheMisses(const unsigned int *indices, int triStart, int triTotal, int quadStart, int quadTotal)
+{
+	return get_vertex_cache_miss_ratio(SIMULATED_VERTEX_CACHE_SIZE, 3, triTotal,  indices + triStart)  * (triTotal / 3)
+		 + get_vertex_cache_miss_ratio(SIMULATED_VERTEX_CACHE_SIZE, 4, quadTotal, indices + quadStart) * (quadTotal / 4);
+}
+
+
+//========== measurePackedVertices =============================================
+//
+// Purpose:		Packs a smoothed vertex table, unpacks it again the way a
+//				shader would, and adds the size, time and worst error of the
+//				round trip to the totals.
+//
+//==============================================================================
+static void measurePackedVertices(VertexFormatTotals *totals, const float *vertices, int vertexCount)
+{
+	struct PackedVertex	*packed		= malloc(sizeof(struct PackedVertex) * vertexCount);
+	float				*palette	= malloc(sizeof(float) * 4 * vertexCount);
+	float				*unpacked	= malloc(sizeof(float) * 10 * vertexCount);
+	float				origin[3];
+	float				scale[3];
+	int					paletteCount	= 0;
+	int					vertex		= 0;
+	int					axis		= 0;
+	CFAbsoluteTime		start		= 0;
+	double				dot			= 0;
+	double				length		= 0;
+
+	start			= CFAbsoluteTimeGetCurrent();
+	paletteCount	= pack_vertices(vertexCount, vertices, packed, origin, scale, palette);
+	totals->packSeconds += CFAbsoluteTimeGetCurrent() - start;
+
+	if(paletteCount < 0)
+	{
+		totals->unpackableMeshes += 1;
+	}
+	else
+	{
+		start = CFAbsoluteTimeGetCurrent();
+		unpack_vertices(vertexCount, packed, origin, scale, palette, unpacked);
+		totals->unpackSeconds += CFAbsoluteTimeGetCurrent() - start;
+
+		totals->floatBytes	+= sizeof(float) * 10 * vertexCount;
+		totals->packedBytes	+= sizeof(struct PackedVertex) * vertexCount + sizeof(float) * (4 * paletteCount + 6);
+
+		for(vertex = 0; vertex < vertexCount; vertex++)
+		{
+			const float	*before	= vertices + 10 * vertex;
+			const float	*after	= unpacked + 10 * vertex;
+
+			dot		= 0;
+			length	= 0;
+			for(axis = 0; axis < 3; axis++)
+			{
+				totals->maxPositionError = MAX(totals->maxPositionError, fabs(after[axis] - before[axis]));
+				dot		+= after[3 + axis] * before[3 + axis];
+				length	+= before[3 + axis] * before[3 + axis];
+			}
+			// Lines have no normal, and must come back without one.
+			if(length > 0)
+				totals->maxNormalError = MAX(totals->maxNormalError, acos(MIN(1.0, dot / sqrt(length))));
+			else if(after[3] != 0 || after[4] != 0 || after[5] != 0)
+				totals->exactMismatches += 1;
+
+			if(memcmp(after + 6, before + 6, sizeof(float) * 4) != 0)
+				totals->exactMismatches += 1;
+		}
+	}
+
+	free(packed);
+	free(palette);
+	free(unpacked);
+}
+
+
+@interface LDrawBenchmark ()
+
+- (NSDictionary *) loadLibrary;
+- (NSDictionary *) benchmarkModelAtPath:(NSString *)path;
+- (NSDictionary *) smoothPartsInReport:(PartReport *)partReport;
+- (NSDictionary *) smoothBakedPartsInReport:(PartReport *)partReport;
+- (NSDictionary *) compareWelders;
+- (NSDictionary *) libraryCacheReport;
+
+@end
+
+
+@implementation LDrawBenchmark
+
+#pragma mark -
+#pragma mark RUNNING
+#pragma mark -
+
+//---------- runWithArgumentCount:arguments: -------------------------[static]--
+//
+// Purpose:		Entry point from main(). argv[1] is LDRAW_BENCHMARK_ARGUMENT.
+//				Returns the process exit status.
+//
+//------------------------------------------------------------------------------
++ (int) runWithArgumentCount:(int)argc arguments:(const char **)argv
+{
+	NSAutoreleasePool	*pool		= [[NSAutoreleasePool alloc] init];
+	NSMutableArray		*arguments	= [NSMutableArray array];
+	LDrawBenchmark		*benchmark	= nil;
+	int					status		= 0;
+	int					counter		= 0;
+
+	for(counter = 2; counter < argc; counter++)
+	{
+		[arguments addObject:[NSString stringWithUTF8String:argv[counter]]];
+	}
+
+	benchmark = [[LDrawBenchmark alloc] initWithArguments:arguments];
+	if(benchmark == nil)
+	{
+		fprintf(stderr,
+				"usage: %s " LDRAW_BENCHMARK_ARGUMENT " [--ldraw folder] [--iterations n] [--optimize] [--smooth]\n"
+				"           [--threads] [--welders] [--lazy] [--serial] [--output file] path ...\n",
+				argv[0]);
+		status = 1;
+	}
+	else
+	{
+		status = [benchmark run];
+		[benchmark release];
+	}
+
+	[pool drain];
+
+	return status;
+
+}//end runWithArgumentCount:arguments:
+
+
+#pragma mark -
+#pragma mark INITIALIZATION
+#pragma mark -
+
+//========== initWithArguments: ================================================
+//
+// Purpose:		Reads the options and model paths. Returns nil if they don't
+//				make sense.
+//
+//==============================================================================
+- (id) initWithArguments:(NSArray *)arguments
+{
+	NSFileManager	*fileManager	= [NSFileManager defaultManager];
+	NSString		*argument		= nil;
+	NSString		*path			= nil;
+	NSString		*subpath		= nil;
+	NSString		*extension		= nil;
+	NSMutableArray	*folderContents	= nil;
+	BOOL			isFolder		= NO;
+	NSUInteger		counter			= 0;
+
+	self = [super init];
+
+	modelPaths	= [[NSMutableArray alloc] init];
+	iterations	= 1;
+
+	for(counter = 0; counter < [arguments count]; counter++)
+	{
+		argument = [arguments objectAtIndex:counter];
+
+		if([argument isEqualToString:@"--optimize"])
+			optimize = YES;
+		else if([argument isEqualToString:@"--smooth"])
+			smooth = YES;
+		else if([argument isEqualToString:@"--threads"])
+			checkThreads = YES;
+		else if([argument isEqualToString:@"--welders"])
+			compareWeld = YES;
+		else if([argument isEqualToString:@"--lazy"])
+			deferSubmodels = YES;
+		else if([argument isEqualToString:@"--serial"])
+			serialParsing = YES;
+		else if(		[argument isEqualToString:@"--ldraw"]
+				||	[argument isEqualToString:@"--iterations"]
+				||	[argument isEqualToString:@"--output"] )
+		{
+			if(counter + 1 == [arguments count])
+			{
+				[self release];
+				return nil;
+			}
+			counter += 1;
+
+			if([argument isEqualToString:@"--ldraw"])
+				ldrawPath = [[arguments objectAtIndex:counter] copy];
+			else if([argument isEqualToString:@"--output"])
+				outputPath = [[arguments objectAtIndex:counter] copy];
+			else
+				iterations = MAX(1, [[arguments objectAtIndex:counter] integerValue]);
+		}
+		else if([argument hasPrefix:@"--"])
+		{
+			[self release];
+			return nil;
+		}
+		else
+		{
+			path = [argument stringByStandardizingPath];
+
+			if([fileManager fileExistsAtPath:path isDirectory:&isFolder] == NO)
+			{
+				fprintf(stderr, "%s: no such file\n", [path UTF8String]);
+				[self release];
+				return nil;
+			}
+
+			if(isFolder)
+			{
+				folderContents = [NSMutableArray array];
+
+				for(subpath in [fileManager enumeratorAtPath:path])
+				{
+					extension = [[subpath pathExtension] lowercaseString];
+					if(		[extension isEqualToString:@"ldr"]
+					   ||	[extension isEqualToString:@"mpd"]
+					   ||	[extension isEqualToString:@"dat"] )
+					{
+						[folderContents addObject:[path stringByAppendingPathComponent:subpath]];
+					}
+				}
+				// Same order on every machine, so runs can be compared.
+				[folderContents sortUsingSelector:@selector(compare:)];
+				[modelPaths addObjectsFromArray:folderContents];
+			}
+			else
+			{
+				[modelPaths addObject:path];
+			}
+		}
+	}
+
+	// The welder comparison covers the whole library; it needs no models.
+	if([modelPaths count] == 0 && compareWeld == NO)
+	{
+		[self release];
+		return nil;
+	}
+
+	return self;
+
+}//end initWithArguments:
+
+
+#pragma mark -
+#pragma mark BENCHMARK
+#pragma mark -
+
+//========== run ===============================================================
+//
+// Purpose:		Loads the library, then runs each model through the stages
+//				and writes out the report. Returns the process exit status.
+//
+//==============================================================================
+- (int) run
+{
+	NSMutableDictionary	*report			= [NSMutableDictionary dictionary];
+	NSMutableDictionary	*options		= [NSMutableDictionary dictionary];
+	NSMutableArray		*modelReports	= [NSMutableArray array];
+	NSOpenGLContext		*context		= nil;
+	NSDictionary		*libraryReport	= nil;
+	NSData				*json			= nil;
+	NSError				*error			= nil;
+	NSString			*path			= nil;
+
+	// Same start-up the application does, minus the UI. Some of the model
+	// code may touch OpenGL (textures), so give it a context to do that in.
+	[PreferencesDialogController ensureDefaults];
+
+	context = [[NSOpenGLContext alloc] initWithFormat:[LDrawApplication openGLPixelFormat] shareContext:nil];
+	[context makeCurrentContext];
+
+	[LDrawParseScheduler setSerialParsing:serialParsing];
+
+	libraryReport = [self loadLibrary];
+	if(libraryReport == nil)
+	{
+		[context release];
+		return 1;
+	}
+
+	for(path in modelPaths)
+	{
+		[modelReports addObject:[self benchmarkModelAtPath:path]];
+	}
+
+	[options setObject:[NSNumber numberWithUnsignedInteger:iterations] forKey:@"iterations"];
+	[options setObject:[NSNumber numberWithBool:optimize] forKey:@"optimize"];
+	[options setObject:[NSNumber numberWithBool:smooth] forKey:@"smooth"];
+	[options setObject:[NSNumber numberWithBool:checkThreads] forKey:@"threads"];
+	[options setObject:[NSNumber numberWithBool:compareWeld] forKey:@"welders"];
+	[options setObject:[NSNumber numberWithBool:deferSubmodels] forKey:@"lazy"];
+	[options setObject:[NSNumber numberWithBool:serialParsing] forKey:@"serial"];
+	[options setObject:[[LDrawPaths sharedPaths] preferredLDrawPath] forKey:@"ldraw"];
+
+	[report setObject:options forKey:@"options"];
+	[report setObject:libraryReport forKey:@"library"];
+	[report setObject:modelReports forKey:@"models"];
+	if(compareWeld)
+		[report setObject:[self compareWelders] forKey:@"welders"];
+	[report setObject:[self libraryCacheReport] forKey:@"model_cache"];
+#if LDRAW_FAST_SET_BENCHMARKS
+	[report setObject:LDrawFastSetBenchmarks() forKey:@"fast_set"];
+#endif
+
+	json = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted error:&error];
+
+	[NSOpenGLContext clearCurrentContext];
+	[context release];
+
+	if(json == nil)
+	{
+		fprintf(stderr, "%s\n", [[error localizedDescription] UTF8String]);
+		return 1;
+	}
+
+	if(outputPath != nil)
+	{
+		if([json writeToFile:outputPath atomically:YES] == NO)
+		{
+			fprintf(stderr, "%s: could not write\n", [outputPath UTF8String]);
+			return 1;
+		}
+	}
+	else
+	{
+		fwrite([json bytes], 1, [json length], stdout);
+		fputc('\n', stdout);
+	}
+
+	if(threadsMismatched)
+	{
+		fprintf(stderr, "parallel smoothing did not match serial smoothing\n");
+		return 1;
+	}
+
+	if(weldersMismatched)
+	{
+		fprintf(stderr, "grid welding did not match R-tree welding\n");
+		return 1;
+	}
+
+	return 0;
+
+}//end run
+
+
+//========== loadLibrary =======================================================
+//
+// Purpose:		Points the library at the LDraw folder and loads the part
+//				catalog, building it if there isn't one. Returns the report
+//				for the stage, or nil if there's no usable LDraw folder.
+//
+//==============================================================================
+- (NSDictionary *) loadLibrary
+{
+	LDrawPaths			*paths		= [LDrawPaths sharedPaths];
+	PartLibrary			*library	= [PartLibrary sharedPartLibrary];
+	NSString			*folder		= ldrawPath;
+	StageStart			start;
+	__block BOOL		done		= NO;
+	__block BOOL		success		= NO;
+
+	if(folder == nil)
+		folder = [[NSUserDefaults standardUserDefaults] stringForKey:LDRAW_PATH_KEY];
+	if(folder == nil)
+		folder = [paths findLDrawPath];
+
+	if(folder == nil || [paths validateLDrawFolder:folder] == NO)
+	{
+		fprintf(stderr, "No LDraw folder found; use --ldraw.\n");
+		return nil;
+	}
+	[paths setPreferredLDrawPath:folder];
+
+	startStage(&start);
+
+	success = [library load];
+	if(success == NO)
+	{
+		// The catalog is finished on the main queue; keep it turning until
+		// then, since there is no application run loop to do it for us.
+		[library reloadPartsWithMaxLoadCountHandler:NULL
+						   progressIncrementHandler:NULL
+								  completionHandler:^(BOOL reloaded)
+		{
+			success	= reloaded;
+			done	= YES;
+		}];
+
+		while(done == NO)
+		{
+			[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+									 beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+		}
+	}
+
+	if(success == NO)
+	{
+		fprintf(stderr, "%s: could not load the part catalog.\n", [folder UTF8String]);
+		return nil;
+	}
+
+	return finishStage("catalog", &start, 0);
+
+}//end loadLibrary
+
+
+//========== benchmarkModelAtPath: =============================================
+//
+// Purpose:		Runs one model through the stages, iterations times.
+//
+//==============================================================================
+- (NSDictionary *) benchmarkModelAtPath:(NSString *)path
+{
+	NSMutableDictionary	*modelReport	= [NSMutableDictionary dictionary];
+	NSMutableArray		*runs			= [NSMutableArray array];
+	NSDictionary		*attributes		= [[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL];
+	unsigned long long	fileSize		= [attributes fileSize];
+	NSAutoreleasePool	*pool			= nil;
+	NSMutableArray		*stages			= nil;
+	LDrawFile			*file			= nil;
+	PartReport			*partReport		= nil;
+	NSMutableDictionary	*resolveReport	= nil;
+	NSUInteger			missingCount	= 0;
+	NSUInteger			counter			= 0;
+	StageStart			start;
+
+	[modelReport setObject:path forKey:@"path"];
+	[modelReport setObject:[NSNumber numberWithUnsignedLongLong:fileSize] forKey:@"bytes"];
+
+	for(counter = 0; counter < iterations; counter++)
+	{
+		pool	= [[NSAutoreleasePool alloc] init];
+		stages	= [NSMutableArray array];
+
+		// Load
+		startStage(&start);
+		file = [LDrawFile fileFromContentsAtPath:path deferringSubmodels:deferSubmodels];
+		[stages addObject:finishStage("load", &start, fileSize)];
+
+		if(file == nil)
+		{
+			[modelReport setObject:@"could not read file" forKey:@"error"];
+			[pool drain];
+			break;
+		}
+
+		// Resolve - finds (and the first time, loads) every part used.
+		startStage(&start);
+		partReport		= [PartReport partReportForContainer:file];
+		missingCount	= [[partReport missingParts] count];
+		resolveReport	= finishStage("resolve", &start, 0);
+
+		[resolveReport setObject:[NSNumber numberWithUnsignedInteger:[partReport numberOfParts]] forKey:@"parts"];
+		[resolveReport setObject:[NSNumber numberWithUnsignedInteger:missingCount] forKey:@"missing_parts"];
+		[resolveReport setObject:[NSNumber numberWithUnsignedInteger:[[file submodels] count]] forKey:@"submodels"];
+		[stages addObject:resolveReport];
+
+		if(optimize)
+		{
+			startStage(&start);
+			[file optimizeStructure];
+			[stages addObject:finishStage("optimize", &start, 0)];
+		}
+
+		if(smooth)
+		{
+			[stages addObject:[self smoothPartsInReport:partReport]];
+		}
+
+		if(checkThreads)
+		{
+			[stages addObject:[self smoothBakedPartsInReport:partReport]];
+		}
+
+		// runs keeps the stage reports alive past the pool.
+		[runs addObject:stages];
+		[pool drain];
+	}
+
+	[modelReport setObject:runs forKey:@"runs"];
+
+	return modelReport;
+
+}//end benchmarkModelAtPath:
+
+
+//========== smoothPartsInReport: ==============================================
+//
+// Purpose:		Runs every distinct library part in the report through the
+//				mesh smoother, the way a display list would be built for it,
+//				and reports the time spent in each of the smoother's stages,
+//				with the t_junctions stage broken down further.
+//
+//				Under vertex_format it also reports the simulated vertex cache
+//				misses per triangle before and after optimize_indexed_mesh, and
+//				the size and round-trip error of the packed vertex format.
+//
+//==============================================================================
+- (NSDictionary *) smoothPartsInReport:(PartReport *)partReport
+{
+	PartLibrary				*library		= [PartLibrary sharedPartLibrary];
+	NSMutableIndexSet		*partSymbols	= [NSMutableIndexSet indexSet];
+	NSUInteger				partSymbol		= 0;
+	NSMutableDictionary		*smoothReport	= nil;
+	NSMutableDictionary		*stageTimes		= [NSMutableDictionary dictionary];
+	NSMutableDictionary		*tJunctionTimes	= [NSMutableDictionary dictionary];
+	NSMutableDictionary		*formatReport	= [NSMutableDictionary dictionary];
+	VertexFormatTotals		format			= {0};
+	CFTimeInterval			times[smoothStageCount]	= {0};
+	CFTimeInterval			timers[MESH_TIMER_COUNT]	= {0};
+	int						timer			= 0;
+	CFAbsoluteTime			stageStart		= 0;
+	unsigned long long		faceCount		= 0;
+	unsigned long long		vertexCount		= 0;
+	unsigned long long		indexCount		= 0;
+	NSUInteger				meshCount		= 0;
+	int						stage			= 0;
+	StageStart				start;
+
+	for(LDrawPart *part in [partReport allParts])
+	{
+		[partSymbols addIndex:[part partSymbol]];
+	}
+	[partSymbols removeIndex:LDrawSymbolNone];
+
+	startStage(&start);
+
+	for(partSymbol = [partSymbols firstIndex]; partSymbol != NSNotFound; partSymbol = [partSymbols indexGreaterThanIndex:partSymbol])
+	{
+		NSAutoreleasePool		*pool		= [[NSAutoreleasePool alloc] init];
+		LDrawModel				*model		= [library modelForSymbol:(LDrawSymbol)partSymbol];
+		BenchmarkMeshCollector	*collector	= nil;
+		struct Mesh				*mesh		= NULL;
+		int						triCount	= 0;
+		int						quadCount	= 0;
+		int						lineCount	= 0;
+		int						totalVerts	= 0;
+		int						totalIndices	= 0;
+
+		// Missing parts and MPD submodels have nothing to smooth.
+		if(model != nil)
+		{
+			stageStart	= CFAbsoluteTimeGetCurrent();
+			collector	= [[BenchmarkMeshCollector alloc] init];
+			[model collectSelf:collector];
+
+			triCount	= (int)([collector->tris  length] / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS));
+			quadCount	= (int)([collector->quads length] / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS));
+			lineCount	= (int)([collector->lines length] / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS));
+		}
+
+		if(model != nil && triCount + quadCount + lineCount == 0)
+		{
+			// Nothing to smooth - a display list wouldn't be built either.
+			[collector release];
+			times[smoothStageCollect] += CFAbsoluteTimeGetCurrent() - stageStart;
+		}
+		else if(model != nil)
+		{
+
+			// Faces first, then lines, as create_mesh requires.
+			mesh = create_mesh(triCount, quadCount, lineCount);
+			addFaces(mesh, collector->tris,  3);
+			addFaces(mesh, collector->quads, 4);
+			addFaces(mesh, collector->lines, 2);
+			[collector release];
+			times[smoothStageCollect] += CFAbsoluteTimeGetCurrent() - stageStart;
+
+			#define TIME_SMOOTH_STAGE(which, call) \
+				stageStart = CFAbsoluteTimeGetCurrent(); call; times[which] += CFAbsoluteTimeGetCurrent() - stageStart;
+
+			TIME_SMOOTH_STAGE(smoothStageSort,			finish_faces_and_sort(mesh));
+			TIME_SMOOTH_STAGE(smoothStageCreases,		add_creases(mesh));
+			TIME_SMOOTH_STAGE(smoothStageTJunctions,	find_and_remove_t_junctions(mesh));
+			TIME_SMOOTH_STAGE(smoothStageJoin,			finish_creases_and_join(mesh));
+			TIME_SMOOTH_STAGE(smoothStageNormals,		smooth_vertices(mesh));
+			TIME_SMOOTH_STAGE(smoothStageMerge,			merge_vertices(mesh));
+
+			stageStart = CFAbsoluteTimeGetCurrent();
+			{
+				int				lineStart	= 0;
+				int				lineTotal	= 0;
+				int				triStart	= 0;
+				int				triTotal	= 0;
+				int				quadStart	= 0;
+				int				quadTotal	= 0;
+				float			*vertices	= NULL;
+				unsigned int	*indices	= NULL;
+
+				get_final_mesh_counts(mesh, &totalVerts, &totalIndices);
+				vertices	= malloc(sizeof(float) * 10 * totalVerts);
+				indices		= malloc(sizeof(unsigned int) * totalIndices);
+
+				write_indexed_mesh(mesh, totalVerts, vertices, totalIndices, indices, 0,
+								   &lineStart, &lineTotal, &triStart, &triTotal, &quadStart, &quadTotal);
+				for(timer = 0; timer < MESH_TIMER_COUNT; timer++)
+					timers[timer] += get_mesh_timer(mesh, timer);
+				destroy_mesh(mesh);
+				times[smoothStageWrite] += CFAbsoluteTimeGetCurrent() - stageStart;
+
+				format.missesBefore	+= measureVertexCacheMisses(indices, triStart, triTotal, quadStart, quadTotal);
+				stageStart = CFAbsoluteTimeGetCurrent();
+				optimize_indexed_mesh(1, totalVerts, vertices, totalIndices, indices, &triStart, &triTotal, &quadStart, &quadTotal);
+				times[smoothStageOptimize] += CFAbsoluteTimeGetCurrent() - stageStart;
+				format.missesAfter	+= measureVertexCacheMisses(indices, triStart, triTotal, quadStart, quadTotal);
+				format.triangles	+= triTotal / 3 + 2 * (quadTotal / 4);
+
+				measurePackedVertices(&format, vertices, totalVerts);
+
+				free(vertices);
+				free(indices);
+			}
+
+			#undef TIME_SMOOTH_STAGE
+
+			faceCount	+= triCount + quadCount + lineCount;
+			vertexCount	+= totalVerts;
+			indexCount	+= totalIndices;
+			meshCount	+= 1;
+		}
+
+		[pool drain];
+	}
+
+	smoothReport = finishStage("smooth", &start, 0);
+
+	for(stage = 0; stage < smoothStageCount; stage++)
+	{
+		[stageTimes setObject:[NSNumber numberWithDouble:times[stage]]
+					   forKey:[NSString stringWithUTF8String:smoothStageNames[stage]]];
+	}
+	[smoothReport setObject:stageTimes forKey:@"stage_seconds"];
+
+	for(timer = 0; timer < MESH_TIMER_COUNT; timer++)
+	{
+		[tJunctionTimes setObject:[NSNumber numberWithDouble:timers[timer]]
+						   forKey:[NSString stringWithUTF8String:tJunctionTimerNames[timer]]];
+	}
+	[smoothReport setObject:tJunctionTimes forKey:@"t_junction_seconds"];
+
+	if(format.triangles > 0)
+	{
+		[formatReport setObject:[NSNumber numberWithDouble:format.missesBefore / format.triangles] forKey:@"acmr_before"];
+		[formatReport setObject:[NSNumber numberWithDouble:format.missesAfter  / format.triangles] forKey:@"acmr_after"];
+	}
+	[formatReport setObject:[NSNumber numberWithUnsignedLongLong:format.floatBytes] forKey:@"float_bytes"];
+	[formatReport setObject:[NSNumber numberWithUnsignedLongLong:format.packedBytes] forKey:@"packed_bytes"];
+	[formatReport setObject:[NSNumber numberWithDouble:format.packSeconds] forKey:@"pack_seconds"];
+	[formatReport setObject:[NSNumber numberWithDouble:format.unpackSeconds] forKey:@"unpack_seconds"];
+	[formatReport setObject:[NSNumber numberWithDouble:format.maxPositionError] forKey:@"max_position_error"];
+	[formatReport setObject:[NSNumber numberWithDouble:format.maxNormalError] forKey:@"max_normal_error_radians"];
+	[formatReport setObject:[NSNumber numberWithUnsignedLongLong:format.exactMismatches] forKey:@"exact_mismatches"];
+	[formatReport setObject:[NSNumber numberWithUnsignedInteger:format.unpackableMeshes] forKey:@"unpackable_meshes"];
+	[smoothReport setObject:formatReport forKey:@"vertex_format"];
+	[smoothReport setObject:[NSNumber numberWithUnsignedInteger:meshCount] forKey:@"meshes"];
+	[smoothReport setObject:[NSNumber numberWithUnsignedLongLong:faceCount] forKey:@"input_faces"];
+	[smoothReport setObject:[NSNumber numberWithUnsignedLongLong:vertexCount] forKey:@"output_vertices"];
+	[smoothReport setObject:[NSNumber numberWithUnsignedLongLong:indexCount] forKey:@"output_indices"];
+
+	return smoothReport;
+
+}//end smoothPartsInReport:
+
+
+//========== smoothBakedPartsInReport: =========================================
+//
+// Purpose:		Bakes every part in the report into one mesh - each placed by
+//				its own transform - the way a big submodel or LSynth hose ends
+//				up smoothed as a whole, and smooths it once on one thread and
+//				once in parallel.
+//
+// Notes:		The two results must be bit-identical; if they are not, the
+//				run fails.
+//
+//==============================================================================
+- (NSDictionary *) smoothBakedPartsInReport:(PartReport *)partReport
+{
+	PartLibrary				*library		= [PartLibrary sharedPartLibrary];
+	NSMutableDictionary		*collectors		= [NSMutableDictionary dictionary];
+	NSMutableData			*tris			= [NSMutableData data];
+	NSMutableData			*quads			= [NSMutableData data];
+	NSMutableData			*lines			= [NSMutableData data];
+	NSMutableDictionary		*bakeReport		= nil;
+	BenchmarkMeshCollector	*collector		= nil;
+	LDrawModel				*model			= nil;
+	NSNumber				*key			= nil;
+	NSData					*serialMesh		= nil;
+	NSData					*parallelMesh	= nil;
+	CFTimeInterval			serialTime		= 0;
+	CFTimeInterval			parallelTime	= 0;
+	BOOL					identical		= NO;
+	StageStart				start;
+
+	startStage(&start);
+
+	for(LDrawPart *part in [partReport allParts])
+	{
+		model = [library modelForSymbol:[part partSymbol]];
+		if(model == nil)
+			continue;
+
+		key			= [NSNumber numberWithUnsignedInt:[part partSymbol]];
+		collector	= [collectors objectForKey:key];
+		if(collector == nil)
+		{
+			collector = [[BenchmarkMeshCollector alloc] init];
+			[model collectSelf:collector];
+			[collectors setObject:collector forKey:key];
+			[collector release];
+		}
+
+		addTransformedFaces(tris,  collector->tris,  3, [part transformationMatrix]);
+		addTransformedFaces(quads, collector->quads, 4, [part transformationMatrix]);
+		addTransformedFaces(lines, collector->lines, 2, [part transformationMatrix]);
+	}
+
+	serialMesh		= smoothFaces(tris, quads, lines, MESH_THREADS_SERIAL,   MESH_WELD_GRID, &serialTime,   NULL);
+	parallelMesh	= smoothFaces(tris, quads, lines, MESH_THREADS_PARALLEL, MESH_WELD_GRID, &parallelTime, NULL);
+	identical		= [serialMesh isEqualToData:parallelMesh];
+
+	if(identical == NO)
+		threadsMismatched = YES;
+
+	bakeReport = finishStage("smooth_baked", &start, 0);
+
+	[bakeReport setObject:[NSNumber numberWithUnsignedInteger:([tris length] + [quads length] + [lines length]) / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS)] forKey:@"input_faces"];
+	[bakeReport setObject:[NSNumber numberWithDouble:serialTime] forKey:@"serial_seconds"];
+	[bakeReport setObject:[NSNumber numberWithDouble:parallelTime] forKey:@"parallel_seconds"];
+	[bakeReport setObject:[NSNumber numberWithBool:identical] forKey:@"identical"];
+
+	return bakeReport;
+
+}//end smoothBakedPartsInReport:
+
+
+//========== compareWelders ====================================================
+//
+// Purpose:		Smooths every part in the library once with each of the mesh
+//				smoother's welders, and reports the time each spent welding.
+//
+// Notes:		The welders must agree exactly; every part where they don't is
+//				listed, and the run fails.
+//
+//==============================================================================
+- (NSDictionary *) compareWelders
+{
+	PartLibrary				*library		= [PartLibrary sharedPartLibrary];
+	NSMutableArray			*partNames		= [NSMutableArray array];
+	NSMutableArray			*mismatches		= [NSMutableArray array];
+	NSMutableDictionary		*weldReport		= nil;
+	NSString				*partName		= nil;
+	CFTimeInterval			rtreeTime		= 0;
+	CFTimeInterval			gridTime		= 0;
+	unsigned long long		faceCount		= 0;
+	NSUInteger				meshCount		= 0;
+	StageStart				start;
+
+	for(NSDictionary *record in [library allPartCatalogRecords])
+	{
+		[partNames addObject:[record objectForKey:PART_NUMBER_KEY]];
+	}
+	// Same order on every machine, so runs can be compared.
+	[partNames sortUsingSelector:@selector(compare:)];
+
+	startStage(&start);
+
+	for(partName in partNames)
+	{
+		NSAutoreleasePool		*pool		= [[NSAutoreleasePool alloc] init];
+		LDrawModel				*model		= [library modelForName:partName];
+		BenchmarkMeshCollector	*collector	= nil;
+		NSData					*rtreeMesh	= nil;
+		NSData					*gridMesh	= nil;
+		CFTimeInterval			seconds		= 0;
+		CFTimeInterval			weldSeconds	= 0;
+		NSUInteger				faces		= 0;
+
+		if(model != nil)
+		{
+			collector	= [[BenchmarkMeshCollector alloc] init];
+			[model collectSelf:collector];
+			faces		= ([collector->tris length] + [collector->quads length] + [collector->lines length]) / (sizeof(GLfloat) * COLLECTED_FACE_FLOATS);
+		}
+
+		if(faces > 0)
+		{
+			rtreeMesh	= smoothFaces(collector->tris, collector->quads, collector->lines, MESH_THREADS_AUTO, MESH_WELD_RTREE, &seconds, &weldSeconds);
+			rtreeTime	+= weldSeconds;
+			gridMesh	= smoothFaces(collector->tris, collector->quads, collector->lines, MESH_THREADS_AUTO, MESH_WELD_GRID,  &seconds, &weldSeconds);
+			gridTime	+= weldSeconds;
+
+			if([rtreeMesh isEqualToData:gridMesh] == NO)
+				[mismatches addObject:partName];
+
+			faceCount	+= faces;
+			meshCount	+= 1;
+		}
+
+		[collector release];
+		[pool drain];
+	}
+
+	if([mismatches count] > 0)
+		weldersMismatched = YES;
+
+	weldReport = finishStage("welders", &start, 0);
+
+	[weldReport setObject:[NSNumber numberWithUnsignedInteger:meshCount] forKey:@"meshes"];
+	[weldReport setObject:[NSNumber numberWithUnsignedLongLong:faceCount] forKey:@"input_faces"];
+	[weldReport setObject:[NSNumber numberWithDouble:rtreeTime] forKey:@"rtree_seconds"];
+	[weldReport setObject:[NSNumber numberWithDouble:gridTime] forKey:@"grid_seconds"];
+	[weldReport setObject:mismatches forKey:@"mismatched_parts"];
+
+	return weldReport;
+
+}//end compareWelders
+
+
+//========== libraryCacheReport ================================================
+//
+// Purpose:		Returns what the part library's model cache did over the run.
+//
+//==============================================================================
+- (NSDictionary *) libraryCacheReport
+{
+	PartLibraryCacheStatistics	statistics	= [[PartLibrary sharedPartLibrary] cacheStatistics];
+	NSMutableDictionary			*report		= [NSMutableDictionary dictionary];
+
+	[report setObject:[NSNumber numberWithUnsignedInteger:statistics.hits] forKey:@"hits"];
+	[report setObject:[NSNumber numberWithUnsignedInteger:statistics.misses] forKey:@"misses"];
+	[report setObject:[NSNumber numberWithUnsignedInteger:statistics.reloads] forKey:@"reloads"];
+	[report setObject:[NSNumber numberWithUnsignedInteger:statistics.evictions] forKey:@"evictions"];
+	[report setObject:[NSNumber numberWithUnsignedInteger:statistics.residentModels] forKey:@"resident_models"];
+	[report setObject:[NSNumber numberWithUnsignedInteger:statistics.pinnedModels] forKey:@"pinned_models"];
+	[report setObject:[NSNumber numberWithUnsignedInteger:statistics.residentBytes] forKey:@"resident_bytes"];
+	[report setObject:[NSNumber numberWithUnsignedInteger:statistics.memoryBudget] forKey:@"budget_bytes"];
+
+	return report;
+
+}//end libraryCacheReport
+
+
+#pragma mark -
+#pragma mark DESTRUCTOR
+#pragma mark -
+
+//========== dealloc ===========================================================
+//
+// Purpose:		Done timing.
+//
+//==============================================================================
+- (void) dealloc
+{
+	[modelPaths	release];
+	[ldrawPath	release];
+	[outputPath	release];
+
+	[super dealloc];
+
+}//end dealloc
+
+
+@end
@@ -14,6 +14,8 @@
 //==============================================================================
 #import "LDrawColor.h"
 
+#import <libkern/OSAtomic.h>
+
 #import "LDrawKeywords.h"
 #import "LDrawModel.h"
 #import "LDrawStep.h"
@@ -507,20 +509,29 @@ void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 // Purpose:		Returns the color which should be used for drawing 
 //				LDrawEdgeColor for this color. 
 //
+// Notes:		Library colors are shared by every parser thread, so the 
+//				compliment is built off to the side and published atomically. 
+//				A thread which loses the race just throws its copy away. 
+//
 //==============================================================================
 - (LDrawColor *) complimentColor
 {
+	LDrawColor	*newCompliment	= nil;
+	
 	// LDConfig compliment colors look ugly. Bricksmith uses internally-derived 
 	// compliments which look more like the original LDraw. 
 	if(fakeComplimentColor == nil)
 	{
-		self->fakeComplimentColor = [[LDrawColor alloc] init];
+		newCompliment = [[LDrawColor alloc] init];
 		
 		GLfloat fakeComplimentComponents[4] = {};
 		complimentColor(self->colorRGBA, fakeComplimentComponents);
 		
-		[fakeComplimentColor setColorCode:LDrawEdgeColor];
-		[fakeComplimentColor setColorRGBA:fakeComplimentComponents];
+		[newCompliment setColorCode:LDrawEdgeColor];
+		[newCompliment setColorRGBA:fakeComplimentComponents];
+		
+		if(OSAtomicCompareAndSwapPtrBarrier(nil, newCompliment, (void **)&self->fakeComplimentColor) == false)
+			[newCompliment release];
 	}
 	
 	return fakeComplimentColor;
@@ -663,6 +674,8 @@ void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 //==============================================================================
 - (void) setColorCode:(LDrawColorT)newCode
 {
+	[self noteWillChange];
+	
 	self->colorCode = newCode;
 
 }//end setColorCode:
@@ -675,8 +688,14 @@ void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 //==============================================================================
 - (void) setColorRGBA:(GLfloat *)newComponents
 {
+	[self noteWillChange];
+	
 	memcpy(self->colorRGBA, newComponents, sizeof(GLfloat[4]));
 	
+	// The compliment is derived from the components; rebuild it next time.
+	[self->fakeComplimentColor autorelease];
+	self->fakeComplimentColor = nil;
+	
 }//end setColorRGBA:
 
 
@@ -693,6 +712,8 @@ void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 //==============================================================================
 - (void) setEdgeColorCode:(LDrawColorT)newCode
 {
+	[self noteWillChange];
+	
 	self->edgeColorCode = newCode;
 	
 }//end setEdgeColorCode:
@@ -711,6 +732,8 @@ void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 //==============================================================================
 - (void) setEdgeColorRGBA:(GLfloat *)newComponents
 {
+	[self noteWillChange];
+	
 	memcpy(self->edgeColorRGBA, newComponents, sizeof(GLfloat[4]));
 	
 	// Disable the edge color code, since we have real color values for it now.
@@ -729,6 +752,8 @@ void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 //==============================================================================
 - (void) setLuminance:(uint8_t)newValue
 {
+	[self noteWillChange];
+	
 	self->luminance		= newValue;
 	self->hasLuminance	= YES;
 	
@@ -745,6 +770,8 @@ void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 //==============================================================================
 - (void) setMaterial:(LDrawColorMaterialT)newValue
 {
+	[self noteWillChange];
+	
 	self->material = newValue;
 
 }//end setMaterial:
@@ -761,6 +788,8 @@ void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 //==============================================================================
 - (void) setMaterialParameters:(NSString *)newValue
 {
+	[self noteWillChange];
+	
 	[newValue retain];
 	[self->materialParameters release];
 	
@@ -777,6 +806,8 @@ void RGBtoHSV( float r, float g, float b, float *h, float *s, float *v );
 //==============================================================================
 - (void) setName:(NSString *)newName
 {
+	[self noteWillChange];
+	
 	[newName retain];
 	[self->name release];
 	
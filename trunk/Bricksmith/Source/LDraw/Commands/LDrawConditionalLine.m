@@ -24,7 +24,9 @@
 //==============================================================================
 #import "LDrawConditionalLine.h"
 
+#import "LDrawTokenizer.h"
 #import "LDrawUtilities.h"
+#import "LDrawWriter.h"
 
 @implementation LDrawConditionalLine
 
@@ -47,8 +49,11 @@
 			 inRange:(NSRange)range
 		 parentGroup:(dispatch_group_t)parentGroup
 {
-	NSString                *workingLine            = [lines objectAtIndex:range.location];
-	NSString                *parsedField            = nil;
+	const char              *lineBytes              = NULL;
+	NSUInteger              lineLength              = 0;
+	const char              *fieldBegin             = NULL;
+	const char              *fieldEnd               = NULL;
+	struct LDrawTokenizer    tokenizer;
 	Point3                  workingVertex           = ZeroPoint3;
 	LDrawColor				*parsedColor			= nil;
 	
@@ -60,68 +65,59 @@
 	// raise an exception. We don't want this to happen here.
 	@try
 	{
+		lineBytes = [LDrawUtilities bytesForLineAtIndex:range.location
+												inLines:lines
+												 length:&lineLength
+											   encoding:NULL];
+		LDrawTokenizerInit(&tokenizer, lineBytes, lineBytes + lineLength);
+		
 		//Read in the line code and advance past it.
-		parsedField = [LDrawUtilities readNextField:  workingLine
-										  remainder: &workingLine ];
 		//Only attempt to create the part if this is a valid line.
-		if([parsedField integerValue] == 5)
+		if(LDrawTokenizerNextInt(&tokenizer) == 5)
 		{
 			//Read in the color code.
 			// (color)
-			parsedField = [LDrawUtilities readNextField:  workingLine
-											  remainder: &workingLine ];
-			parsedColor = [LDrawUtilities parseColorFromField:parsedField];
+			LDrawTokenizerNextField(&tokenizer, &fieldBegin, &fieldEnd);
+			parsedColor = [LDrawUtilities parseColorFromFieldBytes:fieldBegin end:fieldEnd];
 			[self setLDrawColor:parsedColor];
 			
 			//Read Vertex 1.
 			// (x1)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.x = [parsedField floatValue];
+			workingVertex.x = LDrawTokenizerNextFloat(&tokenizer);
 			// (y1)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.y = [parsedField floatValue];
+			workingVertex.y = LDrawTokenizerNextFloat(&tokenizer);
 			// (z1)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.z = [parsedField floatValue];
+			workingVertex.z = LDrawTokenizerNextFloat(&tokenizer);
 			
 			[self setVertex1:workingVertex];
 				
 			//Read Vertex 2.
 			// (x2)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.x = [parsedField floatValue];
+			workingVertex.x = LDrawTokenizerNextFloat(&tokenizer);
 			// (y2)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.y = [parsedField floatValue];
+			workingVertex.y = LDrawTokenizerNextFloat(&tokenizer);
 			// (z2)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.z = [parsedField floatValue];
+			workingVertex.z = LDrawTokenizerNextFloat(&tokenizer);
 			
 			[self setVertex2:workingVertex];
 			
 			//Read Conditonal Vertex 1.
 			// (x3)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.x = [parsedField floatValue];
+			workingVertex.x = LDrawTokenizerNextFloat(&tokenizer);
 			// (y3)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.y = [parsedField floatValue];
+			workingVertex.y = LDrawTokenizerNextFloat(&tokenizer);
 			// (z3)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.z = [parsedField floatValue];
+			workingVertex.z = LDrawTokenizerNextFloat(&tokenizer);
 			
 			[self setConditionalVertex1:workingVertex];
 			
 			//Read Conditonal Vertex 2.
 			// (x4)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.x = [parsedField floatValue];
+			workingVertex.x = LDrawTokenizerNextFloat(&tokenizer);
 			// (y4)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.y = [parsedField floatValue];
+			workingVertex.y = LDrawTokenizerNextFloat(&tokenizer);
 			// (z4)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.z = [parsedField floatValue];
+			workingVertex.z = LDrawTokenizerNextFloat(&tokenizer);
 			
 			[self setConditionalVertex2:workingVertex];
 		}
@@ -243,29 +239,52 @@
 //==============================================================================
 - (NSString *) write
 {
-	return [NSString stringWithFormat:
-				@"5 %@ %@ %@ %@ %@ %@ %@ %@ %@ %@ %@ %@ %@",
-				[LDrawUtilities outputStringForColor:self->color],
-				
-				[LDrawUtilities outputStringForFloat:vertex1.x],
-				[LDrawUtilities outputStringForFloat:vertex1.y],
-				[LDrawUtilities outputStringForFloat:vertex1.z],
-				
-				[LDrawUtilities outputStringForFloat:vertex2.x],
-				[LDrawUtilities outputStringForFloat:vertex2.y],
-				[LDrawUtilities outputStringForFloat:vertex2.z],
-				
-				[LDrawUtilities outputStringForFloat:conditionalVertex1.x],
-				[LDrawUtilities outputStringForFloat:conditionalVertex1.y],
-				[LDrawUtilities outputStringForFloat:conditionalVertex1.z],
-		
-				[LDrawUtilities outputStringForFloat:conditionalVertex2.x],
-				[LDrawUtilities outputStringForFloat:conditionalVertex2.y],
-				[LDrawUtilities outputStringForFloat:conditionalVertex2.z]		
-			];
+	return [LDrawWriter stringByWritingDirective:self];
+	
 }//end write
 
 
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends the line to the stream; see -write for the format.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
+	[stream appendBytes:"5 " length:2];
+	[stream appendColor:self->color];
+	
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex1.x];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex1.y];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex1.z];
+	
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex2.x];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex2.y];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex2.z];
+	
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:conditionalVertex1.x];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:conditionalVertex1.y];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:conditionalVertex1.z];
+	
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:conditionalVertex2.x];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:conditionalVertex2.y];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:conditionalVertex2.z];
+	
+}//end writeToStream:
+
+
 //========== writeElementToVertexBuffer:withColor:wireframe: ===================
 //
 // Purpose:		Writes this object into the specified vertex buffer, which is a 
@@ -360,6 +379,8 @@
 //==============================================================================
 -(void) setConditionalVertex1:(Point3)newVertex
 {
+	[self noteWillChange];
+	
 	conditionalVertex1 = newVertex;
 	
 }//end setconditionalVertex1:
@@ -372,6 +393,8 @@
 //==============================================================================
 -(void) setConditionalVertex2:(Point3)newVertex
 {
+	[self noteWillChange];
+	
 	conditionalVertex2 = newVertex;
 	
 }//end setconditionalVertex2:
@@ -388,6 +411,8 @@
 //==============================================================================
 - (void) moveBy:(Vector3)moveVector
 {
+	[self noteWillChange];
+	
 	//I don't know if this makes any sense.
 	conditionalVertex1.x += moveVector.x;
 	conditionalVertex1.y += moveVector.y;
@@ -354,6 +354,8 @@
 //==============================================================================
 - (void) setHidden:(BOOL) flag
 {
+	[self noteWillChange];
+	
 	if(self->hidden != flag)
 	{
 		self->hidden = flag;
@@ -370,6 +372,8 @@
 //==============================================================================
 - (void) setLDrawColor:(LDrawColor *)newColor
 {
+	[self noteWillChange];
+	
 	[newColor retain];
 	[self->color release];
 	self->color = newColor;
@@ -406,7 +406,7 @@
 //==============================================================================
 - (void) drawSelf:(id<LDrawRenderer>)renderer
 {
-    NSArray         *constraints         = [self subdirectives];
+    NSArray         *constraints         = [self readOnlySubdirectives];
     LDrawDirective  *currentDirective    = nil;
 
     if(self->hidden == NO)
@@ -582,7 +582,7 @@
     NSMutableString *written        = [NSMutableString string];
     NSString        *CRLF           = [NSString CRLF];
     NSString        *lsynthVisibility = @"SHOW";
-    NSArray         *constraints    = [self subdirectives];
+    NSArray         *constraints    = [self readOnlySubdirectives];
     LDrawDirective  *currentCommand = nil;
     NSString		*commandString	= nil;
     NSUInteger      numberCommands  = 0;
@@ -681,7 +681,7 @@
 - (Box3) boundingBox3 {
     if ([self revalCache:CacheFlagBounds] == CacheFlagBounds)
     {
-        cachedBounds = [LDrawUtilities boundingBox3ForDirectives:[self subdirectives]];
+        cachedBounds = [LDrawUtilities boundingBox3ForDirectives:[self readOnlySubdirectives]];
     }
     return cachedBounds;
 }
@@ -694,6 +694,8 @@
 //==============================================================================
 - (void) setLsynthClass:(int)class
 {
+    [self noteWillChange];
+
     self->lsynthClass = class;
 }//end setLsynthClass:
 
@@ -715,6 +717,8 @@
 //==============================================================================
 - (void) setLsynthType:(NSString *)type
 {
+    [self noteWillChange];
+
     [type retain];
     [self->synthType release];
     self->synthType = type;
@@ -741,6 +745,8 @@
 //==============================================================================
 - (void) setHidden:(BOOL) flag
 {
+    [self noteWillChange];
+
     if(self->hidden != flag)
     {
         self->hidden = flag;
@@ -814,6 +820,8 @@
 //==============================================================================
 - (void) setLDrawColor:(LDrawColor *)newColor
 {
+    [self noteWillChange];
+
     // Store the color
     [newColor retain];
     [self->color release];
@@ -1043,6 +1051,8 @@
 //==============================================================================
 - (void)doAutoHullOnBand
 {
+    [self noteWillChange];
+
     // clean out INSIDE/OUTSIDE directives
     int i;
     for (i = [[self subdirectives] count] - 1; i >= 0; i--) {
@@ -22,7 +22,9 @@
 #import "LDrawColor.h"
 #import "LDrawDragHandle.h"
 #import "LDrawStep.h"
+#import "LDrawTokenizer.h"
 #import "LDrawUtilities.h"
+#import "LDrawWriter.h"
 
 // If set to 1, lines don't draw using the new renderer.  This can be used
 // as a quick-and-dirty way to measure the fps cost of line drawing or see
@@ -35,6 +37,19 @@
 #pragma mark INITIALIZATION
 #pragma mark -
 
+//---------- parsesConcurrently --------------------------------------[static]--
+//
+// Purpose:		Line primitives parse from nothing but their own text, so a 
+//				worker can take them. Conditional lines inherit this.
+//
+//------------------------------------------------------------------------------
++ (BOOL) parsesConcurrently
+{
+	return YES;
+	
+}//end parsesConcurrently
+
+
 //========== initWithLines:inRange:parentGroup: ================================
 //
 // Purpose:		Returns the LDraw directive based on lineFromFile, a single line 
@@ -49,8 +64,11 @@
 			 inRange:(NSRange)range
 		 parentGroup:(dispatch_group_t)parentGroup
 {
-	NSString    *workingLine    = [lines objectAtIndex:range.location];
-	NSString    *parsedField    = nil;
+	const char  *lineBytes      = NULL;
+	NSUInteger  lineLength      = 0;
+	const char  *fieldBegin     = NULL;
+	const char  *fieldEnd       = NULL;
+	struct LDrawTokenizer tokenizer;
 	Point3      workingVertex   = ZeroPoint3;
 	LDrawColor  *parsedColor    = nil;
 	
@@ -60,42 +78,39 @@
 	// raise an exception. We don't want this to happen here.
 	@try
 	{
+		lineBytes = [LDrawUtilities bytesForLineAtIndex:range.location
+												inLines:lines
+												 length:&lineLength
+											   encoding:NULL];
+		LDrawTokenizerInit(&tokenizer, lineBytes, lineBytes + lineLength);
+		
 		//Read in the line code and advance past it.
-		parsedField = [LDrawUtilities readNextField:  workingLine
-										  remainder: &workingLine ];
 		//Only attempt to create the part if this is a valid line.
-		if([parsedField integerValue] == 2)
+		if(LDrawTokenizerNextInt(&tokenizer) == 2)
 		{
 			//Read in the color code.
 			// (color)
-			parsedField = [LDrawUtilities readNextField:  workingLine
-											  remainder: &workingLine ];
-			parsedColor = [LDrawUtilities parseColorFromField:parsedField];
+			LDrawTokenizerNextField(&tokenizer, &fieldBegin, &fieldEnd);
+			parsedColor = [LDrawUtilities parseColorFromFieldBytes:fieldBegin end:fieldEnd];
 			[self setLDrawColor:parsedColor];
 			
 			//Read Vertex 1.
 			// (x1)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.x = [parsedField floatValue];
+			workingVertex.x = LDrawTokenizerNextFloat(&tokenizer);
 			// (y1)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.y = [parsedField floatValue];
+			workingVertex.y = LDrawTokenizerNextFloat(&tokenizer);
 			// (z1)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.z = [parsedField floatValue];
+			workingVertex.z = LDrawTokenizerNextFloat(&tokenizer);
 			
 			[self setVertex1:workingVertex];
 				
 			//Read Vertex 2.
 			// (x2)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.x = [parsedField floatValue];
+			workingVertex.x = LDrawTokenizerNextFloat(&tokenizer);
 			// (y2)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.y = [parsedField floatValue];
+			workingVertex.y = LDrawTokenizerNextFloat(&tokenizer);
 			// (z2)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.z = [parsedField floatValue];
+			workingVertex.z = LDrawTokenizerNextFloat(&tokenizer);
 			
 			[self setVertex2:workingVertex];
 		}
@@ -389,21 +404,38 @@
 //==============================================================================
 - (NSString *) write
 {
-	return [NSString stringWithFormat:
-				@"2 %@ %@ %@ %@ %@ %@ %@",
-				[LDrawUtilities outputStringForColor:self->color],
-				
-				[LDrawUtilities outputStringForFloat:vertex1.x],
-				[LDrawUtilities outputStringForFloat:vertex1.y],
-				[LDrawUtilities outputStringForFloat:vertex1.z],
-				
-				[LDrawUtilities outputStringForFloat:vertex2.x],
-				[LDrawUtilities outputStringForFloat:vertex2.y],
-				[LDrawUtilities outputStringForFloat:vertex2.z]				
-			];
+	return [LDrawWriter stringByWritingDirective:self];
+	
 }//end write
 
 
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends the line to the stream; see -write for the format.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
+	[stream appendBytes:"2 " length:2];
+	[stream appendColor:self->color];
+	
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex1.x];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex1.y];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex1.z];
+	
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex2.x];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex2.y];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex2.z];
+	
+}//end writeToStream:
+
+
 //========== writeElementToVertexBuffer:withColor:wireframe: ===================
 //
 // Purpose:		Writes this object into the specified vertex buffer, which is a 
@@ -577,6 +609,8 @@
 //==============================================================================
 -(void) setVertex1:(Point3)newVertex
 {
+	[self noteWillChange];
+	
 	vertex1 = newVertex;
 	[self invalCache:(CacheFlagBounds|DisplayList)];
 	
@@ -595,6 +629,8 @@
 //==============================================================================
 -(void) setVertex2:(Point3)newVertex
 {
+	[self noteWillChange];
+	
 	vertex2 = newVertex;
 	[self invalCache:(CacheFlagBounds|DisplayList)];
 	
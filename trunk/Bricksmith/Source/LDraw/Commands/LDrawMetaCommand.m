@@ -313,6 +313,8 @@
 //==============================================================================
 -(void) setStringValue:(NSString *)newString
 {
+	[self noteWillChange];
+	
 	[newString retain];
 	[commandString release];
 	
@@ -14,6 +14,7 @@
 #import "ColorLibrary.h"
 #import "LDrawDirective.h"
 #import "LDrawDrawableElement.h"
+#import "LDrawSymbolTable.h"
 #import "MatrixMath.h"
 
 @class LDrawFile;
@@ -40,6 +41,7 @@ typedef enum PartType {
 @private
 	NSString		*displayName;
 	NSString		*referenceName; //lower-case version of display name
+	LDrawSymbol		partSymbol;		// interned name, shared by every part referencing the same file
 	
 	GLfloat			glTransformation[16];
 
@@ -57,6 +59,7 @@ typedef enum PartType {
 
 //Accessors
 - (NSString *) displayName;
+- (LDrawSymbol) partSymbol;
 - (Point3) position;
 - (NSString *) referenceName;
 - (LDrawModel *) referencedMPDSubmodel;
@@ -27,7 +27,9 @@
 #import "LDrawFile.h"
 #import "LDrawModel.h"
 #import "LDrawStep.h"
+#import "LDrawTokenizer.h"
 #import "LDrawUtilities.h"
+#import "LDrawWriter.h"
 #import "PartLibrary.h"
 #import "LDrawPaths.h"
 #import "PartReport.h"
@@ -120,10 +122,15 @@ int floatNearGrid(float v, float grid, float epsi)
 			 inRange:(NSRange)range
 		 parentGroup:(dispatch_group_t)parentGroup
 {
-	NSString    *workingLine    = [lines objectAtIndex:range.location];
-	NSString    *parsedField    = nil;
+	const char  *lineBytes      = NULL;
+	NSUInteger  lineLength      = 0;
+	NSStringEncoding lineEncoding = NSUTF8StringEncoding;
+	const char  *fieldBegin     = NULL;
+	const char  *fieldEnd       = NULL;
+	struct LDrawTokenizer tokenizer;
 	Matrix4     transformation  = IdentityMatrix4;
 	LDrawColor  *parsedColor    = nil;
+	NSString    *partName       = nil;
 	
 	self = [super initWithLines:lines inRange:range parentGroup:parentGroup];
 	
@@ -131,65 +138,56 @@ int floatNearGrid(float v, float grid, float epsi)
 	// raise an exception. We don't want this to happen here.
 	@try
 	{
+		lineBytes = [LDrawUtilities bytesForLineAtIndex:range.location
+												inLines:lines
+												 length:&lineLength
+											   encoding:&lineEncoding];
+		LDrawTokenizerInit(&tokenizer, lineBytes, lineBytes + lineLength);
+		
 		//Read in the line code and advance past it.
-		parsedField = [LDrawUtilities readNextField:  workingLine
-										  remainder: &workingLine ];
 		//Only attempt to create the part if this is a valid line.
-		if([parsedField integerValue] == 1)
+		if(LDrawTokenizerNextInt(&tokenizer) == 1)
 		{
 			//Read in the color code.
 			// (color)
-			parsedField = [LDrawUtilities readNextField:  workingLine
-											  remainder: &workingLine ];
-			parsedColor = [LDrawUtilities parseColorFromField:parsedField];
+			LDrawTokenizerNextField(&tokenizer, &fieldBegin, &fieldEnd);
+			parsedColor = [LDrawUtilities parseColorFromFieldBytes:fieldBegin end:fieldEnd];
 			[self setLDrawColor:parsedColor];
 			
 			//Read position.
 			// (x)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[3][0] = [parsedField floatValue];
+			transformation.element[3][0] = LDrawTokenizerNextFloat(&tokenizer);
 			// (y)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[3][1] = [parsedField floatValue];
+			transformation.element[3][1] = LDrawTokenizerNextFloat(&tokenizer);
 			// (z)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[3][2] = [parsedField floatValue];
+			transformation.element[3][2] = LDrawTokenizerNextFloat(&tokenizer);
 			
 			
 			//Read Transformation X.
 			// (a)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[0][0] = [parsedField floatValue];
+			transformation.element[0][0] = LDrawTokenizerNextFloat(&tokenizer);
 			// (b)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[1][0] = [parsedField floatValue];
+			transformation.element[1][0] = LDrawTokenizerNextFloat(&tokenizer);
 			// (c)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[2][0] = [parsedField floatValue];
+			transformation.element[2][0] = LDrawTokenizerNextFloat(&tokenizer);
 			
 			
 			//Read Transformation Y.
 			// (d)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[0][1] = [parsedField floatValue];
+			transformation.element[0][1] = LDrawTokenizerNextFloat(&tokenizer);
 			// (e)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[1][1] = [parsedField floatValue];
+			transformation.element[1][1] = LDrawTokenizerNextFloat(&tokenizer);
 			// (f)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[2][1] = [parsedField floatValue];
+			transformation.element[2][1] = LDrawTokenizerNextFloat(&tokenizer);
 			
 			
 			//Read Transformation Z.
 			// (g)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[0][2] = [parsedField floatValue];
+			transformation.element[0][2] = LDrawTokenizerNextFloat(&tokenizer);
 			// (h)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[1][2] = [parsedField floatValue];
+			transformation.element[1][2] = LDrawTokenizerNextFloat(&tokenizer);
 			// (i)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			transformation.element[2][2] = [parsedField floatValue];
+			transformation.element[2][2] = LDrawTokenizerNextFloat(&tokenizer);
 			
 			//finish off the corner of the matrix.
 			transformation.element[3][3] = 1;
@@ -199,9 +197,14 @@ int floatNearGrid(float v, float grid, float epsi)
 			//Read Part Name
 			// (part.dat) -- It can have spaces (for MPD models), so we just use the whole 
 			// rest of the line.
-			[self setDisplayName:[workingLine stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]]
+			LDrawTokenizerRemainder(&tokenizer, &fieldBegin, &fieldEnd);
+			partName = [[NSString alloc] initWithBytes:fieldBegin
+												length:fieldEnd - fieldBegin
+											  encoding:lineEncoding];
+			[self setDisplayName:partName
 						   parse:YES
 						 inGroup:parentGroup];
+			[partName release];
 			
 			// Debug check: full part resolution isn't thread-safe so make sure we haven't run it by accident here!
 			assert(cacheType == PartTypeUnresolved);
@@ -613,32 +616,48 @@ int floatNearGrid(float v, float grid, float epsi)
 //==============================================================================
 - (NSString *) write
 {
-	Matrix4 transformation = [self transformationMatrix];
-
-	return [NSString stringWithFormat:
-				@"1 %@ %@ %@ %@ %@ %@ %@ %@ %@ %@ %@ %@ %@ %@",
-				[LDrawUtilities outputStringForColor:self->color],
-				
-				[LDrawUtilities outputStringForFloat:transformation.element[3][0]], //position.x,			(x)
-				[LDrawUtilities outputStringForFloat:transformation.element[3][1]], //position.y,			(y)
-				[LDrawUtilities outputStringForFloat:transformation.element[3][2]], //position.z,			(z)
-				
-				[LDrawUtilities outputStringForFloat:transformation.element[0][0]], //transformationX.x,	(a)
-				[LDrawUtilities outputStringForFloat:transformation.element[1][0]], //transformationX.y,	(b)
-				[LDrawUtilities outputStringForFloat:transformation.element[2][0]], //transformationX.z,	(c)
-				
-				[LDrawUtilities outputStringForFloat:transformation.element[0][1]], //transformationY.x,	(d)
-				[LDrawUtilities outputStringForFloat:transformation.element[1][1]], //transformationY.y,	(e)
-				[LDrawUtilities outputStringForFloat:transformation.element[2][1]], //transformationY.z,	(f)
-				
-				[LDrawUtilities outputStringForFloat:transformation.element[0][2]], //transformationZ.x,	(g)
-				[LDrawUtilities outputStringForFloat:transformation.element[1][2]], //transformationZ.y,	(h)
-				[LDrawUtilities outputStringForFloat:transformation.element[2][2]], //transformationZ.z,	(i)
-				
-				displayName
-			];
+	return [LDrawWriter stringByWritingDirective:self];
+	
 }//end write
 
+
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends the part's line to the stream; see -write for the 
+//				order of the matrix elements.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
+	Matrix4	transformation	= [self transformationMatrix];
+	int		row				= 0;
+	int		column			= 0;
+
+	[stream appendBytes:"1 " length:2];
+	[stream appendColor:self->color];
+	
+	// position (x y z)
+	for(column = 0; column < 3; column++)
+	{
+		[stream appendBytes:" " length:1];
+		[stream appendFloat:transformation.element[3][column]];
+	}
+	
+	// rotation (a b c, d e f, g h i) is the transpose of our 3x3.
+	for(column = 0; column < 3; column++)
+	{
+		for(row = 0; row < 3; row++)
+		{
+			[stream appendBytes:" " length:1];
+			[stream appendFloat:transformation.element[row][column]];
+		}
+	}
+	
+	[stream appendBytes:" " length:1];
+	[stream appendString:displayName];
+	
+}//end writeToStream:
+
 #pragma mark -
 #pragma mark DISPLAY
 #pragma mark -
@@ -797,6 +816,20 @@ To work, this needs to multiply the modelViewGLMatrix by the part transform.
 }//end referenceName
 
 
+//========== partSymbol ========================================================
+//
+// Purpose:		Returns the interned form of the part's name. Parts which 
+//				reference the same file have the same symbol, however they spell 
+//				its name. 
+//
+//==============================================================================
+- (LDrawSymbol) partSymbol
+{
+	return partSymbol;
+	
+}//end partSymbol
+
+
 //========== referencedMPDSubmodel =============================================
 //
 // Purpose:		Returns the MPD model to which this part refers, or nil if there 
@@ -950,13 +983,23 @@ To work, this needs to multiply the modelViewGLMatrix by the part transform.
 				  parse:(BOOL)shouldParse
 				inGroup:(dispatch_group_t)parentGroup
 {
-	NSString            *newReferenceName   = [newPartName lowercaseString];
+	LDrawSymbolTable    *symbolTable        = [LDrawSymbolTable sharedSymbolTable];
+	NSString            *newDisplayName     = nil;
+	NSString            *newReferenceName   = nil;
 	dispatch_group_t    parseGroup          = NULL;
 
-	[newPartName retain];
+	[self noteWillChange];
+	
+	// Keep the symbol table's copies of the names; every part that references 
+	// the same file shares them. 
+	partSymbol = [symbolTable symbolForPartName:newPartName
+									displayName:&newDisplayName
+								  referenceName:&newReferenceName];
+
+	[newDisplayName retain];
 	[displayName release];
 	
-	displayName = newPartName;
+	displayName = newDisplayName;
 	
 	[newReferenceName retain];
 	[referenceName release];
@@ -983,7 +1026,7 @@ To work, this needs to multiply the modelViewGLMatrix by the part transform.
 		else
 			parseGroup = parentGroup;
 #endif
-		[[PartLibrary sharedPartLibrary] loadModelForName:referenceName inGroup:parseGroup];
+		[[PartLibrary sharedPartLibrary] loadModelForName:[symbolTable partNameForSymbol:partSymbol] inGroup:parseGroup];
 		
 #if USE_BLOCKS
 		if(parentGroup == NULL)
@@ -1031,6 +1074,8 @@ To work, this needs to multiply the modelViewGLMatrix by the part transform.
 //==============================================================================
 - (void) setTransformationMatrix:(Matrix4 *)newMatrix
 {
+	[self noteWillChange];
+	
 	[self invalCache:CacheFlagBounds];
 	Matrix4GetGLMatrix4(*newMatrix, self->glTransformation);
 	
@@ -1468,7 +1513,7 @@ To work, this needs to multiply the modelViewGLMatrix by the part transform.
 		modelToDraw = [self referencedMPDSubmodel];
 		
 		if(modelToDraw == nil)
-			modelToDraw = [[PartLibrary sharedPartLibrary] modelForName_threadSafe:referenceName];
+			modelToDraw = [[PartLibrary sharedPartLibrary] modelForName_threadSafe:[[LDrawSymbolTable sharedSymbolTable] partNameForSymbol:partSymbol]];
 		
 		flatCopy    = [modelToDraw copy];
 		
@@ -1584,12 +1629,15 @@ To work, this needs to multiply the modelViewGLMatrix by the part transform.
 		else 
 		{
 			// Try the part library first for speed - sub-paths will thrash the modelmanager.
-			cacheModel = [[PartLibrary sharedPartLibrary] modelForName:referenceName];
+			cacheModel = [[PartLibrary sharedPartLibrary] modelForSymbol:partSymbol];
 			if(cacheModel != nil)
 			{
 				// Intentional: do not observe library parts - they are immutable so 
 				// we don't need observations, and messing with the lib parts set is expensive.
 				// [cacheModel addObserver:self];
+				
+				// But do keep the library from evicting it out from under us.
+				[[PartLibrary sharedPartLibrary] pinModel:cacheModel];
 
 				// WE DO NOT LOOK UP THE DRAWABLE VBO HERE!!!  Do that in -optimizeOpenGL 
 				// instead. 
@@ -1644,6 +1692,11 @@ To work, this needs to multiply the modelViewGLMatrix by the part transform.
 			[cacheModel removeObserver:self];
 		}
 		
+		if(cacheModel != nil && cacheType == PartTypeLibrary)
+		{
+			[[PartLibrary sharedPartLibrary] unpinModel:cacheModel];
+		}
+		
 		if(cacheType == PartTypeNotFound)
 		{
 			[[NSNotificationCenter defaultCenter] removeObserver:self name:LDrawMPDSubModelAdded object:nil];	
@@ -1749,6 +1802,7 @@ To work, this needs to multiply the modelViewGLMatrix by the part transform.
 			[self unresolvePart];
 			[referenceName release];
 			referenceName = [[redirect referenceName] retain];
+			partSymbol = [redirect partSymbol];
 			[displayName release];
 			displayName = [[redirect displayName] retain];
 
@@ -0,0 +1,84 @@
+//==============================================================================
+//
+// File:		LDrawPrimitiveBlock.h
+//
+// Purpose:		All the flattened lines, triangles and quads of an optimized
+//				library part, stored as flat arrays rather than objects.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import "LDrawDirective.h"
+
+// Primitive block - THEORY OF OPERATION
+//
+// -[LDrawModel optimizeStructure] flattens a library part into thousands of
+// tiny LDrawLine/LDrawTriangle/LDrawQuadrilateral objects, each with its own
+// isa, observer set, retained color and padding.  Once flattened, nobody ever
+// edits them; they are only collected, bounded and hit-tested.  So the
+// optimized part keeps them in one primitive block instead.
+//
+// For each primitive type the block has three parallel arrays: an int32 index
+// into its color table, the vertices (x y z, 2, 3 or 4 per primitive) and, for
+// triangles and quads, the flattened normal.  Lines always use the same
+// normal the LDrawLine collector does.  All of it lives in a single NSData, in
+// the layout +storageLengthForCounts: describes; copies share that buffer,
+// and the part cache stores it byte for byte.
+//
+// Colors 16 and 24 stay unresolved, exactly as in the flattened objects, so
+// the collector still substitutes the part's own color.
+//
+// Anything that needs real objects (e.g. flattening an optimized part into
+// yet another part) gets them from -flattenIntoLines:..., which rebuilds each
+// primitive on the fly.
+
+// Primitive types, in storage order.
+typedef enum
+{
+	LDrawPrimitiveLines				= 0,
+	LDrawPrimitiveTriangles			= 1,
+	LDrawPrimitiveQuadrilaterals	= 2,
+	LDrawPrimitiveTypeCount			= 3
+
+} LDrawPrimitiveType;
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Class:		LDrawPrimitiveBlock
+//
+////////////////////////////////////////////////////////////////////////////////
+@interface LDrawPrimitiveBlock : LDrawDirective <NSCoding>
+{
+	NSArray			*colors;			// LDrawColors, indexed by colorIndices
+	GLfloat			*colorComponents;	// RGBA of each color
+	GLfloat			**colorArguments;	// what the collector is passed for each color
+
+	NSData			*storage;			// backs the arrays below; shared by copies
+	NSUInteger		counts[LDrawPrimitiveTypeCount];
+	const int32_t	*colorIndices[LDrawPrimitiveTypeCount];
+	const GLfloat	*vertices[LDrawPrimitiveTypeCount];
+	const GLfloat	*normals[LDrawPrimitiveTypeCount];	// NULL for lines
+
+	Box3			bounds;
+}
+
+// Initialization
+- (id) initWithLines:(NSArray *)lines
+		   triangles:(NSArray *)triangles
+	  quadrilaterals:(NSArray *)quadrilaterals;
+- (id) initWithColors:(NSArray *)colorTable
+			   counts:(const NSUInteger *)primitiveCounts
+			  storage:(NSData *)primitiveData;
+
+// Accessors
++ (NSUInteger) verticesPerPrimitive:(LDrawPrimitiveType)type;
++ (NSUInteger) storageLengthForCounts:(const NSUInteger *)primitiveCounts;
+- (NSArray *) colors;
+- (NSUInteger) countOfType:(LDrawPrimitiveType)type;
+- (const int32_t *) colorIndicesOfType:(LDrawPrimitiveType)type;
+- (const GLfloat *) verticesOfType:(LDrawPrimitiveType)type;
+- (const GLfloat *) normalsOfType:(LDrawPrimitiveType)type;
+- (NSData *) storage;
+
+@end
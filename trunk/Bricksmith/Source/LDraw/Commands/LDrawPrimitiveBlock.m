@@ -0,0 +1,805 @@
+//==============================================================================
+//
+// File:		LDrawPrimitiveBlock.m
+//
+// Purpose:		All the flattened lines, triangles and quads of an optimized
+//				library part, stored as flat arrays rather than objects.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import "LDrawPrimitiveBlock.h"
+
+#import "LDrawColor.h"
+#import "LDrawLine.h"
+#import "LDrawQuadrilateral.h"
+#import "LDrawTriangle.h"
+#import "LDrawUtilities.h"
+#import "LDrawWriter.h"
+#include "GLMatrixMath.h"
+
+// The normal LDrawLine hands the collector.
+static GLfloat LineNormal[3] = { 0, -1, 0 };
+
+
+//========== clipPrimitive =====================================================
+//
+// Purpose:		Transforms a triangle or quad into clip space and clips it to
+//				the view, returning the number of NDC triangles (x y z each)
+//				written to ndcTriangles, which must hold 36 floats.
+//
+// Notes:		Quads are split 1-2-3 / 3-4-1, just as LDrawQuadrilateral
+//				hit-tests them.
+//
+//==============================================================================
+static int clipPrimitive(const GLfloat *vertex, NSUInteger vertexCount, Matrix4 transform, GLfloat *ndcTriangles)
+{
+	Point4		clipVertex[4];
+	GLfloat		h_tri1[12];
+	GLfloat		h_tri2[12];
+	NSUInteger	counter		= 0;
+	int			triCount	= 0;
+
+	for(counter = 0; counter < vertexCount; counter++)
+	{
+		clipVertex[counter] = V4MulPointByMatrix(V4FromPoint3(V3Make(vertex[counter*3+0], vertex[counter*3+1], vertex[counter*3+2])), transform);
+	}
+
+	memcpy(h_tri1 + 0, &clipVertex[0], sizeof(GLfloat) * 4);
+	memcpy(h_tri1 + 4, &clipVertex[1], sizeof(GLfloat) * 4);
+	memcpy(h_tri1 + 8, &clipVertex[2], sizeof(GLfloat) * 4);
+	triCount = clipTriangle(h_tri1, ndcTriangles);
+
+	if(vertexCount == 4)
+	{
+		memcpy(h_tri2 + 0, &clipVertex[2], sizeof(GLfloat) * 4);
+		memcpy(h_tri2 + 4, &clipVertex[3], sizeof(GLfloat) * 4);
+		memcpy(h_tri2 + 8, &clipVertex[0], sizeof(GLfloat) * 4);
+		triCount += clipTriangle(h_tri2, ndcTriangles + 9*triCount);
+	}
+
+	return triCount;
+}
+
+
+@interface LDrawPrimitiveBlock ()
+
+- (BOOL) bindColors:(NSArray *)colorTable counts:(const NSUInteger *)primitiveCounts storage:(NSData *)primitiveData;
+
+@end
+
+
+@implementation LDrawPrimitiveBlock
+
+#pragma mark -
+#pragma mark INITIALIZATION
+#pragma mark -
+
+//========== initWithLines:triangles:quadrilaterals: ===========================
+//
+// Purpose:		Packs already-flattened primitives into a block. Only the
+//				vertices, normals and colors are kept.
+//
+//==============================================================================
+- (id) initWithLines:(NSArray *)lines
+		   triangles:(NSArray *)triangles
+	  quadrilaterals:(NSArray *)quadrilaterals
+{
+	NSArray			*primitives[LDrawPrimitiveTypeCount]	= { lines, triangles, quadrilaterals };
+	NSUInteger		primitiveCounts[LDrawPrimitiveTypeCount];
+	NSMutableArray	*colorTable		= [NSMutableArray array];
+	NSMutableData	*primitiveData	= nil;
+	uint8_t			*cursor			= NULL;
+	LDrawColor		*color			= nil;
+	NSUInteger		colorIndex		= 0;
+	NSUInteger		type			= 0;
+	Point3			points[4];
+	Vector3			normal			= ZeroPoint3;
+
+	for(type = 0; type < LDrawPrimitiveTypeCount; type++)
+		primitiveCounts[type] = [primitives[type] count];
+
+	primitiveData	= [NSMutableData dataWithLength:[LDrawPrimitiveBlock storageLengthForCounts:primitiveCounts]];
+	cursor			= [primitiveData mutableBytes];
+
+	for(type = 0; type < LDrawPrimitiveTypeCount; type++)
+	{
+		NSUInteger	vertexCount	= [LDrawPrimitiveBlock verticesPerPrimitive:type];
+		int32_t		*indexOut	= (int32_t *)cursor;
+		GLfloat		*vertexOut	= (GLfloat *)(indexOut + primitiveCounts[type]);
+		GLfloat		*normalOut	= vertexOut + primitiveCounts[type] * vertexCount * 3;
+
+		for(id directive in primitives[type])
+		{
+			// Build the color table as we go.
+			color		= [directive LDrawColor];
+			colorIndex	= [colorTable indexOfObjectIdenticalTo:color];
+			if(colorIndex == NSNotFound)
+			{
+				colorIndex = [colorTable count];
+				[colorTable addObject:color];
+			}
+			*indexOut++ = (int32_t)colorIndex;
+
+			points[0] = [directive vertex1];
+			points[1] = [directive vertex2];
+			if(vertexCount > 2)
+			{
+				points[2]	= [directive vertex3];
+				normal		= [directive normal];
+			}
+			if(vertexCount > 3)
+				points[3] = [directive vertex4];
+
+			memcpy(vertexOut, points, sizeof(Point3) * vertexCount);
+			vertexOut += vertexCount * 3;
+
+			if(type != LDrawPrimitiveLines)
+			{
+				memcpy(normalOut, &normal, sizeof(Vector3));
+				normalOut += 3;
+			}
+		}
+
+		cursor = (type == LDrawPrimitiveLines) ? (uint8_t *)vertexOut : (uint8_t *)normalOut;
+	}
+
+	return [self initWithColors:colorTable counts:primitiveCounts storage:primitiveData];
+
+}//end initWithLines:triangles:quadrilaterals:
+
+
+//========== initWithColors:counts:storage: ====================================
+//
+// Purpose:		Designated initializer. The storage must be laid out as
+//				+storageLengthForCounts: describes; it is retained, not copied.
+//
+// Notes:		Returns nil if the storage is the wrong size or refers to a
+//				color not in the table, so the part cache can hand us its
+//				bytes without checking them first.
+//
+//==============================================================================
+- (id) initWithColors:(NSArray *)colorTable
+			   counts:(const NSUInteger *)primitiveCounts
+			  storage:(NSData *)primitiveData
+{
+	self = [super init];
+
+	if([self bindColors:colorTable counts:primitiveCounts storage:primitiveData] == NO)
+	{
+		[self release];
+		self = nil;
+	}
+
+	return self;
+
+}//end initWithColors:counts:storage:
+
+
+//========== initWithCoder: ====================================================
+//
+// Purpose:		Reads a representation of this object from the given coder,
+//				which is assumed to always be a keyed decoder. This allows us to
+//				read and write LDraw objects as NSData.
+//
+//==============================================================================
+- (id) initWithCoder:(NSCoder *)decoder
+{
+	NSUInteger	primitiveCounts[LDrawPrimitiveTypeCount];
+
+	self = [super initWithCoder:decoder];
+
+	primitiveCounts[LDrawPrimitiveLines]			= [decoder decodeIntegerForKey:@"lineCount"];
+	primitiveCounts[LDrawPrimitiveTriangles]		= [decoder decodeIntegerForKey:@"triangleCount"];
+	primitiveCounts[LDrawPrimitiveQuadrilaterals]	= [decoder decodeIntegerForKey:@"quadrilateralCount"];
+
+	if([self bindColors:[decoder decodeObjectForKey:@"colors"]
+				 counts:primitiveCounts
+				storage:[decoder decodeObjectForKey:@"storage"]] == NO)
+	{
+		[self release];
+		self = nil;
+	}
+
+	return self;
+
+}//end initWithCoder:
+
+
+//========== encodeWithCoder: ==================================================
+//
+// Purpose:		Writes a representation of this object to the given coder,
+//				which is assumed to always be a keyed decoder. This allows us to
+//				read and write LDraw objects as NSData.
+//
+//==============================================================================
+- (void) encodeWithCoder:(NSCoder *)encoder
+{
+	[super encodeWithCoder:encoder];
+
+	[encoder encodeObject:self->colors	forKey:@"colors"];
+	[encoder encodeObject:self->storage	forKey:@"storage"];
+	[encoder encodeInteger:self->counts[LDrawPrimitiveLines]			forKey:@"lineCount"];
+	[encoder encodeInteger:self->counts[LDrawPrimitiveTriangles]		forKey:@"triangleCount"];
+	[encoder encodeInteger:self->counts[LDrawPrimitiveQuadrilaterals]	forKey:@"quadrilateralCount"];
+
+}//end encodeWithCoder:
+
+
+//========== copyWithZone: =====================================================
+//
+// Purpose:		Returns a duplicate of this block. The primitive storage is
+//				immutable, so the copy shares it.
+//
+//==============================================================================
+- (id) copyWithZone:(NSZone *)zone
+{
+	LDrawPrimitiveBlock *copied = (LDrawPrimitiveBlock *)[super copyWithZone:zone];
+
+	[copied bindColors:self->colors counts:self->counts storage:self->storage];
+
+	return copied;
+
+}//end copyWithZone:
+
+
+#pragma mark -
+#pragma mark DIRECTIVES
+#pragma mark -
+
+//========== collectSelf: ========================================================
+//
+// Purpose:		Feeds every primitive to the collector, straight from the
+//				arrays.
+//
+//================================================================================
+- (void) collectSelf:(id<LDrawCollector>)renderer
+{
+	const int32_t	*indices	= NULL;
+	const GLfloat	*vertex		= NULL;
+	const GLfloat	*normal		= NULL;
+	NSUInteger		counter		= 0;
+
+	[self revalCache:DisplayList];
+
+	indices	= self->colorIndices[LDrawPrimitiveLines];
+	vertex	= self->vertices[LDrawPrimitiveLines];
+	for(counter = 0; counter < self->counts[LDrawPrimitiveLines]; counter++, vertex += 6)
+	{
+		[renderer drawLine:(GLfloat *)vertex normal:LineNormal color:self->colorArguments[indices[counter]]];
+	}
+
+	indices	= self->colorIndices[LDrawPrimitiveTriangles];
+	vertex	= self->vertices[LDrawPrimitiveTriangles];
+	normal	= self->normals[LDrawPrimitiveTriangles];
+	for(counter = 0; counter < self->counts[LDrawPrimitiveTriangles]; counter++, vertex += 9, normal += 3)
+	{
+		[renderer drawTri:(GLfloat *)vertex normal:(GLfloat *)normal color:self->colorArguments[indices[counter]]];
+	}
+
+	indices	= self->colorIndices[LDrawPrimitiveQuadrilaterals];
+	vertex	= self->vertices[LDrawPrimitiveQuadrilaterals];
+	normal	= self->normals[LDrawPrimitiveQuadrilaterals];
+	for(counter = 0; counter < self->counts[LDrawPrimitiveQuadrilaterals]; counter++, vertex += 12, normal += 3)
+	{
+		[renderer drawQuad:(GLfloat *)vertex normal:(GLfloat *)normal color:self->colorArguments[indices[counter]]];
+	}
+
+}//end collectSelf:
+
+
+//========== boxTest:transform:boundsOnly:creditObject:hits: ===================
+//
+// Purpose:		Check for intersections with screen-space geometry. The first
+//				primitive that hits settles it.
+//
+//==============================================================================
+- (BOOL)    boxTest:(Box2)testBounds
+		  transform:(Matrix4)transform
+		 boundsOnly:(BOOL)boundsOnly
+	   creditObject:(id)creditObject
+	           hits:(NSMutableSet *)hits
+{
+	const GLfloat	*vertex		= NULL;
+	GLfloat			ndc_tris[36];
+	NSUInteger		type		= 0;
+	NSUInteger		counter		= 0;
+	int				triCount	= 0;
+	int				i			= 0;
+	BOOL			intersects	= NO;
+
+	vertex = self->vertices[LDrawPrimitiveLines];
+	for(counter = 0; counter < self->counts[LDrawPrimitiveLines] && intersects == NO; counter++, vertex += 6)
+	{
+		Vector3 worldVertex1    = V3MulPointByProjMatrix(V3Make(vertex[0], vertex[1], vertex[2]), transform);
+		Vector3 worldVertex2    = V3MulPointByProjMatrix(V3Make(vertex[3], vertex[4], vertex[5]), transform);
+
+		Point2	line[2] = {
+			V2Make(worldVertex1.x,worldVertex1.y),
+			V2Make(worldVertex2.x,worldVertex2.y) };
+
+		intersects = V2BoxIntersectsPolygon(testBounds, line, 2);
+	}
+
+	for(type = LDrawPrimitiveTriangles; type < LDrawPrimitiveTypeCount && intersects == NO; type++)
+	{
+		NSUInteger	vertexCount	= [LDrawPrimitiveBlock verticesPerPrimitive:type];
+
+		vertex = self->vertices[type];
+		for(counter = 0; counter < self->counts[type] && intersects == NO; counter++, vertex += vertexCount * 3)
+		{
+			triCount = clipPrimitive(vertex, vertexCount, transform, ndc_tris);
+			for(i = 0; i < triCount && intersects == NO; ++i)
+			{
+				Point2	tri[3] = {
+					V2Make(ndc_tris[i*9+0],ndc_tris[i*9+1]),
+					V2Make(ndc_tris[i*9+3],ndc_tris[i*9+4]),
+					V2Make(ndc_tris[i*9+6],ndc_tris[i*9+7])
+				};
+
+				intersects = V2BoxIntersectsPolygon(testBounds, tri, 3);
+			}
+		}
+	}
+
+	if(intersects)
+	{
+		[LDrawUtilities registerHitForObject:self creditObject:creditObject hits:hits];
+		if(creditObject != nil)
+			return TRUE;
+	}
+	return FALSE;
+
+}//end boxTest:transform:boundsOnly:creditObject:hits:
+
+
+//========== depthTest:inBox:transform:creditObject:bestObject:bestDepth:=======
+//
+// Purpose:		depthTest finds the closest primitive (in screen space)
+//				overlapping a given point, as well as its device coordinate
+//				depth.
+//
+//==============================================================================
+- (void)	depthTest:(Point2) pt
+				inBox:(Box2)testBounds
+			transform:(Matrix4)transform
+		 creditObject:(id)creditObject
+		   bestObject:(id *)bestObject
+			bestDepth:(float *)bestDepth
+{
+	const GLfloat	*vertex		= NULL;
+	GLfloat			ndc_tris[36];
+	float			tolerance2	= (testBounds.size.width*testBounds.size.width+testBounds.size.height*testBounds.size.height)*0.25;
+	NSUInteger		type		= 0;
+	NSUInteger		counter		= 0;
+	int				triCount	= 0;
+	int				i			= 0;
+
+	vertex = self->vertices[LDrawPrimitiveLines];
+	for(counter = 0; counter < self->counts[LDrawPrimitiveLines]; counter++, vertex += 6)
+	{
+		Vector3 worldVertex1    = V3MulPointByProjMatrix(V3Make(vertex[0], vertex[1], vertex[2]), transform);
+		Vector3 worldVertex2    = V3MulPointByProjMatrix(V3Make(vertex[3], vertex[4], vertex[5]), transform);
+
+		Point3 probe = { pt.x, pt.y, *bestDepth };
+
+		if(DepthOnLineSegment(worldVertex1,worldVertex2,tolerance2, &probe))
+		{
+			if(probe.z <= *bestDepth)
+			{
+				*bestDepth = probe.z;
+				*bestObject = creditObject ? creditObject : self;
+			}
+		}
+	}
+
+	for(type = LDrawPrimitiveTriangles; type < LDrawPrimitiveTypeCount; type++)
+	{
+		NSUInteger	vertexCount	= [LDrawPrimitiveBlock verticesPerPrimitive:type];
+
+		vertex = self->vertices[type];
+		for(counter = 0; counter < self->counts[type]; counter++, vertex += vertexCount * 3)
+		{
+			Point3 probe = { pt.x, pt.y, *bestDepth };
+
+			triCount = clipPrimitive(vertex, vertexCount, transform, ndc_tris);
+			for(i = 0; i < triCount; ++i)
+			{
+				Point3	ndcVertex1 = V3Make(ndc_tris[i*9+0],ndc_tris[i*9+1],ndc_tris[i*9+2]);
+				Point3	ndcVertex2 = V3Make(ndc_tris[i*9+3],ndc_tris[i*9+4],ndc_tris[i*9+5]);
+				Point3	ndcVertex3 = V3Make(ndc_tris[i*9+6],ndc_tris[i*9+7],ndc_tris[i*9+8]);
+
+				if(DepthOnTriangle(ndcVertex1,ndcVertex2,ndcVertex3,&probe))
+				{
+					if(probe.z <= *bestDepth)
+					{
+						*bestDepth = probe.z;
+						*bestObject = creditObject ? creditObject : self;
+					}
+				}
+			}
+		}
+	}
+
+}//end depthTest:inBox:transform:creditObject:bestObject:bestDepth:
+
+
+//========== write =============================================================
+//
+// Purpose:		Returns the primitives as LDraw lines, lines first, then
+//				triangles, then quads.
+//
+//==============================================================================
+- (NSString *) write
+{
+	return [LDrawWriter stringByWritingDirective:self];
+
+}//end write
+
+
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends one type 2, 3 or 4 line per primitive to the stream,
+//				separated by CRLF. There is no line ending after the last one.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
+	static const char	*lineTypes[LDrawPrimitiveTypeCount]	= { "2 ", "3 ", "4 " };
+	const int32_t		*indices		= NULL;
+	const GLfloat		*vertex			= NULL;
+	NSUInteger			floatCount		= 0;
+	NSUInteger			type			= 0;
+	NSUInteger			counter			= 0;
+	NSUInteger			component		= 0;
+	BOOL				firstLine		= YES;
+
+	for(type = 0; type < LDrawPrimitiveTypeCount; type++)
+	{
+		indices		= self->colorIndices[type];
+		vertex		= self->vertices[type];
+		floatCount	= [LDrawPrimitiveBlock verticesPerPrimitive:type] * 3;
+
+		for(counter = 0; counter < self->counts[type]; counter++)
+		{
+			if(firstLine == NO)
+				[stream appendCRLF];
+			firstLine = NO;
+
+			[stream appendBytes:lineTypes[type] length:2];
+			[stream appendColor:[self->colors objectAtIndex:indices[counter]]];
+
+			for(component = 0; component < floatCount; component++)
+			{
+				[stream appendBytes:" " length:1];
+				[stream appendFloat:*vertex++];
+			}
+		}
+	}
+
+}//end writeToStream:
+
+
+#pragma mark -
+#pragma mark ACCESSORS
+#pragma mark -
+
+//---------- verticesPerPrimitive: -----------------------------------[static]--
+//
+// Purpose:		2 for lines, 3 for triangles, 4 for quads.
+//
+//------------------------------------------------------------------------------
++ (NSUInteger) verticesPerPrimitive:(LDrawPrimitiveType)type
+{
+	return type + 2;
+
+}//end verticesPerPrimitive:
+
+
+//---------- storageLengthForCounts: ---------------------------------[static]--
+//
+// Purpose:		Returns the size of the storage for the given number of lines,
+//				triangles and quads.
+//
+// Notes:		For each type in turn the storage holds:
+//
+//					int32_t	colorIndex[count]
+//					GLfloat	vertices[count][verticesPerPrimitive][3]
+//					GLfloat	normals[count][3]		(not for lines)
+//
+//				Every field is 4 bytes, so nothing needs padding.
+//
+//------------------------------------------------------------------------------
++ (NSUInteger) storageLengthForCounts:(const NSUInteger *)primitiveCounts
+{
+	NSUInteger	length	= 0;
+	NSUInteger	type	= 0;
+
+	for(type = 0; type < LDrawPrimitiveTypeCount; type++)
+	{
+		length += primitiveCounts[type] * sizeof(int32_t);
+		length += primitiveCounts[type] * [self verticesPerPrimitive:type] * 3 * sizeof(GLfloat);
+		if(type != LDrawPrimitiveLines)
+			length += primitiveCounts[type] * 3 * sizeof(GLfloat);
+	}
+
+	return length;
+
+}//end storageLengthForCounts:
+
+
+//========== boundingBox3 ======================================================
+//
+// Purpose:		Returns the minimum and maximum points of the box which
+//				perfectly contains this object.
+//
+// Notes:		Computed once when the block is built; it never changes.
+//
+//==============================================================================
+- (Box3) boundingBox3
+{
+	[self revalCache:CacheFlagBounds];
+
+	return self->bounds;
+
+}//end boundingBox3
+
+
+//========== colors ============================================================
+//
+// Purpose:		The color table the color indices refer to.
+//
+//==============================================================================
+- (NSArray *) colors
+{
+	return self->colors;
+
+}//end colors
+
+
+//========== countOfType: ======================================================
+//==============================================================================
+- (NSUInteger) countOfType:(LDrawPrimitiveType)type
+{
+	return self->counts[type];
+
+}//end countOfType:
+
+
+//========== colorIndicesOfType: ===============================================
+//==============================================================================
+- (const int32_t *) colorIndicesOfType:(LDrawPrimitiveType)type
+{
+	return self->colorIndices[type];
+
+}//end colorIndicesOfType:
+
+
+//========== verticesOfType: ===================================================
+//==============================================================================
+- (const GLfloat *) verticesOfType:(LDrawPrimitiveType)type
+{
+	return self->vertices[type];
+
+}//end verticesOfType:
+
+
+//========== normalsOfType: ====================================================
+//
+// Purpose:		One normal per primitive, or NULL for lines.
+//
+//==============================================================================
+- (const GLfloat *) normalsOfType:(LDrawPrimitiveType)type
+{
+	return self->normals[type];
+
+}//end normalsOfType:
+
+
+//========== storage ===========================================================
+//
+// Purpose:		The packed arrays, laid out as +storageLengthForCounts: says.
+//
+//==============================================================================
+- (NSData *) storage
+{
+	return self->storage;
+
+}//end storage
+
+
+#pragma mark -
+#pragma mark UTILITIES
+#pragma mark -
+
+//========== flattenIntoLines:triangles:quadrilaterals:other:currentColor: =====
+//
+// Purpose:		Rebuilds each primitive as an object and flattens that, so an
+//				optimized part flattens exactly as its original primitives did.
+//
+//==============================================================================
+- (void) flattenIntoLines:(NSMutableArray *)lines
+				triangles:(NSMutableArray *)triangles
+		   quadrilaterals:(NSMutableArray *)quadrilaterals
+					other:(NSMutableArray *)everythingElse
+			 currentColor:(LDrawColor *)parentColor
+		 currentTransform:(Matrix4)transform
+		  normalTransform:(Matrix3)normalTransform
+				recursive:(BOOL)recursive
+{
+	const GLfloat			*vertex		= NULL;
+	const GLfloat			*normal		= NULL;
+	LDrawDrawableElement	*primitive	= nil;
+	NSUInteger				type		= 0;
+	NSUInteger				counter		= 0;
+
+	for(type = 0; type < LDrawPrimitiveTypeCount; type++)
+	{
+		vertex = self->vertices[type];
+		normal = self->normals[type];
+
+		for(counter = 0; counter < self->counts[type]; counter++)
+		{
+			switch(type)
+			{
+				case LDrawPrimitiveLines:
+					primitive = [[LDrawLine alloc] init];
+					[(LDrawLine *)primitive setVertex1:V3Make(vertex[0], vertex[1], vertex[2])];
+					[(LDrawLine *)primitive setVertex2:V3Make(vertex[3], vertex[4], vertex[5])];
+					vertex += 6;
+					break;
+
+				case LDrawPrimitiveTriangles:
+					primitive = [[LDrawTriangle alloc] init];
+					[(LDrawTriangle *)primitive setVertex1:V3Make(vertex[0], vertex[1], vertex[2])];
+					[(LDrawTriangle *)primitive setVertex2:V3Make(vertex[3], vertex[4], vertex[5])];
+					[(LDrawTriangle *)primitive setVertex3:V3Make(vertex[6], vertex[7], vertex[8])];
+					[(LDrawTriangle *)primitive setNormal:V3Make(normal[0], normal[1], normal[2])];
+					vertex += 9;
+					normal += 3;
+					break;
+
+				case LDrawPrimitiveQuadrilaterals:
+					primitive = [[LDrawQuadrilateral alloc] init];
+					[(LDrawQuadrilateral *)primitive setVertex1:V3Make(vertex[0], vertex[1],  vertex[2])];
+					[(LDrawQuadrilateral *)primitive setVertex2:V3Make(vertex[3], vertex[4],  vertex[5])];
+					[(LDrawQuadrilateral *)primitive setVertex3:V3Make(vertex[6], vertex[7],  vertex[8])];
+					[(LDrawQuadrilateral *)primitive setVertex4:V3Make(vertex[9], vertex[10], vertex[11])];
+					[(LDrawQuadrilateral *)primitive setNormal:V3Make(normal[0], normal[1], normal[2])];
+					vertex += 12;
+					normal += 3;
+					break;
+			}
+
+			[primitive setLDrawColor:[self->colors objectAtIndex:self->colorIndices[type][counter]]];
+			[primitive flattenIntoLines:lines
+							  triangles:triangles
+						 quadrilaterals:quadrilaterals
+								  other:everythingElse
+						   currentColor:parentColor
+					   currentTransform:transform
+						normalTransform:normalTransform
+							  recursive:recursive];
+			[primitive release];
+		}
+	}
+
+}//end flattenIntoLines:triangles:quadrilaterals:other:currentColor:
+
+
+//========== bindColors:counts:storage: ========================================
+//
+// Purpose:		Points the arrays into the storage, validates it, and caches
+//				what the collector needs for each color.
+//
+//==============================================================================
+- (BOOL) bindColors:(NSArray *)colorTable
+			 counts:(const NSUInteger *)primitiveCounts
+			storage:(NSData *)primitiveData
+{
+	const uint8_t	*cursor		= NULL;
+	NSUInteger		colorCount	= [colorTable count];
+	NSUInteger		type		= 0;
+	NSUInteger		counter		= 0;
+	LDrawColor		*color		= nil;
+	LDrawColorT		colorCode	= LDrawColorBogus;
+
+	if(		primitiveData == nil
+	   ||	[primitiveData length] != [LDrawPrimitiveBlock storageLengthForCounts:primitiveCounts] )
+	{
+		return NO;
+	}
+
+	[primitiveData retain];
+	[self->storage release];
+	self->storage = primitiveData;
+
+	[colorTable retain];
+	[self->colors release];
+	self->colors = colorTable;
+
+	// Arrays
+	cursor = [self->storage bytes];
+	for(type = 0; type < LDrawPrimitiveTypeCount; type++)
+	{
+		self->counts[type]			= primitiveCounts[type];
+		self->colorIndices[type]	= (const int32_t *)cursor;
+		self->vertices[type]		= (const GLfloat *)(self->colorIndices[type] + primitiveCounts[type]);
+		self->normals[type]			= NULL;
+		cursor = (const uint8_t *)(self->vertices[type] + primitiveCounts[type] * [LDrawPrimitiveBlock verticesPerPrimitive:type] * 3);
+
+		if(type != LDrawPrimitiveLines)
+		{
+			self->normals[type]	= (const GLfloat *)cursor;
+			cursor				= (const uint8_t *)(self->normals[type] + primitiveCounts[type] * 3);
+		}
+
+		for(counter = 0; counter < primitiveCounts[type]; counter++)
+		{
+			if(self->colorIndices[type][counter] < 0 || self->colorIndices[type][counter] >= colorCount)
+				return NO;
+		}
+	}
+
+	// Colors
+	free(self->colorComponents);
+	free(self->colorArguments);
+	self->colorComponents	= malloc(sizeof(GLfloat) * 4 * MAX(colorCount, 1));
+	self->colorArguments	= malloc(sizeof(GLfloat *) * MAX(colorCount, 1));
+
+	for(counter = 0; counter < colorCount; counter++)
+	{
+		color		= [colorTable objectAtIndex:counter];
+		colorCode	= [color colorCode];
+
+		if(colorCode == LDrawCurrentColor)
+			self->colorArguments[counter] = LDrawRenderCurrentColor;
+		else if(colorCode == LDrawEdgeColor)
+			self->colorArguments[counter] = LDrawRenderComplimentColor;
+		else
+		{
+			[color getColorRGBA:self->colorComponents + counter * 4];
+			self->colorArguments[counter] = self->colorComponents + counter * 4;
+		}
+	}
+
+	// Bounds
+	self->bounds = InvalidBox;
+	for(type = 0; type < LDrawPrimitiveTypeCount; type++)
+	{
+		const GLfloat	*vertex			= self->vertices[type];
+		NSUInteger		vertexCount		= primitiveCounts[type] * [LDrawPrimitiveBlock verticesPerPrimitive:type];
+
+		for(counter = 0; counter < vertexCount; counter++, vertex += 3)
+		{
+			self->bounds = V3UnionBoxAndPoint(self->bounds, V3Make(vertex[0], vertex[1], vertex[2]));
+		}
+	}
+
+	return YES;
+
+}//end bindColors:counts:storage:
+
+
+#pragma mark -
+#pragma mark DESTRUCTOR
+#pragma mark -
+
+//========== dealloc ===========================================================
+//
+// Purpose:		Time for cleanup.
+//
+//==============================================================================
+- (void) dealloc
+{
+	[colors		release];
+	[storage	release];
+	free(colorComponents);
+	free(colorArguments);
+
+	[super dealloc];
+
+}//end dealloc
+
+
+@end
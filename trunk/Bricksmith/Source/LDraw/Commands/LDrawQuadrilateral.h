@@ -36,10 +36,12 @@
 - (Point3) vertex2;
 - (Point3) vertex3;
 - (Point3) vertex4;
+- (Vector3) normal;
 -(void) setVertex1:(Point3)newVertex;
 -(void) setVertex2:(Point3)newVertex;
 -(void) setVertex3:(Point3)newVertex;
 -(void) setVertex4:(Point3)newVertex;
+-(void) setNormal:(Vector3)newNormal;
 
 //Utilities
 - (void) fixBowtie;
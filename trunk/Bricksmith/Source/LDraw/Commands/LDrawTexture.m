@@ -317,7 +317,7 @@
 //================================================================================
 - (void) drawSelf:(id<LDrawRenderer>)renderer
 {
-	NSArray 		*commands			= [self subdirectives];
+	NSArray 		*commands			= [self readOnlySubdirectives];
 	LDrawDirective	*currentDirective	= nil;
 
 	Vector3 		normal				= ZeroPoint3;
@@ -372,7 +372,7 @@
 //================================================================================
 - (void) collectSelf:(id<LDrawCollector>)renderer
 {
-	NSArray 		*commands			= [self subdirectives];
+	NSArray 		*commands			= [self readOnlySubdirectives];
 	LDrawDirective	*currentDirective	= nil;
 
 	Vector3 		normal				= ZeroPoint3;
@@ -521,7 +521,7 @@
 {
 	NSMutableString *written        = [NSMutableString string];
 	NSString        *CRLF           = [NSString CRLF];
-	NSArray         *commands		= [self subdirectives];
+	NSArray         *commands		= [self readOnlySubdirectives];
 	LDrawDirective  *currentCommand = nil;
 	NSString		*commandString	= nil;
 	NSUInteger      numberCommands  = 0;
@@ -633,7 +633,7 @@
 {
 	if ([self revalCache:CacheFlagBounds] == CacheFlagBounds)
 	{
-		cachedBounds = [LDrawUtilities boundingBox3ForDirectives:[self subdirectives]];
+		cachedBounds = [LDrawUtilities boundingBox3ForDirectives:[self readOnlySubdirectives]];
 	}
 	return cachedBounds;
 	
@@ -679,6 +679,8 @@
 //==============================================================================
 - (void) setGlossmapName:(NSString *)newName
 {
+	[self noteWillChange];
+	
 	[newName retain];
 	[self->glossmapName release];
 	self->glossmapName = newName;
@@ -714,6 +716,8 @@
 	NSString	*newReferenceName   = [newName lowercaseString];
 	dispatch_group_t    parseGroup          = NULL;
 	
+	[self noteWillChange];
+	
 	[newName retain];
 	[self->imageDisplayName release];
 	self->imageDisplayName = newName;
@@ -755,6 +759,8 @@
 //==============================================================================
 -(void) setPlanePoint1:(Point3)newPlanePoint
 {
+	[self noteWillChange];
+	
 	self->planePoint1 = newPlanePoint;
 	
 	if(dragHandles)
@@ -772,6 +778,8 @@
 //==============================================================================
 -(void) setPlanePoint2:(Point3)newPlanePoint
 {
+	[self noteWillChange];
+	
 	self->planePoint2 = newPlanePoint;
 	
 	if(dragHandles)
@@ -789,6 +797,8 @@
 //==============================================================================
 -(void) setPlanePoint3:(Point3)newPlanePoint
 {
+	[self noteWillChange];
+	
 	self->planePoint3 = newPlanePoint;
 	
 	if(dragHandles)
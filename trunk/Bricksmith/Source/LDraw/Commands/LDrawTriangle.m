@@ -26,7 +26,9 @@
 #import "LDrawColor.h"
 #import "LDrawDragHandle.h"
 #import "LDrawStep.h"
+#import "LDrawTokenizer.h"
 #import "LDrawUtilities.h"
+#import "LDrawWriter.h"
 #include "GLMatrixMath.h"
 
 
@@ -36,6 +38,18 @@
 #pragma mark INITIALIZATION
 #pragma mark -
 
+//---------- parsesConcurrently --------------------------------------[static]--
+//
+// Purpose:		Triangles parse from nothing but their own text.
+//
+//------------------------------------------------------------------------------
++ (BOOL) parsesConcurrently
+{
+	return YES;
+	
+}//end parsesConcurrently
+
+
 //========== initWithLines:inRange:parentGroup: ================================
 //
 // Purpose:		Returns a triangle initialized from line of LDraw code beginning 
@@ -50,8 +64,11 @@
 			 inRange:(NSRange)range
 		 parentGroup:(dispatch_group_t)parentGroup
 {
-	NSString    *workingLine    = [lines objectAtIndex:range.location];
-	NSString    *parsedField    = nil;
+	const char  *lineBytes      = NULL;
+	NSUInteger  lineLength      = 0;
+	const char  *fieldBegin     = NULL;
+	const char  *fieldEnd       = NULL;
+	struct LDrawTokenizer tokenizer;
 	Point3      workingVertex   = ZeroPoint3;
 	LDrawColor  *parsedColor    = nil;
 	
@@ -61,55 +78,49 @@
 	// raise an exception. We don't want this to happen here.
 	@try
 	{
+		lineBytes = [LDrawUtilities bytesForLineAtIndex:range.location
+												inLines:lines
+												 length:&lineLength
+											   encoding:NULL];
+		LDrawTokenizerInit(&tokenizer, lineBytes, lineBytes + lineLength);
+		
 		//Read in the line code and advance past it.
-		parsedField = [LDrawUtilities readNextField:  workingLine
-										  remainder: &workingLine ];
 		//Only attempt to create the part if this is a valid line.
-		if([parsedField integerValue] == 3)
+		if(LDrawTokenizerNextInt(&tokenizer) == 3)
 		{
 			//Read in the color code.
 			// (color)
-			parsedField = [LDrawUtilities readNextField:  workingLine
-											  remainder: &workingLine ];
-			parsedColor = [LDrawUtilities parseColorFromField:parsedField];
+			LDrawTokenizerNextField(&tokenizer, &fieldBegin, &fieldEnd);
+			parsedColor = [LDrawUtilities parseColorFromFieldBytes:fieldBegin end:fieldEnd];
 			[self setLDrawColor:parsedColor];
 			
 			//Read Vertex 1.
 			// (x1)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.x = [parsedField floatValue];
+			workingVertex.x = LDrawTokenizerNextFloat(&tokenizer);
 			// (y1)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.y = [parsedField floatValue];
+			workingVertex.y = LDrawTokenizerNextFloat(&tokenizer);
 			// (z1)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.z = [parsedField floatValue];
+			workingVertex.z = LDrawTokenizerNextFloat(&tokenizer);
 			
 			[self setVertex1:workingVertex];
 				
 			//Read Vertex 2.
 			// (x2)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.x = [parsedField floatValue];
+			workingVertex.x = LDrawTokenizerNextFloat(&tokenizer);
 			// (y2)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.y = [parsedField floatValue];
+			workingVertex.y = LDrawTokenizerNextFloat(&tokenizer);
 			// (z2)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.z = [parsedField floatValue];
+			workingVertex.z = LDrawTokenizerNextFloat(&tokenizer);
 			
 			[self setVertex2:workingVertex];
 			
 			//Read Vertex 3.
 			// (x3)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.x = [parsedField floatValue];
+			workingVertex.x = LDrawTokenizerNextFloat(&tokenizer);
 			// (y3)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.y = [parsedField floatValue];
+			workingVertex.y = LDrawTokenizerNextFloat(&tokenizer);
 			// (z3)
-			parsedField = [LDrawUtilities readNextField:workingLine  remainder: &workingLine ];
-			workingVertex.z = [parsedField floatValue];
+			workingVertex.z = LDrawTokenizerNextFloat(&tokenizer);
 			
 			[self setVertex3:workingVertex];
 		}
@@ -440,26 +451,45 @@
 //==============================================================================
 - (NSString *) write
 {
-	return [NSString stringWithFormat:
-				@"3 %@ %@ %@ %@ %@ %@ %@ %@ %@ %@",
-				[LDrawUtilities outputStringForColor:self->color],
-				
-				[LDrawUtilities outputStringForFloat:vertex1.x],
-				[LDrawUtilities outputStringForFloat:vertex1.y],
-				[LDrawUtilities outputStringForFloat:vertex1.z],
-				
-				[LDrawUtilities outputStringForFloat:vertex2.x],
-				[LDrawUtilities outputStringForFloat:vertex2.y],
-				[LDrawUtilities outputStringForFloat:vertex2.z],
-				
-				[LDrawUtilities outputStringForFloat:vertex3.x],
-				[LDrawUtilities outputStringForFloat:vertex3.y],
-				[LDrawUtilities outputStringForFloat:vertex3.z]
-		
-			];
+	return [LDrawWriter stringByWritingDirective:self];
+	
 }//end write
 
 
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends the line to the stream; see -write for the format.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
+	[stream appendBytes:"3 " length:2];
+	[stream appendColor:self->color];
+	
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex1.x];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex1.y];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex1.z];
+	
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex2.x];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex2.y];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex2.z];
+	
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex3.x];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex3.y];
+	[stream appendBytes:" " length:1];
+	[stream appendFloat:vertex3.z];
+	
+}//end writeToStream:
+
+
 //========== writeElementToVertexBuffer:withColor:wireframe: ===================
 //
 // Purpose:		Writes this object into the specified vertex buffer, which is a 
@@ -643,6 +673,18 @@
 }//end vertex3
 
 
+//========== normal ============================================================
+//
+// Purpose:		The surface normal; not necessarily unit length.
+//
+//==============================================================================
+- (Vector3) normal
+{
+	return self->normal;
+	
+}//end normal
+
+
 #pragma mark -
 
 //========== setSelected: ======================================================
@@ -686,6 +728,8 @@
 //==============================================================================
 -(void) setVertex1:(Point3)newVertex
 {
+	[self noteWillChange];
+	
 	self->vertex1 = newVertex;
 	[self recomputeNormal];
 	[self invalCache:(CacheFlagBounds|DisplayList)];
@@ -705,6 +749,8 @@
 //==============================================================================
 -(void) setVertex2:(Point3)newVertex
 {
+	[self noteWillChange];
+	
 	self->vertex2 = newVertex;
 	[self recomputeNormal];
 	[self invalCache:(CacheFlagBounds|DisplayList)];
@@ -724,6 +770,8 @@
 //==============================================================================
 -(void) setVertex3:(Point3)newVertex
 {
+	[self noteWillChange];
+	
 	self->vertex3 = newVertex;
 	[self recomputeNormal];
 	[self invalCache:(CacheFlagBounds|DisplayList)];
@@ -736,6 +784,23 @@
 }//end setVertex3:
 
 
+//========== setNormal: ========================================================
+//
+// Purpose:		Overrides the normal computed from the vertices. Only useful
+//				for restoring a triangle whose normal was transformed along with it
+//				(mirroring flips the winding, but not a transformed normal).
+//
+//==============================================================================
+-(void) setNormal:(Vector3)newNormal
+{
+	[self noteWillChange];
+	
+	self->normal = newNormal;
+	[self invalCache:DisplayList];
+	
+}//end setNormal:
+
+
 #pragma mark -
 #pragma mark ACTIONS
 #pragma mark -
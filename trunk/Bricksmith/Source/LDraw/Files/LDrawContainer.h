@@ -15,6 +15,38 @@
 
 @class PartReport;
 
+// Copies - THEORY OF OPERATION
+//
+// Copying a container used to copy every directive beneath it up front.  Now
+// a copy starts out sharing its source's children: it holds the source (its
+// sharedSource) and has no children of its own, and the source lists it among
+// its sharingCopies.
+//
+// Drawing, writing, bounds and the like only read the children, so they go
+// through -readOnlySubdirectives, which hands back the source's array while the
+// copy is still sharing it.  The copy clones its children only when it is
+// about to change - an insert or remove - or when -subdirectives hands them out
+// to someone who might edit them.  Each clone is one level: the children it
+// makes are themselves sharing copies, so editing one part of a copied file
+// clones only the path down to it.
+//
+// The children can't literally live in two trees - each has one parent and
+// reports to its observers - so the source must hand its copies their own
+// children before it changes.  Anything about to change a directive calls
+// -noteWillChange, which walks from the root of the file down to the
+// directive and unshares every copy made of a container along the way.
+// Display state (step display, the selection) is not covered; it isn't part
+// of what a copy is for.
+//
+// A copy of a copy that hasn't been unshared yet shares the original instead,
+// so there are never chains of copies to walk.  The bookkeeping takes a lock;
+// while nothing is shared, -noteWillChange costs one test of a counter.
+//
+// So copying stays O(1), -copyWithZone: overrides must not touch the copy's
+// subdirectives (or their own).  State that refers to a child, like a file's
+// active model, is kept as an index and resolved in
+// -didCopySharedSubdirectives once the copy has children.
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Class:		LDrawContainer
@@ -27,15 +59,20 @@
 	
 	@private
 	NSMutableArray		*containedObjects;
+	LDrawContainer		*sharedSource;		// set while a copy still shares its source's children
+	CFMutableArrayRef	sharingCopies;		// copies still sharing our children; not retained
+	BOOL				isUnsharing;
 }
 
 //Accessors
++ (BOOL) hasSharedCopies;
 - (NSArray *) allEnclosedElements;
 - (Box3) projectedBoundingBoxWithModelView:(Matrix4)modelView
 								projection:(Matrix4)projection
 									  view:(Box2)viewport;
 - (NSInteger) indexOfDirective:(LDrawDirective *)directive;
 - (NSMutableArray *) subdirectives;
+- (NSArray *) readOnlySubdirectives;
 
 - (void) setPostsNotifications:(BOOL)flag;
 - (void) setSubdirectiveSelected:(BOOL)flag;
@@ -47,6 +84,10 @@
 - (void) insertDirective:(LDrawDirective *)directive atIndex:(NSInteger)index;
 - (void) removeDirective:(LDrawDirective *)doomedDirective;
 - (void) removeDirectiveAtIndex:(NSInteger)index;
+- (void) unshareCopies;
+
+//For subclasses
+- (void) didCopySharedSubdirectives;
 
 - (BOOL) acceptsDroppedDirective:(LDrawDirective *)directive;
 
@@ -12,15 +12,55 @@
 //==============================================================================
 #import "LDrawContainer.h"
 
+#import <libkern/OSAtomic.h>
+#import <pthread.h>
+
 #import "LDrawUtilities.h"
 #import "PartReport.h"
 
+// Guards every container's sharedSource and sharingCopies. Recursive, since 
+// unsharing a copy copies children, which registers their copies in turn.
+static pthread_mutex_t	SharingMutex;
+
+// Copies anywhere that still share their source's children. Changed under 
+// SharingMutex, but read without it (by parser threads, among others), so 
+// it is only touched atomically.
+static volatile int32_t	SharedCopyCount	= 0;
+
+
+@interface LDrawContainer ()
+
+- (void) copySharedSubdirectives;
+
+@end
+
+
 @implementation LDrawContainer
 
 #pragma mark -
 #pragma mark INITIALIZATION
 #pragma mark -
 
+//---------- initialize ----------------------------------------------[static]--
+//
+// Purpose:		Sets up the lock for copy sharing.
+//
+//------------------------------------------------------------------------------
++ (void) initialize
+{
+	pthread_mutexattr_t	attributes;
+	
+	if(self == [LDrawContainer class])
+	{
+		pthread_mutexattr_init(&attributes);
+		pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&SharingMutex, &attributes);
+		pthread_mutexattr_destroy(&attributes);
+	}
+	
+}//end initialize
+
+
 //========== init ==============================================================
 //
 // Purpose:		Creates a new container with absolutely nothing in it, but 
@@ -71,32 +111,38 @@
 {
 	[super encodeWithCoder:encoder];
 	
-	[encoder encodeObject:containedObjects forKey:@"containedObjects"];
+	[encoder encodeObject:[self readOnlySubdirectives] forKey:@"containedObjects"];
 
 }//end encodeWithCoder:
 
 
 //========== copyWithZone: =====================================================
 //
-// Purpose:		Returns a duplicate of this object. Each contained directive is 
-//				copied, so the returned object is a complete duplicate of the 
-//				receiver.
+// Purpose:		Returns a duplicate of this object. The copy shares our 
+//				children until one of us needs them to itself; see the theory 
+//				in LDrawContainer.h.
 //
 //==============================================================================
 - (id) copyWithZone:(NSZone *)zone
 {
 	LDrawContainer  *copiedContainer    = (LDrawContainer *)[super copyWithZone:zone];
-	id              currentObject       = nil;
-	id              copiedObject        = nil;
-	NSInteger       counter             = 0;
+	LDrawContainer  *source             = self;
 	
-	// Copy each subdirective and transfer it into the copied container.
-	for(currentObject in self->containedObjects)
+	pthread_mutex_lock(&SharingMutex);
 	{
-		copiedObject = [currentObject copy];
-		[copiedContainer insertDirective:copiedObject atIndex:counter];
-		[copiedObject release];
+		// If we haven't got our own children yet, neither will the copy; 
+		// share the ones we're sharing.
+		if(self->sharedSource != nil)
+			source = self->sharedSource;
+		
+		if(source->sharingCopies == NULL)
+			source->sharingCopies = CFArrayCreateMutable(NULL, 0, NULL);
+		CFArrayAppendValue(source->sharingCopies, copiedContainer);
+		
+		copiedContainer->sharedSource = [source retain];
+		OSAtomicIncrement32Barrier(&SharedCopyCount);
 	}
+	pthread_mutex_unlock(&SharingMutex);
 	
 	return copiedContainer;
 	
@@ -107,6 +153,19 @@
 #pragma mark ACCESSORS
 #pragma mark -
 
+//---------- hasSharedCopies -----------------------------------------[static]--
+//
+// Purpose:		Returns whether any container copy is still sharing its 
+//				source's children. 
+//
+//------------------------------------------------------------------------------
++ (BOOL) hasSharedCopies
+{
+	return OSAtomicAdd32Barrier(0, &SharedCopyCount) > 0;
+	
+}//end hasSharedCopies
+
+
 //========== allEnclosedElements ===============================================
 //
 // Purpose:		Returns all of the terminal (leaf-node) subdirectives contained 
@@ -119,7 +178,7 @@
 	NSMutableArray  *subelements        = [NSMutableArray array];
 	id              currentDirective    = nil;
 	
-	for(currentDirective in self->containedObjects)
+	for(currentDirective in [self subdirectives])
 	{
 		if([currentDirective respondsToSelector:@selector(allEnclosedElements)])
 			[subelements addObjectsFromArray:[currentDirective allEnclosedElements]];
@@ -166,12 +225,13 @@
 	Box3        bounds              = InvalidBox;
 	Box3        partBounds          = InvalidBox;
 	id          currentDirective    = nil;
-	NSInteger   numberOfDirectives  = [self->containedObjects count];
+	NSArray     *directives         = [self readOnlySubdirectives];
+	NSInteger   numberOfDirectives  = [directives count];
 	NSInteger   counter             = 0;
 	
 	for(counter = 0; counter < numberOfDirectives; counter++)
 	{
-		currentDirective = [self->containedObjects objectAtIndex:counter];
+		currentDirective = [directives objectAtIndex:counter];
 		if([currentDirective respondsToSelector:@selector(projectedBoundingBoxWithModelView:projection:view:)])
 		{
 			partBounds  = [currentDirective projectedBoundingBoxWithModelView:modelView
@@ -193,7 +253,7 @@
 //==============================================================================
 - (NSInteger) indexOfDirective:(LDrawDirective *)directive
 {
-	return [containedObjects indexOfObjectIdenticalTo:directive];
+	return [[self subdirectives] indexOfObjectIdenticalTo:directive];
 	
 }//end indexOfDirective:
 
@@ -202,14 +262,63 @@
 //
 // Purpose:		Returns the LDraw directives stored in this collection.
 //
+// Notes:		Everything that edits the collection, or hands its directives 
+//				to someone who might, goes through here, so a subclass can fill 
+//				it in on first use (see LDrawMPDModel), and so a copy gets its 
+//				own children before anyone can change them. Code which only 
+//				looks should use -readOnlySubdirectives, which doesn't clone a 
+//				copy. Only notification plumbing and teardown use the array 
+//				directly, since they must not force either.
+//
 //==============================================================================
 - (NSMutableArray *) subdirectives
 {
+	if(self->sharedSource != nil)
+		[self copySharedSubdirectives];
+	
 	return containedObjects;
 	
 }//end subdirectives
 
 
+//========== readOnlySubdirectives =============================================
+//
+// Purpose:		Returns the directives in this collection for code which only 
+//				looks at them: drawing, writing, bounds. 
+//
+// Notes:		While we are a copy still sharing our source's children, these 
+//				are the source's children, so reading a copy doesn't clone it. 
+//				Nothing in the array may be changed, and the objects belong to 
+//				the source - anything that wants to edit a child, or hand it to 
+//				someone who might, must use -subdirectives instead. 
+//
+//==============================================================================
+- (NSArray *) readOnlySubdirectives
+{
+	LDrawContainer  *source     = nil;
+	NSArray         *directives = nil;
+	
+	if(self->sharedSource == nil)
+		return [self subdirectives];
+	
+	pthread_mutex_lock(&SharingMutex);
+	{
+		source = [self->sharedSource retain];
+	}
+	pthread_mutex_unlock(&SharingMutex);
+	
+	// We may have been unshared since the test above.
+	if(source == nil)
+		return [self subdirectives];
+	
+	directives = [source readOnlySubdirectives];
+	[source autorelease];
+	
+	return directives;
+	
+}//end readOnlySubdirectives
+
+
 #pragma mark -
 
 //========== setPostsNotifications: ============================================
@@ -249,7 +358,7 @@
 //==============================================================================
 - (void) addDirective:(LDrawDirective *)directive
 {
-	NSInteger index = [containedObjects count];
+	NSInteger index = [[self subdirectives] count];
 	[self insertDirective:directive atIndex:index];
 	
 }//end addDirective:
@@ -263,12 +372,13 @@
 //==============================================================================
 - (void) collectPartReport:(PartReport *)report
 {
+	NSArray     *directives         = [self readOnlySubdirectives];
 	id          currentDirective    = nil;
 	NSInteger   counter             = 0;
 	
-	for(counter = 0; counter < [containedObjects count]; counter++)
+	for(counter = 0; counter < [directives count]; counter++)
 	{
-		currentDirective = [containedObjects objectAtIndex:counter];
+		currentDirective = [directives objectAtIndex:counter];
 		
 		if([currentDirective respondsToSelector:@selector(collectPartReport:)])
 			[currentDirective collectPartReport:report];
@@ -285,12 +395,13 @@
 //==============================================================================
 - (void) applyToAllParts:(LDrawPartVisitor) visitor
 {
+	NSArray     *directives         = [self subdirectives];
 	id          currentDirective    = nil;
 	NSInteger   counter             = 0;
 	
-	for(counter = 0; counter < [containedObjects count]; counter++)
+	for(counter = 0; counter < [directives count]; counter++)
 	{
-		currentDirective = [containedObjects objectAtIndex:counter];
+		currentDirective = [directives objectAtIndex:counter];
 		
 		if([currentDirective respondsToSelector:@selector(applyToAllParts:)])
 			[currentDirective applyToAllParts:visitor];
@@ -325,8 +436,11 @@
 //==============================================================================
 - (void) insertDirective:(LDrawDirective *)directive atIndex:(NSInteger)index
 {
+	if(self->isUnsharing == NO)
+		[self noteWillChange];
+	
 	// Insert
-	[containedObjects insertObject:directive atIndex:index];
+	[[self subdirectives] insertObject:directive atIndex:index];
 	[directive setEnclosingDirective:self];
 	
 	// Apply notification policy to new children
@@ -358,7 +472,13 @@
 //==============================================================================
 - (void) removeDirectiveAtIndex:(NSInteger)index
 {
-	LDrawDirective *doomedDirective = [self->containedObjects objectAtIndex:index];
+	NSMutableArray *directives      = nil;
+	LDrawDirective *doomedDirective = nil;
+	
+	[self noteWillChange];
+	
+	directives      = [self subdirectives];
+	doomedDirective = [directives objectAtIndex:index];
 	
 	if([doomedDirective enclosingDirective] == self)
 		[doomedDirective setEnclosingDirective:nil]; //no parent anymore; it's an orphan now.
@@ -367,7 +487,7 @@
 	// case we'll puke.
 	[doomedDirective removeObserver:self];
 	
-	[containedObjects removeObjectAtIndex:index]; //or disowned at least.
+	[directives removeObjectAtIndex:index]; //or disowned at least.
 	
 	if(self->postsNotifications == YES)
 	{
@@ -389,10 +509,113 @@
 }
 
 
+//========== unshareCopies =====================================================
+//
+// Purpose:		Gives every copy still sharing our children its own, because 
+//				we're about to change. 
+//
+// Notes:		Call -noteWillChange instead; it does this for every container 
+//				that encloses the change too.
+//
+//==============================================================================
+- (void) unshareCopies
+{
+	if(self->sharingCopies == NULL)
+		return;
+	
+	pthread_mutex_lock(&SharingMutex);
+	{
+		// Each copy takes itself off the list as it's unshared.
+		while(CFArrayGetCount(self->sharingCopies) > 0)
+		{
+			[(LDrawContainer *)CFArrayGetValueAtIndex(self->sharingCopies, 0) copySharedSubdirectives];
+		}
+	}
+	pthread_mutex_unlock(&SharingMutex);
+	
+}//end unshareCopies
+
+
 #pragma mark -
 #pragma mark UTILITES
 #pragma mark -
 
+//========== copySharedSubdirectives ===========================================
+//
+// Purpose:		Gives a copy which is still sharing its source's children 
+//				copies of its own.
+//
+// Notes:		Child containers are copied lazily too, so this clones just one 
+//				level of the tree.
+//
+//				The copy is taken off the source's list before its children are 
+//				copied, so only one thread ever does this. If the source were 
+//				being edited on another thread at the same time, the copy could 
+//				see half the edit - but that was true of copying the whole tree 
+//				up front, too.
+//
+//==============================================================================
+- (void) copySharedSubdirectives
+{
+	LDrawContainer  *source         = nil;
+	LDrawDirective  *currentObject  = nil;
+	LDrawDirective  *copiedObject   = nil;
+	NSInteger       counter         = 0;
+	CFIndex         index           = 0;
+	
+	pthread_mutex_lock(&SharingMutex);
+	{
+		source = self->sharedSource;
+		if(source != nil)
+		{
+			index = CFArrayGetFirstIndexOfValue(source->sharingCopies,
+												CFRangeMake(0, CFArrayGetCount(source->sharingCopies)),
+												self);
+			CFArrayRemoveValueAtIndex(source->sharingCopies, index);
+			
+			self->sharedSource = nil;
+			OSAtomicDecrement32Barrier(&SharedCopyCount);
+		}
+	}
+	pthread_mutex_unlock(&SharingMutex);
+	
+	if(source != nil)
+	{
+		// Filling in the children isn't a change anyone else needs to hear 
+		// about first.
+		self->isUnsharing = YES;
+		
+		for(currentObject in [source subdirectives])
+		{
+			copiedObject = [currentObject copy];
+			[self insertDirective:copiedObject atIndex:counter];
+			[copiedObject release];
+			counter++;
+		}
+		
+		self->isUnsharing = NO;
+		[source release];
+		
+		[self didCopySharedSubdirectives];
+	}
+	
+}//end copySharedSubdirectives
+
+
+//========== didCopySharedSubdirectives ========================================
+//
+// Purpose:		Called once a copy has been given children of its own. 
+//				Subclasses which remember something about their source's 
+//				children (by index) point it at their own here. 
+//
+//==============================================================================
+- (void) didCopySharedSubdirectives
+{
+	// stub
+	
+}//end didCopySharedSubdirectives
+
+
 //========== containsReferenceTo: ==============================================
 //
 // Purpose:		Returns if this object (or any of its children) references a 
@@ -401,7 +624,7 @@
 //==============================================================================
 - (BOOL) containsReferenceTo:(NSString *)name
 {
-	NSArray 		*subdirectives		= [self subdirectives];
+	NSArray 		*subdirectives		= [self readOnlySubdirectives];
 	LDrawDirective	*currentDirective	= 0;
 	BOOL			containsReference	= NO;
 	
@@ -442,7 +665,7 @@
 		  normalTransform:(Matrix3)normalTransform
 				recursive:(BOOL)recursive
 {
-	NSArray         *subdirectives      = [self subdirectives];
+	NSArray         *subdirectives      = [self readOnlySubdirectives];
 	LDrawDirective  *currentDirective   = 0;
 	
 	for(currentDirective in subdirectives)
@@ -471,6 +694,28 @@
 //==============================================================================
 - (void) dealloc
 {
+	CFIndex index = 0;
+	
+	// A copy nobody ever looked into just stops sharing.
+	if(self->sharedSource != nil)
+	{
+		pthread_mutex_lock(&SharingMutex);
+		{
+			index = CFArrayGetFirstIndexOfValue(self->sharedSource->sharingCopies,
+												CFRangeMake(0, CFArrayGetCount(self->sharedSource->sharingCopies)),
+												self);
+			CFArrayRemoveValueAtIndex(self->sharedSource->sharingCopies, index);
+			OSAtomicDecrement32Barrier(&SharedCopyCount);
+		}
+		pthread_mutex_unlock(&SharingMutex);
+		
+		[self->sharedSource release];
+	}
+	
+	// Copies retain their source, so none can be left sharing with us.
+	if(self->sharingCopies != NULL)
+		CFRelease(self->sharingCopies);
+	
 	for(id<LDrawObservable> i in self->containedObjects)
 		[i removeObserver:self];
 	//the children must not be allowed to remember us. Crashes could result otherwise.
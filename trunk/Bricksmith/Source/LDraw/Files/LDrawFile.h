@@ -30,13 +30,18 @@
 {
 	NSDictionary	*nameModelDict;
 	LDrawMPDModel	*activeModel;
+	NSInteger		activeModelIndex;	//in a copy, until it has models of its own.
+	BOOL			resolvesActiveModel;
 	NSString		*filePath;			//where this file came from on disk.
 }
 
 // Initialization
 + (LDrawFile *) file;
 + (LDrawFile *) fileFromContentsAtPath:(NSString *)path;
++ (LDrawFile *) fileFromContentsAtPath:(NSString *)path deferringSubmodels:(BOOL)deferSubmodels;
++ (LDrawFile *) fileFromData:(NSData *)data deferringSubmodels:(BOOL)deferSubmodels;
 + (LDrawFile *) parseFromFileContents:(NSString *) fileContents;
+- (id) initWithLines:(NSArray *)lines inRange:(NSRange)range deferringSubmodels:(BOOL)deferSubmodels;
 
 // Accessors
 - (LDrawMPDModel *) activeModel;
@@ -19,9 +19,12 @@
 #endif
 
 #import "MacLDraw.h"
+#import "LDrawMappedLines.h"
 #import "LDrawMPDModel.h"
+#import "LDrawParseScheduler.h"
 #import "LDrawPart.h"
 #import "LDrawUtilities.h"
+#import "LDrawWriter.h"
 #import "PartReport.h"
 #import "StringCategory.h"
 #import "LDrawLSynthDirective.h"
@@ -57,21 +60,69 @@
 //
 // Purpose:		Reads a file from the specified path. 
 //
+// Notes:		The file is mapped rather than decoded into one big string; 
+//				see LDrawMappedLines. 
+//
+//------------------------------------------------------------------------------
++ (LDrawFile *) fileFromContentsAtPath:(NSString *)path
+{
+	return [self fileFromContentsAtPath:path deferringSubmodels:NO];
+	
+}//end fileFromContentsAtPath:
+
+
+//---------- fileFromContentsAtPath:deferringSubmodels: --------------[static]--
+//
+// Purpose:		Reads a file from the specified path. If deferSubmodels is YES, 
+//				the steps of each submodel are not parsed until something 
+//				looks inside it; see initDeferredWithLines:inRange: in 
+//				LDrawMPDModel. 
+//
 //------------------------------------------------------------------------------
 + (LDrawFile *) fileFromContentsAtPath:(NSString *)path
+					deferringSubmodels:(BOOL)deferSubmodels
 {
-	NSString	*fileContents	= [LDrawUtilities stringFromFile:path];
-	LDrawFile	*parsedFile		= nil;
+	LDrawMappedLines	*lines		= [LDrawMappedLines linesWithContentsOfFile:path];
+	LDrawFile			*parsedFile	= nil;
 	
-	if(fileContents != nil)
+	if(lines != nil)
 	{
-		parsedFile = [LDrawFile parseFromFileContents:fileContents];
+		parsedFile = [[LDrawFile alloc] initWithLines:lines
+											  inRange:NSMakeRange(0, [lines count])
+								   deferringSubmodels:deferSubmodels ];
 		[parsedFile setPath:path];
+		[parsedFile autorelease];
 	}
 		
 	return parsedFile;
 	
-}//end fileFromContentsAtPath:
+}//end fileFromContentsAtPath:deferringSubmodels:
+
+
+//---------- fileFromData:deferringSubmodels: ------------------------[static]--
+//
+// Purpose:		Reads a file out of data which has already been loaded, such as 
+//				the data NSDocument hands us when opening a file. 
+//
+//------------------------------------------------------------------------------
++ (LDrawFile *) fileFromData:(NSData *)data
+		  deferringSubmodels:(BOOL)deferSubmodels
+{
+	LDrawMappedLines	*lines		= [[LDrawMappedLines alloc] initWithData:data];
+	LDrawFile			*parsedFile	= nil;
+	
+	if(lines != nil)
+	{
+		parsedFile = [[LDrawFile alloc] initWithLines:lines
+											  inRange:NSMakeRange(0, [lines count])
+								   deferringSubmodels:deferSubmodels ];
+		[parsedFile autorelease];
+		[lines release];
+	}
+	
+	return parsedFile;
+	
+}//end fileFromData:deferringSubmodels:
 
 
 //---------- parseFromFileContents: ----------------------------------[static]--
@@ -147,21 +198,16 @@
 {
 	NSRange         modelRange      = range;
 	NSUInteger      modelStartIndex = range.location;
+	LDrawParseTask  *tasks          = NULL;
 	id              *submodels      = NULL;
-	NSUInteger      insertIndex     = 0;
+	NSUInteger      modelCount      = 0;
+	NSUInteger      counter         = 0;
 	
 	self = [super initWithLines:lines inRange:range parentGroup:parentGroup];
 	if(self)
 	{
-		submodels = calloc(range.length, sizeof(LDrawDirective*));
-		dispatch_group_t    dispatchGroup = NULL;
-#if USE_BLOCKS		
-		dispatch_queue_t    queue           = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);	
-							dispatchGroup   = dispatch_group_create();
-
-		if(parentGroup != NULL)
-			dispatch_group_enter(parentGroup);
-#endif
+		tasks       = calloc(range.length + 1, sizeof(LDrawParseTask));
+		submodels   = calloc(range.length + 1, sizeof(LDrawDirective*));
 														
 		// Search through all the lines in the file, and separate them out into 
 		// submodels.
@@ -170,60 +216,98 @@
 			modelRange  = [LDrawMPDModel rangeOfDirectiveBeginningAtIndex:modelStartIndex
 																  inLines:lines
 																 maxIndex:NSMaxRange(range) - 1];
-			// Parse
-#if USE_BLOCKS			
-			dispatch_group_async(dispatchGroup, queue,
-			^{
-#endif			
-				LDrawMPDModel *newModel    = [[LDrawMPDModel alloc] initWithLines:lines inRange:modelRange parentGroup:dispatchGroup];
-				
-				// Store non-retaining, but *thread-safe* container 
-				// (NSMutableArray is NOT). Since it doesn't retain, we mustn't 
-				// autorelease newDirective. 
-				submodels[insertIndex] = newModel;
-#if USE_BLOCKS
-			});
-#endif			
+			tasks[modelCount].directiveClass    = [LDrawMPDModel class];
+			tasks[modelCount].range             = modelRange;
 			
 			modelStartIndex = NSMaxRange(modelRange);
-			insertIndex     += 1;
+			modelCount      += 1;
 		}
 		while(modelStartIndex < NSMaxRange(range));
 
-#if USE_BLOCKS		
-		dispatch_group_notify(dispatchGroup,queue,
-		^{
-#endif		
-				NSUInteger      counter         = 0;
-				LDrawMPDModel   *currentModel   = nil;
-		
+		// Parse
+		@try
+		{
+			[LDrawParseScheduler parseTasks:tasks
+									  count:modelCount
+									inLines:lines
+								parentGroup:parentGroup
+							 intoDirectives:submodels];
+			
 			// Add all the models in order
-			for(counter = 0; counter < insertIndex; counter++)
+			for(counter = 0; counter < modelCount; counter++)
 			{
-				currentModel = submodels[counter];
-				
-				[self addSubmodel:currentModel];
-				[currentModel release];
+				[self addSubmodel:submodels[counter]];
+				[submodels[counter] release];
 			}
-			
-			if([[self submodels] count] > 0)
-				[self setActiveModel:[[self submodels] objectAtIndex:0]];
-
+		}
+		@finally
+		{
 			free(submodels);
+			free(tasks);
+		}
+		
+		if([[self submodels] count] > 0)
+			[self setActiveModel:[[self submodels] objectAtIndex:0]];
+	}
+	
+	return self;
 
-#if USE_BLOCKS			
-			if(parentGroup != NULL)
-				dispatch_group_leave(parentGroup);
-			
-		});
-		dispatch_release(dispatchGroup);
-#endif		
+}//end initWithLines:inRange:
+
+
+//========== initWithLines:inRange:deferringSubmodels: =========================
+//
+// Purpose:		Parses the MPD models out of the lines. If deferSubmodels is 
+//				YES, only the names and headers of the models are read now; 
+//				each one parses its steps the first time its contents are 
+//				asked for. 
+//
+// Notes:		Documents open this way, so a big file shows its active model 
+//				without waiting on the rest. Anything that walks every part in 
+//				the file will end up parsing all of it anyway, just later; the 
+//				missing-parts check avoids that by asking unparsed models for 
+//				their part names (see PartReport). 
+//
+//==============================================================================
+- (id) initWithLines:(NSArray *)lines
+			 inRange:(NSRange)range
+  deferringSubmodels:(BOOL)deferSubmodels
+{
+	NSRange         modelRange      = range;
+	NSUInteger      modelStartIndex = range.location;
+	LDrawMPDModel   *newModel       = nil;
+	
+	if(deferSubmodels == NO)
+	{
+		return [self initWithLines:lines inRange:range];
 	}
 	
+	self = [super initWithLines:lines inRange:range parentGroup:NULL];
+	if(self)
+	{
+		// Finding where each model starts and ends is just a scan for 0 FILE 
+		// lines; there is nothing worth handing to other threads. 
+		do
+		{
+			modelRange  = [LDrawMPDModel rangeOfDirectiveBeginningAtIndex:modelStartIndex
+																  inLines:lines
+																 maxIndex:NSMaxRange(range) - 1];
+			newModel    = [[LDrawMPDModel alloc] initDeferredWithLines:lines inRange:modelRange];
+			
+			[self addSubmodel:newModel];
+			[newModel release];
+			
+			modelStartIndex = NSMaxRange(modelRange);
+		}
+		while(modelStartIndex < NSMaxRange(range));
+		
+		if([[self submodels] count] > 0)
+			[self setActiveModel:[[self submodels] objectAtIndex:0]];
+	}
 	
 	return self;
 
-}//end initWithLines:inRange:
+}//end initWithLines:inRange:deferringSubmodels:
 
 
 //========== initWithCoder: ====================================================
@@ -257,16 +341,41 @@
 - (id) copyWithZone:(NSZone *)zone
 {
 	LDrawFile   *copiedFile         = (LDrawFile *)[super copyWithZone:zone];
-	NSInteger   indexOfActiveModel  = [self indexOfDirective:self->activeModel];
-	id          copiedActiveModel   = [[copiedFile subdirectives] objectAtIndex:indexOfActiveModel];
 	
-	[copiedFile setActiveModel:copiedActiveModel];
+	// The copy is still sharing our models, so it can't point at its own 
+	// active model yet. It remembers which one it will be instead. (If we are 
+	// a copy still waiting to do that ourselves, pass it on; finding the index 
+	// would clone our models.) 
+	if(self->resolvesActiveModel)
+		copiedFile->activeModelIndex = self->activeModelIndex;
+	else
+		copiedFile->activeModelIndex = [self indexOfDirective:self->activeModel];
+	copiedFile->resolvesActiveModel = YES;
 	
 	return copiedFile;
 	
 }//end copyWithZone:
 
 
+//========== didCopySharedSubdirectives ========================================
+//
+// Purpose:		A copy has models of its own now; make the one its source had 
+//				active the active one. 
+//
+//==============================================================================
+- (void) didCopySharedSubdirectives
+{
+	if(self->resolvesActiveModel)
+	{
+		self->resolvesActiveModel = NO;
+		
+		if(self->activeModelIndex != NSNotFound)
+			[self setActiveModel:[[self subdirectives] objectAtIndex:self->activeModelIndex]];
+	}
+	
+}//end didCopySharedSubdirectives
+
+
 #pragma mark -
 #pragma mark DIRECTIVES
 #pragma mark -
@@ -294,7 +403,7 @@
 	// Draw!
 	//	(only the active model.)
 	//
-	[activeModel draw:optionsMask viewScale:scaleFactor parentColor:parentColor];
+	[[self activeModel] draw:optionsMask viewScale:scaleFactor parentColor:parentColor];
 
 }//end draw:viewScale:parentColor:
 
@@ -307,7 +416,7 @@
 //================================================================================
 - (void) drawSelf:(id<LDrawRenderer>)renderer
 {
-	[activeModel drawSelf:renderer];
+	[[self activeModel] drawSelf:renderer];
 }//end drawSelf:
 
 
@@ -327,7 +436,7 @@
 - (void) collectSelf:(id<LDrawCollector>)renderer
 {
 	assert(!"Why are we here?");
-	[activeModel collectSelf:renderer];
+	[[self activeModel] collectSelf:renderer];
 }//end collectSelf:
 
 
@@ -339,7 +448,7 @@
 //==============================================================================
 - (void) debugDrawboundingBox
 {
-	[activeModel debugDrawboundingBox];
+	[[self activeModel] debugDrawboundingBox];
 }//end debugDrawboundingBox
 
 
@@ -355,7 +464,7 @@
 	creditObject:(id)creditObject
 			hits:(NSMutableDictionary *)hits
 {
-	[activeModel hitTest:pickRay transform:transform viewScale:scaleFactor boundsOnly:boundsOnly creditObject:creditObject hits:hits];
+	[[self activeModel] hitTest:pickRay transform:transform viewScale:scaleFactor boundsOnly:boundsOnly creditObject:creditObject hits:hits];
 }//end hitTest:transform:viewScale:boundsOnly:creditObject:hits:
 
 
@@ -370,7 +479,7 @@
 	   creditObject:(id)creditObject 
 	           hits:(NSMutableSet *)hits
 {
-	return [activeModel boxTest:bounds transform:transform boundsOnly:boundsOnly creditObject:creditObject hits:hits];
+	return [[self activeModel] boxTest:bounds transform:transform boundsOnly:boundsOnly creditObject:creditObject hits:hits];
 }//end boxTest:transform:boundsOnly:creditObject:hits:
 
 
@@ -388,7 +497,7 @@
 		   bestObject:(id *)bestObject 
 			bestDepth:(float *)bestDepth
 {
-	[activeModel depthTest:pt inBox:bounds transform:transform creditObject:creditObject bestObject:bestObject bestDepth:bestDepth];
+	[[self activeModel] depthTest:pt inBox:bounds transform:transform creditObject:creditObject bestObject:bestObject bestDepth:bestDepth];
 }//end depthTest:inBox:transform:creditObject:bestObject:bestDepth:
 
 
@@ -399,10 +508,23 @@
 //==============================================================================
 - (NSString *) write
 {
-	NSMutableString *written        = [NSMutableString string];
-	NSString        *CRLF           = [NSString CRLF];
+	return [LDrawWriter stringByWritingDirective:self];
+	
+}//end write
+
+
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends all the submodels to the stream.
+//
+// Notes:		Trailing whitespace is trimmed off the end of the stream, so 
+//				the file should be the last thing written to it.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
 	LDrawMPDModel   *currentModel   = nil;
-	NSArray         *modelsInFile   = [self subdirectives];
+	NSArray         *modelsInFile   = [self readOnlySubdirectives];
 	NSInteger       numberModels    = [modelsInFile count];
 	NSInteger       counter         = 0;
 	
@@ -412,22 +534,22 @@
 	{
 		currentModel = [modelsInFile objectAtIndex:0];
 		//Write out the model, without MPD wrappers.
-		[written appendString:[currentModel writeModel]];
+		[currentModel writeModelToStream:stream];
 	}
 	else
 	{
 		//Write out each MPD submodel, one after another.
 		for(counter = 0; counter < numberModels; counter++){
 			currentModel = [modelsInFile objectAtIndex:counter];
-			[written appendString:[currentModel write]];
-			[written appendString:CRLF];
+			[currentModel writeToStream:stream];
+			[stream appendCRLF];
 		}
 	}
 	
 	//Trim off any final newline characters.
-	return [written stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+	[stream trimTrailingWhitespace];
 	
-}//end write
+}//end writeToStream:
 
 
 #pragma mark -
@@ -444,6 +566,10 @@
 //==============================================================================
 - (LDrawMPDModel *) activeModel
 {
+	// A fresh copy finds out once it has models of its own.
+	if(self->resolvesActiveModel)
+		[self subdirectives];
+	
 	return activeModel;
 	
 }//end activeModel
@@ -509,7 +635,11 @@
 - (LDrawMPDModel *) modelWithName:(NSString *)soughtName
 {
 	NSString		*referenceName	= [soughtName lowercaseString]; // we standardized on lower-case names for searching.
-	LDrawMPDModel	*foundModel 	= [self->nameModelDict objectForKey:referenceName];
+	LDrawMPDModel	*foundModel 	= nil;
+	
+	// A copy still sharing its source's models has no table yet.
+	[self subdirectives];
+	foundModel = [self->nameModelDict objectForKey:referenceName];
 	
 	return foundModel;
 	
@@ -644,7 +774,7 @@
 {
 	BOOL removedActiveModel = NO;
 	
-	if(doomedDirective == self->activeModel)
+	if(doomedDirective == [self activeModel])
 		removedActiveModel = YES;
 		
 	[super removeDirective:doomedDirective];
@@ -19,9 +19,15 @@
 	// it gets written out as 0 FILE modelName at the beginning.
 	NSString		*modelName;
 	
+	// Set when the steps haven't been parsed yet; see initDeferredWithLines.
+	NSArray			*deferredLines;
+	NSRange			deferredRange;
+	BOOL			isParsingDeferred;
+	
 }
 
 + (id) model;
+- (id) initDeferredWithLines:(NSArray *)lines inRange:(NSRange)range;
 
 // Directives
 - (NSString *) writeModel;
@@ -34,6 +40,9 @@
 
 // Utilities
 + (NSString *) ldrawCompliantNameForName:(NSString *)newDisplayName;
++ (NSRange) rangeOfModelContentsInLines:(NSArray *)lines inRange:(NSRange)range modelName:(NSString **)modelNamePtr;
+- (void) parseDeferredSteps;
+- (NSArray *) deferredPartNames;
 + (BOOL) lineIsMPDModelStart:(NSString*)line modelName:(NSString**)modelNamePtr;
 + (BOOL) lineIsMPDModelEnd:(NSString*)line;
 
@@ -24,9 +24,14 @@
 //==============================================================================
 #import "LDrawMPDModel.h"
 
+#import <libkern/OSAtomic.h>
+
 #import "LDrawFile.h"
 #import "LDrawKeywords.h"
+#import "LDrawSymbolTable.h"
+#import "LDrawTokenizer.h"
 #import "LDrawUtilities.h"
+#import "LDrawWriter.h"
 #import "StringCategory.h"
 
 
@@ -86,45 +91,17 @@
 			 inRange:(NSRange)range
 		 parentGroup:(dispatch_group_t)parentGroup
 {
-	NSString	*mpdFileCommand 	= [lines objectAtIndex:range.location];
-	NSString	*lastLine			= nil;
-	NSString	*mpdSubmodelName	= @"";
-	BOOL		isMPDModel			= NO;
-	BOOL		hasSubmodelEnd		= NO;
-	NSRange 	nonMPDRange 		= range;
-
-	// The first line should be 0 FILE modelName
-	isMPDModel = [[self class] lineIsMPDModelStart:mpdFileCommand modelName:&mpdSubmodelName];
-	
-	// Strip out the MPD commands for model parsing, and read in the model name.
-	if(isMPDModel == YES)
-	{
-		// Strip out the first line and the NOFILE command, if there is one.
-		lastLine = [lines objectAtIndex:NSMaxRange(range)-1];
-		
-		hasSubmodelEnd = [[self class] lineIsMPDModelEnd:lastLine];
-		if(hasSubmodelEnd)
-		{
-			// strip out 0 FILE and 0 NOFILE
-			nonMPDRange = NSMakeRange(range.location + 1, range.length - 2);
-		}
-		else
-		{
-			// strip out 0 FILE only
-			nonMPDRange = NSMakeRange(range.location + 1, range.length - 1);
-		}
-	}
-	else
-	{
-		nonMPDRange = range;
-	}
+	NSString	*mpdSubmodelName	= nil;
+	NSRange 	nonMPDRange 		= [[self class] rangeOfModelContentsInLines:lines
+																   inRange:range
+																 modelName:&mpdSubmodelName];
 
 	// Create a basic model.
 	[super initWithLines:lines inRange:nonMPDRange parentGroup:parentGroup]; //parses model into header and steps.
 	
 	// If it wasn't MPD, we still need a model name. We can get that via the 
 	// parsed model.
-	if(isMPDModel == NO)
+	if(mpdSubmodelName == nil)
 	{
 		mpdSubmodelName = [self modelDescription];
 	}
@@ -137,6 +114,45 @@
 }//end initWithLines:inRange:
 
 
+//========== initDeferredWithLines:inRange: ====================================
+//
+// Purpose:		Creates a submodel from the lines of a file, but only parses 
+//				its name and header. The steps are parsed the first time 
+//				anything asks for the model's contents. 
+//
+// Notes:		The lines are retained until then. If the model is written out 
+//				before it has ever been looked at, its original lines are 
+//				written back verbatim. 
+//
+//==============================================================================
+- (id) initDeferredWithLines:(NSArray *)lines
+					 inRange:(NSRange)range
+{
+	NSString	*mpdSubmodelName	= nil;
+	NSRange 	nonMPDRange 		= [[self class] rangeOfModelContentsInLines:lines
+																   inRange:range
+																 modelName:&mpdSubmodelName];
+	NSUInteger	contentStartIndex	= 0;
+	
+	self = [self init];
+	
+	contentStartIndex	= [self parseHeaderFromLines:lines beginningAtIndex:nonMPDRange.location];
+	contentStartIndex	= MIN(contentStartIndex, NSMaxRange(nonMPDRange));
+	
+	deferredLines		= [lines retain];
+	deferredRange		= NSMakeRange(contentStartIndex, NSMaxRange(nonMPDRange) - contentStartIndex);
+	
+	if(mpdSubmodelName == nil)
+	{
+		mpdSubmodelName = [self modelDescription];
+	}
+	[self setModelName:mpdSubmodelName];
+	
+	return self;
+
+}//end initDeferredWithLines:inRange:
+
+
 //========== initWithCoder: ====================================================
 //
 // Purpose:		Reads a representation of this object from the given coder,
@@ -198,9 +214,7 @@
 									 inLines:(NSArray *)lines
 									maxIndex:(NSUInteger)maxIndex
 {
-	NSString    *firstLine      = nil;
 	BOOL        isMPDModel      = NO;
-	NSString    *currentLine    = nil;
 	NSRange     testRange       = NSMakeRange(index, maxIndex - index + 1);
 	NSRange     modelRange      = testRange;
 	NSUInteger	counter			= 0;
@@ -209,8 +223,7 @@
 	if(testRange.length > 1)
 	{
 		// See if we have to look for MPD syntax.
-		firstLine = [lines objectAtIndex:testRange.location];
-		isMPDModel = [[self class] lineIsMPDModelStart:firstLine modelName:NULL];
+		isMPDModel = [LDrawUtilities lineAtIndex:testRange.location inLines:lines isMetaCommand:LDRAW_MPD_SUBMODEL_START];
 		
 		// Find the end of the MPD model. MPD models can end with 0 NOFILE, or 
 		// they can just stop where the next model starts. 
@@ -220,16 +233,16 @@
 			// otherwise. 
 			modelEndIndex = NSMaxRange(testRange) - 1;
 		
+			// Compare bytes; almost no lines are delimiters, so don't pay 
+			// for a string per line just to find that out. 
 			for(counter = testRange.location + 1; counter < NSMaxRange(testRange); counter++)
 			{
-				currentLine = [lines objectAtIndex:counter];
-				
-				if([[self class] lineIsMPDModelEnd:currentLine])
+				if([LDrawUtilities lineAtIndex:counter inLines:lines isMetaCommand:LDRAW_MPD_SUBMODEL_END])
 				{
 					modelEndIndex = counter;
 					break;
 				}
-				else if([[self class] lineIsMPDModelStart:currentLine modelName:NULL])
+				else if([LDrawUtilities lineAtIndex:counter inLines:lines isMetaCommand:LDRAW_MPD_SUBMODEL_START])
 				{
 					modelEndIndex = counter - 1;
 					break;
@@ -260,24 +273,38 @@
 //==============================================================================
 - (NSString *) write
 {
-	NSString *CRLF = [NSString CRLF]; //we need a DOS line-end marker, because 
-									  //LDraw is predominantly DOS-based.
-	
-	NSMutableString *written = [NSMutableString string];
+	return [LDrawWriter stringByWritingDirective:self];
 	
+}//end write
+
+
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends the submodel to the stream, wrapped in the MPD file 
+//				commands.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
 	//Write it out as:
 	//		0 FILE model_name
 	//			....
 	//		   model text
 	//			....
 	//		0 NOFILE
-	[written appendFormat:@"0 %@ %@%@", LDRAW_MPD_SUBMODEL_START, [self modelName], CRLF];
-	[written appendFormat:@"%@%@", [super write], CRLF];
-	[written appendFormat:@"0 %@", LDRAW_MPD_SUBMODEL_END];
+	[stream appendBytes:"0 " length:2];
+	[stream appendString:LDRAW_MPD_SUBMODEL_START];
+	[stream appendBytes:" " length:1];
+	[stream appendString:[self modelName]];
+	[stream appendCRLF];
 	
-	return written;
+	[self writeModelToStream:stream];
+	[stream appendCRLF];
 	
-}//end write
+	[stream appendBytes:"0 " length:2];
+	[stream appendString:LDRAW_MPD_SUBMODEL_END];
+	
+}//end writeToStream:
 
 
 //========== writeModel =============================================================
@@ -292,6 +319,45 @@
 }//end writeModel
 
 
+//========== writeModelToStream: ===============================================
+//
+// Purpose:		Appends the header and steps of the model, without the MPD 
+//				file commands.
+//
+// Notes:		A submodel nobody has opened yet still has the lines it was 
+//				read from, and those are exactly what it would write, give or 
+//				take formatting. Copying them saves materializing it just to 
+//				save the file.
+//
+//==============================================================================
+- (void) writeModelToStream:(LDrawWriter *)stream
+{
+	NSUInteger	counter	= 0;
+	BOOL		copied	= NO;
+	
+	@synchronized(self)
+	{
+		if(deferredLines != nil && deferredRange.length > 0)
+		{
+			[self writeHeaderToStream:stream];
+			
+			for(counter = deferredRange.location; counter < NSMaxRange(deferredRange); counter++)
+			{
+				[stream appendCRLF];
+				[stream appendString:[deferredLines objectAtIndex:counter]];
+			}
+			copied = YES;
+		}
+	}
+	
+	if(copied == NO)
+	{
+		[super writeModelToStream:stream];
+	}
+	
+}//end writeModelToStream:
+
+
 #pragma mark -
 #pragma mark DISPLAY
 #pragma mark -
@@ -331,6 +397,21 @@
 #pragma mark ACCESSORS
 #pragma mark -
 
+//========== subdirectives =====================================================
+//
+// Purpose:		Returns the steps of the model, parsing them first if the model 
+//				was created deferred.
+//
+//==============================================================================
+- (NSMutableArray *) subdirectives
+{
+	[self parseDeferredSteps];
+	
+	return [super subdirectives];
+	
+}//end subdirectives
+
+
 //========== browsingDescription ===============================================
 //
 // Purpose:		Returns a representation of the directive as a short string 
@@ -367,6 +448,8 @@
 //==============================================================================
 - (void) setModelName:(NSString *)newModelName
 {
+	[self noteWillChange];
+	
 	[newModelName retain];
 	[modelName release];
 	
@@ -494,6 +577,181 @@
 }
 
 
+//---------- rangeOfModelContentsInLines:inRange:modelName: ----------[static]--
+//
+// Purpose:		Returns the part of range holding the model itself, stripped of 
+//				its 0 FILE and 0 NOFILE lines. 
+//
+//				If the lines start with 0 FILE, the name given there is 
+//				returned in modelNamePtr; otherwise it is set to nil. 
+//
+//------------------------------------------------------------------------------
++ (NSRange) rangeOfModelContentsInLines:(NSArray *)lines
+								inRange:(NSRange)range
+							  modelName:(NSString **)modelNamePtr
+{
+	NSString	*mpdFileCommand 	= [lines objectAtIndex:range.location];
+	NSString	*lastLine			= nil;
+	NSString	*mpdSubmodelName	= nil;
+	BOOL		isMPDModel			= NO;
+	BOOL		hasSubmodelEnd		= NO;
+	NSRange 	nonMPDRange 		= range;
+
+	// The first line should be 0 FILE modelName
+	isMPDModel = [self lineIsMPDModelStart:mpdFileCommand modelName:&mpdSubmodelName];
+	
+	// Strip out the MPD commands for model parsing, and read in the model name.
+	if(isMPDModel == YES)
+	{
+		// Strip out the first line and the NOFILE command, if there is one.
+		lastLine = [lines objectAtIndex:NSMaxRange(range)-1];
+		
+		hasSubmodelEnd = [self lineIsMPDModelEnd:lastLine];
+		if(hasSubmodelEnd)
+		{
+			// strip out 0 FILE and 0 NOFILE
+			nonMPDRange = NSMakeRange(range.location + 1, range.length - 2);
+		}
+		else
+		{
+			// strip out 0 FILE only
+			nonMPDRange = NSMakeRange(range.location + 1, range.length - 1);
+		}
+	}
+	else
+	{
+		mpdSubmodelName = nil;
+		nonMPDRange		= range;
+	}
+	
+	*modelNamePtr = mpdSubmodelName;
+	
+	return nonMPDRange;
+
+}//end rangeOfModelContentsInLines:inRange:modelName:
+
+
+//========== parseDeferredSteps ================================================
+//
+// Purpose:		Parses the steps of a deferred model, if that hasn't happened 
+//				yet. 
+//
+// Notes:		Parsing adds the steps through the ordinary container calls, 
+//				which come right back here; the isParsingDeferred flag lets 
+//				them through. Notifications are held back while it happens, 
+//				since as far as the outside world is concerned the model 
+//				hasn't changed. 
+//
+//==============================================================================
+- (void) parseDeferredSteps
+{
+	BOOL	oldPostsNotifications	= NO;
+	
+	if(deferredLines == nil)
+	{
+		// Pairs with the barrier before the store: seeing nil must also mean 
+		// seeing the steps. 
+		OSMemoryBarrier();
+		return;
+	}
+	
+	@synchronized(self)
+	{
+		if(deferredLines != nil && isParsingDeferred == NO)
+		{
+			isParsingDeferred		= YES;
+			oldPostsNotifications	= [self postsNotifications];
+			[self setPostsNotifications:NO];
+			
+			[super parseStepsFromLines:deferredLines inRange:deferredRange parentGroup:NULL];
+			
+			[self setPostsNotifications:oldPostsNotifications];
+			
+			// The steps must be in place before anyone can see deferredLines 
+			// go nil and skip the lock.
+			OSMemoryBarrier();
+			[deferredLines release];
+			deferredLines		= nil;
+			isParsingDeferred	= NO;
+		}
+	}
+	
+}//end parseDeferredSteps
+
+
+//========== deferredPartNames =================================================
+//
+// Purpose:		Returns the reference names of every part used in the steps of 
+//				a model which hasn't parsed them yet, or nil if the steps have 
+//				already been parsed. 
+//
+// Notes:		This is just a scan of the type 1 lines; it lets someone who 
+//				only cares which parts are used - the missing-parts check - 
+//				leave the model unparsed. 
+//
+//==============================================================================
+- (NSArray *) deferredPartNames
+{
+	LDrawSymbolTable		*symbolTable	= [LDrawSymbolTable sharedSymbolTable];
+	NSMutableArray			*partNames		= nil;
+	NSString				*partName		= nil;
+	NSString				*referenceName	= nil;
+	const char				*lineBytes		= NULL;
+	NSUInteger				lineLength		= 0;
+	NSStringEncoding		lineEncoding	= NSUTF8StringEncoding;
+	const char				*fieldBegin 	= NULL;
+	const char				*fieldEnd		= NULL;
+	struct LDrawTokenizer	tokenizer;
+	NSUInteger				counter 		= 0;
+	NSUInteger				fieldCounter	= 0;
+	
+	@synchronized(self)
+	{
+		if(deferredLines != nil && isParsingDeferred == NO)
+		{
+			partNames = [NSMutableArray array];
+			
+			for(counter = deferredRange.location; counter < NSMaxRange(deferredRange); counter++)
+			{
+				lineBytes = [LDrawUtilities bytesForLineAtIndex:counter
+														inLines:deferredLines
+														 length:&lineLength
+													   encoding:&lineEncoding];
+				LDrawTokenizerInit(&tokenizer, lineBytes, lineBytes + lineLength);
+				
+				if(LDrawTokenizerNextInt(&tokenizer) != 1)
+					continue;
+				
+				// Skip the color, position, and matrix; the name is the rest 
+				// of the line, just as LDrawPart reads it. 
+				for(fieldCounter = 0; fieldCounter < 13; fieldCounter++)
+					LDrawTokenizerNextField(&tokenizer, &fieldBegin, &fieldEnd);
+				
+				LDrawTokenizerRemainder(&tokenizer, &fieldBegin, &fieldEnd);
+				if(fieldEnd > fieldBegin)
+				{
+					partName = [[NSString alloc] initWithBytes:fieldBegin
+														length:fieldEnd - fieldBegin
+													  encoding:lineEncoding];
+					if(partName != nil)
+					{
+						[symbolTable symbolForPartName:partName
+										   displayName:NULL
+										 referenceName:&referenceName];
+						if(referenceName != nil)
+							[partNames addObject:referenceName];
+						[partName release];
+					}
+				}
+			}
+		}
+	}
+	
+	return partNames;
+	
+}//end deferredPartNames
+
+
 //========== registerUndoActions ===============================================
 //
 // Purpose:		Registers the undo actions that are unique to this subclass, 
@@ -534,7 +792,8 @@
 //==============================================================================
 - (void) dealloc
 {
-	[modelName	release];
+	[modelName		release];
+	[deferredLines	release];
 
 	[super dealloc];
 	
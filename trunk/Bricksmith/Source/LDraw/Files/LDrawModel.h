@@ -12,6 +12,7 @@
 #import "LDrawContainer.h"
 @class ColorLibrary;
 @class LDrawFile;
+@class LDrawPrimitiveBlock;
 @class LDrawStep;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -46,6 +47,10 @@
 //Initialization
 + (id) model;
 
+//Directives
+- (void) writeModelToStream:(LDrawWriter *)stream;
+- (void) writeHeaderToStream:(LDrawWriter *)stream;
+
 //Accessors
 - (NSString *) category;
 - (ColorLibrary *) colorLibrary;
@@ -78,7 +83,17 @@
 - (NSUInteger) maxStepIndexToOutput;
 - (NSUInteger) numberElements;
 - (void) optimizeStructure;
+- (void) optimizeStructureWithLines:(NSArray *)lines
+						  triangles:(NSArray *)triangles
+					 quadrilaterals:(NSArray *)quadrilaterals
+							  other:(NSArray *)everythingElse;
+- (void) optimizeStructureWithPrimitiveBlock:(LDrawPrimitiveBlock *)block
+									   other:(NSArray *)everythingElse;
 - (NSUInteger) parseHeaderFromLines:(NSArray *)lines beginningAtIndex:(NSUInteger)index;
+- (void) parseStepsFromLines:(NSArray *)lines inRange:(NSRange)range parentGroup:(dispatch_group_t)parentGroup;
 - (BOOL) line:(NSString *)line isValidForHeader:(NSString *)headerKey info:(NSString**)infoPtr;
+- (BOOL) hasDisplayList;
+- (void) discardDisplayList;
+- (NSUInteger) estimatedMemoryUsage;
 
 @end
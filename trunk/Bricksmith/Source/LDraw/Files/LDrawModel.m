@@ -16,6 +16,7 @@
 //==============================================================================
 #import "LDrawModel.h"
 
+#import <objc/runtime.h>
 #import <string.h>
 
 #import "ColorLibrary.h"
@@ -24,11 +25,14 @@
 #import "LDrawFile.h"
 #import "LDrawKeywords.h"
 #import "LDrawLine.h"
+#import "LDrawParseScheduler.h"
 #import "LDrawQuadrilateral.h"
 #import "LDrawStep.h"
 #import "LDrawPart.h"
+#import "LDrawPrimitiveBlock.h"
 #import "LDrawTriangle.h"
 #import "LDrawUtilities.h"
+#import "LDrawWriter.h"
 #import "StringCategory.h"
 #import "LDrawLSynthDirective.h"
 
@@ -42,6 +46,9 @@
 
 #define NO_CULL_SMALL_BRICKS 0
 
+// What a display list costs per vertex: XYZ, normal and RGBA floats.
+#define DL_BYTES_PER_VERTEX		(10 * sizeof(GLfloat))
+
 @implementation LDrawModel
 
 
@@ -118,77 +125,19 @@
 		 parentGroup:(dispatch_group_t)parentGroup
 {
 	NSUInteger		contentStartIndex	= 0;
-	NSRange			stepRange			= range;
-	NSUInteger		maxLineIndex		= 0;
-	NSUInteger      insertIndex			= 0;
-	id *			substeps			= NULL;
 	
 	//Start with a nice blank model.
 	self = [super initWithLines:lines inRange:range parentGroup:parentGroup];
 	self->cachedBounds = InvalidBox;
 
-	substeps = calloc(range.length, sizeof(LDrawDirective*));
-	
 	//Try and get the header out of the file. If it's there, the lines returned 
 	// will not contain it.
 	contentStartIndex   = [self parseHeaderFromLines:lines beginningAtIndex:range.location];
-	maxLineIndex        = NSMaxRange(range) - 1;
-
-	dispatch_group_t	modelDispatchGroup = NULL;
-#if USE_BLOCKS
-	modelDispatchGroup = dispatch_group_create();
-	dispatch_queue_t	queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-	if(parentGroup != NULL)
-		dispatch_group_enter(parentGroup);
-#endif
-	// Parse out steps. Each time we run into a new 0 STEP command, we finish 
-	// the current step. 
-	do
-	{
-		stepRange   = [LDrawStep rangeOfDirectiveBeginningAtIndex:contentStartIndex inLines:lines maxIndex:maxLineIndex];
-#if USE_BLOCKS
-		dispatch_group_async(modelDispatchGroup,queue,
-		^{
-#endif
-			LDrawStep * newStep     = [[LDrawStep alloc] initWithLines:lines inRange:stepRange parentGroup:modelDispatchGroup];
-			substeps[insertIndex] = newStep;
-#if USE_BLOCKS
-		});
-#endif
-		++insertIndex;
-
-		contentStartIndex = NSMaxRange(stepRange);
-		
-	}
-	while(contentStartIndex < NSMaxRange(range));
-		
-#if USE_BLOCKS
-	dispatch_group_notify(modelDispatchGroup,queue,
-	^{
-#endif
-		NSUInteger      counter				= 0;
-		for(counter = 0; counter < insertIndex; counter++)
-		{
-			LDrawStep * step = substeps[counter];
-			
-			[self addStep:step];
-			[step release];
-		}
-
-		free(substeps);
-			
-		// Degenerate case: utterly empty file. Create one empty step, because it is 
-		// illegal to have a 0-step model in Bricksmith. 
-		if([[self steps] count] == 0)
-		{
-			[self addStep];
-		}
-#if USE_BLOCKS
-		if(parentGroup != NULL)
-			dispatch_group_leave(parentGroup);
-	});
-	dispatch_release(modelDispatchGroup);	
-#endif	
+	
+	[self parseStepsFromLines:lines
+					  inRange:NSMakeRange(contentStartIndex, NSMaxRange(range) - contentStartIndex)
+				  parentGroup:parentGroup];
+	
 	return self;
 	
 }//end initWithLines:inRange:
@@ -248,8 +197,11 @@
 	[copied setFileName:[self fileName]];
 	[copied setAuthor:[self author]];
 	
-	[copied setStepDisplay:[self stepDisplay]];
-	[copied setMaximumStepIndexForStepDisplay:[self maximumStepIndexForStepDisplay]];
+	// Not through the setters: the step index is checked against the steps, 
+	// and asking for those would make the copy clone them right away. 
+	[copied invalCache:CacheFlagBounds|DisplayList];
+	copied->stepDisplayActive		= self->stepDisplayActive;
+	copied->currentStepDisplayed	= self->currentStepDisplayed;
 	
 	//I don't think we care about the cached bounds.
 	
@@ -271,7 +223,7 @@
 - (void) draw:(NSUInteger)optionsMask viewScale:(float)scaleFactor parentColor:(LDrawColor *)parentColor
 
 {
-	NSArray     *steps              = [self subdirectives];
+	NSArray     *steps              = [self readOnlySubdirectives];
 	NSUInteger  maxIndex            = [self maxStepIndexToOutput];
 	LDrawStep   *currentDirective   = nil;
 	NSUInteger  counter             = 0;
@@ -322,12 +274,10 @@
 
 	if(cull_result == cull_skip)
 		return;
-		
-	if(cull_result == cull_box)
-	{
-		[renderer drawBoxFrom:minxyz to:maxxyz];
-		return;
-	}
+
+	#else
+
+	cull_result = cull_draw;
 
 	#endif
 
@@ -345,19 +295,29 @@
 	} else
 		[self revalCache:DisplayList];
 		
+	// A tiny model gets a box, rather than paying for a smoothed mesh nobody 
+	// can see.  The one exception is a library part that already has a DL: 
+	// only those are built with LODs, and the coarse LOD stands in instead, 
+	// which doesn't pop as the part shrinks.
+	if(cull_result == cull_box && (!isOptimized || !dl))
+	{
+		[renderer drawBoxFrom:minxyz to:maxxyz];
+		return;
+	}
+
 	// Now: if we do not have a DL (no DL or we threw it out because it
 	// was invalid) build one now: get a collector and call "collect" on
 	// ourselves, which will walk our tree picking up primitives.
 	if(!dl)
 	{
-		id<LDrawCollector> collector = [renderer beginDL];
+		id<LDrawCollector> collector = isOptimized ? [renderer beginLibraryPartDL] : [renderer beginDL];
 		[self collectSelf:collector];
 		[renderer endDL:&dl cleanupFunc:&dl_dtor];
 	}
 	
 	// Finally: if we have a DL (cached or brand new, draw it!!)
 	if(dl)
-		[renderer drawDL:dl];	
+		[renderer drawDL:dl cull:cull_result];	
 
 	if (!isOptimized)
 	{
@@ -369,7 +329,7 @@
 		// Library parts are guaranteed to be only steps of primitives,
 		// so there is no need for this.
 		
-		NSArray     *steps              = [self subdirectives];
+		NSArray     *steps              = [self readOnlySubdirectives];
 		NSUInteger  maxIndex            = [self maxStepIndexToOutput];
 		LDrawStep   *currentDirective   = nil;
 		NSUInteger  counter             = 0;
@@ -429,7 +389,7 @@
 //================================================================================
 - (void) collectSelf:(id<LDrawCollector>)renderer
 {
-	NSArray     *steps              = [self subdirectives];
+	NSArray     *steps              = [self readOnlySubdirectives];
 	NSUInteger  maxIndex            = [self maxStepIndexToOutput];
 	LDrawStep   *currentDirective   = nil;
 	NSUInteger  counter             = 0;
@@ -451,7 +411,7 @@
 //==============================================================================
 - (void) debugDrawboundingBox
 {
-	NSArray     *steps              = [self subdirectives];
+	NSArray     *steps              = [self readOnlySubdirectives];
 	NSUInteger  maxIndex            = [self maxStepIndexToOutput];
 	LDrawStep   *currentDirective   = nil;
 	NSUInteger  counter             = 0;
@@ -568,41 +528,88 @@
 //==============================================================================
 - (NSString *) write
 {
-	NSString        *CRLF           = [NSString CRLF]; //we need a DOS line-end marker, because 
-														//LDraw is predominantly DOS-based.
-	NSMutableString *written        = [NSMutableString string];
-	NSArray         *steps          = [self subdirectives];
+	LDrawWriter	*writer		= [[LDrawWriter alloc] init];
+	NSString	*written	= nil;
+	
+	[self writeModelToStream:writer];
+	written = [writer string];
+	[writer release];
+	
+	return written;
+
+}//end write
+
+
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends the model to the stream.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
+	[self writeModelToStream:stream];
+	
+}//end writeToStream:
+
+
+//========== writeModelToStream: ===============================================
+//
+// Purpose:		Appends the header and steps of the model, without any MPD 
+//				wrapper, to the stream. There is no line ending after the last 
+//				line.
+//
+// Notes:		Subclasses which wrap the model in something else override 
+//				-writeToStream:, never this.
+//
+//==============================================================================
+- (void) writeModelToStream:(LDrawWriter *)stream
+{
+	NSArray         *steps          = [self readOnlySubdirectives];
 	NSUInteger      numberSteps     = [steps count];
 	LDrawStep       *currentStep    = nil;
-	NSString        *stepOutput     = nil;
 	NSUInteger      counter         = 0;
 	
-	//Write out the file header in all of its irritating glory.
-	[written appendFormat:@"0 %@%@", [self modelDescription], CRLF];
-	[written appendFormat:@"0 %@ %@%@", LDRAW_HEADER_NAME, [self fileName], CRLF];
-	[written appendFormat:@"0 %@ %@%@", LDRAW_HEADER_AUTHOR, [self author], CRLF];		
+	[self writeHeaderToStream:stream];
 	
 	//Write out all the steps in the file.
 	for(counter = 0; counter < numberSteps; counter++)
 	{
 		currentStep = [steps objectAtIndex:counter];
+		[stream appendCRLF];
 		
 		// Omit the 0 STEP command for 1-step models, which probably aren't 
 		// being built with steps in mind anyway. 
-		if(numberSteps == 1)
-			stepOutput = [currentStep writeWithStepCommand:NO];
-		else
-			stepOutput = [currentStep write];
-		
-		[written appendFormat:@"%@%@", stepOutput, CRLF];
+		[currentStep writeToStream:stream withStepCommand:(numberSteps > 1)];
 	}
+
+}//end writeModelToStream:
+
+
+//========== writeHeaderToStream: ==============================================
+//
+// Purpose:		Appends the three header lines (description, name, author) to 
+//				the stream, with no line ending after the last one.
+//
+//==============================================================================
+- (void) writeHeaderToStream:(LDrawWriter *)stream
+{
+	//Write out the file header in all of its irritating glory.
+	[stream appendBytes:"0 " length:2];
+	[stream appendString:[self modelDescription]];
+	[stream appendCRLF];
 	
-	//Now remove that last CRLF.
-	[written deleteCharactersInRange:NSMakeRange([written length] - [CRLF length], [CRLF length])];
+	[stream appendBytes:"0 " length:2];
+	[stream appendString:LDRAW_HEADER_NAME];
+	[stream appendBytes:" " length:1];
+	[stream appendString:[self fileName]];
+	[stream appendCRLF];
 	
-	return written;
+	[stream appendBytes:"0 " length:2];
+	[stream appendString:LDRAW_HEADER_AUTHOR];
+	[stream appendBytes:" " length:1];
+	[stream appendString:[self author]];
 
-}//end write
+}//end writeHeaderToStream:
 
 
 #pragma mark -
@@ -657,7 +664,7 @@
 	{
 		cachedBounds = InvalidBox;
 		
-		NSArray     *steps              = [self subdirectives];
+		NSArray     *steps              = [self readOnlySubdirectives];
 		NSUInteger  maxIndex            = [self maxStepIndexToOutput];
 		LDrawStep   *currentDirective   = nil;
 		NSUInteger  counter             = 0;
@@ -1060,6 +1067,8 @@
 //==============================================================================
 - (void) setModelDescription:(NSString *)newDescription
 {
+	[self noteWillChange];
+	
 	[newDescription retain];
 	[modelDescription release];
 	
@@ -1078,6 +1087,8 @@
 //==============================================================================
 - (void) setFileName:(NSString *)newName
 {
+	[self noteWillChange];
+	
 	[newName retain];
 	[fileName release];
 	
@@ -1093,6 +1104,8 @@
 //==============================================================================
 - (void) setAuthor:(NSString *)newAuthor
 {
+    [self noteWillChange];
+
     // LLW - Don't allow author to be set to nil, as this causes funky
     // behavior in the inspector
     if (newAuthor == nil)
@@ -1138,6 +1151,8 @@
 {
 	Point3 oldPoint = self->rotationCenter;
 	
+	[self noteWillChange];
+	
 	self->rotationCenter = newPoint;
 	
 	NSDictionary *info = [NSDictionary dictionaryWithObject:[NSValue valueWithBytes:&oldPoint objCType:@encode(Point3)] forKey:@"oldRotationCenter"];
@@ -1280,7 +1295,7 @@
 //==============================================================================
 - (NSUInteger) maxStepIndexToOutput
 {
-	NSArray     *steps  = [self subdirectives];
+	NSArray     *steps  = [self readOnlySubdirectives];
 	NSUInteger  maxStep = 0;
 	
 	// If step display is active, we want to display only as far as the 
@@ -1335,9 +1350,8 @@
 //				library.
 //
 //				To optimize, we flatten all the primitives referenced by a part 
-//				into a non-nested structure, then separate all the directives 
-//				out by the type: all triangles go in a step, all quadrilaterals 
-//				go in their own step, etc. 
+//				into a non-nested structure, then pack all the lines, triangles 
+//				and quadrilaterals into one LDrawPrimitiveBlock. 
 //
 //				Then when drawing, we need not call glBegin() each time. The 
 //				result is a speed increase of over 1000%. 
@@ -1347,21 +1361,11 @@
 //==============================================================================
 - (void) optimizeStructure
 {
-	NSArray         *steps              = [self subdirectives];
-	
 	NSMutableArray  *lines              = [NSMutableArray array];
 	NSMutableArray  *triangles          = [NSMutableArray array];
 	NSMutableArray  *quadrilaterals     = [NSMutableArray array];
 	NSMutableArray  *everythingElse     = [NSMutableArray array];
 	
-	LDrawStep       *linesStep          = [LDrawStep emptyStepWithFlavor:LDrawStepLines];
-	LDrawStep       *trianglesStep      = [LDrawStep emptyStepWithFlavor:LDrawStepTriangles];
-	LDrawStep       *quadrilateralsStep = [LDrawStep emptyStepWithFlavor:LDrawStepQuadrilaterals];
-	LDrawStep       *everythingElseStep = [LDrawStep emptyStepWithFlavor:LDrawStepAnyDirectives];
-	
-	NSUInteger      directiveCount      = 0;
-	NSInteger       counter             = 0;
-	
 	// Traverse the entire hiearchy of part references and sort out each 
 	// primitive type into a flat list. This allows staggering speed increases. 
 	//
@@ -1375,7 +1379,67 @@
 		  currentTransform:IdentityMatrix4
 		   normalTransform:IdentityMatrix3
 				 recursive:YES];
-		  
+	
+	[self optimizeStructureWithLines:lines
+						   triangles:triangles
+					  quadrilaterals:quadrilaterals
+							   other:everythingElse];
+		
+}//end optimizeStructure
+
+
+//========== optimizeStructureWithLines:triangles:quadrilaterals:other: ========
+//
+// Purpose:		Replaces the contents of the model with the given 
+//				already-flattened directives. This is the second half of 
+//				-optimizeStructure. 
+//
+// Notes:		The lines, triangles and quads are packed into a single 
+//				LDrawPrimitiveBlock in the first step; nobody edits a library 
+//				part, so they don't need to be objects. Everything else goes in 
+//				a second step as-is. 
+//
+//==============================================================================
+- (void) optimizeStructureWithLines:(NSArray *)lines
+						  triangles:(NSArray *)triangles
+					 quadrilaterals:(NSArray *)quadrilaterals
+							  other:(NSArray *)everythingElse
+{
+	LDrawPrimitiveBlock *block          = nil;
+	
+	if([lines count] + [triangles count] + [quadrilaterals count] > 0)
+	{
+		block = [[LDrawPrimitiveBlock alloc] initWithLines:lines
+												 triangles:triangles
+											quadrilaterals:quadrilaterals];
+	}
+	
+	[self optimizeStructureWithPrimitiveBlock:block other:everythingElse];
+	[block release];
+	
+}//end optimizeStructureWithLines:triangles:quadrilaterals:other:
+
+
+//========== optimizeStructureWithPrimitiveBlock:other: ========================
+//
+// Purpose:		Replaces the contents of the model with a block of flattened 
+//				primitives and a step of everything else. 
+//
+// Notes:		The part cache uses this to rebuild an optimized part straight 
+//				from its stored geometry, without ever flattening anything. 
+//
+//==============================================================================
+- (void) optimizeStructureWithPrimitiveBlock:(LDrawPrimitiveBlock *)block
+									   other:(NSArray *)everythingElse
+{
+	NSArray         *steps              = [self subdirectives];
+	
+	LDrawStep       *primitivesStep     = [LDrawStep emptyStepWithFlavor:LDrawStepAnyDirectives];
+	LDrawStep       *everythingElseStep = [LDrawStep emptyStepWithFlavor:LDrawStepAnyDirectives];
+	
+	NSUInteger      directiveCount      = 0;
+	NSInteger       counter             = 0;
+	
 	// Now that we have everything separated, remove the main step (it's the one 
 	// that has the entire model in it) and . 
 	directiveCount = [steps count];
@@ -1385,30 +1449,10 @@
 	}
 	
 	// Replace the original directives with the categorized steps we've created 
-	if([lines count] > 0)
+	if(block != nil)
 	{
-		for(id directive in lines)
-		{
-			[linesStep addDirective:directive];
-		}
-		[self addDirective:linesStep];
-	}
-
-	if([triangles count] > 0)
-	{
-		for(id directive in triangles)
-		{
-			[trianglesStep addDirective:directive];
-		}
-		[self addDirective:trianglesStep];
-	}
-	if([quadrilaterals count] > 0)
-	{
-		for(id directive in quadrilaterals)
-		{
-			[quadrilateralsStep addDirective:directive];
-		}
-		[self addDirective:quadrilateralsStep];
+		[primitivesStep addDirective:block];
+		[self addDirective:primitivesStep];
 	}
 	if([everythingElse count] > 0 || [[self subdirectives] count] == 0)
 	{								// Make sure there is at least one step in the model!
@@ -1421,7 +1465,7 @@
 
 	isOptimized = TRUE;
 		
-}//end optimizeStructure
+}//end optimizeStructureWithPrimitiveBlock:other:
 
 
 //========== parseHeaderFromLines:beginningAtIndex: ============================
@@ -1513,6 +1557,83 @@
 }//end parseHeaderFromLines
 
 
+//========== parseStepsFromLines:inRange:parentGroup: ==========================
+//
+// Purpose:		Parses the body of the model - everything after the header - 
+//				into steps, and adds them. 
+//
+//				A step may be ended by: 
+//					* a 0 STEP line
+//					* a 0 ROTSTEP line
+//					* the end of the file
+//
+//				A STEP or ROTSTEP command is part of the step they end, so they 
+//				are the last line IN the step. 
+//
+//				The final step marker is optional. Thus a file that has no step 
+//				markers still has one step. 
+//
+//==============================================================================
+- (void) parseStepsFromLines:(NSArray *)lines
+					 inRange:(NSRange)range
+				 parentGroup:(dispatch_group_t)parentGroup
+{
+	NSUInteger		contentStartIndex	= range.location;
+	NSRange			stepRange			= range;
+	NSUInteger		maxLineIndex		= NSMaxRange(range) - 1;
+	NSUInteger		stepCount			= 0;
+	NSUInteger		counter				= 0;
+	LDrawParseTask	*tasks				= calloc(range.length + 1, sizeof(LDrawParseTask));
+	id *			substeps			= calloc(range.length + 1, sizeof(LDrawDirective*));
+	
+	// Find the steps. Each time we run into a new 0 STEP command, we finish 
+	// the current step. 
+	do
+	{
+		stepRange   = [LDrawStep rangeOfDirectiveBeginningAtIndex:contentStartIndex inLines:lines maxIndex:maxLineIndex];
+		
+		tasks[stepCount].directiveClass	= [LDrawStep class];
+		tasks[stepCount].range			= stepRange;
+		++stepCount;
+
+		contentStartIndex = NSMaxRange(stepRange);
+		
+	}
+	while(contentStartIndex < NSMaxRange(range));
+	
+	// A failed parse leaves no steps behind, but these are still ours to free.
+	@try
+	{
+		[LDrawParseScheduler parseTasks:tasks
+								  count:stepCount
+								inLines:lines
+							parentGroup:parentGroup
+						 intoDirectives:substeps];
+		
+		for(counter = 0; counter < stepCount; counter++)
+		{
+			LDrawStep * step = substeps[counter];
+			
+			[self addStep:step];
+			[step release];
+		}
+	}
+	@finally
+	{
+		free(substeps);
+		free(tasks);
+	}
+		
+	// Degenerate case: utterly empty file. Create one empty step, because it is 
+	// illegal to have a 0-step model in Bricksmith. 
+	if([[self steps] count] == 0)
+	{
+		[self addStep];
+	}
+	
+}//end parseStepsFromLines:inRange:parentGroup:
+
+
 //========== line:isValidForHeader: ============================================
 //
 // Purpose:		Determines if the given line of LDraw is formatted to be the 
@@ -1572,6 +1693,88 @@
 	
 }//end registerUndoActions:
 
+//========== hasDisplayList ====================================================
+//
+// Purpose:		Returns whether the model is holding on to a display list.
+//
+//==============================================================================
+- (BOOL) hasDisplayList
+{
+	return dl != NULL;
+	
+}//end hasDisplayList
+
+
+//========== discardDisplayList ================================================
+//
+// Purpose:		Throws away the cached display list, if any. It will be rebuilt 
+//				the next time the model is drawn. 
+//
+// Notes:		The part library calls this when it evicts the model. If a draw 
+//				session still has the list queued, the list goes away when the 
+//				session is done with it. 
+//
+//==============================================================================
+- (void) discardDisplayList
+{
+	if(dl)
+	{
+		dl_dtor(dl);
+		dl_dtor = NULL;
+		dl = NULL;
+	}
+	
+}//end discardDisplayList
+
+
+//========== estimatedMemoryUsage ==============================================
+//
+// Purpose:		Returns roughly how many bytes the model is keeping alive: its 
+//				directives, its flattened geometry and its display list. 
+//
+// Notes:		This is only as deep as an optimized library part goes - the 
+//				model, its steps and their directives - and only the primitive 
+//				block's geometry is counted toward the display list. It's meant 
+//				for budgeting the part library, not for accounting. 
+//
+//==============================================================================
+- (NSUInteger) estimatedMemoryUsage
+{
+	LDrawPrimitiveBlock	*block			= nil;
+	NSUInteger			bytes			= class_getInstanceSize([self class]);
+	NSUInteger			vertexCount		= 0;
+	NSUInteger			type			= 0;
+	
+	for(LDrawStep *step in [self readOnlySubdirectives])
+	{
+		bytes += class_getInstanceSize([step class]);
+		
+		for(LDrawDirective *directive in [step subdirectives])
+		{
+			bytes += class_getInstanceSize([directive class]);
+			
+			if([directive isKindOfClass:[LDrawPrimitiveBlock class]])
+			{
+				block	= (LDrawPrimitiveBlock *)directive;
+				bytes	+= [[block storage] length];
+				
+				for(type = 0; type < LDrawPrimitiveTypeCount; type++)
+				{
+					vertexCount +=		[block countOfType:type]
+									*	[LDrawPrimitiveBlock verticesPerPrimitive:type];
+				}
+			}
+		}
+	}
+	
+	if(dl)
+		bytes += vertexCount * DL_BYTES_PER_VERTEX;
+	
+	return bytes;
+	
+}//end estimatedMemoryUsage
+
+
 #pragma mark -
 #pragma mark DESTRUCTOR
 #pragma mark -
@@ -75,6 +75,7 @@ typedef enum
 
 //Directives
 - (NSString *) writeWithStepCommand:(BOOL) flag;
+- (void) writeToStream:(LDrawWriter *)stream withStepCommand:(BOOL)flag;
 
 //Accessors
 - (LDrawModel *) enclosingModel;
@@ -34,8 +34,10 @@
 #import "LDrawKeywords.h"
 #import "LDrawModel.h"
 #import "LDrawMPDModel.h"
+#import "LDrawParseScheduler.h"
 #import "LDRawPart.h"
 #import "LDrawUtilities.h"
+#import "LDrawWriter.h"
 #import "StringCategory.h"
 #import "LDrawLSynthDirective.h"
 
@@ -109,46 +111,33 @@
 	NSString        *currentLine        = nil;
 	Class           CommandClass        = Nil;
 	NSRange         commandRange        = range;
-	id              *directives         = calloc(range.length, sizeof(LDrawDirective*));
+	LDrawParseTask  *tasks              = NULL;
+	id              *directives         = NULL;
 	NSUInteger      lineIndex           = 0;
-	NSUInteger      insertIndex         = 0;
+	NSUInteger      taskCount           = 0;
+	NSUInteger      counter             = 0;
 		
 	self = [super initWithLines:lines inRange:range parentGroup:parentGroup];
 	
 	cachedBounds = InvalidBox;
 	
-	dispatch_group_t    stepDispatchGroup   = NULL;
-#if USE_BLOCKS
-	dispatch_queue_t    queue               = NULL;	
-	
-	// Create a group for the multithreaded parsing of the step contents.
-	queue               = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);	
-	stepDispatchGroup   = dispatch_group_create();
-	
-	// Prevent the owning group from completing until the step is finished 
-	// asynchronously parsing its contents. 
-	if(parentGroup != NULL)
-	{
-		dispatch_group_enter(parentGroup);
-	}
-#endif	
-
 	// Parse out the STEP command
 	if(range.length > 0)
 	{
-		currentLine = [lines objectAtIndex:(NSMaxRange(range) - 1)];
+		lineIndex = NSMaxRange(range) - 1;
 		
 		// See if the line is a step delimiter. If the delimiter doesn't exist, 
 		// it's implied (such as in a 1-step model). Otherwise, it marks the end 
 		// of the step. 
-		if([[self class] lineIsStepTerminator:currentLine])
+		if([LDrawUtilities lineAtIndex:lineIndex inLines:lines isMetaCommand:LDRAW_STEP_TERMINATOR])
 		{
 			// Nothing more to parse. Stop.
 			range.length -= 1;
 		}
-		else if([[self class] lineIsRotationStepTerminator:currentLine])
+		else if([LDrawUtilities lineAtIndex:lineIndex inLines:lines isMetaCommand:LDRAW_ROTATION_STEP_TERMINATOR])
 		{
 			// Parse the rotation step.
+			currentLine = [lines objectAtIndex:lineIndex];
 			if([self parseRotationStepFromLine:currentLine] == NO)
 				@throw [NSException exceptionWithName:@"BricksmithParseException" reason:@"Bad rotstep syntax" userInfo:nil];
 			
@@ -156,73 +145,54 @@
 		}
 	}
 	
-	// Convert each non-step-delimiter line into a directive, and add it to this 
-	// step. 
-	lineIndex = range.location;
+	// Find each non-step-delimiter directive in the step.
+	tasks       = calloc(range.length + 1, sizeof(LDrawParseTask));
+	directives  = calloc(range.length + 1, sizeof(LDrawDirective*));
+	lineIndex   = range.location;
 	while(lineIndex < NSMaxRange(range))
 	{
-		currentLine = [lines objectAtIndex:lineIndex];
-		if([currentLine length] > 0)
+		// Empty lines have no class.
+		CommandClass = [LDrawUtilities classForDirectiveAtIndex:lineIndex inLines:lines];
+		if(CommandClass != Nil)
 		{
-			CommandClass = [LDrawUtilities classForDirectiveBeginningWithLine:currentLine];
 			commandRange = [CommandClass rangeOfDirectiveBeginningAtIndex:lineIndex
 																  inLines:lines
 																 maxIndex:NSMaxRange(range) - 1];
-#if USE_BLOCKS
-			// Parse (multithreaded)
-			dispatch_group_async(stepDispatchGroup, queue,
-			^{
-#endif
-				// Parse but disallow multithreading for subparsing. LDraw 
-				// objects be be deeply recursive, which means we would pile 
-				// up a lot of dispatch_group_wait calls, resulting in so 
-				// many threads we run out of stack space. 
-				LDrawDirective *newDirective = [[CommandClass alloc] initWithLines:lines inRange:commandRange parentGroup:stepDispatchGroup];
-				
-				// Store non-retaining, but *thread-safe* container 
-				// (NSMutableArray is NOT). Since it doesn't retain, we mustn't 
-				// autorelease newDirective. 
-				directives[insertIndex] = newDirective;
-#if USE_BLOCKS
-			});
-#endif
-			lineIndex     = NSMaxRange(commandRange);
-			insertIndex += 1;
+			tasks[taskCount].directiveClass = CommandClass;
+			tasks[taskCount].range          = commandRange;
+			
+			lineIndex   = NSMaxRange(commandRange);
+			taskCount   += 1;
 		}
 		else
 		{
 			lineIndex += 1;
 		}
-
 	}
 	
-#if USE_BLOCKS
-	dispatch_group_notify(stepDispatchGroup, queue,
-	^{
-#endif
-		NSUInteger      counter             = 0;
-		LDrawDirective  *currentDirective   = nil;
-
+	// Parse them, on as many threads as are worth it. If that raises, the 
+	// scheduler has already released whatever it parsed; the buffers are 
+	// still ours. 
+	@try
+	{
+		[LDrawParseScheduler parseTasks:tasks
+								  count:taskCount
+								inLines:lines
+							parentGroup:parentGroup
+						 intoDirectives:directives];
+		
 		// Add the accumulated directives *in order*
-		for(counter = 0; counter < insertIndex; counter++)
+		for(counter = 0; counter < taskCount; counter++)
 		{
-			currentDirective = directives[counter];
-			
-			[self addDirective:currentDirective];
-			[currentDirective release];
+			[self addDirective:directives[counter]];
+			[directives[counter] release];
 		}
+	}
+	@finally
+	{
 		free(directives);
-		
-#if USE_BLOCKS
-		// Now that the step is complete, we can release our lock on the 
-		// parent group and allow it to finish. 
-		if(parentGroup != NULL)
-		{
-			dispatch_group_leave(parentGroup);
-		}
-	});
-	dispatch_release(stepDispatchGroup);
-#endif
+		free(tasks);
+	}
 	
 	return self;
 	
@@ -301,7 +271,6 @@
 									 inLines:(NSArray *)lines
 									maxIndex:(NSUInteger)maxIndex
 {
-	NSString    *currentLine    = nil;
 	NSUInteger  counter         = 0;
 	NSRange     testRange       = NSMakeRange(index, maxIndex - index + 1);
 	NSInteger	stepLength		= 0;
@@ -313,14 +282,15 @@
 	// step. 
 	for(counter = testRange.location; counter < NSMaxRange(testRange); counter++)
 	{
-		currentLine = [lines objectAtIndex:counter];
 		stepLength++;
 		
 		// See if the line is a step delimiter. If the delimiter doesn't exist, 
 		// it's implied (such as in a 1-step model). Otherwise, it marks the end 
 		// of the step. 
-		if(		[[self class] lineIsStepTerminator:currentLine]
-		   ||	[[self class] lineIsRotationStepTerminator:currentLine] )
+		// (Checked on the raw line bytes; this runs over every line in the 
+		// file, and we don't want to make a string for each one.) 
+		if(		[LDrawUtilities lineAtIndex:counter inLines:lines isMetaCommand:LDRAW_STEP_TERMINATOR]
+		   ||	[LDrawUtilities lineAtIndex:counter inLines:lines isMetaCommand:LDRAW_ROTATION_STEP_TERMINATOR] )
 		{
 			// Nothing more to parse. Stop.
 			break;
@@ -350,7 +320,7 @@
 - (void) draw:(NSUInteger)optionsMask viewScale:(float)scaleFactor parentColor:(LDrawColor *)parentColor
 
 {
-	NSArray         *commandsInStep     = [self subdirectives];
+	NSArray         *commandsInStep     = [self readOnlySubdirectives];
 	LDrawDirective  *currentDirective   = nil;
 	
 	//Draw each element in the step.
@@ -374,7 +344,7 @@
 //================================================================================
 - (void) drawSelf:(id<LDrawRenderer>)renderer
 {
-	NSArray         *commandsInStep     = [self subdirectives];
+	NSArray         *commandsInStep     = [self readOnlySubdirectives];
 	LDrawDirective  *currentDirective   = nil;
 	
 	//Draw each element in the step.
@@ -397,7 +367,7 @@
 //================================================================================
 - (void) collectSelf:(id<LDrawCollector>)renderer
 {
-	NSArray         *commandsInStep     = [self subdirectives];
+	NSArray         *commandsInStep     = [self readOnlySubdirectives];
 	LDrawDirective  *currentDirective   = nil;
 	
 	//Draw each element in the step.
@@ -416,7 +386,7 @@
 //==============================================================================
 - (void) debugDrawboundingBox
 {
-	NSArray         *commandsInStep     = [self subdirectives];
+	NSArray         *commandsInStep     = [self readOnlySubdirectives];
 	LDrawDirective  *currentDirective   = nil;
 	
 	//Draw each element in the step.
@@ -535,6 +505,18 @@
 }//end write
 
 
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends the step's commands to the stream, followed by 0 STEP.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
+	[self writeToStream:stream withStepCommand:YES];
+	
+}//end writeToStream:
+
+
 //========== writeWithStepCommand: =============================================
 //
 // Purpose:		Write out all the commands in the step. The output will be 
@@ -549,72 +531,88 @@
 //==============================================================================
 - (NSString *) writeWithStepCommand:(BOOL)flag
 {
-	NSMutableString *written        = [NSMutableString string];
-	NSString        *CRLF           = [NSString CRLF];
-	Tuple3          angleZYX        = [self rotationAngleZYX];
+	LDrawWriter	*writer		= [[LDrawWriter alloc] init];
+	NSString	*written	= nil;
+	
+	[self writeToStream:writer withStepCommand:flag];
+	written = [writer string];
+	[writer release];
+	
+	return written;
 	
-	NSArray         *commandsInStep = [self subdirectives];
+}//end writeWithStepCommand:
+
+
+//========== writeToStream:withStepCommand: ====================================
+//
+// Purpose:		Streaming version of -writeWithStepCommand:. Commands are 
+//				separated by CRLF; there is no line ending after the last line.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream withStepCommand:(BOOL)flag
+{
+	Tuple3          angleZYX        = [self rotationAngleZYX];
+	NSArray         *commandsInStep = [self readOnlySubdirectives];
 	LDrawDirective  *currentCommand = nil;
 	NSUInteger      numberCommands  = [commandsInStep count];
 	NSUInteger      counter         = 0;
+	NSString        *rotationType   = nil;
+	char            rotation[LDRAW_OUTPUT_FIELD_SIZE * 4];
 	
 	// Write all the step's subdirectives
 	for(counter = 0; counter < numberCommands; counter++)
 	{
+		if(counter > 0)
+			[stream appendCRLF];
+		
 		currentCommand = [commandsInStep objectAtIndex:counter];
-		[written appendFormat:@"%@%@", [currentCommand write], CRLF];
+		[currentCommand writeToStream:stream];
 	}
 	
 	// End with 0 STEP or 0 ROTSTEP
 	if(		flag == YES
 		||	self->stepRotationType != LDrawStepRotationNone )
 	{
+		if(numberCommands > 0)
+			[stream appendCRLF];
+		
+		[stream appendBytes:"0 " length:2];
+		
 		switch(self->stepRotationType)
 		{
 			case LDrawStepRotationNone:
-				[written appendFormat:@"0 %@", LDRAW_STEP_TERMINATOR];
+				[stream appendString:LDRAW_STEP_TERMINATOR];
 				break;
 			
 			case LDrawStepRotationRelative:
-				[written appendFormat:@"0 %@ %.3f %.3f %.3f %@",LDRAW_ROTATION_STEP_TERMINATOR,
-																angleZYX.x, 
-																angleZYX.y, 
-																angleZYX.z, 
-																LDRAW_ROTATION_RELATIVE ];
+				rotationType = LDRAW_ROTATION_RELATIVE;
 				break;
 			
 			case LDrawStepRotationAbsolute:
-				[written appendFormat:@"0 %@ %.3f %.3f %.3f %@",LDRAW_ROTATION_STEP_TERMINATOR,
-																angleZYX.x, 
-																angleZYX.y, 
-																angleZYX.z, 
-																LDRAW_ROTATION_ABSOLUTE ];
+				rotationType = LDRAW_ROTATION_ABSOLUTE;
 				break;
 			
 			case LDrawStepRotationAdditive:
-				[written appendFormat:@"0 %@ %.3f %.3f %.3f %@",LDRAW_ROTATION_STEP_TERMINATOR,
-																angleZYX.x, 
-																angleZYX.y, 
-																angleZYX.z, 
-																LDRAW_ROTATION_ADDITIVE ];
+				rotationType = LDRAW_ROTATION_ADDITIVE;
 				break;
 			
 			case LDrawStepRotationEnd:
-				[written appendFormat:@"0 %@ %@", LDRAW_ROTATION_STEP_TERMINATOR, LDRAW_ROTATION_END];
+				[stream appendString:LDRAW_ROTATION_STEP_TERMINATOR];
+				[stream appendBytes:" " length:1];
+				[stream appendString:LDRAW_ROTATION_END];
 				break;
 		}
+		
+		if(rotationType != nil)
+		{
+			[stream appendString:LDRAW_ROTATION_STEP_TERMINATOR];
+			snprintf(rotation, sizeof(rotation), " %.3f %.3f %.3f ", angleZYX.x, angleZYX.y, angleZYX.z);
+			[stream appendCString:rotation];
+			[stream appendString:rotationType];
+		}
 	}
 	
-	//Now remove that last CRLF, if it's there.
-	if([written hasSuffix:CRLF])
-	{
-		NSRange lastNewline = NSMakeRange([written length] - [CRLF length], [CRLF length]);
-		[written deleteCharactersInRange:lastNewline];
-	}
-	
-	return written;
-	
-}//end writeWithStepCommand:
+}//end writeToStream:withStepCommand:
 
 
 #pragma mark -
@@ -704,7 +702,7 @@
 {
 	if ([self revalCache:CacheFlagBounds] == CacheFlagBounds)
 	{
-		cachedBounds = [LDrawUtilities boundingBox3ForDirectives:[self subdirectives]];
+		cachedBounds = [LDrawUtilities boundingBox3ForDirectives:[self readOnlySubdirectives]];
 	}
 	return cachedBounds;
 	
@@ -841,6 +839,8 @@
 //==============================================================================
 - (void) setRotationAngle:(Tuple3)newAngle
 {
+	[self noteWillChange];
+	
 	self->rotationAngle = newAngle;
 
 	if(self->postsNotifications)
@@ -907,6 +907,8 @@
 //==============================================================================
 - (void) setStepFlavor:(LDrawStepFlavorT)newFlavor
 {
+	[self noteWillChange];
+	
 	self->stepFlavor = newFlavor;
 
 	if(self->postsNotifications)
@@ -928,6 +930,8 @@
 //==============================================================================
 - (void) setStepRotationType:(LDrawStepRotationT)newValue
 {
+	[self noteWillChange];
+	
 	self->stepRotationType = newValue;
 
 	if(self->postsNotifications)
@@ -37,19 +37,70 @@
 	together data structures for a specific task and can dump the
 	whole pool when done.
 	
+	REUSE
 	
+	Display list builders and draw sessions each want a pool, and 
+	there's one of each per part per rebuild and per frame.  Rather
+	than create and destroy a pool every time, they borrow one from 
+	a small per-thread cache and return it when done.  Returning a 
+	pool resets it: every allocation is forgotten, but its standard 
+	pages are kept and handed out again.  So once the cache is warm, 
+	a frame's worth of allocations never touches malloc.
+	
+	A returned pool that grew big for one huge job is trimmed back 
+	before it is cached, so one giant part doesn't pin its memory 
+	forever.  Oversized pages (allocations bigger than a page) are 
+	never kept.
+	
+	The pool itself is still not thread-safe; only the cache is 
+	per-thread.  A pool may be returned on a different thread from 
+	the one that borrowed it.
 
  */
 
+// The page size LDrawBDPCreate uses.
+#define LDRAW_BDP_DEFAULT_PAGE_SIZE		4096
+
 // Pools are referred to via an opaque struct ptr.
 struct	LDrawBDP;
 
+// What a pool has been up to.  Requested and wasted bytes accumulate over
+// the life of the pool, resets included.  Wasted bytes are page tails that
+// were abandoned because the next allocation didn't fit.
+struct LDrawBDPStats {
+	size_t		bytes_requested;
+	size_t		bytes_wasted;
+	size_t		pages_in_use;		// pages holding live allocations, oversized ones included
+	size_t		pages_owned;		// pages in use plus pages kept for reuse
+	size_t		resets;
+};
+
 // Allocate a new pool.
 struct LDrawBDP *		LDrawBDPCreate();
 
+// Allocate a new pool whose standard pages are page_size bytes, header
+// included.  Use bigger pages for pools that make many allocations.
+struct LDrawBDP *		LDrawBDPCreateWithPageSize(size_t page_size);
+
 // Destroy the pool, freeing all memory allocated from the pool, as well as
 // the pool itself.
 void					LDrawBDPDestroy(struct LDrawBDP * pool);
 
+// Forget every allocation made from the pool, keeping its standard pages
+// to allocate from again.
+void					LDrawBDPReset(struct LDrawBDP * pool);
+
 // Allocate a new memory block from the pool.
 void *					LDrawBDPAllocate(struct LDrawBDP * pool, size_t sz);
+
+// Returns the pool's counters.
+void					LDrawBDPGetStats(struct LDrawBDP * pool, struct LDrawBDPStats * out_stats);
+
+// Borrow an empty pool with the given page size from this thread's cache,
+// creating one if there's none to hand.  Give it back with LDrawBDPReturn 
+// instead of destroying it.
+struct LDrawBDP *		LDrawBDPBorrow(size_t page_size);
+
+// Reset a borrowed pool and keep it in this thread's cache for the next
+// borrower.  If the cache is full, the oldest pool in it is destroyed.
+void					LDrawBDPReturn(struct LDrawBDP * pool);
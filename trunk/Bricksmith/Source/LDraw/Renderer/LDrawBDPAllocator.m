@@ -8,20 +8,25 @@
 
 #import "LDrawBDPAllocator.h"
 
-/* 
+#import <pthread.h>
+
+/*
 	BDP implementation: the pool consists of one or more large "pages" of memory, consisting of
 	a header and payload.  The header keeps track of how much of the page has been given out.
 	The pool is a linked list of pages.
-	
-	Most pages will be the 'standard' size, used for small sub-allocations.  If the client 
+
+	Most pages will be the 'standard' size, used for small sub-allocations.  If the client
 	requests a large allocation, we make a custom page to contain that one allocation and
-	string it into the pool list.  This is slightly less efficient than the system allocator
-	but lets client code not have to worry about maximum page size.
-	
+	string it into a separate list of oversized pages.  This is slightly less efficient than
+	the system allocator but lets client code not have to worry about maximum page size.
+
 	Allocations are first fit: when we run out of space, we open a new page and we do not worry
-	about wasted space.  So it is important that the typical allocation be much smaller than the 
-	page size.  
-	
+	about wasted space.  So it is important that the typical allocation be much smaller than the
+	page size.
+
+	Resetting the pool rewinds the standard pages rather than freeing them; the list past the
+	current page is then the pages waiting to be reused.
+
 	The page size should be at least 1 VM page.
 */
 
@@ -31,23 +36,37 @@ struct	BDPPage;
 struct	BDPPageHeader {
 	struct BDPPage *	next;		// Ptr to next page in pool.
 	char *				cur;		// Ptr to first free byte in payload to allocate.
-	char *				end;		// Ptr to end of this page's payload - we could eliminate that if we hard code fixed size pages.
+	char *				end;		// Ptr to end of this page's payload.
 };
 
-#define BDP_PAGE_SIZE 4096			// Tune this based on real app use someday?  
-
-#define BDP_PAYLOAD_SIZE (BDP_PAGE_SIZE - sizeof(struct BDPPageHeader))
-
 struct	BDPPage {
 	struct BDPPageHeader	header;
-	char					data[BDP_PAYLOAD_SIZE];
+	char					data[];
 };
 
 struct	LDrawBDP {
-	struct BDPPage *	first;		// Head of the linked list of pages, 
-	struct BDPPage *	cur;		// Tail - the current "open" page to grab data from.
+	struct BDPPage *		first;		// Head of the linked list of standard pages,
+	struct BDPPage *		cur;		// The current "open" page to grab data from.  Pages after it are free.
+	struct BDPPage *		oversized;	// Custom pages, one allocation each.
+	size_t					page_size;
+	size_t					payload_size;
+	struct LDrawBDPStats	stats;
 };
 
+// Each thread keeps a few empty pools around for the next borrower.
+#define BDP_CACHE_SIZE			8
+
+// A pool going back into the cache keeps at most this many bytes of pages.
+#define BDP_CACHE_KEEP_BYTES	(1024 * 1024)
+
+struct	BDPThreadCache {
+	int						count;
+	struct LDrawBDP *		pools[BDP_CACHE_SIZE];
+};
+
+static pthread_key_t	cache_key;
+static pthread_once_t	cache_key_once = PTHREAD_ONCE_INIT;
+
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -58,11 +77,13 @@ struct	LDrawBDP {
 // Purpose:		Prepare a single standard-size empty page for use in the pool.
 //
 //================================================================================
-static struct	BDPPage *	get_new_page()
-{	
-	struct	BDPPage * ptr = (struct	BDPPage *) malloc(sizeof(struct	BDPPage));
+static struct	BDPPage *	get_new_page(struct LDrawBDP * pool)
+{
+	struct	BDPPage * ptr = (struct	BDPPage *) malloc(pool->page_size);
+	ptr->header.next = NULL;
 	ptr->header.cur = ptr->data;
-	ptr->header.end = ptr->data + BDP_PAYLOAD_SIZE;
+	ptr->header.end = ptr->data + pool->payload_size;
+	++pool->stats.pages_owned;
 	return ptr;
 }
 
@@ -76,13 +97,45 @@ static struct	BDPPage *	get_new_page()
 //================================================================================
 struct LDrawBDP *		LDrawBDPCreate()
 {
-	struct LDrawBDP * ret = (struct LDrawBDP *) malloc(sizeof(struct LDrawBDP));
-	ret->first = ret->cur = get_new_page();
-	ret->first->header.next = NULL;
-	return ret;
+	return LDrawBDPCreateWithPageSize(LDRAW_BDP_DEFAULT_PAGE_SIZE);
 }//end LDrawBDPCreate
 
 
+//========== LDrawBDPCreateWithPageSize ==========================================
+//
+// Purpose:		Create a new BDP pool with a given standard page size.
+//
+//================================================================================
+struct LDrawBDP *		LDrawBDPCreateWithPageSize(size_t page_size)
+{
+	assert(page_size > sizeof(struct BDPPageHeader));
+	struct LDrawBDP * ret = (struct LDrawBDP *) calloc(1, sizeof(struct LDrawBDP));
+	ret->page_size = page_size;
+	ret->payload_size = page_size - sizeof(struct BDPPageHeader);
+	ret->first = ret->cur = get_new_page(ret);
+	ret->stats.pages_in_use = 1;
+	return ret;
+}//end LDrawBDPCreateWithPageSize
+
+
+//========== free_oversized ======================================================
+//
+// Purpose:		Free the custom pages made for big allocations.
+//
+//================================================================================
+static void free_oversized(struct LDrawBDP * pool)
+{
+	while(pool->oversized)
+	{
+		struct BDPPage * k = pool->oversized;
+		pool->oversized = pool->oversized->header.next;
+		free(k);
+		--pool->stats.pages_in_use;
+		--pool->stats.pages_owned;
+	}
+}
+
+
 //========== LDrawBDPDestroy =====================================================
 //
 // Purpose:		Destroy a pool.
@@ -92,6 +145,7 @@ struct LDrawBDP *		LDrawBDPCreate()
 //================================================================================
 void					LDrawBDPDestroy(struct LDrawBDP * pool)
 {
+	free_oversized(pool);
 	while(pool->first)
 	{
 		struct BDPPage * k = pool->first;
@@ -102,18 +156,42 @@ void					LDrawBDPDestroy(struct LDrawBDP * pool)
 }//end LDrawBDPDestroy
 
 
+//========== LDrawBDPReset =======================================================
+//
+// Purpose:		Empty a pool without giving its standard pages back to malloc.
+//
+// Notes:		Oversized pages are freed; their size is a one-off.
+//
+//================================================================================
+void					LDrawBDPReset(struct LDrawBDP * pool)
+{
+	struct BDPPage * p;
+
+	free_oversized(pool);
+
+	for(p = pool->first; p != pool->cur->header.next; p = p->header.next)
+		p->header.cur = p->data;
+
+	pool->cur = pool->first;
+	pool->stats.pages_in_use = 1;
+	++pool->stats.resets;
+}//end LDrawBDPReset
+
+
 //========== LDrawBDPAllocate ====================================================
 //
 // Purpose:		Allocate a fixed amount of memory from the pool.
 //
-// Notes:		This routine will create a new page if the current page is full,
-//				or allocate a custom huge-sized page if the amount of memory 
-//				requested is large.
+// Notes:		This routine will move on to the next page if the current page
+//				is full - reusing one left over from before a reset if there is
+//				one - or allocate a custom huge-sized page if the amount of
+//				memory requested is large.
 //
 //================================================================================
 void *					LDrawBDPAllocate(struct LDrawBDP * pool, size_t sz)
 {
 	struct BDPPage * page = pool->cur;
+	pool->stats.bytes_requested += sz;
 	if((page->header.end - page->header.cur) >= sz)
 	{
 		// Quick case: room in the current pool.
@@ -121,25 +199,34 @@ void *					LDrawBDPAllocate(struct LDrawBDP * pool, size_t sz)
 		page->header.cur += sz;
 		return ret;
 	}
-	else if(sz > BDP_PAYLOAD_SIZE)
+	else if(sz > pool->payload_size)
 	{
 		// Oversized case - we make a custom-sized page for this one allocation
-		// and pop it on the head of the list - the tail stays open - maybe
+		// and pop it on the oversized list - the current page stays open - maybe
 		// it still has space.
 		char * raw_buf = (char *) malloc(sizeof(struct BDPPageHeader) + sz);
 		struct BDPPageHeader * h = (struct BDPPageHeader *) raw_buf;
-		h->next = pool->first;
+		h->next = pool->oversized;
 		h->cur = h->end = raw_buf + sizeof(struct BDPPageHeader) + sz;
-		pool->first = (struct BDPPage *) h;		
+		pool->oversized = (struct BDPPage *) h;
+		++pool->stats.pages_in_use;
+		++pool->stats.pages_owned;
 		return raw_buf + sizeof(struct BDPPageHeader);
 	}
 	else
 	{
-		// Allocate a new page and we're ready to go.
-		assert(sz <= BDP_PAYLOAD_SIZE);
-		struct BDPPage * np = get_new_page();
-		page->header.next = np;
-		np->header.next = NULL;
+		// Move on to the next page and we're ready to go.  The tail of
+		// this one is lost.
+		assert(sz <= pool->payload_size);
+		pool->stats.bytes_wasted += page->header.end - page->header.cur;
+
+		struct BDPPage * np = page->header.next;
+		if(np == NULL)
+		{
+			np = get_new_page(pool);
+			page->header.next = np;
+		}
+		++pool->stats.pages_in_use;
 
 		void * ret = np->header.cur;
 		np->header.cur += sz;
@@ -148,3 +235,123 @@ void *					LDrawBDPAllocate(struct LDrawBDP * pool, size_t sz)
 	}
 }//end LDrawBDPAllocate
 
+
+//========== LDrawBDPGetStats ====================================================
+//
+// Purpose:		Return the pool's counters.
+//
+//================================================================================
+void					LDrawBDPGetStats(struct LDrawBDP * pool, struct LDrawBDPStats * out_stats)
+{
+	*out_stats = pool->stats;
+}//end LDrawBDPGetStats
+
+
+#pragma mark -
+
+//========== destroy_thread_cache ================================================
+//
+// Purpose:		Free a thread's cached pools when the thread exits.
+//
+//================================================================================
+static void destroy_thread_cache(void * ref)
+{
+	struct BDPThreadCache * cache = (struct BDPThreadCache *) ref;
+	int n;
+	for(n = 0; n < cache->count; ++n)
+		LDrawBDPDestroy(cache->pools[n]);
+	free(cache);
+}
+
+
+//========== make_cache_key ======================================================
+//
+// Purpose:		Create the thread-specific key for pool caches, once.
+//
+//================================================================================
+static void make_cache_key()
+{
+	pthread_key_create(&cache_key, destroy_thread_cache);
+}
+
+
+//========== get_thread_cache ====================================================
+//
+// Purpose:		Return the calling thread's pool cache, creating it if needed.
+//
+//================================================================================
+static struct BDPThreadCache * get_thread_cache()
+{
+	pthread_once(&cache_key_once, make_cache_key);
+	struct BDPThreadCache * cache = (struct BDPThreadCache *) pthread_getspecific(cache_key);
+	if(cache == NULL)
+	{
+		cache = (struct BDPThreadCache *) calloc(1, sizeof(struct BDPThreadCache));
+		pthread_setspecific(cache_key, cache);
+	}
+	return cache;
+}
+
+
+//========== LDrawBDPBorrow ======================================================
+//
+// Purpose:		Hand out an empty pool from this thread's cache.
+//
+// Notes:		The most recently returned pool is preferred; its pages are
+//				the most likely to still be in cache.
+//
+//================================================================================
+struct LDrawBDP *		LDrawBDPBorrow(size_t page_size)
+{
+	struct BDPThreadCache * cache = get_thread_cache();
+	int n;
+	for(n = cache->count - 1; n >= 0; --n)
+	if(cache->pools[n]->page_size == page_size)
+	{
+		struct LDrawBDP * ret = cache->pools[n];
+		cache->pools[n] = cache->pools[--cache->count];
+		return ret;
+	}
+	return LDrawBDPCreateWithPageSize(page_size);
+}//end LDrawBDPBorrow
+
+
+//========== LDrawBDPReturn ======================================================
+//
+// Purpose:		Take back a borrowed pool, reset and trimmed, for next time.
+//
+//================================================================================
+void					LDrawBDPReturn(struct LDrawBDP * pool)
+{
+	struct BDPThreadCache * cache = get_thread_cache();
+
+	LDrawBDPReset(pool);
+
+	// Trim the page list to what we're willing to keep.
+	size_t keep = BDP_CACHE_KEEP_BYTES / pool->page_size;
+	struct BDPPage * p = pool->first;
+	while(keep > 1 && p->header.next)
+	{
+		p = p->header.next;
+		--keep;
+	}
+	while(p->header.next)
+	{
+		struct BDPPage * k = p->header.next;
+		p->header.next = k->header.next;
+		free(k);
+		--pool->stats.pages_owned;
+	}
+
+	if(cache->count < BDP_CACHE_SIZE)
+	{
+		cache->pools[cache->count++] = pool;
+	}
+	else
+	{
+		// Cache is full - keep the pool just returned, it's the warmest.
+		LDrawBDPDestroy(cache->pools[0]);
+		cache->pools[0] = pool;
+	}
+}//end LDrawBDPReturn
+
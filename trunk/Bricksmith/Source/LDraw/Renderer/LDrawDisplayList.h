@@ -51,11 +51,31 @@ struct	LDrawDL;
 struct	LDrawDLBuilder;
 struct	LDrawDLSession;
 
+// Builder options.  Only library parts are worth the mesh cache and LODs: they
+// are the same every session and drawn at every size, while user models and
+// drag lists change as you edit.
+enum {
+	dl_build_library_part = 1		// Use the mesh cache for this DL and give it LODs.
+};
+
 // Display list creation API.
-struct LDrawDLBuilder *		LDrawDLBuilderCreate();
+struct LDrawDLBuilder *		LDrawDLBuilderCreate(int options);
 struct LDrawDL *			LDrawDLBuilderFinish(struct LDrawDLBuilder * ctx);
 void						LDrawDLDestroy(struct LDrawDL * dl);
 
+// Level of detail.  A finished library-part DL with enough geometry also
+// carries simplified copies of itself, for drawing when the part is only a few pixels across.
+// Studs and other small features melt away; silhouette and colors stay.  The
+// LODs belong to the DL and go away with it.
+enum {
+	dl_lod_full = 0,		// The DL itself.
+	dl_lod_medium = 1,		// For parts a few dozen pixels across.
+	dl_lod_coarse = 2		// For parts barely more than a box.
+};
+
+// Returns the DL to draw for a level - the finest available at or below it.
+struct LDrawDL *			LDrawDLGetLOD(struct LDrawDL * dl, int level);
+
 // Display list mesh accumulation APIs.
 void						LDrawDLBuilderSetTex(struct LDrawDLBuilder * ctx, struct LDrawTextureSpec * spec);
 void						LDrawDLBuilderAddTri(struct LDrawDLBuilder * ctx, const GLfloat v[9], GLfloat n[3], GLfloat c[4]);
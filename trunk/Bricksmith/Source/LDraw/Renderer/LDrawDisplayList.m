@@ -11,7 +11,9 @@
 #import "LDrawBDPAllocator.h"
 #import "LDrawShaderRenderer.h"
 #import "MeshSmooth.h"
+#import "LDrawMeshCache.h"
 #import "GLMatrixMath.h"
+#import <CommonCrypto/CommonDigest.h>
 #import OPEN_GL_HEADER
 #import OPEN_GL_EXT_HEADER
 
@@ -27,6 +29,9 @@
 // This times smoothing of parts.
 #define TIME_SMOOTHING 0
 
+// This saves smoothed meshes to disk and reuses them in later sessions.
+#define WANT_MESH_CACHE 1
+
 #if WANT_SMOOTH
 static const GLuint * idx_null = NULL;
 #endif
@@ -76,6 +81,11 @@ static const GLuint * idx_null = NULL;
 #define INST_MAX_COUNT (1024 * 128)					// Maximum instances to write per draw before going to immediate mode - avoids unbounded VRAM use.
 #define INST_RING_BUFFER_COUNT 4					// Number of VBOs to rotate for hw instancing - doesn't actually help, it turns out.
 #define MODE_FOR_INST_STREAM GL_DYNAMIC_STATIC		// VBO mode for instancing.
+#define BUILDER_PAGE_SIZE (16 * 1024)				// BDP page size for builders - a part's vertex links run to hundreds of KB.
+#define SESSION_PAGE_SIZE (64 * 1024)				// BDP page size for sessions - one instance link per part drawn per frame.
+#define LOD_MIN_INDICES 256							// Meshes smaller than this are cheap enough as they are - no LODs.
+#define LOD_MEDIUM_CELLS 24							// Medium LOD merges vertices in cubes 1/24th of the part's longest side...
+#define LOD_COARSE_CELLS 8							// ...and coarse in cubes 1/8th of it.
 
 enum {
 	dl_has_alpha = 1,		// At least one prim in this DL has translucency.
@@ -160,6 +170,9 @@ struct LDrawDL {
 	GLuint					idx_vbo;				// Single VBO containing all mesh indices.
 #endif
 	int						tex_count;				// Number of per-textures; untex case is always first if present.
+#if WANT_SMOOTH
+	struct LDrawDL *		lod[dl_lod_coarse];		// Simplified stand-ins, finest first; NULL if not worth having.
+#endif
 	#if WANT_STATS
 	int						vrt_count;
 #if WANT_SMOOTH
@@ -272,6 +285,7 @@ struct LDrawDLBuilderPerTex {
 // the data carefully hwen we are done.
 struct	LDrawDLBuilder {
 	int								flags;
+	int								options;		// dl_build_* options from LDrawDLBuilderCreate.
 	struct LDrawBDP *				alloc;
 	struct LDrawDLBuilderPerTex *	head;
 	struct LDrawDLBuilderPerTex *	cur;
@@ -284,10 +298,11 @@ struct	LDrawDLBuilder {
 // Purpose:	Create a new builder capable of accumulating DL data.
 //
 //================================================================================
-struct LDrawDLBuilder * LDrawDLBuilderCreate()
+struct LDrawDLBuilder * LDrawDLBuilderCreate(int options)
 {
-	// All allocs for the builder come from one pool.
-	struct LDrawBDP * alloc = LDrawBDPCreate();
+	// All allocs for the builder come from one pool, borrowed from this 
+	// thread's cache so rebuilding doesn't go back to malloc for pages.
+	struct LDrawBDP * alloc = LDrawBDPBorrow(BUILDER_PAGE_SIZE);
 
 	// Build one tex struct now for the untextured set of meshes, which are the default state.
 	struct LDrawDLBuilderPerTex * untex = (struct LDrawDLBuilderPerTex *) LDrawBDPAllocate(alloc,sizeof(struct LDrawDLBuilderPerTex));
@@ -298,6 +313,7 @@ struct LDrawDLBuilder * LDrawDLBuilderCreate()
 	
 	bld->alloc = alloc;
 	bld->flags = 0;
+	bld->options = options;
 	
 	return bld;
 }//end LDrawDLBuilderCreate
@@ -497,6 +513,190 @@ void LDrawDLBuilderAddLine(struct LDrawDLBuilder * ctx, const GLfloat v[6], GLfl
 }//end LDrawDLBuilderAddLine
 
 
+#if WANT_SMOOTH && WANT_MESH_CACHE
+
+//========== hash_builder_geometry ===============================================
+//
+// Purpose:	Compute the mesh cache key for everything accumulated in a builder.
+//
+// Notes:	The key has to cover exactly what the smoother sees: the vertices of
+//			each primitive list of each non-empty texture, in order.  Each
+//			texture's section starts with its vertex counts, so the same floats
+//			split differently between lists can't produce the same stream.
+//
+//================================================================================
+static void hash_builder_geometry(struct LDrawDLBuilder * ctx, unsigned char key[LDRAW_MESH_CACHE_KEY_SIZE])
+{
+	CC_SHA256_CTX						sha;
+	struct LDrawDLBuilderPerTex *		s;
+	struct LDrawDLBuilderVertexLink *	l;
+	
+	CC_SHA256_Init(&sha);
+	for(s = ctx->head; s; s = s->next)
+	{
+		if(s->tri_head == NULL && s->line_head == NULL && s->quad_head == NULL)
+			continue;
+
+		int counts[3] = { 0 };
+		for(l = s->tri_head; l; l = l->next)
+			counts[0] += l->vcount;
+		for(l = s->quad_head; l; l = l->next)
+			counts[1] += l->vcount;
+		for(l = s->line_head; l; l = l->next)
+			counts[2] += l->vcount;
+		CC_SHA256_Update(&sha, counts, sizeof(counts));
+
+		for(l = s->tri_head; l; l = l->next)
+			CC_SHA256_Update(&sha, l->data, (CC_LONG) (sizeof(GLfloat) * VERT_STRIDE * l->vcount));
+		for(l = s->quad_head; l; l = l->next)
+			CC_SHA256_Update(&sha, l->data, (CC_LONG) (sizeof(GLfloat) * VERT_STRIDE * l->vcount));
+		for(l = s->line_head; l; l = l->next)
+			CC_SHA256_Update(&sha, l->data, (CC_LONG) (sizeof(GLfloat) * VERT_STRIDE * l->vcount));
+	}
+	CC_SHA256_Final(key, &sha);
+}//end hash_builder_geometry
+
+#endif
+
+
+#if WANT_SMOOTH
+
+//========== create_lod ==========================================================
+//
+// Purpose:	Build a simplified copy of a finished DL from its mesh, for drawing
+//			the part when it is small on screen.
+//
+// Notes:	The LOD shares the parent's textures and flags but has its own VBOs.
+//			Returns NULL if simplifying didn't save at least a third of the
+//			indices - then the LOD would cost memory and buy nothing.
+//
+//================================================================================
+static struct LDrawDL * create_lod(
+								struct LDrawDLBuilder *				ctx,
+								struct LDrawDL *					parent,
+								const struct LDrawMeshCacheData *	mesh,
+								float								cell_size)
+{
+	int				tex_count		= parent->tex_count;
+	float *			vertex_table	= (float *) LDrawBDPAllocate(ctx->alloc, mesh->vertex_count * sizeof(GLfloat) * VERT_STRIDE);
+	unsigned int *	index_table		= (unsigned int *) LDrawBDPAllocate(ctx->alloc, (mesh->index_count * 3 / 2 + 3) * sizeof(GLuint));
+	int *			line_start		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * tex_count);
+	int *			line_count		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * tex_count);
+	int *			tri_start		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * tex_count);
+	int *			tri_count		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * tex_count);
+	int *			quad_start		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * tex_count);
+	int *			quad_count		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * tex_count);
+	int				vertex_count	= 0;
+	int				index_count		= 0;
+	int				ti;
+
+	simplify_indexed_mesh(
+		cell_size,
+		tex_count,
+		mesh->vertex_count,
+		mesh->vertex_table,
+		mesh->index_table,
+		mesh->line_start,
+		mesh->line_count,
+		mesh->tri_start,
+		mesh->tri_count,
+		mesh->quad_start,
+		mesh->quad_count,
+		&vertex_count,
+		vertex_table,
+		&index_count,
+		index_table,
+		line_start,
+		line_count,
+		tri_start,
+		tri_count,
+		quad_start,
+		quad_count);
+
+	if(index_count == 0 || index_count * 3 > mesh->index_count * 2)
+		return NULL;
+
+	optimize_indexed_mesh(tex_count, vertex_count, vertex_table, index_count, index_table, tri_start, tri_count, quad_start, quad_count);
+
+	struct LDrawDL * lod = (struct LDrawDL *) malloc(sizeof(struct LDrawDL) + sizeof(struct LDrawDLPerTex) * tex_count);
+
+	lod->next_dl = NULL;
+	lod->instance_head = NULL;
+	lod->instance_tail = NULL;
+	lod->instance_count = 0;
+	lod->flags = parent->flags;
+	lod->tex_count = tex_count;
+	memset(lod->lod, 0, sizeof(lod->lod));
+
+	glGenBuffers(1,&lod->geo_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, lod->geo_vbo);
+	glGenBuffers(1,&lod->idx_vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod->idx_vbo);
+
+	glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(GLfloat) * VERT_STRIDE, vertex_table, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(GLuint), index_table, GL_STATIC_DRAW);
+
+	for(ti = 0; ti < tex_count; ++ti)
+	{
+		memcpy(&lod->texes[ti].spec, &parent->texes[ti].spec, sizeof(struct LDrawTextureSpec));
+		lod->texes[ti].line_off = line_start[ti];
+		lod->texes[ti].line_count = line_count[ti];
+		lod->texes[ti].tri_off = tri_start[ti];
+		lod->texes[ti].tri_count = tri_count[ti];
+		lod->texes[ti].quad_off = quad_start[ti];
+		lod->texes[ti].quad_count = quad_count[ti];
+	}
+
+	#if WANT_STATS
+	lod->vrt_count = vertex_count;
+	lod->idx_count = index_count;
+	#endif
+
+	return lod;
+
+}//end create_lod
+
+
+//========== create_lods =========================================================
+//
+// Purpose:	Give a freshly built DL its medium and coarse LODs, if it is big
+//			enough to benefit.
+//
+// Notes:	Cell sizes are a fixed fraction of the part's size, so each LOD
+//			keeps about the same number of cubes across whatever the part.  Both
+//			LODs are built from the full mesh, not one from the other.
+//
+//================================================================================
+static void create_lods(struct LDrawDLBuilder * ctx, struct LDrawDL * dl, const struct LDrawMeshCacheData * mesh)
+{
+	float	lo[3], hi[3], size = 0.0f;
+	int		v, i;
+
+	memset(dl->lod, 0, sizeof(dl->lod));
+
+	if(mesh->index_count < LOD_MIN_INDICES)
+		return;
+
+	for(v = 0; v < mesh->vertex_count; ++v)
+	for(i = 0; i < 3; ++i)
+	{
+		float c = mesh->vertex_table[v * VERT_STRIDE + i];
+		if(v == 0 || c < lo[i])	lo[i] = c;
+		if(v == 0 || c > hi[i])	hi[i] = c;
+	}
+	for(i = 0; i < 3; ++i)
+		size = MAX(size, hi[i] - lo[i]);
+	if(size <= 0.0f)
+		return;
+
+	dl->lod[dl_lod_medium - 1] = create_lod(ctx, dl, mesh, size / LOD_MEDIUM_CELLS);
+	dl->lod[dl_lod_coarse - 1] = create_lod(ctx, dl, mesh, size / LOD_COARSE_CELLS);
+
+}//end create_lods
+
+#endif
+
+
 //========== LDrawDLBuilderFinish ================================================
 //
 // Purpose:	Take all of the accumulated data in a DL and bake it down to one
@@ -507,6 +707,16 @@ void LDrawDLBuilderAddLine(struct LDrawDLBuilder * ctx, const GLfloat v[6], GLfl
 //			fit the DL perfectly, and one VBO.  So this routine does the counting,
 //			final allocations, and copying.
 //
+//			With smoothing on, a library part's smoothed mesh comes from the
+//			mesh cache if we have seen this exact geometry before; see
+//			LDrawMeshCache.h.  Everything else is smoothed every time - user
+//			models and drag lists are rebuilt as they are edited, and would
+//			only fill the cache with meshes nobody asks for again.
+//			A library part's LODs are made from that mesh here, every time -
+//			simplifying is cheap next to smoothing, so they aren't worth
+//			caching.  Other DLs get none: they are rebuilt as they are edited
+//			and never drawn as LODs for long.
+//
 //================================================================================
 struct LDrawDL * LDrawDLBuilderFinish(struct LDrawDLBuilder * ctx)
 {
@@ -549,7 +759,7 @@ struct LDrawDL * LDrawDLBuilderFinish(struct LDrawDLBuilder * ctx)
 	// an empty one.
 	if(total_texes == 0)
 	{
-		LDrawBDPDestroy(ctx->alloc);
+		LDrawBDPReturn(ctx->alloc);
 		return NULL;
 	}
 	
@@ -579,97 +789,136 @@ struct LDrawDL * LDrawDLBuilderFinish(struct LDrawDLBuilder * ctx)
 	// to our texture list.  The mesh smoother remembers this and dumps out the tris in
 	// tid order later.
 
-	struct Mesh * M = create_mesh(total_tris,total_quads,total_lines);
-
+	struct LDrawMeshCacheData mesh;
+	int ti;
 
-	// Now: walk our building textures - for each non-empty one, we will copy it into
-	// the tex array and push its vertices.
-	int ti = 0;
-	for(s = ctx->head; s; s = s->next)
+	#if WANT_MESH_CACHE
+	int use_cache = (ctx->options & dl_build_library_part) != 0;
+	unsigned char key[LDRAW_MESH_CACHE_KEY_SIZE];
+	if(use_cache)
+		hash_builder_geometry(ctx, key);
+	if(!use_cache || !LDrawMeshCacheRead(key, total_texes, &mesh))
+	#endif
 	{
-		if(s->tri_head == NULL && s->line_head == NULL && s->quad_head == NULL)
-			continue;
-		if(s->spec.tex_obj != 0)
-			dl->flags |= dl_has_tex;
+		struct Mesh * M = create_mesh(total_tris,total_quads,total_lines);
 
-		for(l = s->tri_head; l; l = l->next)
+		// Now: walk our building textures - for each non-empty one, we will copy it into
+		// the tex array and push its vertices.
+		ti = 0;
+		for(s = ctx->head; s; s = s->next)
 		{
-			add_face(M,
-				l->data, l->data+10,l->data+20,NULL,
-				l->data+6,ti);
+			if(s->tri_head == NULL && s->line_head == NULL && s->quad_head == NULL)
+				continue;
+
+			for(l = s->tri_head; l; l = l->next)
+			{
+				add_face(M,
+					l->data, l->data+10,l->data+20,NULL,
+					l->data+6,ti);
+			}
+
+			for(l = s->quad_head; l; l = l->next)
+			{
+				add_face(M,
+					l->data, l->data+10,l->data+20,l->data+30,
+					l->data+6,ti);
+			}
+
+			++ti;
 		}
 
-		for(l = s->quad_head; l; l = l->next)
+		ti = 0;
+		for(s = ctx->head; s; s = s->next)
 		{
-			add_face(M,
-				l->data, l->data+10,l->data+20,l->data+30,
-				l->data+6,ti);
+			if(s->tri_head == NULL && s->line_head == NULL && s->quad_head == NULL)
+				continue;
+
+			for(l = s->line_head; l; l = l->next)
+			{
+				add_face(M,l->data,l->data+10,NULL,NULL,l->data+6,ti);
+			}
+			
+			++ti;
 		}
 
-		++ti;
-	}
 
-	ti = 0;
-	for(s = ctx->head; s; s = s->next)
-	{
-		if(s->tri_head == NULL && s->line_head == NULL && s->quad_head == NULL)
-			continue;
-		if(s->spec.tex_obj != 0)
-			dl->flags |= dl_has_tex;
+		finish_faces_and_sort(M);
+		add_creases(M);
+		find_and_remove_t_junctions(M);
+		finish_creases_and_join(M);
+		smooth_vertices(M);
+		merge_vertices(M);
+		
+		get_final_mesh_counts(M,&mesh.vertex_count,&mesh.index_count);
 
-		for(l = s->line_head; l; l = l->next)
-		{
-			add_face(M,l->data,l->data+10,NULL,NULL,l->data+6,ti);
-		}
+		// The mesh is written to scratch memory rather than straight into mapped
+		// VBOs so that we can save it to the cache too.
+		float *			vertex_table	= (float *) LDrawBDPAllocate(ctx->alloc, mesh.vertex_count * sizeof(GLfloat) * VERT_STRIDE);
+		unsigned int *	index_table		= (unsigned int *) LDrawBDPAllocate(ctx->alloc, mesh.index_count * sizeof(GLuint));
 		
-		++ti;
+		// Grab variable size arrays for the start/offsets of each sub-part of our big pile-o-mesh...
+		// the mesher will give us back our tris sorted by texture.
+		
+		int * line_start	= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
+		int * line_count	= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
+		int * tri_start		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
+		int * tri_count		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
+		int * quad_start	= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
+		int * quad_count	= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
+
+		write_indexed_mesh(
+			M,
+			mesh.vertex_count,
+			vertex_table,
+			mesh.index_count,
+			index_table,
+			0,
+			line_start,
+			line_count,
+			tri_start,
+			tri_count,
+			quad_start,
+			quad_count);
+
+		destroy_mesh(M);
+
+		// Sorted-vertex order is no good to the GPU; reorder for its vertex
+		// cache before the mesh is cached, so cache hits get this for free.
+		optimize_indexed_mesh(
+			total_texes,
+			mesh.vertex_count,
+			vertex_table,
+			mesh.index_count,
+			index_table,
+			tri_start,
+			tri_count,
+			quad_start,
+			quad_count);
+
+		mesh.vertex_table	= vertex_table;
+		mesh.index_table	= index_table;
+		mesh.tex_count		= total_texes;
+		mesh.line_start		= line_start;
+		mesh.line_count		= line_count;
+		mesh.tri_start		= tri_start;
+		mesh.tri_count		= tri_count;
+		mesh.quad_start		= quad_start;
+		mesh.quad_count		= quad_count;
+		mesh.storage		= NULL;
+
+		#if WANT_MESH_CACHE
+		if(use_cache)
+			LDrawMeshCacheWrite(key, &mesh);
+		#endif
 	}
 
-
-	finish_faces_and_sort(M);
-	add_creases(M);
-	find_and_remove_t_junctions(M);
-	finish_creases_and_join(M);
-	smooth_vertices(M);
-	merge_vertices(M);
-	
-	int total_vertices, total_indices;
-	get_final_mesh_counts(M,&total_vertices,&total_indices);
-
 	glGenBuffers(1,&dl->geo_vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, dl->geo_vbo);
 	glGenBuffers(1,&dl->idx_vbo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dl->idx_vbo);
 
-	glBufferData(GL_ARRAY_BUFFER, total_vertices * sizeof(GLfloat) * VERT_STRIDE, NULL, GL_STATIC_DRAW);
-	volatile GLfloat * vertex_ptr = (volatile GLfloat *) glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, total_indices * sizeof(GLuint), NULL, GL_STATIC_DRAW);
-	volatile GLuint * index_ptr = (volatile GLuint *) glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY);
-	
-	// Grab variable size arrays for the start/offsets of each sub-part of our big pile-o-mesh...
-	// the mesher will give us back our tris sorted by texture.
-	
-	int * line_start	= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
-	int * line_count	= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
-	int * tri_start		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
-	int * tri_count		= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
-	int * quad_start	= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
-	int * quad_count	= (int *) LDrawBDPAllocate(ctx->alloc, sizeof(int) * total_texes);
-
-	write_indexed_mesh(
-		M,
-		total_vertices,
-		vertex_ptr,
-		total_indices,
-		index_ptr,
-		0,
-		line_start,
-		line_count,
-		tri_start,
-		tri_count,
-		quad_start,
-		quad_count);
+	glBufferData(GL_ARRAY_BUFFER, mesh.vertex_count * sizeof(GLfloat) * VERT_STRIDE, mesh.vertex_table, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.index_count * sizeof(GLuint), mesh.index_table, GL_STATIC_DRAW);
 
 	ti = 0;
 	
@@ -677,34 +926,40 @@ struct LDrawDL * LDrawDLBuilderFinish(struct LDrawDLBuilder * ctx)
 	{
 		if(s->tri_head == NULL && s->line_head == NULL && s->quad_head == NULL)
 			continue;
+		if(s->spec.tex_obj != 0)
+			dl->flags |= dl_has_tex;
 
 		memcpy(&cur_tex->spec, &s->spec, sizeof(struct LDrawTextureSpec));
 		
-		cur_tex->quad_off = quad_start[ti];
-		cur_tex->line_off = line_start[ti];
-		cur_tex->tri_off = tri_start[ti];
-		cur_tex->quad_count = quad_count[ti];
-		cur_tex->line_count = line_count[ti];
-		cur_tex->tri_count = tri_count[ti];
+		cur_tex->quad_off = mesh.quad_start[ti];
+		cur_tex->line_off = mesh.line_start[ti];
+		cur_tex->tri_off = mesh.tri_start[ti];
+		cur_tex->quad_count = mesh.quad_count[ti];
+		cur_tex->line_count = mesh.line_count[ti];
+		cur_tex->tri_count = mesh.tri_count[ti];
 		
 		++ti;
 		++cur_tex;
 	}
 
-	destroy_mesh(M);
-
 	#if WANT_STATS
-	dl->vrt_count = total_vertices;
-	dl->idx_count = total_indices;
+	dl->vrt_count = mesh.vertex_count;
+	dl->idx_count = mesh.index_count;
 	#endif	
+
+	if(ctx->options & dl_build_library_part)
+		create_lods(ctx, dl, &mesh);
+	else
+		memset(dl->lod, 0, sizeof(dl->lod));
 	
-	glUnmapBuffer(GL_ARRAY_BUFFER);
-	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+	if(mesh.storage)
+		LDrawMeshCacheRelease(&mesh);
+
 	glBindBuffer(GL_ARRAY_BUFFER,0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
 
-	// Release the BDP that contains all of the build-related junk.
-	LDrawBDPDestroy(ctx->alloc);
+	// Return the BDP that contains all of the build-related junk.
+	LDrawBDPReturn(ctx->alloc);
 
 	#if TIME_SMOOTHING
 	NSTimeInterval endTime = [NSDate timeIntervalSinceReferenceDate];			
@@ -742,7 +997,7 @@ struct LDrawDL * LDrawDLBuilderFinish(struct LDrawDLBuilder * ctx)
 	// an empty one.
 	if(total_texes == 0)
 	{
-		LDrawBDPDestroy(ctx->alloc);
+		LDrawBDPReturn(ctx->alloc);
 		return NULL;
 	}
 	
@@ -821,8 +1076,8 @@ struct LDrawDL * LDrawDLBuilderFinish(struct LDrawDLBuilder * ctx)
 	glUnmapBuffer(GL_ARRAY_BUFFER);
 	glBindBuffer(GL_ARRAY_BUFFER,0);
 
-	// Release the BDP that contains all of the build-related junk.
-	LDrawBDPDestroy(ctx->alloc);
+	// Return the BDP that contains all of the build-related junk.
+	LDrawBDPReturn(ctx->alloc);
 	
 	return dl;
 
@@ -870,7 +1125,7 @@ static void setup_tex_spec(struct LDrawTextureSpec * spec)
 //================================================================================
 struct LDrawDLSession * LDrawDLSessionCreate(const GLfloat model_view[16])
 {
-	struct LDrawBDP * alloc = LDrawBDPCreate();
+	struct LDrawBDP * alloc = LDrawBDPBorrow(SESSION_PAGE_SIZE);
 	struct LDrawDLSession * session = (struct LDrawDLSession *) LDrawBDPAllocate(alloc,sizeof(struct LDrawDLSession));
 	session->alloc = alloc;
 	session->dl_head = NULL;
@@ -1228,9 +1483,10 @@ void LDrawDLSessionDrawAndDestroy(struct LDrawDLSession * session)
 	#endif
 	
 	// Finally done - all allocations for session (including our own obj) come from a BDP, so cleanup is quick.  
+	// The BDP goes back to the cache, pages and all, for next frame's session.
 	// Instance VBO remains to be reused.
 	// DLs themselves live on beyond session.
-	LDrawBDPDestroy(session->alloc);
+	LDrawBDPReturn(session->alloc);
 	
 }//end LDrawDLSessionDrawAndDestroy
 
@@ -1435,9 +1691,35 @@ void LDrawDLDestroy(struct LDrawDL * dl)
 	assert(dl->instance_head == NULL);
 
 	#if WANT_SMOOTH
+	// A LOD may itself be queued in the session; if so it waits, as above.
+	int l;
+	for(l = 0; l < dl_lod_coarse; ++l)
+	if(dl->lod[l])
+		LDrawDLDestroy(dl->lod[l]);
+
 	glDeleteBuffers(1,&dl->idx_vbo);
 	#endif
 	glDeleteBuffers(1,&dl->geo_vbo);
 	free(dl);
 
 }//end LDrawDLDestroy
+
+
+//========== LDrawDLGetLOD =======================================================
+//
+// Purpose:	Return the DL to draw at a given level of detail.
+//
+// Notes:	Parts too simple to have a LOD at some level get the next finer one
+//			instead - at worst the DL itself.
+//
+//================================================================================
+struct LDrawDL * LDrawDLGetLOD(struct LDrawDL * dl, int level)
+{
+	#if WANT_SMOOTH
+	for(; level > dl_lod_full; --level)
+	if(dl->lod[level - 1])
+		return dl->lod[level - 1];
+	#endif
+	return dl;
+
+}//end LDrawDLGetLOD
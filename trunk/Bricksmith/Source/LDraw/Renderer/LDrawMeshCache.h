@@ -0,0 +1,78 @@
+//
+//  LDrawMeshCache.h
+//  Bricksmith
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//
+
+#import <Cocoa/Cocoa.h>
+
+/*
+
+	LDrawMeshCache - THEORY OF OPERATION
+
+	Building a DL runs the whole MeshSmooth pipeline (sort, crease, T-junction
+	removal, smoothing, merging) on the DL's geometry.  For a big part this is
+	by far the most expensive thing we do the first time it is drawn, and the
+	answer is the same every session.
+
+	The mesh cache saves the smoother's output - the indexed vertex table, the
+	index table and the per-texture start/count arrays - in one small file per
+	mesh in ~/Library/Caches.
+
+	Entries are keyed by a digest of the smoother's INPUT: every vertex of every
+	primitive, in the order they are fed to the mesh, grouped by texture slot.
+	Texture specs are not part of the key; the smoother only sees slot
+	numbers, and the GL texture objects are different every run anyway.
+	Because the key is the content, there is no invalidation: if a part
+	changes, it simply hashes to a new entry.
+
+	The cache version must be bumped whenever MeshSmooth's output changes for
+	the same input (or the file layout changes); stale files are then ignored
+	and overwritten.
+
+	Reads map the file; the vertex and index tables go straight from the
+	mapping to glBufferData.
+
+	Only optimized library parts use the cache (see LDrawDLBuilderCreate).  The
+	folder is still capped in size: a hit touches the file's modification date,
+	and when a write takes the folder over the cap, the least recently used
+	files are deleted until it is comfortably under again.
+
+ */
+
+#define LDRAW_MESH_CACHE_KEY_SIZE	32
+
+// The smoother's output for one mesh.  For a mesh read from the cache, the
+// pointers refer into the cache file and stay valid until the data is released.
+struct LDrawMeshCacheData {
+	int						vertex_count;		// Vertices are 10 floats - xyz, normal, rgba.
+	const float *			vertex_table;
+	int						index_count;
+	const unsigned int *	index_table;
+	int						tex_count;			// Each array below has tex_count entries.
+	const int *				line_start;
+	const int *				line_count;
+	const int *				tri_start;
+	const int *				tri_count;
+	const int *				quad_start;
+	const int *				quad_count;
+	void *					storage;			// Private - backing store of a cache read.
+};
+
+// Looks up a mesh.  Returns 1 and fills in data on a hit; the data must then
+// be released with LDrawMeshCacheRelease.  tex_count is the number of texture
+// slots the caller expects; an entry with any other count is a miss.
+int						LDrawMeshCacheRead(
+								const unsigned char					key[LDRAW_MESH_CACHE_KEY_SIZE],
+								int									tex_count,
+								struct LDrawMeshCacheData *			out_data);
+
+void					LDrawMeshCacheRelease(struct LDrawMeshCacheData * data);
+
+// Saves freshly smoothed output under key.  Failures are silently ignored -
+// we'll just smooth again next time.
+void					LDrawMeshCacheWrite(
+								const unsigned char					key[LDRAW_MESH_CACHE_KEY_SIZE],
+								const struct LDrawMeshCacheData *	data);
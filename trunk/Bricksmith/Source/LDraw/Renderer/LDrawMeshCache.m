@@ -0,0 +1,364 @@
+//
+//  LDrawMeshCache.m
+//  Bricksmith
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//
+
+#import "LDrawMeshCache.h"
+
+#import <pthread.h>
+#import <sys/time.h>
+
+#import "LDrawPaths.h"
+
+/*
+	Cache file layout - everything is native-endian, since the cache never
+	leaves the machine:
+
+		header
+		float			vertex_table[vertex_count * VERT_STRIDE]
+		uint32_t		index_table[index_count]
+		int32_t			line_start[tex_count]
+		int32_t			line_count[tex_count]
+		int32_t			tri_start[tex_count]
+		int32_t			tri_count[tex_count]
+		int32_t			quad_start[tex_count]
+		int32_t			quad_count[tex_count]
+
+	The header carries the full key; the file name only uses half of it.
+*/
+
+/*
+	Cache versions.  Bump MESH_CACHE_VERSION in the same change as anything
+	that can alter what the smoother writes for the same input - sorting,
+	welding, T junction removal, creasing, smoothing, vertex order - or the
+	cache goes on handing back meshes made the old way and hides the change.
+
+		1	First cache layout.
+		2	Vertices reordered for the post-transform vertex cache.
+		3	Weld centroids summed in array order, and T junctions found against
+			the vertices' final positions.  These shipped before 2 without a
+			bump, so caches written by those builds are thrown out here.
+*/
+
+#define MESH_CACHE_MAGIC		0x42534D43		// 'BSMC'
+#define MESH_CACHE_VERSION		3
+#define MESH_CACHE_EXTENSION	@"bsmc"
+#define VERT_STRIDE				10
+#define MESH_CACHE_MAX_BYTES	(256LL * 1024 * 1024)	// Prune when the folder grows past this...
+#define MESH_CACHE_PRUNE_BYTES	(192LL * 1024 * 1024)	// ...down to this, so we don't prune on every write.
+
+struct MeshCacheHeader {
+	uint32_t		magic;
+	uint32_t		version;
+	unsigned char	key[LDRAW_MESH_CACHE_KEY_SIZE];
+	uint32_t		vertex_stride;
+	uint32_t		vertex_count;
+	uint32_t		index_count;
+	uint32_t		tex_count;
+};
+
+// Size of the cache folder, as far as we know; -1 until the first write
+// measures it.  Guarded by CacheSizeMutex.
+static pthread_mutex_t	CacheSizeMutex	= PTHREAD_MUTEX_INITIALIZER;
+static long long		CacheSizeBytes	= -1;
+
+
+//========== path_for_key ========================================================
+//
+// Purpose:	Returns the cache file for a key.
+//
+//================================================================================
+static NSString * path_for_key(const unsigned char key[LDRAW_MESH_CACHE_KEY_SIZE])
+{
+	char	name[LDRAW_MESH_CACHE_KEY_SIZE + 1];
+	int		i;
+
+	for(i = 0; i < LDRAW_MESH_CACHE_KEY_SIZE / 2; ++i)
+		sprintf(name + i * 2, "%02x", key[i]);
+
+	return [[[[LDrawPaths sharedPaths] meshCachePath] stringByAppendingPathComponent:[NSString stringWithUTF8String:name]]
+															stringByAppendingPathExtension:MESH_CACHE_EXTENSION];
+}//end path_for_key
+
+
+//========== cache_entries =======================================================
+//
+// Purpose:	Returns the URLs of every file in the cache folder, with their
+//			sizes and modification dates prefetched.
+//
+//================================================================================
+static NSArray * cache_entries(void)
+{
+	NSURL * folder = [NSURL fileURLWithPath:[[LDrawPaths sharedPaths] meshCachePath] isDirectory:YES];
+
+	return [[NSFileManager defaultManager] contentsOfDirectoryAtURL:folder
+										 includingPropertiesForKeys:[NSArray arrayWithObjects:NSURLFileSizeKey, NSURLContentModificationDateKey, nil]
+															options:NSDirectoryEnumerationSkipsHiddenFiles
+															  error:NULL];
+}//end cache_entries
+
+
+//========== entry_size ==========================================================
+//
+// Purpose:	Returns the size of a file from cache_entries.
+//
+//================================================================================
+static long long entry_size(NSURL * entry)
+{
+	NSNumber * size = nil;
+
+	[entry getResourceValue:&size forKey:NSURLFileSizeKey error:NULL];
+	return [size longLongValue];
+}//end entry_size
+
+
+//========== entry_date ==========================================================
+//
+// Purpose:	Returns when a file from cache_entries was last used.
+//
+//================================================================================
+static NSDate * entry_date(NSURL * entry)
+{
+	NSDate * date = nil;
+
+	[entry getResourceValue:&date forKey:NSURLContentModificationDateKey error:NULL];
+	return date ? date : [NSDate distantPast];
+}//end entry_date
+
+
+//========== prune_cache =========================================================
+//
+// Purpose:	Measures the cache folder and, if it is over MESH_CACHE_MAX_BYTES,
+//			deletes the least recently used files until it is down to
+//			MESH_CACHE_PRUNE_BYTES.  Returns the size left behind.
+//
+// Notes:	Deleting a file someone is reading is safe - the reader's mapping
+//			keeps the pages alive until it lets go.
+//
+//================================================================================
+static long long prune_cache(void)
+{
+	NSArray *		entries	= cache_entries();
+	long long		total	= 0;
+
+	for(NSURL * entry in entries)
+		total += entry_size(entry);
+
+	if(total <= MESH_CACHE_MAX_BYTES)
+		return total;
+
+	entries = [entries sortedArrayUsingComparator:^NSComparisonResult(id a, id b) {
+		return [entry_date(a) compare:entry_date(b)];
+	}];
+
+	for(NSURL * entry in entries)
+	{
+		if(total <= MESH_CACHE_PRUNE_BYTES)
+			break;
+		if([[NSFileManager defaultManager] removeItemAtURL:entry error:NULL])
+			total -= entry_size(entry);
+	}
+
+	return total;
+}//end prune_cache
+
+
+//========== note_cache_write ====================================================
+//
+// Purpose:	Accounts for a file just written, pruning if that took the folder
+//			over its cap.
+//
+// Notes:	The running total is only an estimate (rewriting a stale entry
+//			counts twice, other processes write too), so the folder is measured
+//			for real the first time and whenever the estimate hits the cap.
+//
+//================================================================================
+static void note_cache_write(long long bytes)
+{
+	pthread_mutex_lock(&CacheSizeMutex);
+
+	if(CacheSizeBytes >= 0)
+		CacheSizeBytes += bytes;
+
+	if(CacheSizeBytes < 0 || CacheSizeBytes > MESH_CACHE_MAX_BYTES)
+		CacheSizeBytes = prune_cache();
+
+	pthread_mutex_unlock(&CacheSizeMutex);
+}//end note_cache_write
+
+
+//========== ranges_ok ===========================================================
+//
+// Purpose:	Checks that every start/count pair lies inside the index table.
+//
+//================================================================================
+static int ranges_ok(const int * starts, const int * counts, int tex_count, int index_count)
+{
+	int i;
+	for(i = 0; i < tex_count; ++i)
+	{
+		if(starts[i] < 0 || counts[i] < 0 || starts[i] > index_count - counts[i])
+			return 0;
+	}
+	return 1;
+}//end ranges_ok
+
+
+//========== LDrawMeshCacheRead ==================================================
+//
+// Purpose:	Map a cache entry and point the caller at its tables.
+//
+// Notes:	A damaged file can't be allowed to hand the GL out-of-range
+//			indices, so we check every index.  That's one linear pass over
+//			memory we are about to upload anyway - nothing next to smoothing.
+//
+//================================================================================
+int LDrawMeshCacheRead(
+					const unsigned char					key[LDRAW_MESH_CACHE_KEY_SIZE],
+					int									tex_count,
+					struct LDrawMeshCacheData *			out_data)
+{
+	NSData *						file;
+	const char *					bytes;
+	const struct MeshCacheHeader *	header;
+	NSUInteger						expected_length;
+	const int *						ranges;
+	int								i;
+	NSString *						path = path_for_key(key);
+
+	file = [[NSData alloc] initWithContentsOfFile:path
+										  options:NSDataReadingMappedIfSafe
+											error:NULL];
+	if(file == nil)
+		return 0;
+
+	bytes = (const char *) [file bytes];
+	header = (const struct MeshCacheHeader *) bytes;
+
+	if([file length] < sizeof(struct MeshCacheHeader)
+	|| header->magic != MESH_CACHE_MAGIC
+	|| header->version != MESH_CACHE_VERSION
+	|| header->vertex_stride != VERT_STRIDE
+	|| header->tex_count != (uint32_t) tex_count
+	|| header->vertex_count > INT32_MAX / (VERT_STRIDE * sizeof(float))
+	|| header->index_count > INT32_MAX / sizeof(uint32_t)
+	|| memcmp(header->key, key, LDRAW_MESH_CACHE_KEY_SIZE) != 0)
+	{
+		[file release];
+		return 0;
+	}
+
+	expected_length = sizeof(struct MeshCacheHeader)
+					+ (NSUInteger) header->vertex_count * VERT_STRIDE * sizeof(float)
+					+ (NSUInteger) header->index_count * sizeof(uint32_t)
+					+ (NSUInteger) tex_count * 6 * sizeof(int32_t);
+	if([file length] != expected_length)
+	{
+		[file release];
+		return 0;
+	}
+
+	out_data->vertex_count	= header->vertex_count;
+	out_data->vertex_table	= (const float *) (bytes + sizeof(struct MeshCacheHeader));
+	out_data->index_count	= header->index_count;
+	out_data->index_table	= (const unsigned int *) (out_data->vertex_table + header->vertex_count * VERT_STRIDE);
+	out_data->tex_count		= tex_count;
+
+	ranges = (const int *) (out_data->index_table + header->index_count);
+	out_data->line_start	= ranges + tex_count * 0;
+	out_data->line_count	= ranges + tex_count * 1;
+	out_data->tri_start		= ranges + tex_count * 2;
+	out_data->tri_count		= ranges + tex_count * 3;
+	out_data->quad_start	= ranges + tex_count * 4;
+	out_data->quad_count	= ranges + tex_count * 5;
+	out_data->storage		= file;
+
+	for(i = 0; i < out_data->index_count; ++i)
+	{
+		if(out_data->index_table[i] >= (unsigned int) out_data->vertex_count)
+		{
+			LDrawMeshCacheRelease(out_data);
+			return 0;
+		}
+	}
+
+	if(!ranges_ok(out_data->line_start, out_data->line_count, tex_count, out_data->index_count)
+	|| !ranges_ok(out_data->tri_start,  out_data->tri_count,  tex_count, out_data->index_count)
+	|| !ranges_ok(out_data->quad_start, out_data->quad_count, tex_count, out_data->index_count))
+	{
+		LDrawMeshCacheRelease(out_data);
+		return 0;
+	}
+
+	// Touch the file so pruning sees it as recently used.
+	utimes([path fileSystemRepresentation], NULL);
+
+	return 1;
+}//end LDrawMeshCacheRead
+
+
+//========== LDrawMeshCacheRelease ===============================================
+//
+// Purpose:	Unmap a cache entry returned by LDrawMeshCacheRead.
+//
+//================================================================================
+void LDrawMeshCacheRelease(struct LDrawMeshCacheData * data)
+{
+	[(NSData *) data->storage release];
+	memset(data, 0, sizeof(struct LDrawMeshCacheData));
+}//end LDrawMeshCacheRelease
+
+
+//========== LDrawMeshCacheWrite =================================================
+//
+// Purpose:	Save one smoothed mesh.
+//
+// Notes:	The write is atomic (temp file + rename), so two windows building
+//			the same part, or a crash mid-write, never leave a torn file.
+//
+//			This is also where the folder is held to its size cap.
+//
+//================================================================================
+void LDrawMeshCacheWrite(
+					const unsigned char					key[LDRAW_MESH_CACHE_KEY_SIZE],
+					const struct LDrawMeshCacheData *	data)
+{
+	struct MeshCacheHeader	header;
+	NSMutableData *			file;
+	NSString *				path = path_for_key(key);
+
+	memset(&header, 0, sizeof(header));
+	header.magic			= MESH_CACHE_MAGIC;
+	header.version			= MESH_CACHE_VERSION;
+	header.vertex_stride	= VERT_STRIDE;
+	header.vertex_count		= data->vertex_count;
+	header.index_count		= data->index_count;
+	header.tex_count		= data->tex_count;
+	memcpy(header.key, key, LDRAW_MESH_CACHE_KEY_SIZE);
+
+	file = [[NSMutableData alloc] initWithCapacity:sizeof(header)
+												 + data->vertex_count * VERT_STRIDE * sizeof(float)
+												 + data->index_count * sizeof(uint32_t)
+												 + data->tex_count * 6 * sizeof(int32_t)];
+
+	[file appendBytes:&header				length:sizeof(header)];
+	[file appendBytes:data->vertex_table	length:data->vertex_count * VERT_STRIDE * sizeof(float)];
+	[file appendBytes:data->index_table		length:data->index_count * sizeof(uint32_t)];
+	[file appendBytes:data->line_start		length:data->tex_count * sizeof(int32_t)];
+	[file appendBytes:data->line_count		length:data->tex_count * sizeof(int32_t)];
+	[file appendBytes:data->tri_start		length:data->tex_count * sizeof(int32_t)];
+	[file appendBytes:data->tri_count		length:data->tex_count * sizeof(int32_t)];
+	[file appendBytes:data->quad_start		length:data->tex_count * sizeof(int32_t)];
+	[file appendBytes:data->quad_count		length:data->tex_count * sizeof(int32_t)];
+
+	[[NSFileManager defaultManager] createDirectoryAtPath:[path stringByDeletingLastPathComponent]
+							  withIntermediateDirectories:YES
+											   attributes:nil
+													error:NULL];
+	if([file writeToFile:path atomically:YES])
+		note_cache_write([file length]);
+	[file release];
+}//end LDrawMeshCacheWrite
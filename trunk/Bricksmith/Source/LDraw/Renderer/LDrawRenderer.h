@@ -24,6 +24,7 @@ enum {
 enum {					// Culling codes from renderer culling checks.
 	cull_skip,			// Don't draw - object is off screen or too-small-to-care.
 	cull_box,			// Draw, but consider replacing with a box for speed - the object is rather small.
+	cull_lod,			// Draw, but a simplified mesh will do - the object is a few dozen pixels across.
 	cull_draw			// Draw, the object is on screen and big.
 };
 
@@ -135,9 +136,14 @@ typedef void (* LDrawDLCleanup_f)(LDrawDLHandle  who);			// Cleanup function ass
 // display list can be accumulated into at one time.  (This is a bit of a defect of the API that we
 // should consider some day fixing.)
 - (id<LDrawCollector>) beginDL;	
+- (id<LDrawCollector>) beginLibraryPartDL;	// As beginDL, for an optimized library part - the only DLs whose meshes are cached on disk.
 - (void) endDL:(LDrawDLHandle *) outHandle cleanupFunc:(LDrawDLCleanup_f *)func;		// Returns NULL if the display list is empty (e.g. no calls between begin/end)
 
 - (void) drawDL:(LDrawDLHandle)dl;
 
+// Draws a DL at the level of detail that suits a cull code from checkCull:to: -
+// cull_box and cull_lod pick progressively less simplified stand-ins for the DL.
+- (void) drawDL:(LDrawDLHandle)dl cull:(int)cull_result;
+
 @end
 
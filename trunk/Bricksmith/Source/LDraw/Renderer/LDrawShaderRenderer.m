@@ -84,7 +84,7 @@ static void set_color4fv(GLfloat * c, GLfloat storage[4])
 		   modelView:(GLfloat *)mv_matrix
 		  projection:(GLfloat *)proj_matrix
 {	
-	pool = LDrawBDPCreate();
+	pool = LDrawBDPBorrow(LDRAW_BDP_DEFAULT_PAGE_SIZE);
 	// Build our shader if it doesn't exist yet.  For now, just stash the GL 
 	// object statically.
 	static GLuint prog = 0;
@@ -168,7 +168,7 @@ static void set_color4fv(GLfloat * c, GLfloat storage[4])
 	glEnableClientState(GL_NORMAL_ARRAY);
 	glEnableClientState(GL_VERTEX_ARRAY);
 
-	LDrawBDPDestroy(pool);
+	LDrawBDPReturn(pool);
 
 	[super dealloc];
 	
@@ -220,7 +220,8 @@ static void set_color4fv(GLfloat * c, GLfloat storage[4])
 //			bounding cube (in MV coordinates) is now entirely out of clip bounds.
 //
 // Notes:	we also look at the screen-space size of the box to decide if we can
-//			cull it because it's tiny or replace it with a box.
+//			cull it because it's tiny, replace it with a box or draw it with a
+//			simplified mesh.
 //
 // TODO:	change hard-coded values to be compensated for aspect ratio, etc.
 //
@@ -252,6 +253,8 @@ static void set_color4fv(GLfloat * c, GLfloat storage[4])
 		return cull_skip;
 	if(dim < 10)
 		return cull_box;
+	if(dim < 40)
+		return cull_lod;
 	
 	return cull_draw;
 }//end pushMatrix:to:
@@ -272,7 +275,7 @@ static void set_color4fv(GLfloat * c, GLfloat storage[4])
 	static struct LDrawDL * unit_cube = NULL;
 	if(!unit_cube)
 	{
-		struct LDrawDLBuilder * builder = LDrawDLBuilderCreate();
+		struct LDrawDLBuilder * builder = LDrawDLBuilderCreate(0);
 
 		#define LBR 0,0,0
 		#define RBR 1,0,0
@@ -668,13 +671,32 @@ static void set_color4fv(GLfloat * c, GLfloat storage[4])
 	
 	dl_stack[dl_stack_top] = dl_now;
 	++dl_stack_top;
-	dl_now = LDrawDLBuilderCreate();
+	dl_now = LDrawDLBuilderCreate(0);
 	
 	return self;
 
 }//end beginDL:
 
 
+//========== beginLibraryPartDL ==================================================
+//
+// Purpose:	This begins accumulating the display list of an optimized library
+//			part, which may come from (and is saved to) the mesh cache.
+//
+//================================================================================
+- (id<LDrawCollector>) beginLibraryPartDL
+{
+	assert(dl_stack_top < DL_STACK_DEPTH);
+	
+	dl_stack[dl_stack_top] = dl_now;
+	++dl_stack_top;
+	dl_now = LDrawDLBuilderCreate(dl_build_library_part);
+	
+	return self;
+
+}//end beginLibraryPartDL
+
+
 //========== endDL:cleanupFunc: ==================================================
 //
 // Purpose: close off a DL, returning the display list if there is one.
@@ -712,4 +734,24 @@ static void set_color4fv(GLfloat * c, GLfloat storage[4])
 
 }//end drawDL:
 
+
+//========== drawDL:cull: ========================================================
+//
+// Purpose:	draw a DL, or one of its LODs if the cull code says the object is
+//			small enough on screen not to need every stud.
+//
+//================================================================================
+- (void) drawDL:(LDrawDLHandle)dl cull:(int)cull_result
+{
+	int level = dl_lod_full;
+	
+	if(cull_result == cull_box)
+		level = dl_lod_coarse;
+	else if(cull_result == cull_lod)
+		level = dl_lod_medium;
+	
+	[self drawDL:(LDrawDLHandle) LDrawDLGetLOD((struct LDrawDL *) dl, level)];
+
+}//end drawDL:cull:
+
 @end
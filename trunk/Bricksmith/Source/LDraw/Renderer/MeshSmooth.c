@@ -9,6 +9,10 @@
 
 #include "MeshSmooth.h"
 
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+
 #pragma mark -
 //==============================================================================
 //	BASIC DATASTRUCTURES
@@ -61,6 +65,16 @@ struct VertexInsert {
 	struct Vertex *			vert;		// Pointer to vertex from another triangle that is a T with our edge.
 };
 
+// Insert requests are handed out from blocks owned by the mesh, rather than
+// malloc'd one at a time; they all die with the mesh.
+#define INSERT_BLOCK_SIZE 256
+
+struct InsertBlock {
+	struct InsertBlock *	next;		// Next (older, full) block.
+	int						count;		// Number of inserts used from this block.
+	struct VertexInsert		inserts[INSERT_BLOCK_SIZE];
+};
+
 // A single face in our mesh.
 struct Face {
 	int					degree	   ;		// Number of vertices - this defines whether we are a line, tri or quad.  
@@ -80,6 +94,7 @@ struct Face {
 // A single vertex for a single face.
 struct Vertex {
 											// These properties are intentionally ordered so that we get near-vertices to sort near each other even before normal smoothing.
+											// They must also stay adjacent: compare_vertices reads them as one block of 10 floats.
 	float			location[3];			// Actual vertex location
 	float			normal[3];				// Smooth normal at this vertex - starts as face normal but can be changed by smoothing.
 	float			color[4];				// Color for my face.
@@ -107,11 +122,15 @@ struct Mesh {
 	int					face_capacity;		// Face capacity reserved in array.
 	struct Face *		faces;				// Malloc'd face memory.
 	
-	struct RTree_node *	index;				// Root node of r-tree that indexes vertices.
+	struct RTree_node *	index;				// Root node of r-tree that indexes vertices, while welding with it.
+	struct InsertBlock *insert_blocks;		// Storage for the T junction inserts on our faces; newest block first.
+	double				timers[MESH_TIMER_COUNT];	// Seconds spent so far in each MESH_TIMER_* stage.
 	#if DEBUG
 	int					flags;				// For debugging, we can flag various conditions that aren't errors but are strange (due to LDraw precision issues).
 	#endif
 	int					highest_tid;		// Highest TID - we have this + 1 total textures in this mesh.
+	int					threading;			// MESH_THREADS_* - whether to process on many threads.
+	int					welder;				// MESH_WELD_* - how to find vertices to snap together.
 };
 
 
@@ -220,6 +239,33 @@ todo
 // The std c lib rule is that we are fundamentally returning p1-p2.
 // So when p1 < p2, we return a negative number, etc.
 
+// 4-wide float vectors, using the compiler's vector extensions so that the same
+// code becomes SSE or NEON.  A comparison yields -1 in each lane that is true.
+typedef float	vec4f_t __attribute__((vector_size(16)));
+typedef int		vec4i_t __attribute__((vector_size(16)));
+
+// Unaligned load of 4 floats.  The caller must own all 16 bytes.
+static inline vec4f_t vec4f_load(const float * p)
+{
+	vec4f_t r;
+	memcpy(&r, p, sizeof(r));
+	return r;
+}
+
+// The lanes of a comparison as bits 0-3.
+static inline int vec4i_mask(vec4i_t m)
+{
+	return (m[0] & 1) | (m[1] & 2) | (m[2] & 4) | (m[3] & 8);
+}
+
+// Whether a vertex is at location p (held in the first 3 lanes of pv.)  This
+// is compare_points(v->location,p) == 0, minus the branches; it reads the
+// 4th float after the location, which is the first of the normal.
+static inline int location_equals(const struct Vertex * v, vec4f_t pv)
+{
+	return (vec4i_mask(vec4f_load(v->location) == pv) & 7) == 7;
+}
+
 // Compare two unique 3-d points in space for location-sameness.
 static int compare_points(const float * __restrict p1, const float * __restrict p2)
 {
@@ -237,33 +283,48 @@ static int compare_points(const float * __restrict p1, const float * __restrict
 
 // Compare two vertices for complete match-up of all vertices - vertex, normal, color.
 // If these all match, we could merge the vertices on the graphics card.
+//
+// The 10 floats are adjacent in the vertex, so we compare them 4 at a time,
+// collect a bit per float that is less and per float that is greater, and
+// the lowest bit set in either tells us which float decides the order.
 static int compare_vertices(const struct Vertex * __restrict v1, const struct Vertex * __restrict v2)
 {
-	if(v1->location[0] < v2->location[0])	return -1;
-	if(v1->location[0] > v2->location[0])	return  1;
-	if(v1->location[1] < v2->location[1])	return -1;
-	if(v1->location[1] > v2->location[1])	return  1;
-	if(v1->location[2] < v2->location[2])	return -1;
-	if(v1->location[2] > v2->location[2])	return  1;
-
-	if(v1->normal[0] < v2->normal[0])	return -1;
-	if(v1->normal[0] > v2->normal[0])	return  1;
-	if(v1->normal[1] < v2->normal[1])	return -1;
-	if(v1->normal[1] > v2->normal[1])	return  1;
-	if(v1->normal[2] < v2->normal[2])	return -1;
-	if(v1->normal[2] > v2->normal[2])	return  1;
-
-	if(v1->color[0] < v2->color[0])	return -1;
-	if(v1->color[0] > v2->color[0])	return  1;
-	if(v1->color[1] < v2->color[1])	return -1;
-	if(v1->color[1] > v2->color[1])	return  1;
-	if(v1->color[2] < v2->color[2])	return -1;
-	if(v1->color[2] > v2->color[2])	return  1;
-	if(v1->color[3] < v2->color[3])	return -1;
-	if(v1->color[3] > v2->color[3])	return  1;	
-	
-	return 0;
-	
+	const float * a = v1->location;
+	const float * b = v2->location;
+	vec4f_t a0 = vec4f_load(a), a1 = vec4f_load(a+4);
+	vec4f_t b0 = vec4f_load(b), b1 = vec4f_load(b+4);
+
+	int lt = vec4i_mask(a0 < b0) | (vec4i_mask(a1 < b1) << 4) | ((a[8] < b[8]) << 8) | ((a[9] < b[9]) << 9);
+	int gt = vec4i_mask(a0 > b0) | (vec4i_mask(a1 > b1) << 4) | ((a[8] > b[8]) << 8) | ((a[9] > b[9]) << 9);
+	int diff = lt | gt;
+
+	if(diff == 0)
+		return 0;
+	return (lt & diff & -diff) ? -1 : 1;
+}
+
+// Tie-breaker for sorting: no two vertices share both a face and an index
+// within it.  Breaking ties this way makes our sort orders total, so any
+// correct sort - one thread or many - leaves the vertices in the same order.
+static int compare_owners(const struct Vertex * __restrict v1, const struct Vertex * __restrict v2)
+{
+	if(v1->face < v2->face)	return -1;
+	if(v1->face > v2->face)	return  1;
+	return v1->index - v2->index;
+}
+
+// Sort order by location, ties broken by owner.
+static int compare_order_3(const struct Vertex * v1, const struct Vertex * v2)
+{
+	int r = compare_points(v1->location, v2->location);
+	return r ? r : compare_owners(v1, v2);
+}
+
+// Sort order by all 10 coords, ties broken by owner.
+static int compare_order_10(const struct Vertex * v1, const struct Vertex * v2)
+{
+	int r = compare_vertices(v1, v2);
+	return r ? r : compare_owners(v1, v2);
 }
 
 // Compare only the "Nth" location field, e.g. only x, y, or z.  
@@ -304,7 +365,7 @@ static void bubble_sort_10(struct Vertex * items, int count)
 		int high_count = 0;
 		swapped = 0;
 		for(i = 1; i < count; ++i)
-		if(compare_vertices(items+i-1,items+i) > 0)
+		if(compare_order_10(items+i-1,items+i) > 0)
 		{
 			swap_blocks(items+i-1,items+i,sizeof(struct Vertex) / sizeof(int));
 			swapped = true;
@@ -316,6 +377,10 @@ static void bubble_sort_10(struct Vertex * items, int count)
 
 // sort APIs are wrapped in functions that don't have an algo, e.g. "just sort by 
 // 10 coords" so we can easily try different algos and see which is fastest.
+//
+// Unlike the location sort, this one stays comparison-based: its input is
+// already in location order, so the bubble sort is close to linear here,
+// where a radix sort would need a counting pass per byte of 10 keys.
 static void sort_vertices_10(struct Vertex * base, int count)
 {
 	bubble_sort_10(base,count);
@@ -323,23 +388,22 @@ static void sort_vertices_10(struct Vertex * base, int count)
 
 // 3-coordinate quick-sort.  The range of arr from [left to right] (inclusive!!)
 // is sorted using quick-sort.  For totally unsorted data, this is a good sort 
-// choice.  Only location is used to sort.
+// choice.  Location is used to sort; colocated vertices go in owner order.
 static void quickSort_3(struct Vertex * arr, int left, int right) 
 {
 	int i = left, j = right;
 
-	struct Vertex * pivot_ptr = arr + (left + right) / 2;
-	float pivot[3] = { pivot_ptr->location[0], pivot_ptr->location[1], pivot_ptr->location[2] };
+	struct Vertex pivot = arr[(left + right) / 2];
 	
 	/* partition */
 
 	while (i <= j) 
 	{
 
-		while(compare_points(arr[i].location,pivot) < 0)
+		while(compare_order_3(arr+i,&pivot) < 0)
 			++i;
 
-		while(compare_points(arr[j].location,pivot) > 0)
+		while(compare_order_3(arr+j,&pivot) > 0)
 			--j;
 
 		if (i <= j) 
@@ -402,11 +466,109 @@ static void quickSort_n(struct Vertex ** arr, int left, int right, int n)
 
 }
 
+// Order-preserving integer key for a float: with the sign bit flipped on
+// positive numbers and every bit flipped on negative ones, unsigned integer
+// order is float order.  -0 is folded into +0 first, since compare_points
+// calls them equal.
+static inline uint32_t float_key(float f)
+{
+	uint32_t u = 0;
+	if(f != 0.0f)
+		memcpy(&u, &f, sizeof(u));
+	return (u & 0x80000000) ? ~u : (u | 0x80000000);
+}
+
+// Radix sort by location.  Each vertex gets a key - its location, then its
+// owner, as compare_order_3 orders them - and the keys are sorted a byte at a
+// time, least significant byte first (LSD), with a counting pass per byte.
+// There are no comparisons at all, so no mispredicted branches, and the time
+// is linear in the number of vertices.
+//
+// Bytes that are the same in every key are skipped; LDraw coordinates are
+// mostly small whole numbers, so the low bytes of the mantissas usually are.
+// The vertices themselves are moved just once, at the end.
+//
+// Below RADIX_MIN_COUNT vertices, the counting passes cost more than they
+// save and quick-sort wins.
+#define RADIX_MIN_COUNT 64
+
+// Key words, least significant first: owner (as a pointer, low then high
+// half), z, y, x.
+#define RADIX_KEY_WORDS 5
+#define RADIX_DIGITS (RADIX_KEY_WORDS * 4)
+
+struct RadixRecord {
+	uint32_t		key[RADIX_KEY_WORDS];
+	int				index;					// Where the vertex is in the unsorted array.
+};
+
+static void radix_sort_3(struct Vertex * base, int count)
+{
+	struct RadixRecord * src = (struct RadixRecord *) malloc(sizeof(struct RadixRecord) * count * 2);
+	struct RadixRecord * dst = src + count;
+	struct Vertex * sorted;
+	int (* histogram)[256] = (int (*)[256]) calloc(RADIX_DIGITS, sizeof(int) * 256);
+	int i, d;
+
+	for(i = 0; i < count; ++i)
+	{
+		// Faces are far more than 4 bytes apart, so face + index orders
+		// exactly as compare_owners does.
+		uint64_t owner = (uint64_t) (uintptr_t) base[i].face + (uint64_t) base[i].index;
+		struct RadixRecord * r = src + i;
+		r->key[0] = (uint32_t) owner;
+		r->key[1] = (uint32_t) (owner >> 32);
+		r->key[2] = float_key(base[i].location[2]);
+		r->key[3] = float_key(base[i].location[1]);
+		r->key[4] = float_key(base[i].location[0]);
+		r->index = i;
+		for(d = 0; d < RADIX_DIGITS; ++d)
+			++histogram[d][(r->key[d >> 2] >> ((d & 3) * 8)) & 0xFF];
+	}
+
+	for(d = 0; d < RADIX_DIGITS; ++d)
+	{
+		int * h = histogram[d];
+		int shift = (d & 3) * 8;
+		int sum = 0, b;
+		struct RadixRecord * t;
+
+		if(h[(src->key[d >> 2] >> shift) & 0xFF] == count)
+			continue;
+
+		for(b = 0; b < 256; ++b)
+		{
+			int n = h[b];
+			h[b] = sum;
+			sum += n;
+		}
+
+		for(i = 0; i < count; ++i)
+			dst[h[(src[i].key[d >> 2] >> shift) & 0xFF]++] = src[i];
+
+		t = src;
+		src = dst;
+		dst = t;
+	}
+
+	sorted = (struct Vertex *) malloc(sizeof(struct Vertex) * count);
+	for(i = 0; i < count; ++i)
+		sorted[i] = base[src[i].index];
+	memcpy(base, sorted, sizeof(struct Vertex) * count);
+
+	free(sorted);
+	free(histogram);
+	free(src < dst ? src : dst);
+}
+
 // General sort by location API, see sort_vertices_10 for
 // logic.
 static void sort_vertices_3(struct Vertex * base, int count)
 {
-	quickSort_3(base,0,count-1);
+	if(count < RADIX_MIN_COUNT)
+		quickSort_3(base,0,count-1);
+	else
+		radix_sort_3(base,count);
 }
 
 // Search primitive.  Given a sorted (by location) array of vertices and a target point (p3) this routine finds the range
@@ -439,7 +601,8 @@ static void range_for_point(struct Vertex * base, int count, struct Vertex ** be
 
 	*begin = first;
 	
-	while(first < stop && compare_points(first->location,p) == 0)
+	vec4f_t pv = { p[0], p[1], p[2], 0.0f };
+	while(first < stop && location_equals(first,pv))
 		++first;
 	*end = first;
 }
@@ -450,10 +613,11 @@ static void range_for_point(struct Vertex * base, int count, struct Vertex ** be
 static void range_for_vertex(struct Vertex * base, struct Vertex * stop, struct Vertex ** begin, struct Vertex ** end, struct Vertex * q)
 {
 	struct Vertex *b = q, *e = q;
-	while(b >= base && compare_points(b->location,q->location) == 0)
+	vec4f_t qv = vec4f_load(q->location);
+	while(b >= base && location_equals(b,qv))
 		--b;
 	++b;
-	while(e < stop && compare_points(e->location,q->location) == 0)
+	while(e < stop && location_equals(e,qv))
 		++e;
 	assert(b < e);
 	assert(b <= q);
@@ -631,6 +795,131 @@ void scan_rtree(struct RTree_node * n, float min_bounds[3], float max_bounds[3],
 	}
 }
 
+#pragma mark -
+//==============================================================================
+//	WELDING GRID
+//==============================================================================
+//
+// The grid is the other way to find vertices to snap together.  Space is cut
+// into cubes EPSI on a side and each distinct vertex location is filed under
+// the cube it falls in.  A box of +/- EPSI around a point touches at most 3
+// cubes per axis, so probing those cubes finds every vertex the R-tree box
+// query would - in the same box, tested the same way - without the recursion
+// and pointer chasing of the tree.
+//
+// The cubes are hashed into buckets; entries are stored flat, sorted by bucket,
+// with a start index per bucket.  Once built the grid is only read, so it can
+// be probed from many threads at once.
+
+// Cell coordinates are clamped to this; anything past it is nonsense geometry,
+// and lumping it into the edge cells is still correct, just slower.
+#define GRID_CELL_LIMIT (1 << 30)
+
+struct GridEntry {
+	int					cell[3];
+	struct Vertex *		vertex;
+};
+
+struct WeldGrid {
+	unsigned int		mask;				// Bucket count - 1; the count is a power of 2.
+	int *				starts;				// Bucket b's entries are [starts[b], starts[b+1]).
+	struct GridEntry *	entries;
+};
+
+// Clamps a floored cell coordinate to something we can store.
+static inline int clamp_cell(double c)
+{
+	if(!(c > -GRID_CELL_LIMIT))	return -GRID_CELL_LIMIT;		// (also catches NaN)
+	if(c > GRID_CELL_LIMIT)		return  GRID_CELL_LIMIT;
+	return (int) c;
+}
+
+// The cell coordinate along one axis.  This is monotonic in x, which is what
+// guarantees that a box's cells contain everything inside the box.
+static inline int grid_cell(float x)
+{
+	return clamp_cell(floor(x / EPSI));
+}
+
+static inline unsigned int grid_hash(const int cell[3])
+{
+	return ((unsigned int) cell[0] * 73856093u) ^ ((unsigned int) cell[1] * 19349663u) ^ ((unsigned int) cell[2] * 83492791u);
+}
+
+// Builds the grid over a location-sorted vertex array.  Like the R-tree, only
+// the first of each run of colocated vertices is filed.
+static struct WeldGrid * build_weld_grid(struct Vertex * base, int count)
+{
+	struct WeldGrid * grid = (struct WeldGrid *) malloc(sizeof(struct WeldGrid));
+	struct GridEntry * cells = (struct GridEntry *) malloc(sizeof(struct GridEntry) * count);
+	int * fill;
+	int buckets = 16;
+	int distinct = 0;
+	int i, b;
+
+	for(i = 0; i < count; ++i)
+	if(i == 0 || compare_points(base[i-1].location,base[i].location) != 0)
+	{
+		cells[distinct].cell[0] = grid_cell(base[i].location[0]);
+		cells[distinct].cell[1] = grid_cell(base[i].location[1]);
+		cells[distinct].cell[2] = grid_cell(base[i].location[2]);
+		cells[distinct].vertex = base+i;
+		++distinct;
+	}
+
+	while(buckets < distinct * 2)
+		buckets *= 2;
+	grid->mask = buckets - 1;
+	grid->starts = (int *) calloc(buckets + 1, sizeof(int));
+	grid->entries = (struct GridEntry *) malloc(sizeof(struct GridEntry) * (distinct ? distinct : 1));
+
+	// Counting sort by bucket; within a bucket, entries stay in array order.
+	for(i = 0; i < distinct; ++i)
+		++grid->starts[(grid_hash(cells[i].cell) & grid->mask) + 1];
+	for(b = 0; b < buckets; ++b)
+		grid->starts[b+1] += grid->starts[b];
+
+	fill = (int *) malloc(sizeof(int) * buckets);
+	memcpy(fill, grid->starts, sizeof(int) * buckets);
+	for(i = 0; i < distinct; ++i)
+		grid->entries[fill[grid_hash(cells[i].cell) & grid->mask]++] = cells[i];
+
+	free(fill);
+	free(cells);
+	return grid;
+}
+
+static void destroy_weld_grid(struct WeldGrid * grid)
+{
+	free(grid->starts);
+	free(grid->entries);
+	free(grid);
+}
+
+// Grid scanning routine - the same contract as scan_rtree: the visitor is called
+// for every filed vertex within (inclusive of edges) min_bounds -> max_bounds.
+static void scan_weld_grid(struct WeldGrid * grid, float min_bounds[3], float max_bounds[3], void (* visitor)(struct Vertex *v, void * ref), void * ref)
+{
+	int lo[3] = { grid_cell(min_bounds[0]), grid_cell(min_bounds[1]), grid_cell(min_bounds[2]) };
+	int hi[3] = { grid_cell(max_bounds[0]), grid_cell(max_bounds[1]), grid_cell(max_bounds[2]) };
+	int c[3];
+
+	for(c[2] = lo[2]; c[2] <= hi[2]; ++c[2])
+	for(c[1] = lo[1]; c[1] <= hi[1]; ++c[1])
+	for(c[0] = lo[0]; c[0] <= hi[0]; ++c[0])
+	{
+		unsigned int b = grid_hash(c) & grid->mask;
+		struct GridEntry * e = grid->entries + grid->starts[b];
+		struct GridEntry * stop = grid->entries + grid->starts[b+1];
+		for(; e < stop; ++e)
+		if(e->cell[0] == c[0] && e->cell[1] == c[1] && e->cell[2] == c[2])
+		if(inside(min_bounds,max_bounds,e->vertex->location))
+		{
+			visitor(e->vertex, ref);
+		}
+	}
+}
+
 #pragma mark -
 //==============================================================================
 //	3-D MATH UTILS
@@ -925,6 +1214,286 @@ void validate_neighbors(struct Mesh * mesh)
 }
 #endif
 
+#pragma mark -
+//==============================================================================
+//	PARALLEL EXECUTION
+//==============================================================================
+//
+// Big meshes are processed by a small pool of worker threads plus the calling
+// thread.  A job is a count of items, cut into fixed-size chunks.  Each
+// participant starts with its own contiguous share of the chunks; when that
+// runs dry it steals chunks from the others' shares until there are none left.
+//
+// Chunks are cut at the same boundaries no matter who runs them (or whether
+// the job runs on one thread), so a stage can keep its results per chunk and
+// combine them in chunk order afterward.  That is how the order-sensitive
+// stages (snapping and joining) come out bit-identical to the serial code: the
+// expensive searches run in parallel, and the linking they feed is replayed on
+// one thread in the original order.
+//
+// Only one job at a time has the pool; a caller that finds it busy simply runs
+// all of its chunks itself.
+
+#define MAX_WORKERS 16
+
+// One participant's share of a job.  Owner and thieves alike claim a chunk by
+// atomically advancing next, so no chunk is run twice.  Shares are padded out
+// to a cache line so participants don't fight over each other's counters.
+struct WorkShare {
+	volatile int	next;					// First item of the next unclaimed chunk.
+	int				end;					// End of this share.
+	char			pad[56];
+};
+
+struct WorkJob {
+	void			(* func)(void * ref, int begin, int end);
+	void *			ref;
+	int				grain;					// Items per chunk.
+	int				share_count;			// Workers + the caller.
+	int				joined;					// Workers that have picked up a share so far.
+	struct WorkShare shares[MAX_WORKERS + 1];
+};
+
+static pthread_once_t	pool_once		= PTHREAD_ONCE_INIT;
+static pthread_mutex_t	pool_owner		= PTHREAD_MUTEX_INITIALIZER;	// Held by whoever is running a job.
+static pthread_mutex_t	pool_lock		= PTHREAD_MUTEX_INITIALIZER;	// Protects the variables below.
+static pthread_cond_t	pool_wake		= PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	pool_done		= PTHREAD_COND_INITIALIZER;
+static int				pool_workers	= 0;
+static int				pool_generation	= 0;		// Bumped for each new job.
+static int				pool_busy		= 0;		// Workers not yet done with the current job.
+static struct WorkJob *	pool_job		= NULL;
+
+// Runs chunks for participant "me" - its own share first, then the others'.
+static void run_share(struct WorkJob * job, int me)
+{
+	int k;
+	for(k = 0; k < job->share_count; ++k)
+	{
+		struct WorkShare * s = job->shares + (me + k) % job->share_count;
+		for(;;)
+		{
+			int b = __sync_fetch_and_add(&s->next, job->grain);
+			if(b >= s->end)
+				break;
+			job->func(job->ref, b, b + job->grain < s->end ? b + job->grain : s->end);
+		}
+	}
+}
+
+// A worker thread: sleeps until a job is posted, helps finish it, repeat.
+// Every worker takes part in every job, so pool_busy counts all of them.
+static void * worker_main(void * unused)
+{
+	int seen = 0;
+	(void)unused;
+	pthread_mutex_lock(&pool_lock);
+	for(;;)
+	{
+		struct WorkJob * job;
+		int me;
+		while(pool_generation == seen)
+			pthread_cond_wait(&pool_wake, &pool_lock);
+		seen = pool_generation;
+		job = pool_job;
+		me = ++job->joined;
+		pthread_mutex_unlock(&pool_lock);
+
+		run_share(job, me);
+
+		pthread_mutex_lock(&pool_lock);
+		if(--pool_busy == 0)
+			pthread_cond_signal(&pool_done);
+	}
+	return NULL;
+}
+
+// Starts one worker per extra CPU, once.
+static void start_workers(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int want = cpus > 1 ? (int) cpus - 1 : 0;
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	if(want > MAX_WORKERS)
+		want = MAX_WORKERS;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while(pool_workers < want && pthread_create(&thread, &attr, worker_main, NULL) == 0)
+		++pool_workers;
+	pthread_attr_destroy(&attr);
+}
+
+static int worker_count(void)
+{
+	pthread_once(&pool_once, start_workers);
+	return pool_workers;
+}
+
+// Calls func(ref, begin, end) over [0, count) in chunks of grain items, on as
+// many threads as we have.  Returns once every chunk is done.
+static void parallel_for(int count, int grain, void (* func)(void * ref, int begin, int end), void * ref)
+{
+	int b;
+	if(worker_count() > 0 && count > grain && pthread_mutex_trylock(&pool_owner) == 0)
+	{
+		struct WorkJob job;
+		int chunks = (count + grain - 1) / grain;
+		int s;
+
+		job.func = func;
+		job.ref = ref;
+		job.grain = grain;
+		job.share_count = pool_workers + 1;
+		job.joined = 0;
+		for(s = 0; s < job.share_count; ++s)
+		{
+			job.shares[s].next = grain * (chunks *  s      / job.share_count);
+			job.shares[s].end  = grain * (chunks * (s + 1) / job.share_count);
+			if(job.shares[s].end > count)
+				job.shares[s].end = count;
+		}
+
+		pthread_mutex_lock(&pool_lock);
+		pool_job = &job;
+		pool_busy = pool_workers;
+		++pool_generation;
+		pthread_cond_broadcast(&pool_wake);
+		pthread_mutex_unlock(&pool_lock);
+
+		run_share(&job, 0);
+
+		pthread_mutex_lock(&pool_lock);
+		while(pool_busy > 0)
+			pthread_cond_wait(&pool_done, &pool_lock);
+		pool_job = NULL;
+		pthread_mutex_unlock(&pool_lock);
+
+		pthread_mutex_unlock(&pool_owner);
+	}
+	else
+	{
+		for(b = 0; b < count; b += grain)
+			func(ref, b, b + grain < count ? b + grain : count);
+	}
+}
+
+// Whether this mesh should be processed with parallel_for.
+static int mesh_wants_threads(const struct Mesh * mesh)
+{
+	switch(mesh->threading) {
+	case MESH_THREADS_SERIAL:	return 0;
+	case MESH_THREADS_PARALLEL:	return 1;
+	default:					return mesh->vertex_count >= MESH_PARALLEL_VERTEX_THRESHOLD;
+	}
+}
+
+// Parallel sort: the array is cut into one run per thread, each run is sorted
+// with the serial sort, and then the runs are merged pairwise, each level of
+// merges in parallel.  The merge takes the same total order as the serial sort,
+// so the result is exactly what the serial sort would produce.
+#define SORT_MAX_RUNS (MAX_WORKERS + 1)
+
+struct SortJob {
+	struct Vertex *	src;
+	struct Vertex *	dst;
+	int				runs;
+	int				width;					// Runs per half of a merge, this pass.
+	int				bounds[SORT_MAX_RUNS + 1];
+	void			(* sort)(struct Vertex * base, int count);
+	int				(* compare)(const struct Vertex * v1, const struct Vertex * v2);
+};
+
+static void sort_runs(void * ref, int begin, int end)
+{
+	struct SortJob * job = (struct SortJob *) ref;
+	for(; begin < end; ++begin)
+		job->sort(job->src + job->bounds[begin], job->bounds[begin+1] - job->bounds[begin]);
+}
+
+static void merge_runs(void * ref, int begin, int end)
+{
+	struct SortJob * job = (struct SortJob *) ref;
+	for(; begin < end; ++begin)
+	{
+		int first = begin * 2 * job->width;
+		int mid = first + job->width < job->runs ? first + job->width : job->runs;
+		int last = first + 2 * job->width < job->runs ? first + 2 * job->width : job->runs;
+		struct Vertex * a = job->src + job->bounds[first];
+		struct Vertex * a_end = job->src + job->bounds[mid];
+		struct Vertex * b = a_end;
+		struct Vertex * b_end = job->src + job->bounds[last];
+		struct Vertex * d = job->dst + job->bounds[first];
+
+		while(a < a_end && b < b_end)
+			*d++ = (job->compare(b, a) < 0) ? *b++ : *a++;
+		memcpy(d, a, sizeof(struct Vertex) * (a_end - a));
+		d += a_end - a;
+		memcpy(d, b, sizeof(struct Vertex) * (b_end - b));
+	}
+}
+
+static void parallel_sort_vertices(
+							struct Vertex *		base,
+							int					count,
+							void				(* sort)(struct Vertex * base, int count),
+							int					(* compare)(const struct Vertex * v1, const struct Vertex * v2))
+{
+	struct SortJob job;
+	struct Vertex * temp;
+	int r;
+
+	job.runs = worker_count() + 1;
+	if(job.runs < 2 || count < job.runs * 2)
+	{
+		sort(base, count);
+		return;
+	}
+
+	for(r = 0; r <= job.runs; ++r)
+		job.bounds[r] = (int) ((long long) count * r / job.runs);
+
+	temp = (struct Vertex *) malloc(sizeof(struct Vertex) * count);
+	job.src = base;
+	job.dst = temp;
+	job.sort = sort;
+	job.compare = compare;
+
+	parallel_for(job.runs, 1, sort_runs, &job);
+
+	for(job.width = 1; job.width < job.runs; job.width *= 2)
+	{
+		struct Vertex * t;
+		parallel_for((job.runs + 2 * job.width - 1) / (2 * job.width), 1, merge_runs, &job);
+		t = job.src;
+		job.src = job.dst;
+		job.dst = t;
+	}
+
+	if(job.src != base)
+		memcpy(base, job.src, sizeof(struct Vertex) * count);
+	free(temp);
+}
+
+// Sort APIs for the mesh as a whole - these go parallel for big meshes.
+static void sort_mesh_3(struct Mesh * mesh)
+{
+	if(mesh_wants_threads(mesh))
+		parallel_sort_vertices(mesh->vertices, mesh->vertex_count, sort_vertices_3, compare_order_3);
+	else
+		sort_vertices_3(mesh->vertices, mesh->vertex_count);
+}
+
+static void sort_mesh_10(struct Mesh * mesh)
+{
+	if(mesh_wants_threads(mesh))
+		parallel_sort_vertices(mesh->vertices, mesh->vertex_count, sort_vertices_10, compare_order_10);
+	else
+		sort_vertices_10(mesh->vertices, mesh->vertex_count);
+}
+
 #pragma mark -
 //==============================================================================
 //	MAIN API IMPLEMENTATION
@@ -951,9 +1520,35 @@ struct Mesh *		create_mesh(int tri_count, int quad_count, int line_count)
 	ret->flags = 0;
 	#endif
 	ret->highest_tid = 0;
+	ret->threading = MESH_THREADS_AUTO;
+	ret->welder = MESH_WELD_GRID;
+	ret->index = NULL;
+	ret->insert_blocks = NULL;
+	memset(ret->timers, 0, sizeof(ret->timers));
 	return ret;
 }
 
+// Pick whether the processing routines run on one thread or many; see
+// MESH_THREADS_AUTO and friends.  The output is the same either way.
+void				set_mesh_threading(struct Mesh * mesh, int mode)
+{
+	mesh->threading = mode;
+}
+
+// Pick how finish_faces_and_sort finds vertices to snap; see MESH_WELD_GRID
+// and MESH_WELD_RTREE.  The output is the same either way.
+void				set_mesh_welder(struct Mesh * mesh, int welder)
+{
+	mesh->welder = welder;
+}
+
+// Seconds the mesh has spent in one of the MESH_TIMER_* stages so far.
+double				get_mesh_timer(struct Mesh * mesh, int timer)
+{
+	assert(timer >= 0 && timer < MESH_TIMER_COUNT);
+	return mesh->timers[timer];
+}
+
 // Add one face to the mesh.  Quads and tris can be added in any order but all 
 // quads and tris (polygons) must be added before all lines.
 // When passing a face, simply pass NULL for any 'extra' vertices - that is,
@@ -1054,51 +1649,206 @@ void				add_face(struct Mesh * mesh, const float p1[3], const float p2[3], const
 	f->vertex[3]->face = f;
 }
 
+// Utility: joins the snap rings of two vertices that are too close - unless
+// they are already in the same ring.
+static void link_snap_rings(struct Vertex * o, struct Vertex * v)
+{
+	struct Vertex * p, * n;
+
+	// Check if o is already in v's sybling list BEFORE v.  If so, bail.
+	for(n = v->prev; n; n = n->prev)
+	if(n == o)
+		return;
+	
+	// Scan forward to find last node in v's list.  
+	n = v;
+	assert(n != o);
+	while(n->next)
+	{
+		n = n->next;
+		if(n == o)		// Already connected to o?  Eject!
+			return;	
+	}
+	
+	p = o;
+	assert(p != v);
+	while(p->prev)
+	{
+		p = p->prev;
+		assert(p != v);	// this would imply our linkage is not doubly linked.
+	}
+	
+	assert(n->next == NULL);
+	assert(p->prev == NULL);
+	n->next = p;
+	p->prev = n;		
+}
+
 // Utility: this is the visior used to snap vertices to each other.
 // Snapping is done by linking nearby vertices into a ring whose
 // centroid is later found.
 static void visit_vertex_to_snap(struct Vertex * v, void * ref)
 {
 	struct Vertex * o = (struct Vertex *) ref;
-	struct Vertex * p, * n;
 	if(o != v)
 	{
 		assert(!vec3f_eq(o->location,v->location));
 		
 		if(vec3f_length2(o->location, v->location) < EPSI2)
+			link_snap_rings(o, v);
+	}
+}
+
+// Utility: finds the vertices that might snap to vi - everything in a box of
+// +/- EPSI around it - with the grid if there is one, else the R-tree.
+static void scan_for_snaps(struct Mesh * mesh, struct WeldGrid * grid, struct Vertex * vi, void (* visitor)(struct Vertex *v, void * ref), void * ref)
+{
+	float mib[3] = { vi->location[0] - EPSI, vi->location[1] - EPSI, vi->location[2] - EPSI };
+	float mab[3] = { vi->location[0] + EPSI, vi->location[1] + EPSI, vi->location[2] + EPSI };
+	if(grid)
+		scan_weld_grid(grid, mib, mab, visitor, ref);
+	else
+		scan_rtree(mesh->index, mib, mab, visitor, ref);
+}
+
+// Utility: the centroid of the snap ring starting at head.  The members are
+// summed in array order, not ring order - the ring's order depends on the
+// order its pairs were found in, and we want every welder (and any number of
+// threads) to agree on the centroid to the last bit.
+static void ring_centroid(struct Vertex * head, float p[3])
+{
+	struct Vertex * local[16];
+	struct Vertex ** members = local;
+	struct Vertex * i;
+	int capacity = 16, n = 0, j, k;
+	float count = 0.0f;
+
+	for(i = head; i; i = i->next)
+	{
+		if(n == capacity)
 		{
-			
-			// Check if o is already in v's sybling list BEFORE v.  If so, bail.
-			for(n = v->prev; n; n = n->prev)
-			if(n == o)
-				return;
-			
-			// Scan forward to find last node in v's list.  
-			n = v;
-			assert(n != o);
-			while(n->next)
+			capacity *= 2;
+			if(members == local)
 			{
-				n = n->next;
-				if(n == o)		// Already connected to o?  Eject!
-					return;	
+				members = (struct Vertex **) malloc(sizeof(struct Vertex *) * capacity);
+				memcpy(members, local, sizeof(local));
 			}
-			
-			p = o;
-			assert(p != v);
-			while(p->prev)
+			else
+				members = (struct Vertex **) realloc(members, sizeof(struct Vertex *) * capacity);
+		}
+		// Insertion sort by address as we go - rings are small.
+		for(j = n++; j > 0 && members[j-1] > i; --j)
+			members[j] = members[j-1];
+		members[j] = i;
+	}
+
+	p[0] = p[1] = p[2] = 0.0f;
+	for(k = 0; k < n; ++k)
+	{
+		count += 1.0f;
+		p[0] += members[k]->location[0];
+		p[1] += members[k]->location[1];
+		p[2] += members[k]->location[2];
+	}
+	
+	assert(count > 0.0f);
+	count = 1.0f / count;
+	p[0] *= count;
+	p[1] *= count;
+	p[2] *= count;
+
+	if(members != local)
+		free(members);
+}
+
+// Parallel snapping: the R-tree or grid scans only read the mesh, so they run on
+// many threads, each chunk of scans recording the too-close pairs it finds.
+// The pairs are then linked on this thread in the order the serial scan
+// would have found them, so we build exactly the same rings.
+#define SNAP_GRAIN 256
+
+struct SnapChunk {
+	int					count;
+	int					capacity;
+	struct Vertex **	pairs;				// o, v, o, v...
+};
+
+struct SnapJob {
+	struct Mesh *		mesh;
+	struct WeldGrid *	grid;
+	struct Vertex **	queries;			// First vertex of each distinct location.
+	struct SnapChunk *	chunks;
+};
+
+struct snap_collector_t {
+	struct Vertex *		o;
+	struct SnapChunk *	chunk;
+};
+
+static void visit_vertex_to_collect(struct Vertex * v, void * ref)
+{
+	struct snap_collector_t * c = (struct snap_collector_t *) ref;
+	if(c->o != v)
+	{
+		assert(!vec3f_eq(c->o->location,v->location));
+		
+		if(vec3f_length2(c->o->location, v->location) < EPSI2)
+		{
+			struct SnapChunk * chunk = c->chunk;
+			if(chunk->count == chunk->capacity)
 			{
-				p = p->prev;
-				assert(p != v);	// this would imply our linkage is not doubly linked.
+				chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 64;
+				chunk->pairs = (struct Vertex **) realloc(chunk->pairs, sizeof(struct Vertex *) * chunk->capacity);
 			}
-			
-			assert(n->next == NULL);
-			assert(p->prev == NULL);
-			n->next = p;
-			p->prev = n;		
+			chunk->pairs[chunk->count++] = c->o;
+			chunk->pairs[chunk->count++] = v;
 		}
 	}
 }
 
+static void collect_snap_pairs(void * ref, int begin, int end)
+{
+	struct SnapJob * job = (struct SnapJob *) ref;
+	struct snap_collector_t c;
+	c.chunk = job->chunks + begin / SNAP_GRAIN;
+	for(; begin < end; ++begin)
+	{
+		c.o = job->queries[begin];
+		scan_for_snaps(job->mesh, job->grid, c.o, visit_vertex_to_collect, &c);
+	}
+}
+
+// Returns the number of distinct locations scanned.
+static int snap_vertices_parallel(struct Mesh * mesh, struct WeldGrid * grid)
+{
+	struct SnapJob job;
+	int v, c, p;
+	int query_count = 0, chunk_count;
+
+	job.mesh = mesh;
+	job.grid = grid;
+	job.queries = (struct Vertex **) malloc(sizeof(struct Vertex *) * mesh->vertex_count);
+	for(v = 0; v < mesh->vertex_count; ++v)
+	if(v == 0 || compare_points(mesh->vertices[v-1].location,mesh->vertices[v].location) != 0)
+		job.queries[query_count++] = mesh->vertices + v;
+
+	chunk_count = (query_count + SNAP_GRAIN - 1) / SNAP_GRAIN;
+	job.chunks = (struct SnapChunk *) calloc(chunk_count, sizeof(struct SnapChunk));
+
+	parallel_for(query_count, SNAP_GRAIN, collect_snap_pairs, &job);
+
+	for(c = 0; c < chunk_count; ++c)
+	{
+		for(p = 0; p < job.chunks[c].count; p += 2)
+			link_snap_rings(job.chunks[c].pairs[p], job.chunks[c].pairs[p+1]);
+		free(job.chunks[c].pairs);
+	}
+
+	free(job.chunks);
+	free(job.queries);
+	return query_count;
+}
+
 // This function does a bunch of post-geometry-adding processing:
 // 1. It sorts the vertices in XYZ order for correct indexing.  This
 // forces colocated vertices together in the list.
@@ -1116,6 +1866,8 @@ static void visit_vertex_to_snap(struct Vertex * v, void * ref)
 // The second sort is needed because the order of sort is ruined by 
 // changing XYZ geometry locations.
 //
+// For big meshes the sorts and the scans in 3a run in parallel.
+//
 // Re: 6, we don't want to delete degenerate quads (a degen quad
 // might be a visible triangle) but passing degenerate geometry to the
 // smoother causes problems - so instead we 'seal off' this geometry to
@@ -1124,29 +1876,42 @@ void				finish_faces_and_sort(struct Mesh * mesh)
 {
 	int v, f;
 	int total_before = 0, total_after = 0;
+	struct WeldGrid * grid = NULL;
 
-	// sort vertices by 10 params
-	sort_vertices_3(mesh->vertices,mesh->vertex_count);
+	// sort vertices by location
+	sort_mesh_3(mesh);
 
-	mesh->index = index_vertices(mesh->vertices,mesh->vertex_count);
+	if(mesh->welder == MESH_WELD_GRID)
+		grid = build_weld_grid(mesh->vertices,mesh->vertex_count);
+	else
+		mesh->index = index_vertices(mesh->vertices,mesh->vertex_count);
 	
 	#if DEBUG
 	validate_vertex_sort_3(mesh);
 	#endif
 	
 	
+	if(mesh_wants_threads(mesh))
+		total_before = snap_vertices_parallel(mesh, grid);
+	else
 	for(v = 0; v < mesh->vertex_count; ++v)
 	{
 		if(v == 0 || compare_points(mesh->vertices[v-1].location,mesh->vertices[v].location) != 0)
 		{
 			++total_before;
-			struct Vertex * vi = mesh->vertices + v;
-			float mib[3] = { vi->location[0] - EPSI, vi->location[1] - EPSI, vi->location[2] - EPSI };
-			float mab[3] = { vi->location[0] + EPSI, vi->location[1] + EPSI, vi->location[2] + EPSI };
-			scan_rtree(mesh->index, mib, mab, visit_vertex_to_snap, vi);
+			scan_for_snaps(mesh, grid, mesh->vertices + v, visit_vertex_to_snap, mesh->vertices + v);
 		}
 	}
 	
+	// Done with the index - snapping is about to move the vertices it points to.
+	if(grid)
+		destroy_weld_grid(grid);
+	if(mesh->index)
+	{
+		destroy_rtree(mesh->index);
+		mesh->index = NULL;
+	}
+	
 	for(v = 0; v < mesh->vertex_count; ++v)
 	if(v == 0 || compare_points(mesh->vertices[v-1].location,mesh->vertices[v].location) != 0)
 	if(mesh->vertices[v].prev == NULL)
@@ -1154,21 +1919,8 @@ void				finish_faces_and_sort(struct Mesh * mesh)
 		if(mesh->vertices[v].next != NULL)
 		{
 			struct Vertex * i;
-			float count = 0.0f;
-			float p[3] = { 0 };
-			for(i=mesh->vertices+v;i;i=i->next)
-			{
-				count += 1.0f;
-				p[0] += i->location[0];
-				p[1] += i->location[1];
-				p[2] += i->location[2];
-			}
-			
-			assert(count > 0.0f);
-			count = 1.0f / count;
-			p[0] *= count;
-			p[1] *= count;
-			p[2] *= count;
+			float p[3];
+			ring_centroid(mesh->vertices+v, p);
 			
 			i = mesh->vertices+v;
 			while(i)
@@ -1197,7 +1949,7 @@ void				finish_faces_and_sort(struct Mesh * mesh)
 	}
 	// printf("BEFORE: %d, AFTER: %d\n", total_before, total_after);
 
-	sort_vertices_3(mesh->vertices,mesh->vertex_count);
+	sort_mesh_3(mesh);
 
 	// then re-build ptr indices into faces since we moved vertices
 	for(v = 0; v < mesh->vertex_count; ++v)
@@ -1325,8 +2077,203 @@ void add_creases(struct Mesh * mesh)
 	}
 }
 
-// Once all creases have been marked, this routine locates all colocated mesh
-// edges going in opposite directions (opposite direction colocated edges mean
+// Utility: calls the visitor for each face edge that could be the neighbor of
+// f's edge i - colocated with it and running the other way, or (if we want
+// inverts) the same way on a winding-flipped face.  Edges are visited in vertex
+// order; the visitor returns non-zero to stop.
+static void visit_join_candidates(
+							struct Mesh *		mesh,
+							struct Face *		f,
+							int					i,
+							int					(* visitor)(struct Face * n, int ni, int flip, void * ref),
+							void *				ref)
+{
+	//     CCW(i)/P1
+	//      /   \		The directed edge we want goes FROM i TO ccw.
+	//     /     i		So p2 = ccw, p1 = i, that is, we want our OTHER
+	//	  /       \		neighbor to go FROM cw TO CCW
+	//	 .---------i/P2
+
+	struct Vertex * p1 = f->vertex[CCW(f,i)];
+	struct Vertex * p2 = f->vertex[      i ];
+	struct Vertex * begin, * end, * v;
+//	range_for_point(mesh->vertices,mesh->vertex_count,&begin,&end,p1->location);
+	range_for_vertex(mesh->vertices,mesh->vertices + mesh->vertex_count,&begin,&end,p1);
+	for(v = begin; v != end; ++v)
+	{
+		if(v->face == f)
+			continue;
+			
+		//	P1/v-----x		Normal case - Since p1->p2 is the ideal direction of our
+		//    \     /		neighbor, p2 = ccw(v).  Thus p1(v) names our edge.
+		//     v   /		
+		//      \ /
+		//     P2/CCW(V)
+		
+		//	P1/v-----x		Backward winding case - thus p2 is CW from P1,
+		//    \     /		and P2 (cw(v) names our edge.
+		//   cw(v) /		
+		//      \ /
+		//     P2/CW(V)
+
+		
+		assert(compare_points(p1->location,v->location)==0);
+		
+		struct Face * n = v->face;
+		struct Vertex * dst = n->vertex[CCW(n,v->index)];
+		#if WANT_INVERTS
+		struct Vertex * inv = n->vertex[ CW(n,v->index)];
+		#endif
+		if(dst->face->degree > 2)
+		if(compare_points(dst->location,p2->location)==0)
+		if(visitor(n, v->index, 0, ref))
+			return;
+		#if WANT_INVERTS
+		if(inv->face->degree > 2)
+		if(compare_points(inv->location,p2->location)==0)
+		if(visitor(n, CW(v->face,v->index), 1, ref))
+			return;
+		#endif
+	}
+}
+
+struct join_info_t {
+	struct Face *	f;
+	int				i;
+};
+
+// Utility: the visitor that joins f's edge i to n's edge ni - or marks the
+// pair as a crease if the angle between them is too sharp.  If n's edge is
+// already spoken for, we keep looking.
+static int visit_edge_to_join(struct Face * n, int ni, int flip, void * ref)
+{
+	struct join_info_t * info = (struct join_info_t *) ref;
+	struct Face * f = info->f;
+	int i = info->i;
+	assert(f->neighbor[i] == UNKNOWN_FACE);
+	if(n->neighbor[ni] != UNKNOWN_FACE)
+		return 0;
+
+	#if WANT_CREASE
+	if(is_crease(f->normal,n->normal,flip))
+	{
+		f->neighbor[i] = NULL;
+		n->neighbor[ni] = NULL;
+		f->index[i] = -1;
+		n->index[ni] = -1;
+		return 1;
+	}
+	#endif
+
+	// v->dst matches p1->p2.  We have neighbors.
+	// Store both - avoid half the work when we get to our neighbor.
+	f->neighbor[i] = n;
+	n->neighbor[ni] = f;
+	f->index[i] = ni;
+	n->index[ni] = i;
+	f->flip[i] = flip;
+	n->flip[ni] = flip;
+	return 1;
+}
+
+// Parallel joining: finding the candidate edges only reads the mesh, so that
+// runs on many threads, each chunk of faces recording its candidates.  The
+// joins themselves depend on which edges are already taken, so they are made
+// on this thread, in face order, exactly as the serial loop makes them.
+#define JOIN_GRAIN 128
+
+// Each face edge gets its candidates in order, then an entry with n == NULL.
+struct JoinCandidate {
+	struct Face *	n;
+	int				ni;
+	int				flip;
+};
+
+struct JoinChunk {
+	int						count;
+	int						capacity;
+	struct JoinCandidate *	candidates;
+};
+
+struct JoinJob {
+	struct Mesh *		mesh;
+	struct JoinChunk *	chunks;
+};
+
+static int visit_edge_to_collect(struct Face * n, int ni, int flip, void * ref)
+{
+	struct JoinChunk * chunk = (struct JoinChunk *) ref;
+	if(chunk->count == chunk->capacity)
+	{
+		chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 4 * JOIN_GRAIN;
+		chunk->candidates = (struct JoinCandidate *) realloc(chunk->candidates, sizeof(struct JoinCandidate) * chunk->capacity);
+	}
+	chunk->candidates[chunk->count].n = n;
+	chunk->candidates[chunk->count].ni = ni;
+	chunk->candidates[chunk->count].flip = flip;
+	++chunk->count;
+	return 0;
+}
+
+static void collect_join_candidates(void * ref, int begin, int end)
+{
+	struct JoinJob * job = (struct JoinJob *) ref;
+	struct JoinChunk * chunk = job->chunks + begin / JOIN_GRAIN;
+	int fi, i;
+	for(fi = begin; fi < end; ++fi)
+	{
+		struct Face * f = job->mesh->faces+fi;
+		for(i = 0; i < f->degree; ++i)
+		{
+			if(f->neighbor[i] == UNKNOWN_FACE)
+				visit_join_candidates(job->mesh, f, i, visit_edge_to_collect, chunk);
+			visit_edge_to_collect(NULL, -1, 0, chunk);
+		}
+	}
+}
+
+static void join_faces_parallel(struct Mesh * mesh)
+{
+	struct JoinJob job;
+	struct JoinCandidate * c = NULL;
+	struct join_info_t info;
+	int chunk_count = (mesh->poly_count + JOIN_GRAIN - 1) / JOIN_GRAIN;
+	int fi;
+
+	job.mesh = mesh;
+	job.chunks = (struct JoinChunk *) calloc(chunk_count, sizeof(struct JoinChunk));
+
+	parallel_for(mesh->poly_count, JOIN_GRAIN, collect_join_candidates, &job);
+
+	for(fi = 0; fi < mesh->poly_count; ++fi)
+	{
+		if(fi % JOIN_GRAIN == 0)
+			c = job.chunks[fi / JOIN_GRAIN].candidates;
+		info.f = mesh->faces+fi;
+		assert(info.f->degree >= 3);
+		for(info.i = 0; info.i < info.f->degree; ++info.i)
+		{
+			// An earlier face may have taken this edge since we looked.
+			for(; c->n; ++c)
+			if(info.f->neighbor[info.i] == UNKNOWN_FACE)
+				visit_edge_to_join(c->n, c->ni, c->flip, &info);
+			++c;
+
+			if(info.f->neighbor[info.i] == UNKNOWN_FACE)
+			{
+				info.f->neighbor[info.i] = NULL;
+				info.f->index[info.i] = -1;
+			}
+		}
+	}
+
+	for(fi = 0; fi < chunk_count; ++fi)
+		free(job.chunks[fi].candidates);
+	free(job.chunks);
+}
+
+// Once all creases have been marked, this routine locates all colocated mesh
+// edges going in opposite directions (opposite direction colocated edges mean
 // the faces go in the same direction) that are not already marked as neighbors
 // or creases.  If the potential join between faces is too sharp, it is marked
 // as a crease, otherwise the edges are recorded as neighbors of each other.
@@ -1334,124 +2281,24 @@ void add_creases(struct Mesh * mesh)
 void				finish_creases_and_join(struct Mesh * mesh)
 {
 	int fi;
-	int i;
-	struct Face * f;
+	struct join_info_t info;
 	
+	if(mesh_wants_threads(mesh))
+		join_faces_parallel(mesh);
+	else
 	for(fi = 0; fi < mesh->poly_count; ++fi)
 	{
-		f = mesh->faces+fi;
-		assert(f->degree >= 3);
-		for(i = 0; i < f->degree; ++i)
+		info.f = mesh->faces+fi;
+		assert(info.f->degree >= 3);
+		for(info.i = 0; info.i < info.f->degree; ++info.i)
 		{
-			if(f->neighbor[i] == UNKNOWN_FACE)
-			{
-				//     CCW(i)/P1
-				//      /   \		The directed edge we want goes FROM i TO ccw.
-				//     /     i		So p2 = ccw, p1 = i, that is, we want our OTHER
-				//	  /       \		neighbor to go FROM cw TO CCW
-				//	 .---------i/P2
-
-				struct Vertex * p1 = f->vertex[CCW(f,i)];
-				struct Vertex * p2 = f->vertex[      i ];
-				struct Vertex * begin, * end, * v;
-//				range_for_point(mesh->vertices,mesh->vertex_count,&begin,&end,p1->location);
-				range_for_vertex(mesh->vertices,mesh->vertices + mesh->vertex_count,&begin,&end,p1);
-				for(v = begin; v != end; ++v)
-				{
-					if(v->face == f)
-						continue;
-						
-					//	P1/v-----x		Normal case - Since p1->p2 is the ideal direction of our
-					//    \     /		neighbor, p2 = ccw(v).  Thus p1(v) names our edge.
-					//     v   /		
-					//      \ /
-					//     P2/CCW(V)
-					
-					//	P1/v-----x		Backward winding case - thus p2 is CW from P1,
-					//    \     /		and P2 (cw(v) names our edge.
-					//   cw(v) /		
-					//      \ /
-					//     P2/CW(V)
+			if(info.f->neighbor[info.i] == UNKNOWN_FACE)
+				visit_join_candidates(mesh, info.f, info.i, visit_edge_to_join, &info);
 
-					
-					assert(compare_points(p1->location,v->location)==0);
-					
-					struct Face * n = v->face;
-					struct Vertex * dst = n->vertex[CCW(n,v->index)];
-					#if WANT_INVERTS
-					struct Vertex * inv = n->vertex[ CW(n,v->index)];
-					#endif
-					if(dst->face->degree > 2)
-					if(compare_points(dst->location,p2->location)==0)
-					{
-						int ni = v->index;
-						assert(f->neighbor[i] == UNKNOWN_FACE);
-						if(n->neighbor[ni] == UNKNOWN_FACE)
-						{	
-							#if WANT_CREASE
-							if(is_crease(f->normal,n->normal,false))
-							{
-								f->neighbor[i] = NULL;
-								n->neighbor[ni] = NULL;
-								f->index[i] = -1;
-								n->index[ni] = -1;
-								break;
-							}
-							else
-							#endif
-							{
-								// v->dst matches p1->p2.  We have neighbors.
-								// Store both - avoid half the work when we get to our neighbor.
-								f->neighbor[i] = n;
-								n->neighbor[ni] = f;
-								f->index[i] = ni;
-								n->index[ni] = i;
-								f->flip[i] = 0;
-								n->flip[ni] = 0;
-								break;
-							}							
-						}
-					}				
-					#if WANT_INVERTS
-					if(inv->face->degree > 2)
-					if(compare_points(inv->location,p2->location)==0)
-					{
-						int ni = CW(v->face,v->index);
-						assert(f->neighbor[i] == UNKNOWN_FACE);
-						if(n->neighbor[ni] == UNKNOWN_FACE)
-						{	
-							#if WANT_CREASE
-							if(is_crease(f->normal,n->normal,true))
-							{
-								f->neighbor[i] = NULL;
-								n->neighbor[ni] = NULL;
-								f->index[i] = -1;
-								n->index[ni] = -1;
-								break;
-							}
-							else
-							#endif
-							{
-								// v->dst matches p1->p2.  We have neighbors.
-								// Store both - avoid half the work when we get to our neighbor.
-								f->neighbor[i] = n;
-								n->neighbor[ni] = f;
-								f->index[i] = ni;
-								n->index[ni] = i;
-								f->flip[i] = 1;
-								n->flip[ni] = 1;
-								break;
-							}							
-						} 
-					}				
-					#endif
-
-				}			
-			}
-			if(f->neighbor[i] == UNKNOWN_FACE)
+			if(info.f->neighbor[info.i] == UNKNOWN_FACE)
 			{
-				f->neighbor[i] = NULL;
-				f->index[i] = -1;
+				info.f->neighbor[info.i] = NULL;
+				info.f->index[info.i] = -1;
 			}
 		}
 	}
@@ -1485,47 +2332,54 @@ static float weight_for_vertex(struct Vertex * v)
 	return acos(d);
 }
 
-// Once all neighbors have been found, this routine calculates the
-// actual per-vertex smooth normals.  This is done by circulating
-// each vertex (via its neighbors) to find all contributing triangles,
-// computing a weighted average (from for each triangle) and applying
-// the new averaged normal to all participating vertices.
-//
-// A few key points:
-// - Circulation around the vertex only goes by neigbhor.  So creases
-// (lack of a neighbor) partition the triangles around our vertex into
-// adjacent groups, each of which get their own smoothing.
-// - This is what makes a 'creased' shape flat-shaded: the creases keep
-// us from circulating more than one triangle.
-// - We weight our average normal by the angle the triangle spans around
-// the vertex, not just a straight average of all participating triangles.
-// We do not want to bias our normal toward the direction of more small
-// triangles.
-void				smooth_vertices(struct Mesh * mesh)
+static void smooth_vertex(struct Vertex * v)
 {
-	int f;
-	int i;
-	for(f = 0; f < mesh->poly_count; ++f)
-	for(i = 0; i < mesh->faces[f].degree; ++i)
-	{
-		// For each vertex, we are going to circulate around attached faces, averaging up our normals.
+	// We are going to circulate around attached faces, averaging up our normals.
+	
+	// First, go clock-wise around, starting at ourselves, until we loop back on ourselves (a closed smooth
+	// circuite - the center vert on a stud top is like this) or we run out of vertices.
 	
-		struct Vertex * v = mesh->faces[f].vertex[i];
+	struct Vertex * c = v;
+	float N[3] = { 0 };
+	int ctr = 0;
+	int circ_dir = -1;
+	float w;
+	do {
+		++ctr;
+		//printf("\tAdd: %f,%f,%f\n",c->normal[0],c->normal[1],c->normal[2]);
 		
-		// First, go clock-wise around, starting at ourselves, until we loop back on ourselves (a closed smooth
-		// circuite - the center vert on a stud top is like this) or we run out of vertices.
+		w = weight_for_vertex(c);
 		
-		struct Vertex * c = v;
-		float N[3] = { 0 };
-		int ctr = 0;
-		int circ_dir = -1;
-		float w;
-		do {
+		if(vec3f_dot(v->face->normal,c->face->normal) > 0.0)
+		{
+			N[0] += w*c->face->normal[0];
+			N[1] += w*c->face->normal[1];
+			N[2] += w*c->face->normal[2];
+		}
+		else
+		{
+			N[0] -= w*c->face->normal[0];
+			N[1] -= w*c->face->normal[1];
+			N[2] -= w*c->face->normal[2];
+		}
+	
+		c = circulate_any(c,&circ_dir);
+
+	} while(c != NULL && c != v);
+	
+	// Now if we did NOT make it back to ourselves it means we are a disconnected circulation.  For example
+	// a semi-circle fan's center will do this if we start from a middle tri.
+	// Circulate in the OTHER direction, skipping ourselves, until we run out.
+	
+	if(c != v)
+	{
+		circ_dir = 1;
+		c = circulate_any(v,&circ_dir);
+		while(c)
+		{
 			++ctr;
 			//printf("\tAdd: %f,%f,%f\n",c->normal[0],c->normal[1],c->normal[2]);
-			
 			w = weight_for_vertex(c);
-			
 			if(vec3f_dot(v->face->normal,c->face->normal) > 0.0)
 			{
 				N[0] += w*c->face->normal[0];
@@ -1538,58 +2392,105 @@ void				smooth_vertices(struct Mesh * mesh)
 				N[1] -= w*c->face->normal[1];
 				N[2] -= w*c->face->normal[2];
 			}
-		
-			c = circulate_any(c,&circ_dir);
+	
+			c = circulate_any(c,&circ_dir);		
+			
+			// Invariant: if we did NOT close-loop up top, we should NOT close-loop down here - that would imply
+			// a triangulation where our neighbor info was assymetric, which would be "bad".
+			assert(c != v);		
+		}
+	}
+	
+	vec3f_normalize(N);
+	//printf("Final: %f %f %f\t%f %f %f (%d)\n",v->location[0],v->location[1], v->location[2], N[0],N[1],N[2], ctr);
+	v->normal[0] = N[0];
+	v->normal[1] = N[1];
+	v->normal[2] = N[2];
+	#if DEBUG_SHOW_NORMALS_AS_COLOR
+	v->color[0] = N[0] * 0.5 + 0.5;
+	v->color[1] = N[1] * 0.5 + 0.5;
+	v->color[2] = N[2] * 0.5 + 0.5;
+	v->color[3] = 1.0f;
+	#endif
+}
 
-		} while(c != NULL && c != v);
-		
-		// Now if we did NOT make it back to ourselves it means we are a disconnected circulation.  For example
-		// a semi-circle fan's center will do this if we start from a middle tri.
-		// Circulate in the OTHER direction, skipping ourselves, until we run out.
-		
-		if(c != v)
+// Smoothing one range of faces.  Each vertex's normal depends only on the
+// faces around it (never on another vertex's normal), so ranges can be done
+// in any order - or at the same time.
+#define SMOOTH_GRAIN 256
+
+static void smooth_face_range(void * ref, int begin, int end)
+{
+	struct Mesh * mesh = (struct Mesh *) ref;
+	int f;
+	int i;
+	for(f = begin; f < end; ++f)
+	for(i = 0; i < mesh->faces[f].degree; ++i)
+		smooth_vertex(mesh->faces[f].vertex[i]);
+}
+
+// Once all neighbors have been found, this routine calculates the
+// actual per-vertex smooth normals.  This is done by circulating
+// each vertex (via its neighbors) to find all contributing triangles,
+// computing a weighted average (from for each triangle) and applying
+// the new averaged normal to all participating vertices.
+//
+// A few key points:
+// - Circulation around the vertex only goes by neigbhor.  So creases
+// (lack of a neighbor) partition the triangles around our vertex into
+// adjacent groups, each of which get their own smoothing.
+// - This is what makes a 'creased' shape flat-shaded: the creases keep
+// us from circulating more than one triangle.
+// - We weight our average normal by the angle the triangle spans around
+// the vertex, not just a straight average of all participating triangles.
+// We do not want to bias our normal toward the direction of more small
+// triangles.
+void				smooth_vertices(struct Mesh * mesh)
+{
+	if(mesh_wants_threads(mesh))
+		parallel_for(mesh->poly_count, SMOOTH_GRAIN, smooth_face_range, mesh);
+	else
+		smooth_face_range(mesh, 0, mesh->poly_count);
+}
+
+// Merging one range of the sorted vertices.  A range may start partway through
+// a run of equal vertices, so it first backs up to find where the run starts.
+// It counts its unique vertices into its own slot of job->unique.
+#define MERGE_GRAIN 4096
+
+struct MergeJob {
+	struct Mesh *	mesh;
+	int *			unique;					// One count per range.
+};
+
+static void merge_vertex_range(void * ref, int begin, int end)
+{
+	struct MergeJob * job = (struct MergeJob *) ref;
+	struct Vertex * vertices = job->mesh->vertices;
+	struct Vertex * first_of_equals = vertices + begin;
+	int unique = 0;
+	int v;
+
+	while(first_of_equals > vertices && compare_vertices(first_of_equals - 1, first_of_equals) == 0)
+		--first_of_equals;
+
+	for(v = begin; v < end; ++v)
+	{
+		if(compare_vertices(first_of_equals, vertices+v) != 0)
 		{
-			circ_dir = 1;
-			c = circulate_any(v,&circ_dir);
-			while(c)
-			{
-				++ctr;
-				//printf("\tAdd: %f,%f,%f\n",c->normal[0],c->normal[1],c->normal[2]);
-				w = weight_for_vertex(c);
-				if(vec3f_dot(v->face->normal,c->face->normal) > 0.0)
-				{
-					N[0] += w*c->face->normal[0];
-					N[1] += w*c->face->normal[1];
-					N[2] += w*c->face->normal[2];
-				}
-				else
-				{
-					N[0] -= w*c->face->normal[0];
-					N[1] -= w*c->face->normal[1];
-					N[2] -= w*c->face->normal[2];
-				}
-		
-				c = circulate_any(c,&circ_dir);		
-				
-				// Invariant: if we did NOT close-loop up top, we should NOT close-loop down here - that would imply
-				// a triangulation where our neighbor info was assymetric, which would be "bad".
-				assert(c != v);		
-			}
+			first_of_equals = vertices+v;
 		}
-		
-		vec3f_normalize(N);
-		//printf("Final: %f %f %f\t%f %f %f (%d)\n",v->location[0],v->location[1], v->location[2], N[0],N[1],N[2], ctr);
-		v->normal[0] = N[0];
-		v->normal[1] = N[1];
-		v->normal[2] = N[2];
-		#if DEBUG_SHOW_NORMALS_AS_COLOR
-		v->color[0] = N[0] * 0.5 + 0.5;
-		v->color[1] = N[1] * 0.5 + 0.5;
-		v->color[2] = N[2] * 0.5 + 0.5;
-		v->color[3] = 1.0f;
-		#endif
-		
+		vertices[v].face->vertex[vertices[v].index] = first_of_equals;
+		if(vertices+v == first_of_equals)
+		{
+			vertices[v].index = -1;
+			++unique;
+		}
+		else
+			vertices[v].index = -2;
 	}
+
+	job->unique[begin / MERGE_GRAIN] = unique;
 }
 
 // This routine merges vertices that have the same complete (10-float)
@@ -1613,29 +2514,28 @@ void				merge_vertices(struct Mesh * mesh)
 	// agree on which ptr to use.  This means that we can build an indexed
 	// mesh off of the ptrs and get maximum sharing.
 	
-	int v;
-
+	struct MergeJob job;
 	int unique = 0;
-	struct Vertex * first_of_equals = mesh->vertices;
+	int c;
 
 	// Resort according ot our xyz + normal + color
-	sort_vertices_10(mesh->vertices,mesh->vertex_count);
+	sort_mesh_10(mesh);
 	
 	// Re-set the tri ptrs again, but...for each IDENTICAL source vertex, use the FIRST of them as the ptr
-	for(v = 0; v < mesh->vertex_count; ++v)
+	job.mesh = mesh;
+	if(mesh_wants_threads(mesh))
 	{
-		if(compare_vertices(first_of_equals, mesh->vertices+v) != 0)
-		{
-			first_of_equals = mesh->vertices+v;
-		}
-		mesh->vertices[v].face->vertex[mesh->vertices[v].index] = first_of_equals;
-		if(mesh->vertices+v == first_of_equals)
-		{
-			mesh->vertices[v].index = -1;
-			++unique;
-		}
-		else
-			mesh->vertices[v].index = -2;
+		int chunk_count = (mesh->vertex_count + MERGE_GRAIN - 1) / MERGE_GRAIN;
+		job.unique = (int *) calloc(chunk_count, sizeof(int));
+		parallel_for(mesh->vertex_count, MERGE_GRAIN, merge_vertex_range, &job);
+		for(c = 0; c < chunk_count; ++c)
+			unique += job.unique[c];
+		free(job.unique);
+	}
+	else
+	{
+		job.unique = &unique;
+		merge_vertex_range(&job, 0, mesh->vertex_count);
 	}
 
 	#if DEBUG
@@ -1657,7 +2557,6 @@ void 	get_final_mesh_counts(struct Mesh * m, int * total_vertices,int * total_in
 // This cleans our mesh, deallocating all internal memory.
 void				destroy_mesh(struct Mesh * mesh)
 {
-	int f,i;
 	#if DEBUG
 	#if SLOW_CHECKING
 		if(mesh->flags & TINY_INITIAL_TRIANGLE)	
@@ -1667,22 +2566,14 @@ void				destroy_mesh(struct Mesh * mesh)
 	#endif
 	#endif
 
-	destroy_rtree(mesh->index);
+	if(mesh->index)
+		destroy_rtree(mesh->index);
 	
-	for(f = 0; f < mesh->face_count; ++f)
+	while(mesh->insert_blocks)
 	{
-		struct Face * fp = mesh->faces+f;
-		for(i = 0; i < fp->degree; ++i)
-		{
-			struct VertexInsert * tj, *k;
-			tj = fp->t_list[i];
-			while(tj)
-			{
-				k = tj;
-				tj = tj->next;
-				free(k);
-			}
-		}
+		struct InsertBlock * k = mesh->insert_blocks;
+		mesh->insert_blocks = k->next;
+		free(k);
 	}
 	
 	free(mesh->vertices);
@@ -1845,9 +2736,10 @@ void				write_indexed_mesh(
 
 
 // When we are looking for T junctions, we use this structure to 'remember' which
-// edge we are working on from the R-tree visitor.
+// edge we are working on from the edge grid.
 
 struct t_finder_info_t { 
+	struct Mesh * mesh;			// The mesh whose faces we are splitting - it owns the insert storage.
 	int split_quads;			// The number of quads that have been split.  Each quad with a 
 								// subdivision must be triangulated, changing our face count, so 
 								// we have to track this.
@@ -1860,11 +2752,27 @@ struct t_finder_info_t {
 	float line_dir[3];			// A normalized direction vector from v1 to v2, used to order the intrusions.
 };
 
+// Hands out one insert request from the mesh's blocks, starting a new block
+// when the current one is used up.
+static struct VertexInsert * alloc_insert(struct Mesh * mesh)
+{
+	struct InsertBlock * b = mesh->insert_blocks;
+	if(b == NULL || b->count == INSERT_BLOCK_SIZE)
+	{
+		b = (struct InsertBlock *) malloc(sizeof(struct InsertBlock));
+		b->next = mesh->insert_blocks;
+		b->count = 0;
+		mesh->insert_blocks = b;
+	}
+	return b->inserts + b->count++;
+}
+
 
 // This is the call back that gets called once for each vertex V that _might_ be near an edge (e.g. 
 // via a bounding box test).  We project the point onto the line and see how far the intruding point
 // is from the projection on the line.  If the point is close, it's a T junction and we record it
-// on a linked list ƒor this side, in order of distanec along the line.
+// on a linked list ƒor this side, in order of distanec along the line.  (Points the same distance
+// along are ordered by address, so the list doesn't depend on the order we find them in.)
 //
 // Since (1) duplicate vertices are not processed and (2) near-duplicate vertices were removed long ago
 // and (3) the bounding box ensures that our point is 'within' the line segment's span, any near-line
@@ -1894,10 +2802,10 @@ void visit_possible_t_junc(struct Vertex * v, void * ref)
 			++info->inserted_pts;
 			struct VertexInsert ** prev = &info->f->t_list[info->i];
 			
-			while(*prev && (*prev)->dist < dist2_lon)
+			while(*prev && ((*prev)->dist < dist2_lon || ((*prev)->dist == dist2_lon && (*prev)->vert < v)))
 				prev = &(*prev)->next;
 				
-			struct VertexInsert * vi = (struct VertexInsert *) malloc(sizeof(struct VertexInsert));
+			struct VertexInsert * vi = alloc_insert(info->mesh);
 			vi->dist = dist2_lon;
 			vi->vert = v;
 			vi->next = *prev;
@@ -1912,6 +2820,231 @@ void visit_possible_t_junc(struct Vertex * v, void * ref)
 	}
 }
 
+// The edge grid.  Rather than searching for the vertices near each edge, we
+// file every edge under the grid cells it passes through, then look each
+// vertex up in its one cell and test only the edges filed there.  The cells
+// are a bit longer than a typical edge, so most edges land in a handful of
+// cells; a long edge is cut into cell-sized pieces and filed along its length,
+// so a baseplate's long sides don't fill their whole bounding box with entries.
+//
+// A vertex only forms a T with an edge if it is within EPSI of it, so padding
+// each piece by (a bit more than) EPSI is enough to catch every T.  Each
+// candidate is still checked against the edge's whole padded bounds before
+// the real test, exactly as the old R-tree search did.
+
+// Long edges are cut into at most this many pieces; past that, pieces just
+// get longer, which costs cells but not correctness.
+#define EDGE_PIECE_LIMIT 65536
+
+// An edge that might need splitting: side i of face f.
+struct TEdge {
+	struct Face *		f;
+	int					i;
+	float				min_bounds[3];		// The edge's bounds, padded by EPSI.
+	float				max_bounds[3];
+};
+
+struct EdgeCell {
+	int					cell[3];
+	int					edge;				// Index into the grid's edges.
+};
+
+struct EdgeGrid {
+	double				scale;				// 1 / cell size.
+	unsigned int		mask;				// Bucket count - 1; the count is a power of 2.
+	int *				starts;				// Bucket b's entries are [starts[b], starts[b+1]).
+	struct EdgeCell *	entries;
+	struct TEdge *		edges;
+};
+
+static int compare_edge_cells(const void * lhs, const void * rhs)
+{
+	const struct EdgeCell * a = (const struct EdgeCell *) lhs;
+	const struct EdgeCell * b = (const struct EdgeCell *) rhs;
+	int i;
+	for(i = 0; i < 3; ++i)
+	{
+		if(a->cell[i] < b->cell[i]) return -1;
+		if(a->cell[i] > b->cell[i]) return  1;
+	}
+	return 0;
+}
+
+// Files every non-creased, non-degenerate polygon edge of the mesh.  These are
+// the edges we can split to remove T junctions.
+static struct EdgeGrid * build_edge_grid(struct Mesh * mesh)
+{
+	struct EdgeGrid * grid = (struct EdgeGrid *) malloc(sizeof(struct EdgeGrid));
+	struct EdgeCell * cells = NULL;
+	struct EdgeCell * mine = NULL;
+	int cell_count = 0, cell_capacity = 0;
+	int mine_capacity = 0;
+	int edge_count = 0;
+	double total_extent = 0.0, cell_size;
+	int f, i, e, b, buckets = 16;
+	int * fill;
+
+	grid->edges = (struct TEdge *) malloc(sizeof(struct TEdge) * (mesh->poly_count * 4 + 1));
+
+	for(f = 0; f < mesh->poly_count; ++f)
+	{
+		struct Face * fp = mesh->faces+f;
+		if(fp->degree > 2)
+		for(i = 0; i < fp->degree; ++i)
+		{
+			// Sad -- this is not a win - this info is not yet available. :-(
+			if(fp->neighbor[i] == NULL)
+				continue;
+
+			float * p1 = fp->vertex[i]->location;
+			float * p2 = fp->vertex[(i+1)%fp->degree]->location;
+			if(vec3f_eq(p1,p2))
+				continue;
+
+			struct TEdge * te = grid->edges + edge_count++;
+			te->f = fp;
+			te->i = i;
+			te->min_bounds[0] = MIN(p1[0],p2[0]) - EPSI;
+			te->min_bounds[1] = MIN(p1[1],p2[1]) - EPSI;
+			te->min_bounds[2] = MIN(p1[2],p2[2]) - EPSI;
+			te->max_bounds[0] = MAX(p1[0],p2[0]) + EPSI;
+			te->max_bounds[1] = MAX(p1[1],p2[1]) + EPSI;
+			te->max_bounds[2] = MAX(p1[2],p2[2]) + EPSI;
+
+			total_extent += MAX(MAX(fabs(p2[0]-p1[0]),fabs(p2[1]-p1[1])),fabs(p2[2]-p1[2]));
+		}
+	}
+
+	// Cells twice the size of the average edge, so most edges fit in one or
+	// two per axis, padding and all - but never so small that the padding
+	// dominates.
+	cell_size = edge_count ? 2.0 * total_extent / edge_count : 1.0;
+	if(!(cell_size > 4.0 * EPSI))
+		cell_size = 4.0 * EPSI;
+	grid->scale = 1.0 / cell_size;
+
+	for(e = 0; e < edge_count; ++e)
+	{
+		struct TEdge * te = grid->edges + e;
+		float * p1 = te->f->vertex[te->i]->location;
+		float * p2 = te->f->vertex[(te->i+1)%te->f->degree]->location;
+		double extent = MAX(MAX(fabs(p2[0]-p1[0]),fabs(p2[1]-p1[1])),fabs(p2[2]-p1[2]));
+		double pad = EPSI * 1.5;
+		int pieces = (int) MIN(ceil(extent * grid->scale), EDGE_PIECE_LIMIT);
+		int k, mine_count = 0;
+		if(pieces < 1)
+			pieces = 1;
+
+		for(k = 0; k < pieces; ++k)
+		{
+			double t0 = (double) k / pieces, t1 = (double) (k+1) / pieces;
+			int lo[3], hi[3], c[3];
+			for(i = 0; i < 3; ++i)
+			{
+				double a = p1[i] + (p2[i] - p1[i]) * t0;
+				double z = p1[i] + (p2[i] - p1[i]) * t1;
+				lo[i] = clamp_cell(floor((MIN(a,z) - pad) * grid->scale));
+				hi[i] = clamp_cell(floor((MAX(a,z) + pad) * grid->scale));
+			}
+			for(c[2] = lo[2]; c[2] <= hi[2]; ++c[2])
+			for(c[1] = lo[1]; c[1] <= hi[1]; ++c[1])
+			for(c[0] = lo[0]; c[0] <= hi[0]; ++c[0])
+			{
+				if(mine_count == mine_capacity)
+				{
+					mine_capacity = mine_capacity ? mine_capacity * 2 : 64;
+					mine = (struct EdgeCell *) realloc(mine, sizeof(struct EdgeCell) * mine_capacity);
+				}
+				memcpy(mine[mine_count].cell, c, sizeof(c));
+				mine[mine_count].edge = e;
+				++mine_count;
+			}
+		}
+
+		// Neighboring pieces share cells; file the edge in each cell only once,
+		// or a vertex there would find it twice.  (One piece has no repeats.)
+		if(pieces > 1)
+			qsort(mine, mine_count, sizeof(struct EdgeCell), compare_edge_cells);
+		for(k = 0; k < mine_count; ++k)
+		if(k == 0 || compare_edge_cells(mine+k-1, mine+k) != 0)
+		{
+			if(cell_count == cell_capacity)
+			{
+				cell_capacity = cell_capacity ? cell_capacity * 2 : 1024;
+				cells = (struct EdgeCell *) realloc(cells, sizeof(struct EdgeCell) * cell_capacity);
+			}
+			cells[cell_count++] = mine[k];
+		}
+	}
+	free(mine);
+
+	while(buckets < cell_count * 2)
+		buckets *= 2;
+	grid->mask = buckets - 1;
+	grid->starts = (int *) calloc(buckets + 1, sizeof(int));
+	grid->entries = (struct EdgeCell *) malloc(sizeof(struct EdgeCell) * (cell_count ? cell_count : 1));
+
+	// Counting sort by bucket; within a bucket, entries stay in edge order.
+	for(i = 0; i < cell_count; ++i)
+		++grid->starts[(grid_hash(cells[i].cell) & grid->mask) + 1];
+	for(b = 0; b < buckets; ++b)
+		grid->starts[b+1] += grid->starts[b];
+
+	fill = (int *) malloc(sizeof(int) * buckets);
+	memcpy(fill, grid->starts, sizeof(int) * buckets);
+	for(i = 0; i < cell_count; ++i)
+		grid->entries[fill[grid_hash(cells[i].cell) & grid->mask]++] = cells[i];
+
+	free(fill);
+	free(cells);
+	return grid;
+}
+
+static void destroy_edge_grid(struct EdgeGrid * grid)
+{
+	free(grid->starts);
+	free(grid->entries);
+	free(grid->edges);
+	free(grid);
+}
+
+// Tests vertex v against every edge filed in its cell, recording the Ts it forms.
+static void find_t_junctions_at(struct EdgeGrid * grid, struct Vertex * v, struct t_finder_info_t * info)
+{
+	int c[3] = {
+		clamp_cell(floor(v->location[0] * grid->scale)),
+		clamp_cell(floor(v->location[1] * grid->scale)),
+		clamp_cell(floor(v->location[2] * grid->scale)) };
+	unsigned int b = grid_hash(c) & grid->mask;
+	struct EdgeCell * e = grid->entries + grid->starts[b];
+	struct EdgeCell * stop = grid->entries + grid->starts[b+1];
+
+	for(; e < stop; ++e)
+	if(e->cell[0] == c[0] && e->cell[1] == c[1] && e->cell[2] == c[2])
+	{
+		struct TEdge * te = grid->edges + e->edge;
+		if(inside(te->min_bounds,te->max_bounds,v->location))
+		{
+			info->f = te->f;
+			info->i = te->i;
+			info->v1 = te->f->vertex[ te->i					 ];
+			info->v2 = te->f->vertex[(te->i+1)%te->f->degree];
+			info->line_dir[0] = info->v2->location[0] - info->v1->location[0];
+			info->line_dir[1] = info->v2->location[1] - info->v1->location[1];
+			info->line_dir[2] = info->v2->location[2] - info->v1->location[2];
+			visit_possible_t_junc(v, info);
+		}
+	}
+}
+
+// Utility: wall-clock seconds, for the stage timers.
+static double mesh_seconds(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
 // Given a convex polygon (specified by an interleaved XYZ array "poly" and pt_count points, this routine
 // cuts down the degree of the polygon by cutting off an 'ear' (that is, a non-reflex vertex).  The ear is
 // added as a triangle, and the polygon loses a vertex.  This is done by cutting off the sharpest corners 
@@ -1975,8 +3108,9 @@ void add_ear_and_remove(float * poly, int pt_count, struct Mesh * target_mesh, c
 
 
 // This routine finds and removes all T junctions from the mesh.  It does this by...
-// For each non-creased edge (we don't de-T creases for speed) we R-tree search for
-// all T-forming vertices and put them in a sorted linked list by edge.
+// For each distinct vertex we test the non-creased edges near it (we don't de-T
+// creases for speed) via the edge grid, and put every T it forms in a sorted
+// linked list by edge.
 //
 // Then we build a brand new copy of our mesh and peel off ears for each interference
 // as new triangles.  When done, we're left with triangles that we also add.
@@ -1987,46 +3121,28 @@ void find_and_remove_t_junctions(struct Mesh * mesh)
 	assert(mesh->vertex_count == mesh->vertex_capacity);
 	assert(mesh->face_count == mesh->face_capacity);
 	struct t_finder_info_t	info;
-	int fi;
+	struct EdgeGrid * grid;
+	int v;
+	double start = mesh_seconds(), found;
+	info.mesh = mesh;
 	info.inserted_pts = 0;
 	info.split_quads = 0;
 
-	
-	for(fi = 0; fi < mesh->poly_count; ++fi)
+	grid = build_edge_grid(mesh);
+	found = mesh_seconds();
+	mesh->timers[MESH_TIMER_T_JUNCTION_INDEX] += found - start;
+	start = found;
+
+	for(v = 0; v < mesh->vertex_count; ++v)
+	if(v == 0 || compare_points(mesh->vertices[v-1].location,mesh->vertices[v].location) != 0)
 	{
-		info.f = mesh->faces+fi;
-		if(info.f->degree > 2)
-		for(info.i = 0; info.i < info.f->degree; ++info.i)
-		{
-			// Sad -- this is not a win - this info is not yet available. :-(
-			if(info.f->neighbor[info.i] == NULL)
-				continue;
-				
-			info.v1 = info.f->vertex[ info.i					 ];
-			info.v2 = info.f->vertex[(info.i+1)%info.f->degree];
-			
-			if(vec3f_eq(info.v1->location,info.v2->location))
-				continue;
-			
-			info.line_dir[0] = info.v2->location[0] - info.v1->location[0];
-			info.line_dir[1] = info.v2->location[1] - info.v1->location[1];
-			info.line_dir[2] = info.v2->location[2] - info.v1->location[2];
-//			vec3f_normalize(info.line_dir);
-			
-			float mib[3] = { 
-								MIN(info.v1->location[0],info.v2->location[0]) - EPSI,
-								MIN(info.v1->location[1],info.v2->location[1]) - EPSI,
-								MIN(info.v1->location[2],info.v2->location[2]) - EPSI };
-
-			float mab[3] = { 
-								MAX(info.v1->location[0],info.v2->location[0]) + EPSI,
-								MAX(info.v1->location[1],info.v2->location[1]) + EPSI,
-								MAX(info.v1->location[2],info.v2->location[2]) + EPSI };
-								
-			scan_rtree(mesh->index, mib, mab, visit_possible_t_junc, &info);
-		}
+		find_t_junctions_at(grid, mesh->vertices + v, &info);
 	}
 
+	destroy_edge_grid(grid);
+	found = mesh_seconds();
+	mesh->timers[MESH_TIMER_T_JUNCTION_SEARCH] += found - start;
+	start = found;
 
 	//printf("Subdivided %d quads and added %d pts.\n", info.split_quads,info.inserted_pts);
 	if(info.inserted_pts > 0)
@@ -2038,6 +3154,8 @@ void find_and_remove_t_junctions(struct Mesh * mesh)
 							mesh->tri_count + info.inserted_pts + 2 * info.split_quads,
 							mesh->quad_count - info.split_quads,
 							mesh->line_count);
+		new_mesh->threading = mesh->threading;
+		new_mesh->welder = mesh->welder;
 
 		for(f = 0; f < mesh->face_count; ++f)
 		{
@@ -2106,6 +3224,9 @@ void find_and_remove_t_junctions(struct Mesh * mesh)
 		finish_faces_and_sort(new_mesh);
 		add_creases(new_mesh);
 		
+		mesh->timers[MESH_TIMER_T_JUNCTION_REBUILD] += mesh_seconds() - start;
+		memcpy(new_mesh->timers, mesh->timers, sizeof(mesh->timers));
+		
 		struct Mesh temp;
 		
 		memcpy(&temp,mesh,sizeof(struct Mesh));
@@ -2118,3 +3239,700 @@ void find_and_remove_t_junctions(struct Mesh * mesh)
 	}
 }
 
+
+
+
+#pragma mark -
+//==============================================================================
+//	LEVEL OF DETAIL
+//==============================================================================
+
+// A part a few dozen pixels across doesn't need every stud.  To make a cheaper
+// stand-in for a finished mesh, we cluster its vertices: space is cut into
+// cubes cell_size on a side, and every vertex in a cube moves to the average
+// location of the cube's vertices.  Triangles and lines whose corners all land
+// in different cubes survive (quads become two triangles); the rest have
+// collapsed to a point or an edge and are dropped, as are exact repeats.  A
+// stud, smaller than a cube, collapses to almost nothing.
+//
+// Vertices keep their own normal and color, so creases stay creased and the
+// output is still a legal mesh for the same draw code.
+//
+// This works on the indexed output of write_indexed_mesh rather than on the
+// mesh itself, so that meshes that come out of a cache can be simplified too.
+
+// The vertices that fell into one cube.
+struct LodCluster {
+	int		cell[3];
+	float	sum[3];						// Sum of vertex locations.
+	int		count;
+};
+
+static inline unsigned int hash_words(const unsigned int * w, int n)
+{
+	unsigned int h = 2166136261u;
+	int i;
+	for(i = 0; i < n; ++i)
+		h = (h ^ w[i]) * 16777619u;
+	return h ^ (h >> 15);
+}
+
+// Finds or inserts key (n words) into an open-addressed table of slots holding
+// row indices into keys (-1 = empty).  Returns the row for key; next_row is
+// the row a new key gets, and is bumped if it is used.
+static int find_or_add_row(int * slots, unsigned int mask, unsigned int * keys, int n, const unsigned int * key, int * next_row)
+{
+	unsigned int s = hash_words(key, n) & mask;
+	while(slots[s] != -1)
+	{
+		if(memcmp(keys + slots[s] * n, key, n * sizeof(unsigned int)) == 0)
+			return slots[s];
+		s = (s + 1) & mask;
+	}
+	slots[s] = (*next_row)++;
+	memcpy(keys + slots[s] * n, key, n * sizeof(unsigned int));
+	return slots[s];
+}
+
+static unsigned int table_mask(int count)
+{
+	unsigned int size = 16;
+	while(size < (unsigned int) count * 2)
+		size *= 2;
+	return size - 1;
+}
+
+void				simplify_indexed_mesh(
+							float					cell_size,
+							int						tex_count,
+							int						vertex_count,
+							const float *			vertex_table,
+							const unsigned int *	index_table,
+							const int				line_starts[],
+							const int				line_counts[],
+							const int				tri_starts[],
+							const int				tri_counts[],
+							const int				quad_starts[],
+							const int				quad_counts[],
+							int *					out_vertex_count,
+							float *					out_vertex_table,
+							int *					out_index_count,
+							unsigned int *			out_index_table,
+							int						out_line_starts[],
+							int						out_line_counts[],
+							int						out_tri_starts[],
+							int						out_tri_counts[],
+							int						out_quad_starts[],
+							int						out_quad_counts[])
+{
+	double inv = 1.0 / cell_size;
+	float lo[3] = { 0 };
+	int v, i, ti, d;
+	int index_total = 0, prim_total = 0;
+
+	int * cluster_of = (int *) malloc(sizeof(int) * (vertex_count + 1));
+	int * out_of = (int *) malloc(sizeof(int) * (vertex_count + 1));
+	struct LodCluster * clusters = (struct LodCluster *) malloc(sizeof(struct LodCluster) * (vertex_count + 1));
+	int cluster_count = 0, out_count = 0, prim_count = 0;
+
+	// Cubes are counted from the low corner of the mesh's bounds.
+	for(v = 0; v < vertex_count; ++v)
+	for(i = 0; i < 3; ++i)
+	if(v == 0 || vertex_table[v*10+i] < lo[i])
+		lo[i] = vertex_table[v*10+i];
+
+	// Pass 1: sort vertices into cubes.
+	{
+		unsigned int mask = table_mask(vertex_count);
+		int * slots = (int *) malloc(sizeof(int) * (mask + 1));
+		unsigned int * keys = (unsigned int *) malloc(sizeof(unsigned int) * 3 * (vertex_count + 1));
+		memset(slots, 0xFF, sizeof(int) * (mask + 1));
+
+		for(v = 0; v < vertex_count; ++v)
+		{
+			const float * p = vertex_table + v*10;
+			unsigned int key[3];
+			int row, fresh = cluster_count;
+			for(i = 0; i < 3; ++i)
+				key[i] = (unsigned int) clamp_cell(floor((p[i] - lo[i]) * inv));
+			row = find_or_add_row(slots, mask, keys, 3, key, &cluster_count);
+			if(row == fresh)
+			{
+				memcpy(clusters[row].cell, key, sizeof(key));
+				clusters[row].count = 0;
+				clusters[row].sum[0] = clusters[row].sum[1] = clusters[row].sum[2] = 0.0f;
+			}
+			// A sharp corner has a vertex per normal, so it pulls the average
+			// a little harder than a smooth one; that's fine - corners are
+			// what we most want to keep.
+			clusters[row].sum[0] += p[0];
+			clusters[row].sum[1] += p[1];
+			clusters[row].sum[2] += p[2];
+			++clusters[row].count;
+			cluster_of[v] = row;
+		}
+		free(slots);
+		free(keys);
+	}
+
+	// Pass 2: one output vertex per cube per distinct normal and color.
+	{
+		unsigned int mask = table_mask(vertex_count);
+		int * slots = (int *) malloc(sizeof(int) * (mask + 1));
+		unsigned int * keys = (unsigned int *) malloc(sizeof(unsigned int) * 8 * (vertex_count + 1));
+		memset(slots, 0xFF, sizeof(int) * (mask + 1));
+
+		for(v = 0; v < vertex_count; ++v)
+		{
+			const float * p = vertex_table + v*10;
+			unsigned int key[8];
+			int row, fresh = out_count;
+			key[0] = cluster_of[v];
+			memcpy(key + 1, p + 3, sizeof(float) * 7);
+			row = find_or_add_row(slots, mask, keys, 8, key, &out_count);
+			if(row == fresh)
+			{
+				struct LodCluster * c = clusters + cluster_of[v];
+				float * o = out_vertex_table + row * 10;
+				float scale = 1.0f / c->count;
+				o[0] = c->sum[0] * scale;
+				o[1] = c->sum[1] * scale;
+				o[2] = c->sum[2] * scale;
+				memcpy(o + 3, p + 3, sizeof(float) * 7);
+			}
+			out_of[v] = row;
+		}
+		free(slots);
+		free(keys);
+	}
+
+	// Pass 3: the primitives that survive, in the same TID-then-type order
+	// write_indexed_mesh uses.
+	for(ti = 0; ti < tex_count; ++ti)
+		prim_total += line_counts[ti] / 2 + tri_counts[ti] / 3 + 2 * (quad_counts[ti] / 4);
+	{
+		unsigned int mask = table_mask(prim_total);
+		int * slots = (int *) malloc(sizeof(int) * (mask + 1));
+		unsigned int * keys = (unsigned int *) malloc(sizeof(unsigned int) * 4 * (prim_total + 1));
+		memset(slots, 0xFF, sizeof(int) * (mask + 1));
+
+		for(ti = 0; ti < tex_count; ++ti)
+		for(d = 2; d <= 3; ++d)
+		{
+			int * starts = (d == 2) ? out_line_starts : out_tri_starts;
+			int * counts = (d == 2) ? out_line_counts : out_tri_counts;
+			int pass;
+			starts[ti] = index_total;
+
+			// Triangles come from the tris, then from each half of the quads.
+			for(pass = 0; pass < (d == 2 ? 1 : 3); ++pass)
+			{
+				const unsigned int * src;
+				int n, step, p;
+				static const int quad_halves[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+				if(d == 2)			{ src = index_table + line_starts[ti];	n = line_counts[ti];	step = 2; }
+				else if(pass == 0)	{ src = index_table + tri_starts[ti];	n = tri_counts[ti];		step = 3; }
+				else				{ src = index_table + quad_starts[ti];	n = quad_counts[ti];	step = 4; }
+
+				for(p = 0; p + step <= n; p += step)
+				{
+					unsigned int corner[3], key[4];
+					int k, j, fresh = prim_count;
+					for(k = 0; k < d; ++k)
+						corner[k] = src[p + (step == 4 ? quad_halves[pass-1][k] : k)];
+
+					// Collapsed?
+					if(cluster_of[corner[0]] == cluster_of[corner[1]])						continue;
+					if(d == 3 && (cluster_of[corner[1]] == cluster_of[corner[2]] ||
+								  cluster_of[corner[0]] == cluster_of[corner[2]]))			continue;
+
+					// Repeated?  Winding doesn't matter; the mesh is drawn two-sided.
+					key[0] = ti * 4 + d;
+					for(k = 0; k < 3; ++k)
+						key[k+1] = k < d ? (unsigned int) out_of[corner[k]] : 0xFFFFFFFFu;
+					for(k = 1; k < 4; ++k)
+					for(j = k; j > 1 && key[j-1] > key[j]; --j)
+					{
+						unsigned int t = key[j]; key[j] = key[j-1]; key[j-1] = t;
+					}
+					if(find_or_add_row(slots, mask, keys, 4, key, &prim_count) != fresh)
+						continue;
+
+					for(k = 0; k < d; ++k)
+						out_index_table[index_total++] = out_of[corner[k]];
+				}
+			}
+			counts[ti] = index_total - starts[ti];
+		}
+
+		free(slots);
+		free(keys);
+	}
+
+	for(ti = 0; ti < tex_count; ++ti)
+	{
+		out_quad_starts[ti] = out_tri_starts[ti] + out_tri_counts[ti];
+		out_quad_counts[ti] = 0;
+	}
+
+	// Pass 4: squeeze out vertices only dropped primitives used.  New slots
+	// never pass old ones, so this can be done in place, front to back.
+	{
+		int used = 0;
+		for(v = 0; v < out_count; ++v)
+			out_of[v] = -1;
+		for(i = 0; i < index_total; ++i)
+			out_of[out_index_table[i]] = 0;
+		for(v = 0; v < out_count; ++v)
+		if(out_of[v] == 0)
+		{
+			if(used != v)
+				memcpy(out_vertex_table + used * 10, out_vertex_table + v * 10, sizeof(float) * 10);
+			out_of[v] = used++;
+		}
+		for(i = 0; i < index_total; ++i)
+			out_index_table[i] = out_of[out_index_table[i]];
+		out_count = used;
+	}
+
+	*out_vertex_count = out_count;
+	*out_index_count = index_total;
+
+	free(cluster_of);
+	free(out_of);
+	free(clusters);
+}
+
+
+
+#pragma mark -
+//==============================================================================
+//	VERTEX CACHE OPTIMIZATION
+//==============================================================================
+
+// write_indexed_mesh emits primitives in sorted-vertex order, which is good for
+// nothing in particular once the GPU sees it.  Here we reorder each run of
+// triangles (or quads) so that primitives sharing vertices are drawn close
+// together and the post-transform cache gets hits, using Tom Forsyth's "linear
+// speed vertex cache optimisation": every vertex gets a score from its place
+// in a simulated LRU cache and from how many undrawn primitives still use it;
+// we greedily draw the best-scoring primitive next.
+//
+// Then vertices are renumbered in the order the index table first uses them,
+// so that vertex fetch walks the VBO front to back.
+
+#define FORSYTH_CACHE_SIZE		32
+#define FORSYTH_DECAY_POWER		1.5f
+#define FORSYTH_LAST_PRIM_SCORE	0.75f
+#define FORSYTH_VALENCE_SCALE	2.0f
+#define FORSYTH_VALENCE_POWER	0.5f
+
+struct ForsythVertex {
+	float	score;
+	int		cache_pos;				// -1 if not in the simulated cache.
+	int		remaining;				// Undrawn primitives using this vertex.
+	int		first;					// Start of our primitives in the prims-of-vertex table.
+	int		filled;					// Primitives filed there so far, while setting up.
+};
+
+static float forsyth_score(const struct ForsythVertex * v, int degree)
+{
+	float score = 0.0f;
+	if(v->remaining == 0)
+		return -1.0f;
+	if(v->cache_pos >= 0)
+	{
+		// The vertices of the primitive just drawn score the same no matter
+		// which order they went in.
+		if(v->cache_pos < degree)
+			score = FORSYTH_LAST_PRIM_SCORE;
+		else
+			score = powf(1.0f - (float) (v->cache_pos - degree) / (FORSYTH_CACHE_SIZE - degree), FORSYTH_DECAY_POWER);
+	}
+	return score + FORSYTH_VALENCE_SCALE * powf((float) v->remaining, -FORSYTH_VALENCE_POWER);
+}
+
+// Reorders count indices (count / degree primitives) in place.  verts must
+// have vertex_count entries, all zero on entry; they are left zero on exit.
+static void forsyth_reorder(unsigned int * indices, int count, int degree, struct ForsythVertex * verts)
+{
+	int prim_count = count / degree;
+	int i, k, p;
+	int * prims_of_vertex;
+	float * prim_score;
+	char * drawn;
+	unsigned int * out;
+	int cache[FORSYTH_CACHE_SIZE + 4];
+	int cache_count = 0;
+	int best = -1, scan = 0;
+
+	if(prim_count < 2)
+		return;
+
+	prims_of_vertex = (int *) malloc(sizeof(int) * count);
+	prim_score = (float *) malloc(sizeof(float) * prim_count);
+	drawn = (char *) calloc(prim_count, 1);
+	out = (unsigned int *) malloc(sizeof(unsigned int) * count);
+
+	// Vertex valences, then each vertex's slice of the prims-of-vertex table.
+	// A zero cache_pos marks a vertex we haven't given a slice yet.
+	for(i = 0; i < count; ++i)
+		++verts[indices[i]].remaining;
+	for(i = 0, k = 0; i < count; ++i)
+	{
+		struct ForsythVertex * v = verts + indices[i];
+		if(v->cache_pos == 0)
+		{
+			v->cache_pos = -1;
+			v->first = k;
+			v->score = forsyth_score(v, degree);
+			k += v->remaining;
+		}
+	}
+	for(i = 0; i < count; ++i)
+	{
+		struct ForsythVertex * v = verts + indices[i];
+		prims_of_vertex[v->first + v->filled++] = i / degree;
+	}
+
+	for(p = 0; p < prim_count; ++p)
+	{
+		prim_score[p] = 0.0f;
+		for(k = 0; k < degree; ++k)
+			prim_score[p] += verts[indices[p * degree + k]].score;
+		if(best < 0 || prim_score[p] > prim_score[best])
+			best = p;
+	}
+
+	for(i = 0; i < prim_count; ++i)
+	{
+		int new_cache[FORSYTH_CACHE_SIZE + 4];
+		int new_count = 0;
+
+		if(best < 0)
+		{
+			// Nothing in the cache leads anywhere - take the next undrawn
+			// primitive in the original order.
+			while(drawn[scan])
+				++scan;
+			best = scan;
+		}
+
+		// Draw it.
+		drawn[best] = 1;
+		for(k = 0; k < degree; ++k)
+		{
+			struct ForsythVertex * v = verts + indices[best * degree + k];
+			int * ours = prims_of_vertex + v->first;
+			int j;
+			out[i * degree + k] = indices[best * degree + k];
+
+			// Retire the primitive from the vertex's list, keeping the undrawn
+			// ones at the front.
+			for(j = 0; ours[j] != best; ++j) { }
+			ours[j] = ours[v->remaining - 1];
+			ours[v->remaining - 1] = best;
+			--v->remaining;
+
+			new_cache[new_count++] = indices[best * degree + k];
+		}
+
+		// The drawn vertices go to the front of the cache, then the rest in
+		// order; whatever falls off the end is out.
+		for(k = 0; k < cache_count; ++k)
+		{
+			int c = cache[k];
+			int j, dup = 0;
+			for(j = 0; j < degree; ++j)
+				if(new_cache[j] == c)
+					dup = 1;
+			if(!dup)
+				new_cache[new_count++] = c;
+		}
+		for(k = FORSYTH_CACHE_SIZE; k < new_count; ++k)
+		{
+			verts[new_cache[k]].cache_pos = -1;
+			verts[new_cache[k]].score = forsyth_score(verts + new_cache[k], degree);
+		}
+		cache_count = MIN(new_count, FORSYTH_CACHE_SIZE);
+		memcpy(cache, new_cache, sizeof(int) * cache_count);
+
+		// Rescore everything in the cache, and their primitives; the best of
+		// those goes next.
+		for(k = 0; k < cache_count; ++k)
+		{
+			verts[cache[k]].cache_pos = k;
+			verts[cache[k]].score = forsyth_score(verts + cache[k], degree);
+		}
+		best = -1;
+		for(k = 0; k < cache_count; ++k)
+		{
+			struct ForsythVertex * v = verts + cache[k];
+			int j;
+			for(j = 0; j < v->remaining; ++j)
+			{
+				int q = prims_of_vertex[v->first + j];
+				int m;
+				prim_score[q] = 0.0f;
+				for(m = 0; m < degree; ++m)
+					prim_score[q] += verts[indices[q * degree + m]].score;
+				if(best < 0 || prim_score[q] > prim_score[best])
+					best = q;
+			}
+		}
+	}
+
+	memcpy(indices, out, sizeof(unsigned int) * count);
+
+	for(i = 0; i < count; ++i)
+		memset(verts + indices[i], 0, sizeof(struct ForsythVertex));
+
+	free(prims_of_vertex);
+	free(prim_score);
+	free(drawn);
+	free(out);
+}
+
+void				optimize_indexed_mesh(
+							int						tex_count,
+							int						vertex_count,
+							float *					io_vertex_table,
+							int						index_count,
+							unsigned int *			io_index_table,
+							const int				tri_starts[],
+							const int				tri_counts[],
+							const int				quad_starts[],
+							const int				quad_counts[])
+{
+	struct ForsythVertex * verts = (struct ForsythVertex *) calloc(vertex_count + 1, sizeof(struct ForsythVertex));
+	int * new_of = (int *) malloc(sizeof(int) * (vertex_count + 1));
+	float * old_table = (float *) malloc(sizeof(float) * 10 * (vertex_count + 1));
+	int ti, i, v, next = 0;
+
+	for(ti = 0; ti < tex_count; ++ti)
+	{
+		forsyth_reorder(io_index_table + tri_starts[ti], tri_counts[ti], 3, verts);
+		forsyth_reorder(io_index_table + quad_starts[ti], quad_counts[ti], 4, verts);
+	}
+	free(verts);
+
+	// Renumber in first-use order.  Any vertex no index uses keeps its
+	// place relative to the others, after all of the used ones.
+	for(v = 0; v < vertex_count; ++v)
+		new_of[v] = -1;
+	for(i = 0; i < index_count; ++i)
+	if(new_of[io_index_table[i]] == -1)
+		new_of[io_index_table[i]] = next++;
+	for(v = 0; v < vertex_count; ++v)
+	if(new_of[v] == -1)
+		new_of[v] = next++;
+
+	memcpy(old_table, io_vertex_table, sizeof(float) * 10 * vertex_count);
+	for(v = 0; v < vertex_count; ++v)
+		memcpy(io_vertex_table + new_of[v] * 10, old_table + v * 10, sizeof(float) * 10);
+	for(i = 0; i < index_count; ++i)
+		io_index_table[i] = new_of[io_index_table[i]];
+
+	free(new_of);
+	free(old_table);
+}
+
+float				get_vertex_cache_miss_ratio(
+							int						cache_size,
+							int						degree,
+							int						index_count,
+							const unsigned int *	index_table)
+{
+	unsigned int * fifo;
+	int head = 0, used = 0, misses = 0, i, k;
+
+	if(index_count < degree)
+		return 0.0f;
+
+	fifo = (unsigned int *) malloc(sizeof(unsigned int) * cache_size);
+	for(i = 0; i < index_count; ++i)
+	{
+		for(k = 0; k < used; ++k)
+			if(fifo[k] == index_table[i])
+				break;
+		if(k < used)
+			continue;
+		++misses;
+		if(used < cache_size)
+			fifo[used++] = index_table[i];
+		else
+		{
+			fifo[head] = index_table[i];
+			head = (head + 1) % cache_size;
+		}
+	}
+	free(fifo);
+
+	return (float) misses / (index_count / degree);
+}
+
+
+
+#pragma mark -
+//==============================================================================
+//	PACKED VERTICES
+//==============================================================================
+
+// A 40-byte vertex is mostly waste: a part's vertices fill a small box, unit
+// normals have two degrees of freedom, and a part uses a handful of colors.
+// So a packed vertex is 12 bytes:
+//
+// - The location, as 16-bit fractions of the mesh's bounding box.  Even a
+//   48x48 baseplate comes out under 0.02 LDU per step.
+// - The normal, octahedrally encoded: project onto the octahedron |x|+|y|+|z|
+//   = 1, fold the lower half over the upper and keep x and y as 16-bit snorms.
+//   Lines have no normal; they get PACKED_NO_NORMAL.
+// - An index into a palette of the mesh's distinct RGBA colors, kept exactly,
+//   meta-color markers included.
+
+static inline float sign_not_zero(float v)
+{
+	return v < 0.0f ? -1.0f : 1.0f;
+}
+
+static inline short snorm16(float v)
+{
+	return (short) lrintf(MAX(-1.0f, MIN(1.0f, v)) * 32767.0f);
+}
+
+static void encode_octahedral(const float n[3], short out[2])
+{
+	float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+	float x, y;
+	if(l1 == 0.0f)
+	{
+		out[0] = PACKED_NO_NORMAL;
+		out[1] = 0;
+		return;
+	}
+	x = n[0] / l1;
+	y = n[1] / l1;
+	if(n[2] < 0.0f)
+	{
+		float fx = (1.0f - fabsf(y)) * sign_not_zero(x);
+		float fy = (1.0f - fabsf(x)) * sign_not_zero(y);
+		x = fx;
+		y = fy;
+	}
+	out[0] = snorm16(x);
+	out[1] = snorm16(y);
+}
+
+static void decode_octahedral(const short in[2], float n[3])
+{
+	float x, y, z, l;
+	if(in[0] == PACKED_NO_NORMAL)
+	{
+		n[0] = n[1] = n[2] = 0.0f;
+		return;
+	}
+	x = in[0] / 32767.0f;
+	y = in[1] / 32767.0f;
+	z = 1.0f - fabsf(x) - fabsf(y);
+	if(z < 0.0f)
+	{
+		float fx = (1.0f - fabsf(y)) * sign_not_zero(x);
+		float fy = (1.0f - fabsf(x)) * sign_not_zero(y);
+		x = fx;
+		y = fy;
+	}
+	l = sqrtf(x * x + y * y + z * z);
+	n[0] = x / l;
+	n[1] = y / l;
+	n[2] = z / l;
+}
+
+int					pack_vertices(
+							int						vertex_count,
+							const float *			vertex_table,
+							struct PackedVertex *	out_vertices,
+							float					out_origin[3],
+							float					out_scale[3],
+							float *					out_palette)
+{
+	float hi[3] = { 0 };
+	int palette_count = 0;
+	int v, i;
+	unsigned int mask = 63;
+	int * slots;
+
+	// Bounds.  The scale is the size of one step; a flat mesh still gets a
+	// non-zero one so that decoding never divides by zero.
+	for(i = 0; i < 3; ++i)
+		out_origin[i] = 0.0f;
+	for(v = 0; v < vertex_count; ++v)
+	for(i = 0; i < 3; ++i)
+	{
+		float c = vertex_table[v * 10 + i];
+		if(v == 0 || c < out_origin[i])	out_origin[i] = c;
+		if(v == 0 || c > hi[i])			hi[i] = c;
+	}
+	for(i = 0; i < 3; ++i)
+		out_scale[i] = hi[i] > out_origin[i] ? (hi[i] - out_origin[i]) / 65535.0f : 1.0f;
+
+	// The palette is a hash of colors by their bits - sized for the common
+	// case of a few colors and grown if a part has more.
+	while(mask + 1 < (unsigned int) MIN(vertex_count, PACKED_MAX_COLORS) * 2)
+		mask = mask * 2 + 1;
+	slots = (int *) malloc(sizeof(int) * (mask + 1));
+	memset(slots, 0xFF, sizeof(int) * (mask + 1));
+
+	for(v = 0; v < vertex_count; ++v)
+	{
+		const float * src = vertex_table + v * 10;
+		struct PackedVertex * dst = out_vertices + v;
+		unsigned int key[4];
+		unsigned int s;
+
+		for(i = 0; i < 3; ++i)
+			dst->position[i] = (unsigned short) MIN(65535L, lrintf((src[i] - out_origin[i]) / out_scale[i]));
+
+		encode_octahedral(src + 3, dst->normal);
+
+		memcpy(key, src + 6, sizeof(key));
+		s = hash_words(key, 4) & mask;
+		while(slots[s] != -1 && memcmp(out_palette + slots[s] * 4, src + 6, sizeof(float) * 4) != 0)
+			s = (s + 1) & mask;
+		if(slots[s] == -1)
+		{
+			if(palette_count == PACKED_MAX_COLORS)
+			{
+				free(slots);
+				return -1;
+			}
+			slots[s] = palette_count;
+			memcpy(out_palette + palette_count * 4, src + 6, sizeof(float) * 4);
+			++palette_count;
+		}
+		dst->color = (unsigned short) slots[s];
+	}
+
+	free(slots);
+	return palette_count;
+}
+
+void				unpack_vertices(
+							int							vertex_count,
+							const struct PackedVertex *	vertices,
+							const float					origin[3],
+							const float					scale[3],
+							const float *				palette,
+							float *						out_vertex_table)
+{
+	int v;
+	for(v = 0; v < vertex_count; ++v)
+	{
+		const struct PackedVertex * src = vertices + v;
+		float * dst = out_vertex_table + v * 10;
+		dst[0] = origin[0] + src->position[0] * scale[0];
+		dst[1] = origin[1] + src->position[1] * scale[1];
+		dst[2] = origin[2] + src->position[2] * scale[2];
+		decode_octahedral(src->normal, dst + 3);
+		memcpy(dst + 6, palette + src->color * 4, sizeof(float) * 4);
+	}
+}
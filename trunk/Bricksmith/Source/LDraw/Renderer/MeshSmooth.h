@@ -54,6 +54,14 @@
 //
 // Texture IDs should be sequential and zero based.
 //
+// Threading:
+//
+// Big meshes (a whole LSynth hose, a baked submodel) are processed on several
+// threads; small ones stay on the calling thread, where the set-up would cost
+// more than it saves.  Either way the output is bit-identical, so the choice
+// is purely one of speed.  Only one mesh at a time gets the worker threads; a
+// second big mesh processed at the same time just runs serially.
+//
 //==============================================================================
 
 
@@ -95,6 +103,45 @@ void				finish_creases_and_join(struct Mesh * mesh);
 void				smooth_vertices(struct Mesh * mesh);
 void				merge_vertices(struct Mesh * mesh);
 
+//==============================================================================
+// Threading API
+//==============================================================================
+
+// Meshes with at least this many vertices are processed in parallel by default.
+#define MESH_PARALLEL_VERTEX_THRESHOLD	32768
+
+#define MESH_THREADS_AUTO		0		// Parallel at or above the threshold.  The default.
+#define MESH_THREADS_SERIAL		1		// Always on the calling thread.
+#define MESH_THREADS_PARALLEL	2		// Always in parallel, whatever the size.
+
+// Picks how the processing routines run.  Call it before finish_faces_and_sort.
+void				set_mesh_threading(struct Mesh * mesh, int mode);
+
+//==============================================================================
+// Welding API
+//==============================================================================
+
+#define MESH_WELD_RTREE			0		// Search an R-tree of the vertices.
+#define MESH_WELD_GRID			1		// Probe a hash grid of EPSI-sized cells.  The default.
+
+// Picks how finish_faces_and_sort finds vertices to weld.  Both strategies
+// weld exactly the same vertices to exactly the same place.
+void				set_mesh_welder(struct Mesh * mesh, int welder);
+
+//==============================================================================
+// Timing API
+//==============================================================================
+
+// T junction removal times itself in three parts, so its cost can be seen
+// without a profiler.  The timers add up over the mesh's life.
+#define MESH_TIMER_T_JUNCTION_INDEX		0	// Filing edges into the edge grid.
+#define MESH_TIMER_T_JUNCTION_SEARCH	1	// Testing each vertex against the edges near it.
+#define MESH_TIMER_T_JUNCTION_REBUILD	2	// Splitting faces and re-sorting the new mesh.
+#define MESH_TIMER_COUNT				3
+
+// Returns the seconds the mesh has spent in one MESH_TIMER_* stage.
+double				get_mesh_timer(struct Mesh * mesh, int timer);
+
 //==============================================================================
 // Data output API
 //==============================================================================
@@ -131,4 +178,107 @@ void				write_indexed_mesh(
 // This releases all internal storage for the mesh when smoothing is complete.
 void				destroy_mesh(struct Mesh * mesh);
 
+//==============================================================================
+// Level of detail API
+//==============================================================================
+
+// Makes a cheaper copy of a mesh written by write_indexed_mesh (with an index
+// base of 0), for drawing it when it is small on screen.  Vertices within the
+// same cell_size cube are merged; primitives that collapse are dropped and
+// quads come out as triangles, so every out_quad_counts entry is 0.  The
+// tables and start/count arrays are laid out as write_indexed_mesh's are.
+//
+// The output never has more vertices than the input, nor more than 3/2 as
+// many indices; size the output tables for that.
+void				simplify_indexed_mesh(
+							float					cell_size,
+							int						tex_count,
+							int						vertex_count,
+							const float *			vertex_table,
+							const unsigned int *	index_table,
+							const int				line_starts[],
+							const int				line_counts[],
+							const int				tri_starts[],
+							const int				tri_counts[],
+							const int				quad_starts[],
+							const int				quad_counts[],
+							int *					out_vertex_count,
+							float *					out_vertex_table,
+							int *					out_index_count,
+							unsigned int *			out_index_table,
+							int						out_line_starts[],
+							int						out_line_counts[],
+							int						out_tri_starts[],
+							int						out_tri_counts[],
+							int						out_quad_starts[],
+							int						out_quad_counts[]);
+
+//==============================================================================
+// Vertex cache API
+//==============================================================================
+
+// Reorders the tris and quads of a mesh written by write_indexed_mesh (with an
+// index base of 0) for the GPU's post-transform vertex cache, then renumbers
+// the vertices in the order they are first used.  The start/count arrays are
+// unchanged; so is what gets drawn.
+void				optimize_indexed_mesh(
+							int						tex_count,
+							int						vertex_count,
+							float *					io_vertex_table,
+							int						index_count,
+							unsigned int *			io_index_table,
+							const int				tri_starts[],
+							const int				tri_counts[],
+							const int				quad_starts[],
+							const int				quad_counts[]);
+
+// Simulates a FIFO vertex cache of cache_size entries over a run of
+// primitives of degree vertices each, and returns the average number of
+// cache misses per primitive (the "ACMR").  1.0 or less is good for
+// triangles; 3.0 is the worst possible.
+float				get_vertex_cache_miss_ratio(
+							int						cache_size,
+							int						degree,
+							int						index_count,
+							const unsigned int *	index_table);
+
+//==============================================================================
+// Packed vertex API
+//==============================================================================
+
+// A compact form of the 10-float vertex: 12 bytes instead of 40.  Locations
+// are quantized over the mesh's bounds, normals are octahedrally encoded and
+// colors are indices into a per-mesh palette, which stays exact.
+struct PackedVertex {
+	unsigned short		position[3];	// origin + position * scale.
+	unsigned short		color;			// Index into the palette.
+	short				normal[2];		// Octahedral, as snorms.
+};
+
+#define PACKED_NO_NORMAL	(-32768)	// normal[0] of a vertex with a zero normal (lines).
+#define PACKED_MAX_COLORS	65536
+
+// Packs a vertex table.  The palette must have room for 4 floats per distinct
+// color - vertex_count colors at most.  Returns the number of palette
+// entries, or -1 if the mesh has more than PACKED_MAX_COLORS colors.
+int					pack_vertices(
+							int						vertex_count,
+							const float *			vertex_table,
+							struct PackedVertex *	out_vertices,
+							float					out_origin[3],
+							float					out_scale[3],
+							float *					out_palette);
+
+// Unpacks vertices to the 10-float form, as a shader would.  Locations come
+// back within about half a step (scale) of the originals - positions round to
+// the nearest step, and computing origin + position * scale in float can add
+// a little more - and normals within about 0.005 radians.
+void				unpack_vertices(
+							int							vertex_count,
+							const struct PackedVertex *	vertices,
+							const float					origin[3],
+							const float					scale[3],
+							const float *				palette,
+							float *						out_vertex_table);
+
 #endif /* MeshSmooth_H */
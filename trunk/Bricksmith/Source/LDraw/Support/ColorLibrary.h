@@ -13,9 +13,36 @@
 //==============================================================================
 #import <Foundation/Foundation.h>
 #import OPEN_GL_HEADER
+#import <pthread.h>
 
 #import "LDrawColor.h"
 
+// Color lookup - THEORY OF OPERATION
+//
+// Every primitive the parser reads resolves its color code here, from many
+// parser threads at once.  So lookups go through an immutable snapshot of the
+// library: an array indexed directly by the standard codes 0-511, and a small
+// map for codes outside that range.  Readers just load the snapshot pointer;
+// no locks, no NSNumber keys.
+//
+// Registering a color code is rare (ldconfig.ldr, a model's own !COLOUR
+// lines), but registrations come in runs, often with lookups in between.  So
+// registering only updates the master dictionaries under a lock and retires
+// the snapshot.  Until there is a new one, lookups search the dictionaries
+// under the lock.  A fresh snapshot is built once the library has answered
+// about as many lookups as building it would cost, or when a batch of
+// registrations ends (see -publishLookupTable), so a file that alternates
+// !COLOUR lines with lookups never rebuilds the snapshot per line.
+//
+// Lock-free readers announce themselves in a counter while they use the
+// snapshot.  A retired snapshot - and the colors it retains - is freed the
+// next time the library changes with no reader in flight.
+//
+// Direct 0x2RRGGBB colors are NOT in the snapshot.  A model can use thousands
+// of them, each found mid-parse, and rebuilding the snapshot for each would
+// cost quadratic time and memory.  They live in their own map, guarded by its
+// own lock, which only direct-color lookups take.
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -42,6 +69,15 @@
 {
 	NSMutableDictionary	*colors;		// keys are LDrawColorT codes; objects are LDrawColors
 	NSMutableDictionary *privateColors;	// colors we might be asked to display, but should NOT be in the color picker
+	
+	pthread_mutex_t				mutex;			// guards the dictionaries and publishing
+	struct ColorLookupTable		*lookupTable;	// read without locking; NULL when out of date
+	struct ColorLookupTable		*retiredTables;
+	volatile int32_t			activeReaders;	// lookups using lookupTable right now
+	NSUInteger					lockedLookups;	// lookups answered under the lock since the last change
+	
+	pthread_mutex_t				directMutex;	// guards directColors
+	CFMutableDictionaryRef		directColors;	// keys are 0x2RRGGBB-style values; objects are LDrawColors
 }
 
 // Initialization
@@ -50,11 +86,13 @@
 // Accessors
 - (NSArray *) colors;
 - (LDrawColor *) colorForCode:(LDrawColorT)colorCode;
+- (LDrawColor *) colorForDirectValue:(uint32_t)directValue;
 - (void) getComplimentRGBA:(GLfloat *)complimentRGBA forCode:(LDrawColorT)colorCode;
 
 // Registering Colors
 - (void) addColor:(LDrawColor *)newColor;
 - (void) addPrivateColor:(LDrawColor *)newColor;
+- (LDrawColor *) addDirectColor:(LDrawColor *)newColor forValue:(uint32_t)directValue;
 
 // Utilities
 
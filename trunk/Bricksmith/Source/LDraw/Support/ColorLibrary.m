@@ -20,11 +20,53 @@
 //==============================================================================
 #import "ColorLibrary.h"
 
+#import <libkern/OSAtomic.h>
+
 #import "LDrawColor.h"
 #import "LDrawFile.h"
 #import "LDrawModel.h"
 #import "LDrawPaths.h"
 
+// Codes below this are looked up by array index.
+#define COLOR_LOOKUP_DENSE_SIZE		512
+
+// An immutable snapshot of a library's colors. See ColorLibrary.h.
+typedef struct ColorLookupTable
+{
+	LDrawColor				*dense[COLOR_LOOKUP_DENSE_SIZE];	// retained
+	CFMutableDictionaryRef	overflow;		// other codes -> LDrawColor
+	struct ColorLookupTable	*nextRetired;
+
+} ColorLookupTable;
+
+
+//========== freeLookupTable ===================================================
+//
+// Purpose:		Releases a snapshot and everything it retains.
+//
+//==============================================================================
+static void freeLookupTable(ColorLookupTable *table)
+{
+	int counter = 0;
+
+	for(counter = 0; counter < COLOR_LOOKUP_DENSE_SIZE; counter++)
+		[table->dense[counter] release];
+
+	CFRelease(table->overflow);
+	free(table);
+}
+
+
+@interface ColorLibrary ()
+
+- (LDrawColor *) colorForCodeLocked:(LDrawColorT)colorCode;
+- (void) publishLookupTable;
+- (void) retireLookupTable;
+- (void) freeRetiredTables;
+
+@end
+
+
 @implementation ColorLibrary
 
 static ColorLibrary	*sharedColorLibrary	= nil;
@@ -97,6 +139,9 @@ static ColorLibrary	*sharedColorLibrary	= nil;
 			blendedColor = [LDrawColor blendedColorForCode:counter];
 			[sharedColorLibrary addPrivateColor:blendedColor];
 		}
+		
+		// That's all of them; parser threads will hammer this from now on.
+		[sharedColorLibrary publishLookupTable];
 	}
 	
 	return sharedColorLibrary;
@@ -115,6 +160,11 @@ static ColorLibrary	*sharedColorLibrary	= nil;
 	
 	colors = [[NSMutableDictionary alloc] init];
 	
+	pthread_mutex_init(&mutex, NULL);
+	pthread_mutex_init(&directMutex, NULL);
+	
+	directColors = CFDictionaryCreateMutable(NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+	
 	return self;
 
 }//end init
@@ -150,13 +200,29 @@ static ColorLibrary	*sharedColorLibrary	= nil;
 //==============================================================================
 - (LDrawColor *) colorForCode:(LDrawColorT)colorCode
 {
-	NSNumber	*key	= [NSNumber numberWithInteger:colorCode];
-	LDrawColor	*color	= [self->colors objectForKey:key];
+	ColorLookupTable	*table	= NULL;
+	LDrawColor			*color	= nil;
 	
-	// Try searching the private colors.
-	if(color == nil)
+	// The barrier in the increment orders it before loading the table; see 
+	// -freeRetiredTables for the other half. 
+	OSAtomicIncrement32Barrier(&self->activeReaders);
+	table = self->lookupTable;
+	
+	if(table != NULL)
+	{
+		// The snapshot already gives the public colors precedence over the 
+		// private ones. 
+		if(colorCode >= 0 && colorCode < COLOR_LOOKUP_DENSE_SIZE)
+			color = table->dense[colorCode];
+		else
+			color = (LDrawColor *)CFDictionaryGetValue(table->overflow, (const void *)(intptr_t)colorCode);
+		
+		OSAtomicDecrement32Barrier(&self->activeReaders);
+	}
+	else
 	{
-		color = [self->privateColors objectForKey:key];
+		OSAtomicDecrement32Barrier(&self->activeReaders);
+		color = [self colorForCodeLocked:colorCode];
 	}
 	
 	// Try the shared library.
@@ -176,6 +242,68 @@ static ColorLibrary	*sharedColorLibrary	= nil;
 }//end colorForCode:
 
 
+//========== colorForCodeLocked: ===============================================
+//
+// Purpose:		Looks a color code up in the dictionaries, for when the 
+//				snapshot is out of date. 
+//
+// Notes:		Once this has answered about as many lookups as there are colors 
+//				- what building a snapshot costs - it builds one, so a library 
+//				that has stopped changing gets back to lock-free lookups. 
+//
+//==============================================================================
+- (LDrawColor *) colorForCodeLocked:(LDrawColorT)colorCode
+{
+	NSNumber	*key		= [NSNumber numberWithInteger:colorCode];
+	LDrawColor	*color		= nil;
+	BOOL		publish		= NO;
+	
+	pthread_mutex_lock(&mutex);
+	{
+		color = [self->colors objectForKey:key];
+		if(color == nil)
+			color = [self->privateColors objectForKey:key];
+		
+		// Colors are never removed from a library, so using one after 
+		// unlocking is safe. 
+		self->lockedLookups++;
+		publish = (self->lockedLookups > [self->colors count] + [self->privateColors count]);
+	}
+	pthread_mutex_unlock(&mutex);
+	
+	if(publish)
+		[self publishLookupTable];
+	
+	return color;
+	
+}//end colorForCodeLocked:
+
+
+//========== colorForDirectValue: ==============================================
+//
+// Purpose:		Returns the color registered for a direct color value (e.g. 
+//				0x2RRGGBB), or nil if the parser hasn't seen it yet. 
+//
+// Notes:		Direct colors are kept out of the lock-free snapshot; see 
+//				ColorLibrary.h. This lock is only shared with other direct-color 
+//				lookups. 
+//
+//==============================================================================
+- (LDrawColor *) colorForDirectValue:(uint32_t)directValue
+{
+	LDrawColor	*color	= nil;
+	
+	pthread_mutex_lock(&directMutex);
+	{
+		color = (LDrawColor *)CFDictionaryGetValue(self->directColors, (const void *)(uintptr_t)directValue);
+	}
+	pthread_mutex_unlock(&directMutex);
+	
+	return color;
+	
+}//end colorForDirectValue:
+
+
 //========== complimentColorForCode: ===========================================
 //
 // Purpose:		Returns the color that should be used when the compliment color 
@@ -231,7 +359,12 @@ static ColorLibrary	*sharedColorLibrary	= nil;
 	LDrawColorT	 colorCode	= [newColor colorCode];
 	NSNumber	*key		= [NSNumber numberWithInteger:colorCode];
 
-	[self->colors setObject:newColor forKey:key];
+	pthread_mutex_lock(&mutex);
+	{
+		[self->colors setObject:newColor forKey:key];
+		[self retireLookupTable];
+	}
+	pthread_mutex_unlock(&mutex);
 	
 }//end addColor:
 
@@ -253,15 +386,163 @@ static ColorLibrary	*sharedColorLibrary	= nil;
 	LDrawColorT	 colorCode	= [newColor colorCode];
 	NSNumber	*key		= [NSNumber numberWithInteger:colorCode];
 	
-	// Allocate if it doesn't exist. 
-	if(self->privateColors == nil)
-		self->privateColors = [[NSMutableDictionary alloc] init];
+	pthread_mutex_lock(&mutex);
+	{
+		// Allocate if it doesn't exist. 
+		if(self->privateColors == nil)
+			self->privateColors = [[NSMutableDictionary alloc] init];
 
-	[self->privateColors setObject:newColor forKey:key];
+		[self->privateColors setObject:newColor forKey:key];
+		[self retireLookupTable];
+	}
+	pthread_mutex_unlock(&mutex);
 	
 }//end addPrivateColor:
 
 
+//========== addDirectColor:forValue: ==========================================
+//
+// Purpose:		Registers the color the parser built for a direct color value, 
+//				so every later use of the value shares it. 
+//
+// Returns:		The color now registered for the value. If another thread got 
+//				there first, that is its color, not newColor. 
+//
+//==============================================================================
+- (LDrawColor *) addDirectColor:(LDrawColor *)newColor
+					   forValue:(uint32_t)directValue
+{
+	const void	*key			= (const void *)(uintptr_t)directValue;
+	LDrawColor	*registered		= nil;
+	
+	// Registered colors are never removed, so returning one after unlocking 
+	// is safe. 
+	pthread_mutex_lock(&directMutex);
+	{
+		registered = (LDrawColor *)CFDictionaryGetValue(self->directColors, key);
+		if(registered == nil)
+		{
+			registered = newColor;
+			CFDictionarySetValue(self->directColors, key, newColor);
+		}
+	}
+	pthread_mutex_unlock(&directMutex);
+	
+	return registered;
+	
+}//end addDirectColor:forValue:
+
+
+#pragma mark -
+#pragma mark LOOKUP TABLE
+#pragma mark -
+
+//========== publishLookupTable ================================================
+//
+// Purpose:		Builds a snapshot of the library for lock-free lookups, unless 
+//				another thread just did. 
+//
+// Notes:		Call this at the end of a batch of registrations, if you know 
+//				where that is. Otherwise lookups do, once they've paid for it. 
+//
+//==============================================================================
+- (void) publishLookupTable
+{
+	ColorLookupTable	*table		= NULL;
+	NSDictionary		*sources[2]	= { self->privateColors, self->colors }; // later wins
+	LDrawColorT			colorCode	= LDrawColorBogus;
+	int					counter		= 0;
+	
+	pthread_mutex_lock(&mutex);
+	{
+		table = self->lookupTable;
+		if(table == NULL)
+		{
+			table			= calloc(1, sizeof(ColorLookupTable));
+			table->overflow	= CFDictionaryCreateMutable(NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+			
+			for(counter = 0; counter < 2; counter++)
+			{
+				for(NSNumber *key in sources[counter])
+				{
+					LDrawColor *color = [sources[counter] objectForKey:key];
+					
+					colorCode = (LDrawColorT)[key integerValue];
+					if(colorCode >= 0 && colorCode < COLOR_LOOKUP_DENSE_SIZE)
+					{
+						[color retain];
+						[table->dense[colorCode] release];
+						table->dense[colorCode] = color;
+					}
+					else
+						CFDictionarySetValue(table->overflow, (const void *)(intptr_t)colorCode, color);
+				}
+			}
+			
+			// Readers must never see the pointer before the contents.
+			OSMemoryBarrier();
+			self->lookupTable = table;
+			
+			[self freeRetiredTables];
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	
+}//end publishLookupTable
+
+
+//========== retireLookupTable =================================================
+//
+// Purpose:		Marks the snapshot out of date. Called with the lock held.
+//
+// Notes:		A reader may still be using the old snapshot, so it goes on the 
+//				retired list rather than being freed here. 
+//
+//==============================================================================
+- (void) retireLookupTable
+{
+	if(self->lookupTable != NULL)
+	{
+		self->lookupTable->nextRetired	= self->retiredTables;
+		self->retiredTables				= self->lookupTable;
+		self->lookupTable				= NULL;
+	}
+	self->lockedLookups = 0;
+	
+	[self freeRetiredTables];
+	
+}//end retireLookupTable
+
+
+//========== freeRetiredTables =================================================
+//
+// Purpose:		Frees the retired snapshots if no lookup can be using them. 
+//				Called with the lock held, after lookupTable has been changed. 
+//
+// Notes:		A reader bumps activeReaders before it loads lookupTable; we 
+//				store lookupTable before we read activeReaders. With a full 
+//				barrier on both sides, either we see the reader, or the reader 
+//				sees the new lookupTable and never touches a retired one. 
+//
+//==============================================================================
+- (void) freeRetiredTables
+{
+	ColorLookupTable	*retired	= NULL;
+	
+	OSMemoryBarrier();
+	if(self->activeReaders != 0)
+		return;
+	
+	while(self->retiredTables != NULL)
+	{
+		retired				= self->retiredTables;
+		self->retiredTables	= retired->nextRetired;
+		freeLookupTable(retired);
+	}
+	
+}//end freeRetiredTables
+
+
 #pragma mark -
 #pragma mark UTILITY FUNCTIONS
 #pragma mark -
@@ -314,7 +595,21 @@ void complimentColor(const GLfloat *originalColor, GLfloat *complimentColor)
 //==============================================================================
 - (void) dealloc
 {
-	[colors release];
+	ColorLookupTable	*retired	= NULL;
+	
+	[self retireLookupTable];
+	while(self->retiredTables != NULL)
+	{
+		retired				= self->retiredTables;
+		self->retiredTables	= retired->nextRetired;
+		freeLookupTable(retired);
+	}
+	pthread_mutex_destroy(&mutex);
+	pthread_mutex_destroy(&directMutex);
+	
+	[colors			release];
+	[privateColors	release];
+	CFRelease(directColors);
 	
 	[super dealloc];
 }
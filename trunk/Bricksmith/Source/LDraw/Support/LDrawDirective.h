@@ -23,6 +23,7 @@
 @class LDrawModel;
 @class LDrawStep;
 @class LDrawPart;
+@class LDrawWriter;
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -88,6 +89,21 @@
 // Thus if the position of an object is changed 8 times between any external
 // code reading the object, an inval message is sent to observers only once.
 // See invalCache and revalCache for more details.
+//
+// INVALIDATION BATCHES
+//
+// A bulk edit (moving 5000 selected parts) invalidates each directive once,
+// and each of those sends its own statusInvalidated up the tree.  Wrapping the
+// edit in +beginInvalidationBatch / +commitInvalidationBatch holds those
+// messages back.  Flags are still set on the directives as usual, but the
+// notifications are queued; on commit, each observer receives ONE
+// statusInvalidated carrying the union of the flags of everything it watches
+// that changed.  The observers' own invalidations are coalesced the same way,
+// a level at a time, until the cascade reaches the top.  (The "who" of a
+// coalesced message is just one of the observables that changed.)
+//
+// Batches nest; only the outermost commit delivers.  A batch belongs to the
+// thread that opened it, so parser threads are unaffected.
 
 @protocol LDrawObserver;
 @protocol LDrawObservable;
@@ -189,6 +205,11 @@ typedef void(^LDrawPartVisitor)(LDrawPart *);
 
 // Class methods
 +(NSString *)defaultIconName;
++ (BOOL) parsesConcurrently;
+
+// Invalidation batches
++ (void) beginInvalidationBatch;
++ (void) commitInvalidationBatch;
 
 // Initialization
 - (id) initWithLines:(NSArray *)lines inRange:(NSRange)range;
@@ -208,6 +229,7 @@ typedef void(^LDrawPartVisitor)(LDrawPart *);
 - (void) depthTest:(Point2)testPt inBox:(Box2)bounds transform:(Matrix4)transform creditObject:(id)creditObject bestObject:(id *)bestObject bestDepth:(float *)bestDepth;
 
 - (NSString *) write;
+- (void) writeToStream:(LDrawWriter *)stream;
 
 // Display
 - (NSString *) browsingDescription;
@@ -238,6 +260,7 @@ typedef void(^LDrawPartVisitor)(LDrawPart *);
 				recursive:(BOOL)recursive;
 - (BOOL) isAncestorInList:(NSArray *)containers;
 - (void) noteNeedsDisplay;
+- (void) noteWillChange;
 - (void) registerUndoActions:(NSUndoManager *)undoManager;
 
 // These methods should really be "protected" methods for sub-classes to use when acting like observables.
@@ -13,6 +13,65 @@
 #import "LDrawFile.h"
 #import "LDrawModel.h"
 #import "LDrawStep.h"
+#import "LDrawWriter.h"
+
+// The invalidation batch open on this thread, if any.
+typedef struct
+{
+	NSUInteger				depth;
+	CFMutableDictionaryRef	pending;		// LDrawDirective (retained) -> CacheFlagsT not yet sent
+
+} InvalidationBatch;
+
+// The observers of one level of a batch, as it is being delivered.
+typedef struct
+{
+	CFMutableDictionaryRef	flags;			// observer -> union of CacheFlagsT
+	CFMutableDictionaryRef	who;			// observer -> first observable to reach it
+	id						observable;
+	CacheFlagsT				newFlags;
+
+} ObserverGathering;
+
+static __thread InvalidationBatch	*currentBatch	= NULL;
+
+
+//========== retainObserver / releaseObserver ==================================
+//
+// Purpose:		Key callbacks which keep observers alive while they are told, 
+//				but still compare them by pointer. 
+//
+//==============================================================================
+static const void *retainObserver(CFAllocatorRef allocator, const void *observer)
+{
+	return CFRetain(observer);
+}
+
+static void releaseObserver(CFAllocatorRef allocator, const void *observer)
+{
+	CFRelease(observer);
+}
+
+static const CFDictionaryKeyCallBacks	retainedObserverCallBacks	= { 0, retainObserver, releaseObserver, NULL, NULL, NULL };
+
+
+//========== gatherObserver ====================================================
+//
+// Purpose:		Folds one observable's flags into what its observer will be 
+//				sent when the batch is delivered.
+//
+//==============================================================================
+static void gatherObserver(void *observer, void *context)
+{
+	ObserverGathering	*gathering	= context;
+	CacheFlagsT			flags		= (CacheFlagsT)(uintptr_t)CFDictionaryGetValue(gathering->flags, observer);
+	
+	if(flags == 0)
+		CFDictionarySetValue(gathering->who, observer, gathering->observable);
+	
+	CFDictionarySetValue(gathering->flags, observer, (const void *)(uintptr_t)(flags | gathering->newFlags));
+}
+
 	
 @implementation LDrawDirective
 
@@ -27,6 +86,24 @@
 }
 
 
+//---------- parsesConcurrently --------------------------------------[static]--
+//
+// Purpose:		Returns YES if directives of this class can be parsed on a 
+//				worker thread, alongside their siblings. 
+//
+//				Anything which may load from the part library while parsing 
+//				can only do so if the library is thread-safe, which it is when 
+//				built with blocks. Subclasses whose parsing touches nothing 
+//				shared return YES.
+//
+//------------------------------------------------------------------------------
++ (BOOL) parsesConcurrently
+{
+	return USE_BLOCKS;
+	
+}//end parsesConcurrently
+
+
 #pragma mark -
 #pragma mark INITIALIZATION
 #pragma mark -
@@ -448,6 +525,23 @@
 }//end write
 
 
+//========== writeToStream: ====================================================
+//
+// Purpose:		Appends the LDraw code for this directive to the stream.
+//
+//				Directives with a lot of output (files, models, and the common 
+//				geometry lines) override this to avoid building intermediate 
+//				strings, and implement -write in terms of it instead. The 
+//				default just appends -write.
+//
+//==============================================================================
+- (void) writeToStream:(LDrawWriter *)stream
+{
+	[stream appendString:[self write]];
+	
+}//end writeToStream:
+
+
 #pragma mark -
 #pragma mark DISPLAY
 #pragma mark -
@@ -791,6 +885,36 @@
 }//end setNeedsDisplay
 
 
+//========== noteWillChange ====================================================
+//
+// Purpose:		Call before changing the directive. Any copy of it, or of a 
+//				container it is in, which is still sharing it gets its own 
+//				first.
+//
+// Notes:		Going from the root down matters: unsharing a container's copy 
+//				copies the containers inside it lazily, and those copies must 
+//				be unshared in turn on the way down to us.
+//
+//==============================================================================
+- (void) noteWillChange
+{
+	NSArray     *ancestors  = nil;
+	id          ancestor    = nil;
+	
+	if([LDrawContainer hasSharedCopies] == NO)
+		return;
+	
+	ancestors = [self ancestors];
+	
+	for(ancestor in ancestors)
+	{
+		if([ancestor isKindOfClass:[LDrawContainer class]])
+			[ancestor unshareCopies];
+	}
+	
+}//end noteWillChange
+
+
 //========== registerUndoActions: ==============================================
 //
 // Purpose:		Registers the undo actions that are unique to this subclass, 
@@ -972,10 +1096,19 @@
 - (void) invalCache:(CacheFlagsT) flags
 {
 	CacheFlagsT newFlags = flags & ~invalFlags;
+	CacheFlagsT pendingFlags = 0;
 	if(newFlags != 0)
 	{
 		invalFlags |= newFlags;
 		
+		// Inside a batch, observers hear about it when the batch commits.
+		if(currentBatch != NULL)
+		{
+			pendingFlags = (CacheFlagsT)(uintptr_t)CFDictionaryGetValue(currentBatch->pending, self);
+			CFDictionarySetValue(currentBatch->pending, self, (const void *)(uintptr_t)(pendingFlags | newFlags));
+			return;
+		}
+		
 		#if NEW_SET
 			MESSAGE_FOR_SET(observers,LDrawObserver,statusInvalidated:newFlags who:self);
 		#else		
@@ -1024,4 +1157,136 @@
 	return were_dirty;
 }
 
+
+#pragma mark -
+#pragma mark INVALIDATION BATCHES
+#pragma mark -
+
+//---------- beginInvalidationBatch ----------------------------------[static]--
+//
+// Purpose:		Holds back this thread's statusInvalidated messages until the 
+//				matching commitInvalidationBatch. Batches nest. 
+//
+// Notes:		Callers must commit even if the edit throws - put the commit 
+//				in an @finally. 
+//
+//------------------------------------------------------------------------------
++ (void) beginInvalidationBatch
+{
+	if(currentBatch == NULL)
+	{
+		currentBatch			= calloc(1, sizeof(InvalidationBatch));
+		currentBatch->pending	= CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+	}
+	currentBatch->depth++;
+	
+}//end beginInvalidationBatch
+
+
+//---------- commitInvalidationBatch ---------------------------------[static]--
+//
+// Purpose:		Closes a batch. Closing the outermost one delivers everything 
+//				it held back: each observer gets one statusInvalidated with 
+//				the union of the flags of the directives it watches. 
+//
+// Notes:		The batch stays open while delivering, so when observers 
+//				invalidate themselves in turn, that is queued too and sent 
+//				on the next pass - one level of the tree per pass. 
+//
+//				Observers are retained while they are being told, since 
+//				telling one may release another. If an observer throws, the 
+//				batch is still closed; otherwise every later invalidation on 
+//				this thread would be queued forever. 
+//
+//------------------------------------------------------------------------------
++ (void) commitInvalidationBatch
+{
+	InvalidationBatch		*batch			= currentBatch;
+	CFMutableDictionaryRef	pending			= NULL;
+	ObserverGathering		gathering		= { NULL, NULL, nil, 0 };
+	const void				**keys			= NULL;
+	const void				**values		= NULL;
+	CFIndex					count			= 0;
+	CFIndex					counter			= 0;
+	LDrawDirective			*directive		= nil;
+	id<LDrawObserver>		observer		= nil;
+	
+	assert(batch != NULL && batch->depth > 0);
+	
+	if(batch->depth > 1)
+	{
+		batch->depth--;
+		return;
+	}
+	
+	@try
+	{
+		while(CFDictionaryGetCount(batch->pending) > 0)
+		{
+			pending			= batch->pending;
+			batch->pending	= CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+			
+			gathering.flags	= CFDictionaryCreateMutable(NULL, 0, &retainedObserverCallBacks, NULL);
+			gathering.who	= CFDictionaryCreateMutable(NULL, 0, NULL, NULL);
+			
+			// Whose observers need to hear what?
+			count	= CFDictionaryGetCount(pending);
+			keys	= malloc(count * sizeof(void *));
+			values	= malloc(count * sizeof(void *));
+			CFDictionaryGetKeysAndValues(pending, keys, values);
+			
+			for(counter = 0; counter < count; counter++)
+			{
+				directive				= (LDrawDirective *)keys[counter];
+				gathering.observable	= directive;
+				gathering.newFlags		= (CacheFlagsT)(uintptr_t)values[counter];
+				
+				#if NEW_SET
+					FUNCTION_FOR_SET(directive->observers, gatherObserver, &gathering);
+				#else
+					for(NSValue *o in directive->observers)
+						gatherObserver([o pointerValue], &gathering);
+				#endif
+			}
+			free(keys);		keys	= NULL;
+			free(values);	values	= NULL;
+			
+			// Tell them, once each.
+			count	= CFDictionaryGetCount(gathering.flags);
+			keys	= malloc(count * sizeof(void *));
+			values	= malloc(count * sizeof(void *));
+			CFDictionaryGetKeysAndValues(gathering.flags, keys, values);
+			
+			for(counter = 0; counter < count; counter++)
+			{
+				observer = (id<LDrawObserver>)keys[counter];
+				[observer statusInvalidated:(CacheFlagsT)(uintptr_t)values[counter]
+										who:(id<LDrawObservable>)CFDictionaryGetValue(gathering.who, observer)];
+			}
+			free(keys);		keys	= NULL;
+			free(values);	values	= NULL;
+			
+			CFRelease(gathering.flags);	gathering.flags	= NULL;
+			CFRelease(gathering.who);	gathering.who	= NULL;
+			CFRelease(pending);			pending			= NULL;
+		}
+	}
+	@finally
+	{
+		free(keys);
+		free(values);
+		if(gathering.flags != NULL)
+			CFRelease(gathering.flags);
+		if(gathering.who != NULL)
+			CFRelease(gathering.who);
+		if(pending != NULL)
+			CFRelease(pending);
+		
+		CFRelease(batch->pending);
+		free(batch);
+		currentBatch = NULL;
+	}
+	
+}//end commitInvalidationBatch
+
 @end
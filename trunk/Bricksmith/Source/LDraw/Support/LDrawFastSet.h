@@ -26,10 +26,51 @@
 	NULL	NULL	The set is empty.
 	id1		NULL	The set contains one object, refered to via id1.
 	id1		id2		The set contains two objects, referred to via id1 and id2.
-	NULL	id2		The set contains at least 3 objects, contained in an NSMutableSet stored in id2.
+	NULL	id2		The set contains at least 3 objects, contained in an LDrawPointerSet stored in id2.
+	
+	OVERFLOW
+	
+	Shared submodels and LSynth constraints can have dozens of observers, and every 
+	invalCache: broadcasts to all of them.  So the overflow is not an NSMutableSet of 
+	boxed NSValues but a plain open-addressing hash of the pointers themselves: a 
+	power-of-two array of slots, probed linearly.  A slot holds NULL (empty), 
+	LDrawPointerSetTombstone (removed) or a member.
+	
+	BROADCAST
+	
+	Observers may add or remove observers (even themselves) while a message is being 
+	broadcast.  Instead of copying the set up front, a broadcast holds a reference on 
+	the slot array it is walking.  Any mutation of a slot array that somebody is 
+	walking first gives the set its own private copy, so the walk never sees the 
+	array change under it.  Like the old copy, observers added during a broadcast 
+	are not messaged, and each one is checked against the live set before it is.  
+	Broadcasts that don't mutate - nearly all of them - never copy anything.
+	
+	None of this is thread-safe; observers are only changed on one thread at a time.
 	
 */
 
+#include <stdint.h>
+
+// A removed member. Probing continues past it; inserting may reuse it.
+#define LDrawPointerSetTombstone	((void *)1)
+
+typedef struct LDrawPointerSlots {
+
+	uint32_t			refCount;		// the owning set, plus broadcasts walking it
+	uint32_t			capacity;		// power of two
+	void *				slots[];
+
+} LDrawPointerSlots;
+
+typedef struct LDrawPointerSet {
+
+	LDrawPointerSlots *	table;
+	uint32_t			count;			// members
+	uint32_t			used;			// members plus tombstones
+
+} LDrawPointerSet;
+
 typedef struct {
 
 	union {
@@ -38,16 +79,33 @@ typedef struct {
 			void *			p2;
 		} ptr;
 		struct {
-			void *			flag;
-			NSMutableSet *	mutable_set;
+			void *				flag;
+			LDrawPointerSet *	overflow;
 		} obj;
 	};
 	
 } LDrawFastSet;
 
 
+LDrawPointerSet *		LDrawPointerSetCreate(void * p1, void * p2, void * p3);
+void					LDrawPointerSetDestroy(LDrawPointerSet * set);
+int						LDrawPointerSetContains(const LDrawPointerSet * set, const void * p);
+void					LDrawPointerSetInsert(LDrawPointerSet * set, void * p);
+int						LDrawPointerSetRemove(LDrawPointerSet * set, const void * p);
+void					LDrawPointerSetGetTwo(const LDrawPointerSet * set, void ** p1, void ** p2);
+
+LDrawPointerSlots *		LDrawPointerSetBeginBroadcast(LDrawPointerSet * set);
+void					LDrawPointerSetEndBroadcast(LDrawPointerSlots * slots);
+
+#if LDRAW_FAST_SET_BENCHMARKS
+@class NSDictionary;
+NSDictionary *			LDrawFastSetBenchmarks(void);
+#endif
 
 
+
+// An overflow member is still in the set if the set still has the very slot 
+// array being walked (nothing has changed), or if a lookup finds it.
 #define MESSAGE_FOR_SET(this,ns_type,__msg) \
 	do {																					\
 		if(this.ptr.p1)																		\
@@ -62,22 +120,50 @@ typedef struct {
 		{																					\
 			if(this.ptr.p2)																	\
 			{																				\
-				NSSet * orig = [NSSet setWithSet:this.obj.mutable_set];						\
-				for (NSValue * o in orig)													\
+				LDrawPointerSlots * walk = LDrawPointerSetBeginBroadcast(this.obj.overflow);\
+				uint32_t i;																	\
+				for(i = 0; i < walk->capacity; ++i)											\
 				{																			\
-					id<ns_type> oo = [o pointerValue];										\
-					if(LDrawFastSetContains(this,oo))										\
+					id<ns_type> oo = walk->slots[i];										\
+					if(oo == NULL || (void *) oo == LDrawPointerSetTombstone)				\
+						continue;															\
+					if(	(this.obj.flag == NULL && this.obj.overflow != NULL					\
+						 && this.obj.overflow->table == walk)								\
+						|| LDrawFastSetContains(this,oo))									\
 					{																		\
 						[oo __msg];															\
 					}																		\
 				}																			\
+				LDrawPointerSetEndBroadcast(walk);											\
+			}																				\
+		}																					\
+	} while(0)
+
+// Calls __func(member, __context) for each member.  Unlike MESSAGE_FOR_SET, 
+// __func must not change the set.
+#define FUNCTION_FOR_SET(this,__func,__context) \
+	do {																					\
+		if(this.ptr.p1)																		\
+		{																					\
+			__func(this.ptr.p1, __context);													\
+			if(this.ptr.p2)																	\
+				__func(this.ptr.p2, __context);												\
+		}																					\
+		else if(this.ptr.p2)																\
+		{																					\
+			LDrawPointerSlots * walk = this.obj.overflow->table;							\
+			uint32_t i;																		\
+			for(i = 0; i < walk->capacity; ++i)												\
+			{																				\
+				if(walk->slots[i] != NULL && walk->slots[i] != LDrawPointerSetTombstone)	\
+					__func(walk->slots[i], __context);										\
 			}																				\
 		}																					\
 	} while(0)
 
 #define LDrawFastSetContains(this, p) \
-	((this.obj.flag == NULL && this.obj.mutable_set != nil) ?								\
-		([this.obj.mutable_set containsObject:[NSValue valueWithPointer:p]] ? 1 : 0) :		\
+	((this.obj.flag == NULL && this.obj.overflow != NULL) ?									\
+		LDrawPointerSetContains(this.obj.overflow, p) :										\
 		((this.ptr.p1 == p || this.ptr.p2 == p) ? 1 : 0))
 
 #define LDrawFastSetInit(this) \
@@ -88,8 +174,8 @@ typedef struct {
 
 #define LDrawFastSetDealloc(this) \
 	do {\
-		if(this.obj.flag == NULL && this.obj.mutable_set != nil)							\
-		[this.obj.mutable_set release];														\
+		if(this.obj.flag == NULL && this.obj.overflow != NULL)								\
+			LDrawPointerSetDestroy(this.obj.overflow);										\
 	} while(0) 
 
 #define LDrawFastSetInsert(this,p) \
@@ -100,12 +186,9 @@ typedef struct {
 			{																				\
 				if(p != this.ptr.p1 && p != this.ptr.p2)									\
 				{																			\
-					NSMutableSet * new_set = [[NSMutableSet alloc] initWithCapacity:3];		\
-					[new_set addObject:[NSValue valueWithPointer:this.ptr.p1]];				\
-					[new_set addObject:[NSValue valueWithPointer:this.ptr.p2]];				\
-					[new_set addObject:[NSValue valueWithPointer:p]];						\
+					LDrawPointerSet * new_set = LDrawPointerSetCreate(this.ptr.p1, this.ptr.p2, p);\
 					this.obj.flag = NULL;													\
-					this.obj.mutable_set = new_set;											\
+					this.obj.overflow = new_set;											\
 				}																			\
 			}																				\
 			else																			\
@@ -118,7 +201,7 @@ typedef struct {
 		{																					\
 			if(this.ptr.p2)																	\
 			{																				\
-				[this.obj.mutable_set addObject:[NSValue valueWithPointer:p]];				\
+				LDrawPointerSetInsert(this.obj.overflow, p);								\
 			}																				\
 			else																			\
 			{																				\
@@ -130,22 +213,16 @@ typedef struct {
 
 #define LDrawFastSetRemove(this, p) \
 	do {																					\
-		if(this.obj.flag == NULL && this.obj.mutable_set != nil)							\
+		if(this.obj.flag == NULL && this.obj.overflow != NULL)								\
 		{																					\
-			NSValue * me = [NSValue valueWithPointer:p];									\
-			assert([this.obj.mutable_set containsObject:me]);								\
-			[this.obj.mutable_set removeObject:me];											\
-			assert([this.obj.mutable_set count] >= 2);										\
-			if([this.obj.mutable_set count] == 2)											\
+			LDrawPointerSet * overflow_set = this.obj.overflow;								\
+			int found = LDrawPointerSetRemove(overflow_set, p);									\
+			assert(found); (void) found;													\
+			assert(overflow_set->count >= 2);												\
+			if(overflow_set->count == 2)												\
 			{																				\
-				void ** ptr = &this.ptr.p1;													\
-				NSMutableSet * dead = this.obj.mutable_set;									\
-				for(NSValue * o in dead)													\
-				{																			\
-					*ptr = [o pointerValue];												\
-					++ptr;																	\
-				}																			\
-				[dead release];																\
+				LDrawPointerSetGetTwo(overflow_set, &this.ptr.p1, &this.ptr.p2);						\
+				LDrawPointerSetDestroy(overflow_set);										\
 			}																				\
 		}																					\
 		else																				\
@@ -0,0 +1,421 @@
+//==============================================================================
+//
+// File:		LDrawFastSet.m
+//
+// Purpose:		The open-addressing pointer set LDrawFastSet overflows into.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import <Foundation/Foundation.h>
+
+#import "LDrawFastSet.h"
+
+#if LDRAW_FAST_SET_BENCHMARKS
+#import "LDrawDirective.h"
+#endif
+
+// An overflow set starts with room for 3 pointers and then some.
+#define POINTER_SET_MIN_CAPACITY	8
+
+
+//========== hashPointer =======================================================
+//
+// Purpose:		Returns the first slot to probe for p. Objects are 16-byte
+//				aligned, so the low bits carry nothing; Fibonacci hashing
+//				spreads what's left over the whole table.
+//
+//==============================================================================
+static inline uint32_t hashPointer(const void *p, uint32_t capacity)
+{
+	uint64_t bits = (uint64_t)((uintptr_t)p >> 4);
+
+	return (uint32_t)((bits * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+
+//========== allocSlots ========================================================
+//
+// Purpose:		Returns an empty slot array, referenced once.
+//
+//==============================================================================
+static LDrawPointerSlots *allocSlots(uint32_t capacity)
+{
+	LDrawPointerSlots *slots = calloc(1, sizeof(LDrawPointerSlots) + capacity * sizeof(void *));
+
+	slots->refCount	= 1;
+	slots->capacity	= capacity;
+
+	return slots;
+}
+
+
+//========== releaseSlots ======================================================
+//
+// Purpose:		Drops one reference to a slot array.
+//
+//==============================================================================
+static void releaseSlots(LDrawPointerSlots *slots)
+{
+	if(--slots->refCount == 0)
+		free(slots);
+}
+
+
+//========== findSlot ==========================================================
+//
+// Purpose:		Returns the index of the slot holding p, or -1.
+//
+//==============================================================================
+static int32_t findSlot(const LDrawPointerSlots *slots, const void *p)
+{
+	uint32_t	mask	= slots->capacity - 1;
+	uint32_t	index	= hashPointer(p, slots->capacity);
+
+	// The table is never full, so this finds p or an empty slot.
+	while(slots->slots[index] != NULL)
+	{
+		if(slots->slots[index] == p)
+			return (int32_t)index;
+		index = (index + 1) & mask;
+	}
+
+	return -1;
+}
+
+
+//========== rehash ============================================================
+//
+// Purpose:		Moves the members into a fresh slot array of the given
+//				capacity, leaving the tombstones behind. The old array is
+//				released, not freed; a broadcast may still be walking it.
+//
+//==============================================================================
+static void rehash(LDrawPointerSet *set, uint32_t capacity)
+{
+	LDrawPointerSlots	*old		= set->table;
+	LDrawPointerSlots	*fresh		= allocSlots(capacity);
+	uint32_t			mask		= capacity - 1;
+	uint32_t			counter		= 0;
+	uint32_t			index		= 0;
+	void				*p			= NULL;
+
+	for(counter = 0; counter < old->capacity; counter++)
+	{
+		p = old->slots[counter];
+		if(p != NULL && p != LDrawPointerSetTombstone)
+		{
+			index = hashPointer(p, capacity);
+			while(fresh->slots[index] != NULL)
+				index = (index + 1) & mask;
+			fresh->slots[index] = p;
+		}
+	}
+
+	releaseSlots(old);
+	set->table	= fresh;
+	set->used	= set->count;
+}
+
+
+//========== makePrivate =======================================================
+//
+// Purpose:		Gives the set its own slot array if a broadcast is walking the
+//				current one, so the mutation that follows doesn't disturb it.
+//
+//==============================================================================
+static inline void makePrivate(LDrawPointerSet *set)
+{
+	if(set->table->refCount > 1)
+		rehash(set, set->table->capacity);
+}
+
+
+//========== LDrawPointerSetCreate =============================================
+//
+// Purpose:		Creates the overflow for a fast set that's just outgrown its
+//				two inline pointers.
+//
+//==============================================================================
+LDrawPointerSet *LDrawPointerSetCreate(void *p1, void *p2, void *p3)
+{
+	LDrawPointerSet *set = malloc(sizeof(LDrawPointerSet));
+
+	set->table	= allocSlots(POINTER_SET_MIN_CAPACITY);
+	set->count	= 0;
+	set->used	= 0;
+
+	LDrawPointerSetInsert(set, p1);
+	LDrawPointerSetInsert(set, p2);
+	LDrawPointerSetInsert(set, p3);
+
+	return set;
+}
+
+
+//========== LDrawPointerSetDestroy ============================================
+//
+// Purpose:		Frees the set. Its slots live on until any broadcast walking
+//				them is done.
+//
+//==============================================================================
+void LDrawPointerSetDestroy(LDrawPointerSet *set)
+{
+	releaseSlots(set->table);
+	free(set);
+}
+
+
+//========== LDrawPointerSetContains ===========================================
+//
+// Purpose:		Returns 1 if p is a member.
+//
+//==============================================================================
+int LDrawPointerSetContains(const LDrawPointerSet *set, const void *p)
+{
+	return findSlot(set->table, p) >= 0;
+}
+
+
+//========== LDrawPointerSetInsert =============================================
+//
+// Purpose:		Adds p to the set, if it isn't there already.
+//
+// Notes:		The table is kept at most 3/4 full, counting tombstones; when
+//				it would pass that, it's rehashed to at most half full.
+//
+//==============================================================================
+void LDrawPointerSetInsert(LDrawPointerSet *set, void *p)
+{
+	LDrawPointerSlots	*slots		= NULL;
+	uint32_t			capacity	= 0;
+	uint32_t			mask		= 0;
+	uint32_t			index		= 0;
+	int32_t				reuse		= -1;
+
+	if(findSlot(set->table, p) >= 0)
+		return;
+
+	makePrivate(set);
+
+	if((set->used + 1) * 4 > set->table->capacity * 3)
+	{
+		capacity = POINTER_SET_MIN_CAPACITY;
+		while((set->count + 1) * 2 > capacity)
+			capacity *= 2;
+		rehash(set, capacity);
+	}
+
+	slots	= set->table;
+	mask	= slots->capacity - 1;
+	index	= hashPointer(p, slots->capacity);
+
+	while(slots->slots[index] != NULL)
+	{
+		if(reuse < 0 && slots->slots[index] == LDrawPointerSetTombstone)
+			reuse = (int32_t)index;
+		index = (index + 1) & mask;
+	}
+
+	if(reuse >= 0)
+		slots->slots[reuse] = p;
+	else
+	{
+		slots->slots[index] = p;
+		set->used++;
+	}
+	set->count++;
+}
+
+
+//========== LDrawPointerSetRemove =============================================
+//
+// Purpose:		Removes p from the set. Returns 0 if it wasn't a member.
+//
+//==============================================================================
+int LDrawPointerSetRemove(LDrawPointerSet *set, const void *p)
+{
+	int32_t index = findSlot(set->table, p);
+
+	if(index < 0)
+		return 0;
+
+	if(set->table->refCount > 1)
+	{
+		makePrivate(set);
+		index = findSlot(set->table, p);
+	}
+
+	set->table->slots[index] = LDrawPointerSetTombstone;
+	set->count--;
+
+	return 1;
+}
+
+
+//========== LDrawPointerSetGetTwo =============================================
+//
+// Purpose:		Returns the members of a set that has shrunk to two, so the
+//				fast set can hold them inline again.
+//
+//==============================================================================
+void LDrawPointerSetGetTwo(const LDrawPointerSet *set, void **p1, void **p2)
+{
+	const LDrawPointerSlots	*slots		= set->table;
+	void					**out		= p1;
+	uint32_t				counter		= 0;
+
+	for(counter = 0; counter < slots->capacity; counter++)
+	{
+		if(slots->slots[counter] != NULL && slots->slots[counter] != LDrawPointerSetTombstone)
+		{
+			*out = slots->slots[counter];
+			if(out == p2)
+				break;
+			out = p2;
+		}
+	}
+}
+
+
+//========== LDrawPointerSetBeginBroadcast =====================================
+//
+// Purpose:		Returns the slot array to walk for a broadcast, pinned until
+//				LDrawPointerSetEndBroadcast.
+//
+//==============================================================================
+LDrawPointerSlots *LDrawPointerSetBeginBroadcast(LDrawPointerSet *set)
+{
+	set->table->refCount++;
+
+	return set->table;
+}
+
+
+//========== LDrawPointerSetEndBroadcast =======================================
+//
+// Purpose:		Unpins a slot array. It is freed here if the set has moved on
+//				to a new one (or been destroyed) in the meantime.
+//
+//==============================================================================
+void LDrawPointerSetEndBroadcast(LDrawPointerSlots *slots)
+{
+	releaseSlots(slots);
+}
+
+
+#if LDRAW_FAST_SET_BENCHMARKS
+
+#pragma mark -
+#pragma mark BENCHMARKS
+#pragma mark -
+
+#define BENCHMARK_OPERATIONS	1000000
+
+// Counts the messages it gets; that's all.
+@interface LDrawFastSetBenchmarkObserver : NSObject <LDrawObserver>
+{
+	@public
+	NSUInteger messages;
+}
+@end
+
+@implementation LDrawFastSetBenchmarkObserver
+
+- (void) observableSaysGoodbyeCruelWorld:(id<LDrawObservable>) doomedObservable	{ messages++; }
+- (void) statusInvalidated:(CacheFlagsT) flags who:(id<LDrawObservable>) observable	{ messages++; }
+- (void) receiveMessage:(MessageT) msg who:(id<LDrawObservable>) observable		{ messages++; }
+
+@end
+
+
+//========== LDrawFastSetBenchmarks ============================================
+//
+// Purpose:		Times adding, removing and broadcasting to fast sets of
+//				various sizes, and returns nanoseconds per operation for each.
+//
+// Notes:		Turn on LDRAW_FAST_SET_BENCHMARKS in the prefix header and the
+//				--benchmark report includes these under "fast_set".
+//
+//==============================================================================
+NSDictionary *LDrawFastSetBenchmarks(void)
+{
+	static const NSUInteger			sizes[]		= { 1, 2, 3, 8, 32, 128 };
+	NSMutableDictionary				*results	= [NSMutableDictionary dictionary];
+	LDrawFastSetBenchmarkObserver	**observers	= NULL;
+	LDrawFastSet					*sets		= NULL;
+	LDrawFastSet					set;
+	CFAbsoluteTime					start		= 0;
+	NSUInteger						sizeIndex	= 0;
+	NSUInteger						size		= 0;
+	NSUInteger						rounds		= 0;
+	NSUInteger						round		= 0;
+	NSUInteger						counter		= 0;
+	double							addTime		= 0;
+	double							removeTime	= 0;
+	double							sendTime	= 0;
+
+	for(sizeIndex = 0; sizeIndex < sizeof(sizes) / sizeof(sizes[0]); sizeIndex++)
+	{
+		size		= sizes[sizeIndex];
+		rounds		= BENCHMARK_OPERATIONS / size;
+		observers	= malloc(size * sizeof(LDrawFastSetBenchmarkObserver *));
+		sets		= malloc(rounds * sizeof(LDrawFastSet));
+
+		for(counter = 0; counter < size; counter++)
+			observers[counter] = [[LDrawFastSetBenchmarkObserver alloc] init];
+
+		// Fill a set per round, then empty them all; removal in insertion 
+		// order is the common case (a model's parts going away in file order). 
+		// Each phase is timed as a whole: at the small sizes, reading the clock 
+		// costs more than the operations do. 
+		for(round = 0; round < rounds; round++)
+			LDrawFastSetInit(sets[round]);
+
+		start = CFAbsoluteTimeGetCurrent();
+		for(round = 0; round < rounds; round++)
+		{
+			for(counter = 0; counter < size; counter++)
+				LDrawFastSetInsert(sets[round], observers[counter]);
+		}
+		addTime = CFAbsoluteTimeGetCurrent() - start;
+
+		start = CFAbsoluteTimeGetCurrent();
+		for(round = 0; round < rounds; round++)
+		{
+			for(counter = 0; counter < size; counter++)
+				LDrawFastSetRemove(sets[round], observers[counter]);
+		}
+		removeTime = CFAbsoluteTimeGetCurrent() - start;
+
+		for(round = 0; round < rounds; round++)
+			LDrawFastSetDealloc(sets[round]);
+		free(sets);
+
+		LDrawFastSetInit(set);
+		for(counter = 0; counter < size; counter++)
+			LDrawFastSetInsert(set, observers[counter]);
+
+		start = CFAbsoluteTimeGetCurrent();
+		for(round = 0; round < rounds; round++)
+			MESSAGE_FOR_SET(set, LDrawObserver, statusInvalidated:CacheFlagBounds who:nil);
+		sendTime = CFAbsoluteTimeGetCurrent() - start;
+
+		LDrawFastSetDealloc(set);
+
+		[results setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[NSNumber numberWithDouble:addTime		* 1e9 / (rounds * size)], @"add_ns",
+								[NSNumber numberWithDouble:removeTime	* 1e9 / (rounds * size)], @"remove_ns",
+								[NSNumber numberWithDouble:sendTime		* 1e9 / (rounds * size)], @"message_ns",
+								nil]
+					forKey:[NSString stringWithFormat:@"%lu", (unsigned long)size]];
+
+		for(counter = 0; counter < size; counter++)
+			[observers[counter] release];
+		free(observers);
+	}
+
+	return results;
+}
+
+#endif
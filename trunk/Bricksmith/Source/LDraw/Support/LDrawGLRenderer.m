@@ -30,6 +30,7 @@
 #import "LDrawStep.h"
 #import "LDrawUtilities.h"
 #import "LDrawShaderRenderer.h"
+#import "PartLibrary.h"
 #include "OpenGLUtilities.h"
 #include "MacLDraw.h"
 
@@ -289,6 +290,10 @@
 	glMatrixMode(GL_MODELVIEW);
 	glLoadMatrixf([camera getModelView]);
 
+	// Library models evicted since the last frame leave their display lists 
+	// for us to clean up, since we have the context. 
+	[[PartLibrary sharedPartLibrary] discardEvictedDisplayLists];
+	
 	// DRAW!
 	#if !NEW_RENDERER
 	
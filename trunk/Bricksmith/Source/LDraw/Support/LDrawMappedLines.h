@@ -0,0 +1,61 @@
+//==============================================================================
+//
+// File:		LDrawMappedLines.h
+//
+// Purpose:		An immutable array of the lines of an LDraw file, backed by a
+//				memory-mapped copy of the file and a compact line index.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import <Foundation/Foundation.h>
+
+// Mapped lines - THEORY OF OPERATION
+//
+// The parser interface (initWithLines:inRange:parentGroup:) has always taken an
+// NSArray of line strings.  Building that array meant decoding the entire file
+// into one giant NSString (up to three times, while we hunted for the right
+// encoding), then copying every line out of it into its own NSString.  For a
+// big MPD that is several copies of the file alive at once, all before we
+// parse a single directive.
+//
+// LDrawMappedLines is a drop-in NSArray subclass that instead:
+//
+// - Maps the file (the VM system pages it in as we go, and can page it back
+//   out; it is never copied into the heap).
+// - Decides the encoding once, with a single validation pass over the bytes.
+// - Builds an index of line [start, end) offsets in the same pass that finds
+//   the line breaks.  Line terminators are CR, LF or CRLF.
+//
+// Parsers that only need bytes (the primitive constructors, the step and MPD
+// delimiter checks) pull them via +[LDrawUtilities bytesForLineAtIndex:...]
+// with no copying.  Anything that calls -objectAtIndex: still gets a real,
+// self-contained NSString; those are made on demand, so only meta-command
+// lines that actually need text ever turn into strings.
+//
+// Strings returned from objectAtIndex: do not reference the mapping, so they
+// may outlive the array.  The raw bytes may not!
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// class LDrawMappedLines
+//
+////////////////////////////////////////////////////////////////////////////////
+@interface LDrawMappedLines : NSArray
+{
+	NSData				*fileData;		// mapped file contents; owns the bytes.
+	const char			*fileBytes;
+	NSStringEncoding	encoding;		// UTF-8 if valid, otherwise Latin-1.
+	NSUInteger			lineCount;
+	uint32_t			*lineBounds;	// lineCount pairs of [start, end) offsets.
+}
+
+// Initialization
++ (LDrawMappedLines *) linesWithContentsOfFile:(NSString *)path;
+- (id) initWithData:(NSData *)data;
+
+// Accessors
+- (const char *) bytesForLineAtIndex:(NSUInteger)index length:(NSUInteger *)length;
+- (NSStringEncoding) encoding;
+
+@end
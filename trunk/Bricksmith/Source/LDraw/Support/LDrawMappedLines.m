@@ -0,0 +1,269 @@
+//==============================================================================
+//
+// File:		LDrawMappedLines.m
+//
+// Purpose:		An immutable array of the lines of an LDraw file, backed by a
+//				memory-mapped copy of the file and a compact line index.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import "LDrawMappedLines.h"
+
+
+// Returns true if the buffer is well-formed UTF-8.  Pure-ASCII runs (the vast
+// majority of any LDraw file) are skipped 8 bytes at a time.
+static int is_valid_utf8(const unsigned char * p, const unsigned char * e)
+{
+	while(p < e)
+	{
+		if(e - p >= 8)
+		{
+			uint64_t chunk;
+			memcpy(&chunk, p, 8);
+			if((chunk & 0x8080808080808080ULL) == 0)
+			{
+				p += 8;
+				continue;
+			}
+		}
+
+		if(*p < 0x80)
+		{
+			++p;
+			continue;
+		}
+
+		int extra;
+		unsigned int cp;
+		if((*p & 0xE0) == 0xC0)			{ extra = 1; cp = *p & 0x1F; }
+		else if((*p & 0xF0) == 0xE0)	{ extra = 2; cp = *p & 0x0F; }
+		else if((*p & 0xF8) == 0xF0)	{ extra = 3; cp = *p & 0x07; }
+		else
+			return 0;
+
+		if(e - p <= extra)
+			return 0;
+		for(int i = 1; i <= extra; ++i)
+		{
+			if((p[i] & 0xC0) != 0x80)
+				return 0;
+			cp = (cp << 6) | (p[i] & 0x3F);
+		}
+
+		// Reject overlong forms, surrogates and out-of-range code points, as
+		// NSString's decoder does.
+		if(		(extra == 1 && cp < 0x80)
+			||	(extra == 2 && cp < 0x800)
+			||	(extra == 3 && cp < 0x10000)
+			||	(cp >= 0xD800 && cp <= 0xDFFF)
+			||	cp > 0x10FFFF)
+			return 0;
+
+		p += extra + 1;
+	}
+	return 1;
+}
+
+
+@implementation LDrawMappedLines
+
+#pragma mark -
+#pragma mark INITIALIZATION
+#pragma mark -
+
+//---------- linesWithContentsOfFile: --------------------------------[static]--
+//
+// Purpose:		Maps the file at path and indexes its lines. Returns nil if the
+//				file can't be read.
+//
+//------------------------------------------------------------------------------
++ (LDrawMappedLines *) linesWithContentsOfFile:(NSString *)path
+{
+	NSData				*data	= nil;
+	LDrawMappedLines	*lines	= nil;
+
+	// "IfSafe" means we won't map files on network volumes, where the file
+	// could vanish out from under us; those are just read normally.
+	data = [NSData dataWithContentsOfFile:path
+								  options:NSDataReadingMappedIfSafe
+									error:NULL];
+	if(data != nil)
+		lines = [[[LDrawMappedLines alloc] initWithData:data] autorelease];
+
+	return lines;
+
+}//end linesWithContentsOfFile:
+
+
+//========== initWithData: =====================================================
+//
+// Purpose:		Designated initializer. Retains data, picks the encoding and
+//				builds the line index. A UTF-8 byte order mark is not part of
+//				any line.
+//
+// Notes:		Offsets are 32 bits to keep the index small; a 4 GB LDraw file
+//				is not something we intend to support.
+//
+//==============================================================================
+- (id) initWithData:(NSData *)data
+{
+	const unsigned char	*bytes			= [data bytes];
+	NSUInteger			length			= [data length];
+	NSUInteger			lineStart		= 0;
+	NSUInteger			offset			= 0;
+	NSUInteger			capacity		= 0;
+
+	self = [super init];
+
+	if(length > UINT32_MAX)
+	{
+		[self release];
+		return nil;
+	}
+
+	fileData	= [data retain];
+	fileBytes	= (const char *)bytes;
+
+	// Try UTF-8 first, because it's so nice. If that fails it must be Windows
+	// Latin; every byte sequence is legal there. (We used to try MacRoman
+	// after Latin-1 too, but Latin-1 never fails.)
+	if(is_valid_utf8(bytes, bytes + length))
+		encoding = NSUTF8StringEncoding;
+	else
+		encoding = NSISOLatin1StringEncoding;
+
+	// Most LDraw lines are 40-80 bytes; guess low and grow.
+	capacity	= length / 32 + 16;
+	lineBounds	= malloc(capacity * 2 * sizeof(uint32_t));
+
+	// Editors on Windows like to start UTF-8 files with a byte order mark.
+	// Decoding to NSString used to drop it; left on line 0, it would hide
+	// the line's type (and an MPD's first 0 FILE).
+	if(length >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF)
+		lineStart = 3;
+
+	while(lineStart < length)
+	{
+		offset = lineStart;
+		while(offset < length && bytes[offset] != '\n' && bytes[offset] != '\r')
+			offset++;
+
+		if(lineCount == capacity)
+		{
+			capacity	*= 2;
+			lineBounds	= realloc(lineBounds, capacity * 2 * sizeof(uint32_t));
+		}
+		lineBounds[lineCount * 2    ] = (uint32_t)lineStart;
+		lineBounds[lineCount * 2 + 1] = (uint32_t)offset;
+		lineCount++;
+
+		// LDraw files are in DOS format. Oh the agony. Treat CRLF as one break.
+		if(offset < length && bytes[offset] == '\r')
+		{
+			offset++;
+			if(offset < length && bytes[offset] == '\n')
+				offset++;
+		}
+		else if(offset < length)
+			offset++;
+		lineStart = offset;
+	}
+
+	return self;
+
+}//end initWithData:
+
+
+#pragma mark -
+#pragma mark ACCESSORS
+#pragma mark -
+
+//========== count =============================================================
+//
+// Purpose:		NSArray primitive.
+//
+//==============================================================================
+- (NSUInteger) count
+{
+	return lineCount;
+
+}//end count
+
+
+//========== objectAtIndex: ====================================================
+//
+// Purpose:		NSArray primitive. Returns a fresh string for the line, with
+//				the line terminator removed.
+//
+// Notes:		The string is a copy; it must be, since it may outlive the
+//				mapping (comments, for instance, hang onto their line).
+//
+//==============================================================================
+- (id) objectAtIndex:(NSUInteger)index
+{
+	NSUInteger	length	= 0;
+	const char	*bytes	= [self bytesForLineAtIndex:index length:&length];
+	NSString	*line	= nil;
+
+	line = [[NSString alloc] initWithBytes:bytes
+									length:length
+								  encoding:encoding];
+
+	return [line autorelease];
+
+}//end objectAtIndex:
+
+
+//========== bytesForLineAtIndex:length: =======================================
+//
+// Purpose:		Returns a pointer to the raw bytes of the line, without the
+//				line terminator. The bytes are in -encoding and are NOT
+//				null-terminated; they are valid as long as the receiver is.
+//
+//==============================================================================
+- (const char *) bytesForLineAtIndex:(NSUInteger)index length:(NSUInteger *)length
+{
+	if(index >= lineCount)
+		[NSException raise:NSRangeException format:@"line index %lu beyond count %lu", (unsigned long)index, (unsigned long)lineCount];
+
+	if(length != NULL)
+		*length = lineBounds[index * 2 + 1] - lineBounds[index * 2];
+
+	return fileBytes + lineBounds[index * 2];
+
+}//end bytesForLineAtIndex:length:
+
+
+//========== encoding ==========================================================
+//
+// Purpose:		The text encoding detected for the file.
+//
+//==============================================================================
+- (NSStringEncoding) encoding
+{
+	return encoding;
+
+}//end encoding
+
+
+#pragma mark -
+#pragma mark DESTRUCTOR
+#pragma mark -
+
+//========== dealloc ===========================================================
+//
+// Purpose:		Unmap and release.
+//
+//==============================================================================
+- (void) dealloc
+{
+	free(lineBounds);
+	[fileData release];
+
+	[super dealloc];
+
+}//end dealloc
+
+
+@end
@@ -0,0 +1,74 @@
+//==============================================================================
+//
+// File:		LDrawParseScheduler.h
+//
+// Purpose:		Parses a run of sibling directives, spreading them over worker
+//				threads in chunks.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import <Foundation/Foundation.h>
+
+// Parse scheduler - THEORY OF OPERATION
+//
+// A container parses its lines in two passes.  First it walks the lines on
+// its own thread and finds the class and line range of each directive in it;
+// that is cheap, and has to be serial anyway since a directive's range
+// depends on where the last one ended.  Then the scheduler creates the
+// directives.
+//
+// A part file is mostly tens of thousands of one-line primitives, each of
+// which takes well under a microsecond to parse, so scheduling them one at a
+// time costs more than the parse.  Instead, the scheduler cuts the list into
+// chunks of about PARSE_CHUNK_LINES lines - enough to amortize a dispatch,
+// and few enough that a chunk's lines and the objects made from them stay in
+// cache - and hands each chunk to a worker via dispatch_apply, which blocks
+// until they are all done.  Each chunk gets its own autorelease pool, so the
+// scratch objects a parse throws off are freed by the worker that made them,
+// all at once, when the chunk is done.
+//
+// Results land in the caller's array by index, so the container adds them in
+// file order no matter which worker finished first.
+//
+// Not every directive is safe to parse off the calling thread: a part
+// reference loads the part it names from the library, and without USE_BLOCKS
+// the library has no locking.  So only classes which answer YES to
+// +[LDrawDirective parsesConcurrently] go to workers; the rest are parsed on
+// the calling thread, in order, before the workers start.
+//
+// +setSerialParsing: turns the workers off altogether, so that every
+// directive is parsed on the calling thread in file order.  This is for
+// benchmarks and debugging, where run-to-run noise from the thread pool is
+// unwanted.
+
+// One directive to be parsed.
+typedef struct
+{
+	Class		directiveClass;
+	NSRange		range;
+
+} LDrawParseTask;
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// class LDrawParseScheduler
+//
+////////////////////////////////////////////////////////////////////////////////
+@interface LDrawParseScheduler : NSObject
+{
+}
+
+// Configuration
++ (BOOL) serialParsing;
++ (void) setSerialParsing:(BOOL)flag;
+
+// Parsing
++ (void) parseTasks:(LDrawParseTask *)tasks
+			  count:(NSUInteger)count
+			inLines:(NSArray *)lines
+		parentGroup:(dispatch_group_t)parentGroup
+	 intoDirectives:(id *)directives;
+
+@end
@@ -0,0 +1,228 @@
+//==============================================================================
+//
+// File:		LDrawParseScheduler.m
+//
+// Purpose:		Parses a run of sibling directives, spreading them over worker
+//				threads in chunks.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import "LDrawParseScheduler.h"
+
+#import <dispatch/dispatch.h>
+
+#import "LDrawDirective.h"
+
+// Lines per worker chunk. At 50-100 bytes per line, this keeps a chunk's text
+// and the primitives made from it around L2 size.
+#define PARSE_CHUNK_LINES		512
+
+// A chunk of the task list: tasks [start, end).
+typedef struct
+{
+	NSUInteger	start;
+	NSUInteger	end;
+
+} ParseChunk;
+
+static BOOL	serialParsing	= NO;
+
+
+//========== parseTask =========================================================
+//
+// Purpose:		Parses one directive into its slot. The result is retained, as
+//				from alloc/init.
+//
+//==============================================================================
+static void parseTask(LDrawParseTask *task, NSArray *lines, dispatch_group_t parentGroup, id *slot)
+{
+	*slot = [[task->directiveClass alloc] initWithLines:lines inRange:task->range parentGroup:parentGroup];
+}
+
+
+@implementation LDrawParseScheduler
+
+#pragma mark -
+#pragma mark CONFIGURATION
+#pragma mark -
+
+//---------- serialParsing -------------------------------------------[static]--
+//
+// Purpose:		Returns YES if all parsing happens on the calling thread.
+//
+//------------------------------------------------------------------------------
++ (BOOL) serialParsing
+{
+	return serialParsing;
+
+}//end serialParsing
+
+
+//---------- setSerialParsing: ---------------------------------------[static]--
+//
+// Purpose:		Turns the worker threads off (YES) or on (NO). When off, every
+//				directive is parsed on the calling thread in file order, so
+//				that runs are reproducible.
+//
+// Notes:		Don't change this while a parse is in progress.
+//
+//------------------------------------------------------------------------------
++ (void) setSerialParsing:(BOOL)flag
+{
+	serialParsing = flag;
+
+}//end setSerialParsing:
+
+
+#pragma mark -
+#pragma mark PARSING
+#pragma mark -
+
+//---------- parseTasks:count:inLines:parentGroup:intoDirectives: ----[static]--
+//
+// Purpose:		Creates the directive for each task, storing it (retained) in
+//				the matching element of directives. Returns when all of them
+//				have been parsed.
+//
+// Notes:		If parsing any directive raises, the exception is re-raised
+//				here once the rest of the parse has finished. When several do,
+//				the one from earliest in the file wins, so the outcome doesn't
+//				depend on thread timing. Every slot is released and set to nil
+//				before the exception leaves, so the caller only has its own
+//				buffers to free. (That means directives must start out all nil;
+//				callers calloc it.)
+//
+//------------------------------------------------------------------------------
++ (void) parseTasks:(LDrawParseTask *)tasks
+			  count:(NSUInteger)count
+			inLines:(NSArray *)lines
+		parentGroup:(dispatch_group_t)parentGroup
+	 intoDirectives:(id *)directives
+{
+	BOOL			*isConcurrent		= NULL;
+	ParseChunk		*chunks				= NULL;
+	NSException		**chunkExceptions	= NULL;
+	NSUInteger		chunkCount			= 0;
+	NSUInteger		chunkLines			= 0;
+	NSUInteger		concurrentLines		= 0;
+	NSUInteger		counter				= 0;
+
+	if(count == 0)
+		return;
+
+	@try
+	{
+		// Deterministic mode: everything here, in order.
+		if(serialParsing)
+		{
+			for(counter = 0; counter < count; counter++)
+				parseTask(&tasks[counter], lines, parentGroup, &directives[counter]);
+			return;
+		}
+
+		isConcurrent = malloc(count * sizeof(BOOL));
+		for(counter = 0; counter < count; counter++)
+		{
+			isConcurrent[counter] = [tasks[counter].directiveClass parsesConcurrently];
+			if(isConcurrent[counter])
+				concurrentLines += tasks[counter].range.length;
+		}
+
+		// Not worth a trip to the thread pool; parse it all right here.
+		if(concurrentLines < 2 * PARSE_CHUNK_LINES)
+		{
+			for(counter = 0; counter < count; counter++)
+				parseTask(&tasks[counter], lines, parentGroup, &directives[counter]);
+			return;
+		}
+
+		// The directives which must stay on this thread go first, in order. Cut
+		// the rest into chunks as we go.
+		chunks = malloc((concurrentLines / PARSE_CHUNK_LINES + 1) * sizeof(ParseChunk));
+		chunks[0].start = 0;
+
+		for(counter = 0; counter < count; counter++)
+		{
+			if(isConcurrent[counter] == NO)
+			{
+				parseTask(&tasks[counter], lines, parentGroup, &directives[counter]);
+			}
+			else
+			{
+				chunkLines += tasks[counter].range.length;
+				if(chunkLines >= PARSE_CHUNK_LINES)
+				{
+					chunks[chunkCount].end = counter + 1;
+					chunkCount += 1;
+					chunks[chunkCount].start = counter + 1;
+					chunkLines = 0;
+				}
+			}
+		}
+		if(chunkLines > 0)
+		{
+			chunks[chunkCount].end = count;
+			chunkCount += 1;
+		}
+
+		// Fan out.
+		chunkExceptions = calloc(chunkCount, sizeof(NSException *));
+
+		dispatch_apply(chunkCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t chunkIndex)
+		{
+			NSAutoreleasePool	*pool		= [[NSAutoreleasePool alloc] init];
+			NSUInteger			taskIndex	= 0;
+
+			@try
+			{
+				for(taskIndex = chunks[chunkIndex].start; taskIndex < chunks[chunkIndex].end; taskIndex++)
+				{
+					if(isConcurrent[taskIndex])
+						parseTask(&tasks[taskIndex], lines, parentGroup, &directives[taskIndex]);
+				}
+			}
+			@catch(NSException *exception)
+			{
+				// An exception must not escape into GCD; carry it home.
+				chunkExceptions[chunkIndex] = [exception retain];
+			}
+
+			[pool drain];
+		});
+
+		for(counter = 0; counter < chunkCount; counter++)
+		{
+			if(chunkExceptions[counter] != nil)
+			{
+				NSException *exception = [chunkExceptions[counter] autorelease];
+
+				for(counter += 1; counter < chunkCount; counter++)
+					[chunkExceptions[counter] release];
+
+				@throw exception;
+			}
+		}
+	}
+	@catch(NSException *exception)
+	{
+		// The caller never sees a half-finished parse, so whatever did get 
+		// parsed is ours to release. 
+		for(counter = 0; counter < count; counter++)
+		{
+			[directives[counter] release];
+			directives[counter] = nil;
+		}
+		@throw;
+	}
+	@finally
+	{
+		free(isConcurrent);
+		free(chunks);
+		free(chunkExceptions);
+	}
+
+}//end parseTasks:count:inLines:parentGroup:intoDirectives:
+
+
+@end
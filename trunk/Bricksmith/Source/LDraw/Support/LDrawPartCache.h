@@ -0,0 +1,57 @@
+//==============================================================================
+//
+// File:		LDrawPartCache.h
+//
+// Purpose:		On-disk cache of flattened, optimized library parts.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import <Foundation/Foundation.h>
+
+@class LDrawModel;
+
+// Part cache - THEORY OF OPERATION
+//
+// Every library part we load is parsed, has all of its subparts and primitives
+// loaded and parsed, and is then flattened by -[LDrawModel optimizeStructure]
+// into a primitive block of transformed lines, triangles and quads.  The
+// result is the same every launch until the library changes.
+//
+// The part cache saves that flattened result in a small binary file per part
+// (in ~/Library/Caches), and the part library tries it before parsing text.
+// A cache hit skips the parse AND skips loading every subpart the part
+// references, since the flattened geometry already contains them.
+//
+// A cache file is valid if:
+//
+// - Its format version matches ours.
+// - The source .dat file has the same path, size and modification time as
+//   when it was cached.
+// - The part catalog has the same modification time as when it was cached.
+//   Flattened geometry depends on every subpart and primitive the part pulls
+//   in, not just its own file; any library update rebuilds the catalog, so
+//   the catalog date stands in for "nothing in the library changed."
+//
+// The file is a fixed header, a color table, the primitive block's storage
+// byte for byte, then the header strings.  It is read through a mapping, and
+// the block takes its arrays straight from the file; no primitive objects are
+// built at all.
+//
+// Only parts made entirely of lines, triangles and quads are cached.  Parts
+// with textures (or anything else that lands in the "other" step) are always
+// parsed from text.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// class LDrawPartCache
+//
+////////////////////////////////////////////////////////////////////////////////
+@interface LDrawPartCache : NSObject
+{
+}
+
++ (LDrawModel *) modelForPartAtPath:(NSString *)partPath;
++ (void) saveModel:(LDrawModel *)model forPartAtPath:(NSString *)partPath;
+
+@end
@@ -0,0 +1,354 @@
+//==============================================================================
+//
+// File:		LDrawPartCache.m
+//
+// Purpose:		On-disk cache of flattened, optimized library parts.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import "LDrawPartCache.h"
+
+#import <CommonCrypto/CommonDigest.h>
+#import <sys/stat.h>
+
+#import "ColorLibrary.h"
+#import "LDrawColor.h"
+#import "LDrawFile.h"
+#import "LDrawMPDModel.h"
+#import "LDrawPaths.h"
+#import "LDrawPrimitiveBlock.h"
+#import "LDrawStep.h"
+
+// Bump the version any time the record layout OR the flattening rules change;
+// old cache files are then simply ignored and overwritten.
+#define PART_CACHE_MAGIC		0x42535043		// 'BSPC'
+#define PART_CACHE_VERSION		2
+#define PART_CACHE_EXTENSION	@"bspc"
+
+typedef struct
+{
+	uint32_t	magic;
+	uint32_t	version;
+	int64_t		sourceModified;		// mtime of the .dat file, in seconds
+	uint64_t	sourceSize;			// size of the .dat file, in bytes
+	int64_t		libraryStamp;		// mtime of the part catalog, in seconds
+	uint32_t	colorCount;
+	uint32_t	lineCount;
+	uint32_t	triangleCount;
+	uint32_t	quadCount;
+	uint32_t	stringLength;		// NUL-terminated: description, file name, author, source path
+	uint32_t	geometryLength;		// LDrawPrimitiveBlock storage for the counts above
+
+} PartCacheHeader;
+
+typedef struct
+{
+	int32_t		colorCode;
+	int32_t		edgeColorCode;
+	uint32_t	isLibraryColor;		// if set, look the code up; ignore the components
+	float		colorRGBA[4];
+	float		edgeColorRGBA[4];
+
+} PartCacheColor;
+
+
+//========== statFile ==========================================================
+//
+// Purpose:		Returns the modification time and size of a file; NO if it
+//				can't be stat'ed.
+//
+//==============================================================================
+static BOOL statFile(NSString *path, int64_t *modified, uint64_t *size)
+{
+	struct stat info;
+
+	if(path == nil || stat([path fileSystemRepresentation], &info) != 0)
+		return NO;
+
+	*modified	= (int64_t)info.st_mtime;
+	*size		= (uint64_t)info.st_size;
+
+	return YES;
+}
+
+
+//========== libraryStamp ======================================================
+//
+// Purpose:		A value which changes whenever the part library is updated.
+//
+//==============================================================================
+static int64_t libraryStamp(void)
+{
+	int64_t		modified	= 0;
+	uint64_t	size		= 0;
+
+	statFile([[LDrawPaths sharedPaths] partCatalogPath], &modified, &size);
+
+	return modified;
+}
+
+
+//========== cacheFileForPart ==================================================
+//
+// Purpose:		Part names aren't unique across search paths (official vs.
+//				unofficial), so cache files are named by a digest of the full
+//				path.
+//
+//==============================================================================
+static NSString *cacheFileForPart(NSString *partPath)
+{
+	const char		*pathBytes	= [partPath UTF8String];
+	unsigned char	digest[CC_SHA256_DIGEST_LENGTH];
+	NSMutableString	*name		= [NSMutableString stringWithCapacity:32];
+	int				counter		= 0;
+
+	CC_SHA256(pathBytes, (CC_LONG)strlen(pathBytes), digest);
+
+	for(counter = 0; counter < 16; counter++)
+		[name appendFormat:@"%02x", digest[counter]];
+
+	return [[[[LDrawPaths sharedPaths] partCachePath] stringByAppendingPathComponent:name]
+										stringByAppendingPathExtension:PART_CACHE_EXTENSION];
+}
+
+
+@implementation LDrawPartCache
+
+#pragma mark -
+#pragma mark READING
+#pragma mark -
+
+//---------- modelForPartAtPath: -------------------------------------[static]--
+//
+// Purpose:		Returns an optimized model for the part, built from the cache,
+//				or nil if there is no valid cache entry.
+//
+// Notes:		Like -[PartLibrary readModelAtPath:...], the model returned is
+//				the first submodel of a file which is deliberately never
+//				released.
+//
+//				Safe to call from multiple threads at once.
+//
+//------------------------------------------------------------------------------
++ (LDrawModel *) modelForPartAtPath:(NSString *)partPath
+{
+	NSData					*data			= nil;
+	const char				*bytes			= NULL;
+	const PartCacheHeader	*header			= NULL;
+	const PartCacheColor	*colorRecords	= NULL;
+	const char				*geometry		= NULL;
+	const char				*strings		= NULL;
+	const char				*stringsEnd		= NULL;
+	const char				*headerStrings[4];
+	NSUInteger				counts[LDrawPrimitiveTypeCount];
+	NSUInteger				expectedLength	= 0;
+	int64_t					sourceModified	= 0;
+	uint64_t				sourceSize		= 0;
+	NSUInteger				counter			= 0;
+
+	NSMutableArray			*colors			= nil;
+	LDrawColor				*color			= nil;
+	LDrawPrimitiveBlock		*block			= nil;
+	LDrawFile				*file			= nil;
+	LDrawMPDModel			*model			= nil;
+
+	if(statFile(partPath, &sourceModified, &sourceSize) == NO)
+		return nil;
+
+	data = [NSData dataWithContentsOfFile:cacheFileForPart(partPath)
+								  options:NSDataReadingMappedIfSafe
+									error:NULL];
+	if([data length] < sizeof(PartCacheHeader))
+		return nil;
+
+	bytes	= [data bytes];
+	header	= (const PartCacheHeader *)bytes;
+
+	// Validate
+	if(		header->magic			!= PART_CACHE_MAGIC
+	   ||	header->version			!= PART_CACHE_VERSION
+	   ||	header->sourceModified	!= sourceModified
+	   ||	header->sourceSize		!= sourceSize
+	   ||	header->libraryStamp	!= libraryStamp() )
+	{
+		return nil;
+	}
+
+	counts[LDrawPrimitiveLines]				= header->lineCount;
+	counts[LDrawPrimitiveTriangles]			= header->triangleCount;
+	counts[LDrawPrimitiveQuadrilaterals]	= header->quadCount;
+	if(header->geometryLength != [LDrawPrimitiveBlock storageLengthForCounts:counts])
+		return nil;
+
+	expectedLength	=	sizeof(PartCacheHeader)
+					+	header->colorCount		* sizeof(PartCacheColor)
+					+	header->geometryLength
+					+	header->stringLength;
+	if([data length] != expectedLength)
+		return nil;
+
+	colorRecords	= (const PartCacheColor *)	(bytes + sizeof(PartCacheHeader));
+	geometry		= (const char *)			(colorRecords + header->colorCount);
+	strings			= geometry + header->geometryLength;
+	stringsEnd		= strings + header->stringLength;
+
+	// Header strings. The last one is the source path, which guards against
+	// digest collisions.
+	for(counter = 0; counter < 4; counter++)
+	{
+		const char *terminator = memchr(strings, 0, stringsEnd - strings);
+		if(terminator == NULL)
+			return nil;
+		headerStrings[counter]	= strings;
+		strings					= terminator + 1;
+	}
+	if(strcmp(headerStrings[3], [partPath UTF8String]) != 0)
+		return nil;
+
+	// Colors
+	colors = [NSMutableArray arrayWithCapacity:header->colorCount];
+	for(counter = 0; counter < header->colorCount; counter++)
+	{
+		const PartCacheColor *record = colorRecords + counter;
+
+		color = nil;
+		if(record->isLibraryColor)
+			color = [[ColorLibrary sharedColorLibrary] colorForCode:record->colorCode];
+
+		// Not a library color (or the library changed under us); rebuild it
+		// from its components.
+		if(color == nil)
+		{
+			color = [[[LDrawColor alloc] init] autorelease];
+			[color setColorCode:record->colorCode];
+			[color setColorRGBA:(GLfloat *)record->colorRGBA];
+			[color setEdgeColorCode:record->edgeColorCode];
+			if(record->edgeColorCode == LDrawColorBogus)
+				[color setEdgeColorRGBA:(GLfloat *)record->edgeColorRGBA];
+		}
+		[colors addObject:color];
+	}
+
+	// Geometry. The block checks the color indices itself.
+	if(header->geometryLength > 0)
+	{
+		block = [[LDrawPrimitiveBlock alloc] initWithColors:colors
+													 counts:counts
+													storage:[data subdataWithRange:NSMakeRange(geometry - bytes, header->geometryLength)]];
+		if(block == nil)
+			return nil;
+	}
+
+	// Assemble the model just as the text parser would have left it.
+	model = [[LDrawMPDModel alloc] init];
+	[model setModelDescription:[NSString stringWithUTF8String:headerStrings[0]]];
+	[model setFileName:[NSString stringWithUTF8String:headerStrings[1]]];
+	[model setAuthor:[NSString stringWithUTF8String:headerStrings[2]]];
+	[model setModelName:[model modelDescription]];
+	[model optimizeStructureWithPrimitiveBlock:block other:[NSArray array]];
+	[block release];
+
+	file = [[LDrawFile alloc] init];
+	[file addSubmodel:model];
+	[file setActiveModel:model];
+	[model release];
+
+	return model;
+
+}//end modelForPartAtPath:
+
+
+#pragma mark -
+#pragma mark WRITING
+#pragma mark -
+
+//---------- saveModel:forPartAtPath: --------------------------------[static]--
+//
+// Purpose:		Writes the optimized model to the cache. Models which contain
+//				anything other than lines, triangles and quads are skipped.
+//
+// Notes:		The write is atomic, so a racing reader on another thread (or
+//				a crash) never sees a partial file.
+//
+//------------------------------------------------------------------------------
++ (void) saveModel:(LDrawModel *)model forPartAtPath:(NSString *)partPath
+{
+	NSMutableData		*colorData			= [NSMutableData data];
+	NSMutableData		*stringData			= [NSMutableData data];
+	NSMutableData		*fileData			= nil;
+	NSString			*cachePath			= nil;
+	PartCacheHeader		header				= {};
+	LDrawPrimitiveBlock	*block				= nil;
+	NSArray				*headerStrings		= nil;
+
+	if(model == nil || statFile(partPath, &header.sourceModified, &header.sourceSize) == NO)
+		return;
+
+	header.magic		= PART_CACHE_MAGIC;
+	header.version		= PART_CACHE_VERSION;
+	header.libraryStamp	= libraryStamp();
+
+	for(LDrawStep *step in [model steps])
+	{
+		for(id directive in [step subdirectives])
+		{
+			// Textures and the like can't be cached; parse this part every
+			// time. An optimized model only ever has one block.
+			if([directive isKindOfClass:[LDrawPrimitiveBlock class]] == NO || block != nil)
+				return;
+			block = directive;
+		}
+	}
+
+	if(block != nil)
+	{
+		for(LDrawColor *color in [block colors])
+		{
+			PartCacheColor record = {};
+
+			record.colorCode		= [color colorCode];
+			record.edgeColorCode	= [color edgeColorCode];
+			record.isLibraryColor	= ([[ColorLibrary sharedColorLibrary] colorForCode:record.colorCode] == color);
+			[color getColorRGBA:record.colorRGBA];
+			[color getEdgeColorRGBA:record.edgeColorRGBA];
+
+			[colorData appendBytes:&record length:sizeof(record)];
+		}
+
+		header.colorCount		= (uint32_t)[[block colors] count];
+		header.lineCount		= (uint32_t)[block countOfType:LDrawPrimitiveLines];
+		header.triangleCount	= (uint32_t)[block countOfType:LDrawPrimitiveTriangles];
+		header.quadCount		= (uint32_t)[block countOfType:LDrawPrimitiveQuadrilaterals];
+		header.geometryLength	= (uint32_t)[[block storage] length];
+	}
+
+	headerStrings = [NSArray arrayWithObjects:	[model modelDescription],
+												[model fileName],
+												[model author],
+												partPath,
+												nil ];
+	for(NSString *string in headerStrings)
+	{
+		const char *utf8 = [string UTF8String];
+		[stringData appendBytes:utf8 length:strlen(utf8) + 1];
+	}
+	header.stringLength = (uint32_t)[stringData length];
+
+	fileData = [NSMutableData dataWithBytes:&header length:sizeof(header)];
+	[fileData appendData:colorData];
+	if(block != nil)
+		[fileData appendData:[block storage]];
+	[fileData appendData:stringData];
+
+	cachePath = cacheFileForPart(partPath);
+	[[NSFileManager defaultManager] createDirectoryAtPath:[cachePath stringByDeletingLastPathComponent]
+							  withIntermediateDirectories:YES
+											   attributes:nil
+													error:NULL];
+	[fileData writeToFile:cachePath atomically:YES];
+
+}//end saveModel:forPartAtPath:
+
+
+@end
@@ -43,5 +43,9 @@
 #define MLCAD_INI_FILE_NAME						MLCAD @"." MLCAD_EXTENSION
 
 #define PART_CATALOG_NAME						@"Bricksmith Parts.plist"
+#define PART_CATALOG_MANIFEST_NAME				@"Bricksmith Parts Manifest.plist"
+
+#define PART_CACHE_DIRECTORY_NAME				@"Part Cache"
+#define MESH_CACHE_DIRECTORY_NAME				@"Mesh Cache"
 
 #endif
\ No newline at end of file
@@ -37,6 +37,10 @@ typedef enum
 - (NSString *) ldconfigPath;
 - (NSString *) MLCadIniPath;
 - (NSString *) partCatalogPath;
+- (NSString *) partCatalogManifestPath;
+- (NSString *) applicationCachesPath;
+- (NSString *) meshCachePath;
+- (NSString *) partCachePath;
 - (NSString *) subpartsPathForDomain:(LDrawDomain)domain;
 
 // Utilities
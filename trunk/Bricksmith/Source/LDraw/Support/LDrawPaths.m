@@ -283,6 +283,73 @@
 }
 
 
+//========== partCatalogManifestPath ===========================================
+//
+// Purpose:		Returns the path to the list of files the part catalog was built
+//				from, which lives next to the catalog.
+//
+//==============================================================================
+- (NSString *) partCatalogManifestPath
+{
+	NSString        *pathToManifest = nil;
+	
+	if(self->preferredLDrawPath != nil)
+	{
+		pathToManifest = [self->preferredLDrawPath stringByAppendingPathComponent:PART_CATALOG_MANIFEST_NAME];
+	}
+	
+	return pathToManifest;
+	
+}//end partCatalogManifestPath
+
+
+//========== applicationCachesPath =============================================
+//
+// Purpose:		Returns our folder in the user's Caches folder. Everything in
+//				there is disposable and machine-specific. (It may not actually
+//				exist; this method doesn't check.)
+//
+//==============================================================================
+- (NSString *) applicationCachesPath
+{
+	NSString    *userCaches     = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) objectAtIndex:0];
+	NSString    *bundleID       = [[NSBundle mainBundle] bundleIdentifier];
+	
+	if(bundleID == nil)
+		bundleID = @"Bricksmith";
+	
+	return [userCaches stringByAppendingPathComponent:bundleID];
+	
+}//end applicationCachesPath
+
+
+//========== meshCachePath =====================================================
+//
+// Purpose:		Returns the folder in which smoothed part meshes are cached.
+//
+//==============================================================================
+- (NSString *) meshCachePath
+{
+	return [[self applicationCachesPath] stringByAppendingPathComponent:MESH_CACHE_DIRECTORY_NAME];
+	
+}//end meshCachePath
+
+
+//========== partCachePath =====================================================
+//
+// Purpose:		Returns the folder in which precompiled library parts are 
+//				cached. This lives in the user's Caches folder rather than the 
+//				LDraw folder, since it is disposable and machine-specific. (It 
+//				may not actually exist there; this method doesn't check.) 
+//
+//==============================================================================
+- (NSString *) partCachePath
+{
+	return [[self applicationCachesPath] stringByAppendingPathComponent:PART_CACHE_DIRECTORY_NAME];
+	
+}//end partCachePath
+
+
 //========== subpartsPathForDomain: ============================================
 //==============================================================================
 - (NSString *) subpartsPathForDomain:(LDrawDomain)domain
@@ -0,0 +1,52 @@
+//==============================================================================
+//
+// File:		LDrawStepExporter.h
+//
+// Purpose:		Writes a file out as a series of files, one for each
+//				progressive step of each submodel.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import <Foundation/Foundation.h>
+
+@class LDrawFile;
+
+// Step exporter - THEORY OF OPERATION
+//
+// Exporting steps writes, for every submodel and every step n in it, a copy
+// of the whole file in which that submodel comes first and is cut off after
+// step n.  Doing that by deleting steps off a copy of the file and writing it
+// again serializes the whole file once per step.
+//
+// But every one of those files is made of the same pieces: each model's
+// "0 FILE" line and header, each of its steps, and the other models written
+// in full.  So we write each of those pieces to bytes exactly once, on the
+// calling thread, since writing a directive is not guaranteed to be free of
+// side effects.  Then each submodel gets its own worker, which glues the
+// pieces together for each of its steps and writes the files.  The only
+// per-file work left is copying bytes, which is as much as any step file
+// needs anyway.
+//
+// The glue reproduces -[LDrawFile writeToStream:] exactly; see
+// appendModel() in the .m.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// class LDrawStepExporter
+//
+////////////////////////////////////////////////////////////////////////////////
+@interface LDrawStepExporter : NSObject
+{
+	LDrawFile	*file;
+}
+
+// Initialization
+- (id) initWithFile:(LDrawFile *)fileIn;
+
+// Export
+- (void) exportToFolder:(NSString *)folderPath
+	  modelFolderFormat:(NSString *)modelFolderFormat
+		 stepFileFormat:(NSString *)stepFileFormat;
+
+@end
@@ -0,0 +1,313 @@
+//==============================================================================
+//
+// File:		LDrawStepExporter.m
+//
+// Purpose:		Writes a file out as a series of files, one for each
+//				progressive step of each submodel.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import "LDrawStepExporter.h"
+
+#import <dispatch/dispatch.h>
+
+#import "LDrawFile.h"
+#import "LDrawKeywords.h"
+#import "LDrawMPDModel.h"
+#import "LDrawStep.h"
+#import "LDrawWriter.h"
+
+// One submodel, already written out in pieces. None of the pieces end in a
+// line ending.
+typedef struct
+{
+	NSString	*modelName;
+	NSString	*fileName;		// modelName made safe to use in a path component
+	NSString	*folderName;	// unique among all the models being exported
+	NSData		*opening;		// 0 FILE modelName
+	NSData		*header;		// description, name and author lines
+	NSArray		*steps;			// NSData per step, each ending in its 0 STEP
+	NSData		*loneStep;		// the first step as written when it is the only one
+
+} ExportedModel;
+
+
+//========== pathSafeName ======================================================
+//
+// Purpose:		Returns name with the characters that can't appear in a single
+//				path component replaced. Both "/" and ":" count, since the
+//				Finder shows one as the other.
+//
+//==============================================================================
+static NSString *pathSafeName(NSString *name)
+{
+	NSString *safeName = name;
+
+	safeName = [safeName stringByReplacingOccurrencesOfString:@"/" withString:@"-"];
+	safeName = [safeName stringByReplacingOccurrencesOfString:@":" withString:@"-"];
+
+	return safeName;
+}
+
+
+//========== appendModel =======================================================
+//
+// Purpose:		Appends the model as if only its first stepCount steps existed,
+//				matching -[LDrawMPDModel writeToStream:] when wrapped and
+//				-[LDrawModel writeModelToStream:] when not.
+//
+//==============================================================================
+static void appendModel(LDrawWriter *stream, ExportedModel *model, NSUInteger stepCount, BOOL wrapped)
+{
+	NSUInteger counter = 0;
+
+	if(wrapped)
+	{
+		[stream appendData:model->opening];
+		[stream appendCRLF];
+	}
+
+	[stream appendData:model->header];
+
+	// A model with one step doesn't write its 0 STEP.
+	if(stepCount == 1)
+	{
+		[stream appendCRLF];
+		[stream appendData:model->loneStep];
+	}
+	else
+	{
+		for(counter = 0; counter < stepCount; counter++)
+		{
+			[stream appendCRLF];
+			[stream appendData:[model->steps objectAtIndex:counter]];
+		}
+	}
+
+	if(wrapped)
+	{
+		[stream appendCRLF];
+		[stream appendBytes:"0 " length:2];
+		[stream appendString:LDRAW_MPD_SUBMODEL_END];
+	}
+}
+
+
+@implementation LDrawStepExporter
+
+#pragma mark -
+#pragma mark INITIALIZATION
+#pragma mark -
+
+//========== initWithFile: =====================================================
+//
+// Purpose:		Prepares to export the steps of the given file.
+//
+//==============================================================================
+- (id) initWithFile:(LDrawFile *)fileIn
+{
+	self = [super init];
+	if(self)
+	{
+		file = [fileIn retain];
+	}
+	return self;
+
+}//end initWithFile:
+
+
+#pragma mark -
+#pragma mark EXPORT
+#pragma mark -
+
+//========== exportToFolder:modelFolderFormat:stepFileFormat: ==================
+//
+// Purpose:		Writes every cumulative step of every submodel into folderPath.
+//				Each submodel gets a subfolder named with modelFolderFormat
+//				(which takes the model name), holding one file per step named
+//				with stepFileFormat (model name, then 1-based step number).
+//
+//				The submodel whose steps are being written is moved to the top
+//				of each file, so that renderers such as L3P will draw it.
+//
+// Notes:		The file is only read on the calling thread, and not after
+//				this returns.
+//
+//				Submodels are written concurrently, so their folder names are
+//				settled beforehand. Names that only differ by path characters
+//				or case (e.g. "a/b" and "A:b") would otherwise share a folder
+//				and overwrite each other's step files; later ones get a
+//				numbered suffix instead.
+//
+//==============================================================================
+- (void) exportToFolder:(NSString *)folderPath
+	  modelFolderFormat:(NSString *)modelFolderFormat
+		 stepFileFormat:(NSString *)stepFileFormat
+{
+	NSArray			*submodels		= [file submodels];
+	NSUInteger		modelCount		= [submodels count];
+	ExportedModel	*models			= NULL;
+	LDrawWriter		*writer			= [[LDrawWriter alloc] init];
+	LDrawMPDModel	*currentModel	= nil;
+	NSArray			*steps			= nil;
+	NSMutableArray	*stepData		= nil;
+	NSMutableSet	*usedFolders	= nil;
+	NSString		*baseFolder		= nil;
+	NSString		*folderName		= nil;
+	NSUInteger		suffix			= 0;
+	NSUInteger		modelCounter	= 0;
+	NSUInteger		counter			= 0;
+
+	if(modelCount == 0)
+	{
+		[writer release];
+		return;
+	}
+
+	models = calloc(modelCount, sizeof(ExportedModel));
+
+	//---------- Write each piece once ----------------------------------------
+
+	for(modelCounter = 0; modelCounter < modelCount; modelCounter++)
+	{
+		currentModel	= [submodels objectAtIndex:modelCounter];
+		steps			= [currentModel steps];
+		stepData		= [[NSMutableArray alloc] initWithCapacity:[steps count]];
+
+		models[modelCounter].modelName = [[currentModel modelName] copy];
+
+		[writer appendBytes:"0 " length:2];
+		[writer appendString:LDRAW_MPD_SUBMODEL_START];
+		[writer appendBytes:" " length:1];
+		[writer appendString:[currentModel modelName]];
+		models[modelCounter].opening = [[writer takeData] retain];
+
+		[currentModel writeHeaderToStream:writer];
+		models[modelCounter].header = [[writer takeData] retain];
+
+		for(counter = 0; counter < [steps count]; counter++)
+		{
+			[[steps objectAtIndex:counter] writeToStream:writer withStepCommand:YES];
+			[stepData addObject:[writer takeData]];
+		}
+		models[modelCounter].steps = stepData;
+
+		if([steps count] > 0)
+		{
+			[[steps objectAtIndex:0] writeToStream:writer withStepCommand:NO];
+			models[modelCounter].loneStep = [[writer takeData] retain];
+		}
+	}
+	[writer release];
+
+	//---------- Choose a distinct folder for each submodel -------------------
+
+	usedFolders = [[NSMutableSet alloc] initWithCapacity:modelCount];
+	for(modelCounter = 0; modelCounter < modelCount; modelCounter++)
+	{
+		models[modelCounter].fileName = [pathSafeName(models[modelCounter].modelName) retain];
+
+		baseFolder	= [NSString stringWithFormat:modelFolderFormat, models[modelCounter].fileName];
+		folderName	= baseFolder;
+		suffix		= 1;
+		// Compare lowercased; the usual Mac file system ignores case.
+		while([usedFolders containsObject:[folderName lowercaseString]])
+		{
+			suffix++;
+			folderName = [NSString stringWithFormat:@"%@ %ld", baseFolder, (long)suffix];
+		}
+		[usedFolders addObject:[folderName lowercaseString]];
+		models[modelCounter].folderName = [folderName copy];
+	}
+	[usedFolders release];
+
+	//---------- Assemble and write the files, one submodel per worker --------
+
+	dispatch_apply(modelCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t modelIndex)
+	{
+		NSAutoreleasePool	*pool			= [[NSAutoreleasePool alloc] init];
+		NSFileManager		*fileManager	= [[NSFileManager alloc] init];
+		LDrawWriter			*output			= [[LDrawWriter alloc] init];
+		ExportedModel		*model			= &models[modelIndex];
+		NSUInteger			stepCount		= [model->steps count];
+		NSString			*modelFolder	= nil;
+		NSString			*outputName		= nil;
+		NSString			*outputPath		= nil;
+		NSUInteger			stepIndex		= 0;
+		NSUInteger			otherIndex		= 0;
+
+		modelFolder = [folderPath stringByAppendingPathComponent:model->folderName];
+		[fileManager createDirectoryAtPath:modelFolder withIntermediateDirectories:YES attributes:nil error:NULL];
+
+		for(stepIndex = 1; stepIndex <= stepCount; stepIndex++)
+		{
+			[output removeAllBytes];
+
+			// Same layout as -[LDrawFile writeToStream:].
+			if(modelCount == 1)
+			{
+				appendModel(output, model, stepIndex, NO);
+			}
+			else
+			{
+				appendModel(output, model, stepIndex, YES);
+				[output appendCRLF];
+
+				for(otherIndex = 0; otherIndex < modelCount; otherIndex++)
+				{
+					if(otherIndex != modelIndex)
+					{
+						appendModel(output, &models[otherIndex], [models[otherIndex].steps count], YES);
+						[output appendCRLF];
+					}
+				}
+			}
+			[output trimTrailingWhitespace];
+
+			outputName = [NSString stringWithFormat:stepFileFormat, model->fileName, (long)stepIndex];
+			outputPath = [modelFolder stringByAppendingPathComponent:outputName];
+			[fileManager createFileAtPath:outputPath contents:[output data] attributes:nil];
+		}
+
+		[output release];
+		[fileManager release];
+		[pool drain];
+	});
+
+	//---------- Clean up -----------------------------------------------------
+
+	for(modelCounter = 0; modelCounter < modelCount; modelCounter++)
+	{
+		[models[modelCounter].modelName release];
+		[models[modelCounter].fileName release];
+		[models[modelCounter].folderName release];
+		[models[modelCounter].opening release];
+		[models[modelCounter].header release];
+		[models[modelCounter].steps release];
+		[models[modelCounter].loneStep release];
+	}
+	free(models);
+
+}//end exportToFolder:modelFolderFormat:stepFileFormat:
+
+
+#pragma mark -
+#pragma mark DESTRUCTOR
+#pragma mark -
+
+//========== dealloc ===========================================================
+//
+// Purpose:		Release the file.
+//
+//==============================================================================
+- (void) dealloc
+{
+	[file release];
+
+	[super dealloc];
+
+}//end dealloc
+
+
+@end
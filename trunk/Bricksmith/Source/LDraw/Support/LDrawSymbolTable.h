@@ -0,0 +1,77 @@
+//==============================================================================
+//
+// File:		LDrawSymbolTable.h
+//
+// Purpose:		Process-wide interning of part names into small integer
+//				symbols.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import <Foundation/Foundation.h>
+#import <pthread.h>
+
+@class LDrawModel;
+
+// Symbol table - THEORY OF OPERATION
+//
+// A big model names the same few hundred parts tens of thousands of times.
+// Left alone, every LDrawPart would carry its own copy of its display name and
+// its lower-case reference name, and every resolve would hash that string
+// again to find the model in the part library.
+//
+// Instead, a part name is interned exactly once, when the part is parsed or
+// renamed.  Interning returns:
+//
+// - a symbol: a small integer naming the part.  Names which differ only in
+//   case or in the path separator (s\3001s01.dat vs S/3001S01.DAT) are the
+//   same symbol, because they are the same file in the library.
+// - shared copies of the display and reference name strings, so 40,000
+//   references to 3001.dat hold one string between them.
+//
+// Each symbol has a slot caching the library model it resolved to.  The part
+// library fills it in the first time a symbol is resolved; from then on,
+// resolving a library part is an array index.  The slot is a weak reference -
+// the part library owns its models and must clear the slot if it ever
+// releases one.
+//
+// Symbols are never freed.  Interning takes a lock (it hashes the name once);
+// reading a symbol's name or cached model does not, since the symbol storage
+// is paged and never moves.  Symbol 0 (LDrawSymbolNone) names nothing.
+
+typedef uint32_t LDrawSymbol;
+
+#define LDrawSymbolNone			0
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// class LDrawSymbolTable
+//
+////////////////////////////////////////////////////////////////////////////////
+@interface LDrawSymbolTable : NSObject
+{
+	pthread_mutex_t			mutex;
+	CFMutableDictionaryRef	spellings;		// exact spelling -> SymbolSpelling *
+	CFMutableDictionaryRef	symbols;		// normalized name -> LDrawSymbol
+	struct SymbolEntry		**pages;		// symbol -> SymbolEntry, paged so it never moves
+	LDrawSymbol				symbolCount;	// including LDrawSymbolNone
+}
+
+// Initialization
++ (LDrawSymbolTable *) sharedSymbolTable;
+
+// Interning
++ (NSString *) normalizedPartName:(NSString *)partName;
+- (LDrawSymbol) symbolForPartName:(NSString *)partName;
+- (LDrawSymbol) symbolForPartName:(NSString *)partName
+					  displayName:(NSString **)displayNameOut
+					referenceName:(NSString **)referenceNameOut;
+
+// Symbols
+- (NSString *) partNameForSymbol:(LDrawSymbol)symbol;
+- (LDrawModel *) libraryModelForSymbol:(LDrawSymbol)symbol;
+- (void) setLibraryModel:(LDrawModel *)model forSymbol:(LDrawSymbol)symbol;
+- (NSUInteger) symbolCount;
+
+@end
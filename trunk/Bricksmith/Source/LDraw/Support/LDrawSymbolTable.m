@@ -0,0 +1,271 @@
+//==============================================================================
+//
+// File:		LDrawSymbolTable.m
+//
+// Purpose:		Process-wide interning of part names into small integer
+//				symbols.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import "LDrawSymbolTable.h"
+
+// 1024 pages of 1024 symbols. A full library is about 20,000 names.
+#define SYMBOL_PAGE_BITS		10
+#define SYMBOL_PAGE_SIZE		(1 << SYMBOL_PAGE_BITS)
+#define SYMBOL_PAGE_COUNT		1024
+
+struct SymbolEntry
+{
+	NSString	*name;				// normalized
+	LDrawModel	*libraryModel;		// weak; owned by the part library
+
+};
+
+// One for each distinct spelling of a name that has been interned.
+typedef struct
+{
+	LDrawSymbol	symbol;
+	NSString	*displayName;
+	NSString	*referenceName;
+
+} SymbolSpelling;
+
+static LDrawSymbolTable *SharedSymbolTable = nil;
+
+
+@implementation LDrawSymbolTable
+
+#pragma mark -
+#pragma mark INITIALIZATION
+#pragma mark -
+
+//---------- initialize ----------------------------------------------[static]--
+//
+// Purpose:		Creates the shared table. Parser threads intern names, so it
+//				must exist before any of them could race to make it.
+//
+//------------------------------------------------------------------------------
++ (void) initialize
+{
+	if(self == [LDrawSymbolTable class])
+		SharedSymbolTable = [[LDrawSymbolTable alloc] init];
+
+}//end initialize
+
+
+//---------- sharedSymbolTable ---------------------------------------[static]--
+//
+// Purpose:		Returns the one table every part interns its name in.
+//
+//------------------------------------------------------------------------------
++ (LDrawSymbolTable *) sharedSymbolTable
+{
+	return SharedSymbolTable;
+
+}//end sharedSymbolTable
+
+
+//========== init ==============================================================
+//
+// Purpose:		Creates an empty table. Symbol 0 is reserved for "no symbol."
+//
+//==============================================================================
+- (id) init
+{
+	self = [super init];
+
+	pthread_mutex_init(&mutex, NULL);
+
+	spellings		= CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+	symbols			= CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+	pages			= calloc(SYMBOL_PAGE_COUNT, sizeof(struct SymbolEntry *));
+	pages[0]		= calloc(SYMBOL_PAGE_SIZE, sizeof(struct SymbolEntry));
+	symbolCount		= 1;
+
+	return self;
+
+}//end init
+
+
+#pragma mark -
+#pragma mark INTERNING
+#pragma mark -
+
+//---------- normalizedPartName: -------------------------------------[static]--
+//
+// Purpose:		Returns the name every spelling of this part's file name
+//				shares: lower-case, with the DOS path separator converted to
+//				the UNIX one (as -[LDrawPaths pathForPartName:] does).
+//
+//------------------------------------------------------------------------------
++ (NSString *) normalizedPartName:(NSString *)partName
+{
+	NSMutableString *normalized = [[[partName lowercaseString] mutableCopy] autorelease];
+
+	[normalized replaceOccurrencesOfString:@"\\" //DOS path separator (doubled for escape-sequence)
+								withString:@"/"
+								   options:0
+									 range:NSMakeRange(0, [normalized length]) ];
+
+	return normalized;
+
+}//end normalizedPartName:
+
+
+//========== symbolForPartName: ================================================
+//
+// Purpose:		Returns the symbol for the part name, interning it if this is
+//				the first time we've seen it.
+//
+//==============================================================================
+- (LDrawSymbol) symbolForPartName:(NSString *)partName
+{
+	return [self symbolForPartName:partName displayName:NULL referenceName:NULL];
+
+}//end symbolForPartName:
+
+
+//========== symbolForPartName:displayName:referenceName: ======================
+//
+// Purpose:		Returns the symbol for the part name, interning it if this is
+//				the first time we've seen it.
+//
+//				Also returns by indirection the table's own copy of partName
+//				and of its lower-case form, for the part to keep instead of its
+//				own. Neither need be retained; the table never releases them.
+//
+// Notes:		The common case - a spelling we've seen before - costs one hash
+//				of partName.
+//
+//==============================================================================
+- (LDrawSymbol) symbolForPartName:(NSString *)partName
+					  displayName:(NSString **)displayNameOut
+					referenceName:(NSString **)referenceNameOut
+{
+	SymbolSpelling		*spelling	= NULL;
+	NSString			*normalized	= nil;
+	NSString			*key		= nil;
+	const void			*value		= NULL;
+	LDrawSymbol			symbol		= LDrawSymbolNone;
+	struct SymbolEntry	*page		= NULL;
+
+	if(partName == nil)
+	{
+		if(displayNameOut)		*displayNameOut		= nil;
+		if(referenceNameOut)	*referenceNameOut	= nil;
+		return LDrawSymbolNone;
+	}
+
+	pthread_mutex_lock(&mutex);
+	{
+		spelling = (SymbolSpelling *)CFDictionaryGetValue(self->spellings, partName);
+
+		if(spelling == NULL)
+		{
+			// New spelling; maybe a new part too.
+			key			= [partName copy];
+			normalized	= [LDrawSymbolTable normalizedPartName:key];
+
+			if(CFDictionaryGetValueIfPresent(self->symbols, normalized, &value))
+			{
+				symbol = (LDrawSymbol)(uintptr_t)value;
+			}
+			else if(self->symbolCount < SYMBOL_PAGE_COUNT * SYMBOL_PAGE_SIZE)
+			{
+				symbol	= self->symbolCount;
+				page	= self->pages[symbol >> SYMBOL_PAGE_BITS];
+				if(page == NULL)
+				{
+					page = calloc(SYMBOL_PAGE_SIZE, sizeof(struct SymbolEntry));
+					self->pages[symbol >> SYMBOL_PAGE_BITS] = page;
+				}
+				page[symbol & (SYMBOL_PAGE_SIZE - 1)].name = [normalized copy];
+				CFDictionarySetValue(self->symbols, page[symbol & (SYMBOL_PAGE_SIZE - 1)].name, (const void *)(uintptr_t)symbol);
+
+				// Publish the count only once the entry is complete.
+				self->symbolCount = symbol + 1;
+			}
+
+			spelling				= malloc(sizeof(SymbolSpelling));
+			spelling->symbol		= symbol;
+			spelling->displayName	= key;
+			spelling->referenceName	= [[key lowercaseString] copy];
+			CFDictionarySetValue(self->spellings, key, spelling);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if(displayNameOut)		*displayNameOut		= spelling->displayName;
+	if(referenceNameOut)	*referenceNameOut	= spelling->referenceName;
+
+	return spelling->symbol;
+
+}//end symbolForPartName:displayName:referenceName:
+
+
+#pragma mark -
+#pragma mark SYMBOLS
+#pragma mark -
+
+//========== partNameForSymbol: ================================================
+//
+// Purpose:		Returns the normalized name of the part, which is the name the
+//				part library files it under.
+//
+//==============================================================================
+- (NSString *) partNameForSymbol:(LDrawSymbol)symbol
+{
+	if(symbol == LDrawSymbolNone || symbol >= self->symbolCount)
+		return nil;
+
+	return self->pages[symbol >> SYMBOL_PAGE_BITS][symbol & (SYMBOL_PAGE_SIZE - 1)].name;
+
+}//end partNameForSymbol:
+
+
+//========== libraryModelForSymbol: ============================================
+//
+// Purpose:		Returns the library model this symbol was last resolved to, or
+//				nil if it hasn't been (or isn't a library part at all).
+//
+//==============================================================================
+- (LDrawModel *) libraryModelForSymbol:(LDrawSymbol)symbol
+{
+	if(symbol == LDrawSymbolNone || symbol >= self->symbolCount)
+		return nil;
+
+	return self->pages[symbol >> SYMBOL_PAGE_BITS][symbol & (SYMBOL_PAGE_SIZE - 1)].libraryModel;
+
+}//end libraryModelForSymbol:
+
+
+//========== setLibraryModel:forSymbol: ========================================
+//
+// Purpose:		Records the library model a symbol resolves to. Pass nil when
+//				the library lets go of the model.
+//
+//==============================================================================
+- (void) setLibraryModel:(LDrawModel *)model forSymbol:(LDrawSymbol)symbol
+{
+	if(symbol == LDrawSymbolNone || symbol >= self->symbolCount)
+		return;
+
+	self->pages[symbol >> SYMBOL_PAGE_BITS][symbol & (SYMBOL_PAGE_SIZE - 1)].libraryModel = model;
+
+}//end setLibraryModel:forSymbol:
+
+
+//========== symbolCount =======================================================
+//
+// Purpose:		Returns the number of distinct parts interned so far.
+//
+//==============================================================================
+- (NSUInteger) symbolCount
+{
+	return self->symbolCount - 1;
+
+}//end symbolCount
+
+
+@end
@@ -0,0 +1,256 @@
+/*
+ *  LDrawTokenizer.c
+ *  Bricksmith
+ *
+ *  Created by bsupnik on 10/16/26.
+ *  Copyright 2026. All rights reserved.
+ *
+ */
+
+#include "LDrawTokenizer.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Longest field we will hand to strtod on the slow path.  LDraw numbers are
+// never anywhere near this long; anything longer is garbage and is truncated.
+#define SLOW_FIELD_MAX		64
+
+// Max significant digits we accumulate into a 64-bit mantissa.  19 decimal
+// digits always fit.
+#define MAX_MANTISSA_DIGITS	19
+
+// Exact powers of ten representable in a double.  A mantissa < 2^53 scaled by
+// one of these is correctly rounded, which is what strtod would give us.
+static const double k_pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// NSCharacterSet's whitespaceAndNewlineCharacterSet, restricted to the bytes
+// that can appear in an 8-bit line.
+static inline int is_white(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+static inline int is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+//==============================================================================
+//	TOKENIZER
+//==============================================================================
+
+void LDrawTokenizerInit(struct LDrawTokenizer * tok, const char * begin, const char * end)
+{
+	tok->cur = begin;
+	tok->end = end;
+}
+
+
+int LDrawTokenizerNextField(struct LDrawTokenizer * tok, const char ** field_begin, const char ** field_end)
+{
+	const char * p = tok->cur;
+	const char * e = tok->end;
+
+	while(p < e && is_white(*p))
+		++p;
+	*field_begin = p;
+	while(p < e && !is_white(*p))
+		++p;
+	*field_end = p;
+	tok->cur = p;
+
+	return *field_begin != *field_end;
+}
+
+
+float LDrawTokenizerNextFloat(struct LDrawTokenizer * tok)
+{
+	const char *	b;
+	const char *	e;
+	LDrawTokenizerNextField(tok, &b, &e);
+	return LDrawScanFloat(b, e);
+}
+
+
+int LDrawTokenizerNextInt(struct LDrawTokenizer * tok)
+{
+	const char *	b;
+	const char *	e;
+	LDrawTokenizerNextField(tok, &b, &e);
+	return LDrawScanInt(b, e);
+}
+
+
+void LDrawTokenizerRemainder(struct LDrawTokenizer * tok, const char ** rest_begin, const char ** rest_end)
+{
+	const char * p = tok->cur;
+	const char * e = tok->end;
+
+	while(p < e && is_white(*p))
+		++p;
+	while(e > p && is_white(e[-1]))
+		--e;
+
+	*rest_begin = p;
+	*rest_end = e;
+	tok->cur = tok->end;
+}
+
+#pragma mark -
+//==============================================================================
+//	NUMBER SCANNING
+//==============================================================================
+//
+//	The fast path handles the overwhelmingly common case: a plain decimal
+//	number with at most 19 significant digits and a small exponent.  The
+//	mantissa is accumulated as an integer and scaled by an exact power of ten,
+//	so the result is exactly what strtod would produce.
+//
+//	Anything else (very long mantissas, huge exponents, inf/nan, hex floats)
+//	is copied to a NUL-terminated buffer and handed to strtod.  We never see
+//	those in real LDraw files, so the copy does not matter.
+
+static float slow_scan_float(const char * begin, const char * end)
+{
+	char	buf[SLOW_FIELD_MAX];
+	size_t	len = end - begin;
+
+	if(len > SLOW_FIELD_MAX - 1)
+		len = SLOW_FIELD_MAX - 1;
+	memcpy(buf, begin, len);
+	buf[len] = 0;
+
+	return (float) strtod(buf, NULL);
+}
+
+
+float LDrawScanFloat(const char * begin, const char * end)
+{
+	const char *	p			= begin;
+	int				negative	= 0;
+	uint64_t		mantissa	= 0;
+	int				digits		= 0;
+	int				exponent	= 0;
+	int				any_digits	= 0;
+	int				truncated	= 0;
+	double			value		= 0.0;
+
+	if(p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		++p;
+	}
+
+	// Not a plain decimal number - let the C library sort out inf, nan, etc.
+	if(p < end && !is_digit(*p) && *p != '.')
+		return slow_scan_float(begin, end);
+
+	// Integer part.
+	while(p < end && is_digit(*p))
+	{
+		if(digits < MAX_MANTISSA_DIGITS)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if(mantissa)
+				++digits;
+		}
+		else
+		{
+			++exponent;
+			truncated = 1;
+		}
+		any_digits = 1;
+		++p;
+	}
+
+	// Fraction.
+	if(p < end && *p == '.')
+	{
+		++p;
+		while(p < end && is_digit(*p))
+		{
+			if(digits < MAX_MANTISSA_DIGITS)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if(mantissa)
+					++digits;
+				--exponent;
+			}
+			else
+				truncated = 1;
+			any_digits = 1;
+			++p;
+		}
+	}
+
+	if(!any_digits)
+		return 0.0f;
+
+	// Exponent - only consumed if it has at least one digit, so "1e" is 1.
+	if(p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *	q			= p + 1;
+		int				exp_neg		= 0;
+		int				exp_val		= 0;
+
+		if(q < end && (*q == '-' || *q == '+'))
+		{
+			exp_neg = (*q == '-');
+			++q;
+		}
+		if(q < end && is_digit(*q))
+		{
+			while(q < end && is_digit(*q))
+			{
+				if(exp_val < 10000)
+					exp_val = exp_val * 10 + (*q - '0');
+				++q;
+			}
+			exponent += exp_neg ? -exp_val : exp_val;
+		}
+	}
+
+	if(truncated || mantissa > (1ULL << 53) || exponent < -22 || exponent > 22)
+		return slow_scan_float(begin, end);
+
+	value = (double) mantissa;
+	if(exponent < 0)
+		value /= k_pow10[-exponent];
+	else
+		value *= k_pow10[exponent];
+
+	return (float) (negative ? -value : value);
+}
+
+
+int LDrawScanInt(const char * begin, const char * end)
+{
+	const char *	p			= begin;
+	int				negative	= 0;
+	long long		value		= 0;
+
+	if(p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		++p;
+	}
+	while(p < end && is_digit(*p))
+	{
+		// Clamp like intValue does rather than wrapping around.
+		if(value <= 2147483648LL)
+			value = value * 10 + (*p - '0');
+		++p;
+	}
+	if(negative)
+		value = -value;
+	if(value > 2147483647LL)
+		value = 2147483647LL;
+	if(value < -2147483647LL - 1)
+		value = -2147483647LL - 1;
+
+	return (int) value;
+}
@@ -0,0 +1,79 @@
+/*
+ *  LDrawTokenizer.h
+ *  Bricksmith
+ *
+ *  Created by bsupnik on 10/16/26.
+ *  Copyright 2026. All rights reserved.
+ *
+ */
+
+#ifndef LDrawTokenizer_H
+#define LDrawTokenizer_H
+
+#include <stddef.h>
+
+//==============================================================================
+//
+// File: LDrawTokenizer
+//
+// LDrawTokenizer is a set of C functions that split one line of LDraw into
+// whitespace-separated fields without allocating memory.  It operates on the
+// raw bytes of the line; since every field we scan numerically is pure ASCII,
+// the tokenizer is indifferent to whether the line is UTF-8, Latin-1 or Mac
+// Roman.  Only the "remainder" of a line (e.g. a part name) needs to be
+// decoded back into a string by the client, using the line's real encoding.
+//
+// The old path (+[LDrawUtilities readNextField:remainder:]) trimmed the line
+// and allocated two substrings per field; a type 1 line cost ~30 autoreleased
+// strings before we ever called floatValue.  This API replaces all of that with
+// pointer bumping.
+//
+// Numeric scanning matches the semantics of -[NSString floatValue] and
+// -[NSString intValue] for the inputs we care about: the longest valid numeric
+// prefix of a field is used, and a field with no numeric prefix scans as 0.
+//
+// Usage:
+//
+// Init a tokenizer on stack with the byte range of a line, then pull fields
+// off in order.  Running off the end of the line is not an error - fields
+// beyond the end scan as empty (and thus 0), just like the NSString code did.
+//
+//==============================================================================
+
+// A tokenizer is just a cursor into the line.  It never owns the line memory;
+// the line must outlive the tokenizer.
+struct LDrawTokenizer {
+	const char *		cur;
+	const char *		end;
+};
+
+// Start tokenizing the bytes [begin, end).
+void				LDrawTokenizerInit(
+							struct LDrawTokenizer *	tok,
+							const char *			begin,
+							const char *			end);
+
+// Skip leading whitespace and return the next field in [*field_begin,
+// *field_end).  Returns 0 (and an empty field) if the line is exhausted.
+int					LDrawTokenizerNextField(
+							struct LDrawTokenizer *	tok,
+							const char **			field_begin,
+							const char **			field_end);
+
+// Scan the next field as a number.  These never fail; a missing or malformed
+// field scans as 0, matching floatValue/intValue.
+float				LDrawTokenizerNextFloat(struct LDrawTokenizer * tok);
+int					LDrawTokenizerNextInt(struct LDrawTokenizer * tok);
+
+// Return the rest of the line with leading and trailing whitespace trimmed.
+// Used for fields that may contain spaces, like MPD part names.
+void				LDrawTokenizerRemainder(
+							struct LDrawTokenizer *	tok,
+							const char **			rest_begin,
+							const char **			rest_end);
+
+// Scan a single field (not a whole line) as a number.
+float				LDrawScanFloat(const char * begin, const char * end);
+int					LDrawScanInt(const char * begin, const char * end);
+
+#endif /* LDrawTokenizer_H */
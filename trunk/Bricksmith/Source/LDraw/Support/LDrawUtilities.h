@@ -31,6 +31,9 @@ typedef enum
 	
 } ViewOrientationT;
 
+// Size of a buffer big enough for any formatted output field.
+#define LDRAW_OUTPUT_FIELD_SIZE		64
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -50,9 +53,18 @@ typedef enum
 
 // Parsing
 + (Class) classForDirectiveBeginningWithLine:(NSString *)line;
++ (Class) classForDirectiveAtIndex:(NSUInteger)index inLines:(NSArray *)lines;
 + (LDrawColor *) parseColorFromField:(NSString *)colorField;
++ (LDrawColor *) parseColorFromFieldBytes:(const char *)begin end:(const char *)end;
 + (NSString *) readNextField:(NSString *) partialDirective
 				   remainder:(NSString **) remainder;
++ (const char *) bytesForLineAtIndex:(NSUInteger)index
+							 inLines:(NSArray *)lines
+							  length:(NSUInteger *)length
+							encoding:(NSStringEncoding *)encoding;
++ (BOOL) lineAtIndex:(NSUInteger)index
+			 inLines:(NSArray *)lines
+	   isMetaCommand:(NSString *)keyword;
 + (NSString *) scanQuotableToken:(NSScanner *)scanner;
 + (NSString *) stringFromFile:(NSString *)path;
 + (NSString *) stringFromFileData:(NSData *)fileData;
@@ -60,6 +72,8 @@ typedef enum
 // Writing
 + (NSString *) outputStringForColor:(LDrawColor *)color;
 + (NSString *) outputStringForFloat:(float)number;
++ (NSUInteger) formatColor:(LDrawColor *)color toBuffer:(char *)buffer;
++ (NSUInteger) formatFloat:(float)number toBuffer:(char *)buffer;
 
 // Hit Detection
 + (void) registerHitForObject:(id)hitObject depth:(float)depth creditObject:(id)creditObject hits:(NSMutableDictionary *)hits;
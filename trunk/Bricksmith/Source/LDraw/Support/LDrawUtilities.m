@@ -15,10 +15,12 @@
 #import "LDrawContainer.h"
 #import "LDrawKeywords.h"
 #import "LDrawLine.h"
+#import "LDrawMappedLines.h"
 #import "LDrawMetaCommand.h"
 #import "LDrawPart.h"
 #import "LDrawQuadrilateral.h"
 #import "LDrawTexture.h"
+#import "LDrawTokenizer.h"
 #import "LDrawTriangle.h"
 #import "PartLibrary.h"
 #import "LDrawLSynth.h"
@@ -26,6 +28,80 @@
 static BOOL                 ColumnizesOutput    = NO;
 static NSString				*defaultAuthor		= @"anonymous";
 
+
+// Writes number exactly as printf's "%f" would, without going through printf.
+// Returns the length; buffer must hold at least LDRAW_OUTPUT_FIELD_SIZE bytes.
+static size_t format_fixed(char * buffer, float number)
+{
+	uint32_t	bits;
+	uint32_t	mantissa;
+	int			exponent;
+	uint64_t	scaled;			// |number| * 10^6, rounded half-even like printf
+	uint64_t	whole;
+	uint32_t	fraction;
+	char		digits[24];
+	int			digitCount	= 0;
+	char		*p			= buffer;
+	int			i;
+
+	memcpy(&bits, &number, sizeof(bits));
+	exponent	= (bits >> 23) & 0xFF;
+	mantissa	= bits & 0x7FFFFF;
+
+	// Inf/NaN, and numbers too big for our 64-bit fixed point.
+	if(exponent == 0xFF || exponent > 150 + 15)
+		return snprintf(buffer, LDRAW_OUTPUT_FIELD_SIZE, "%f", number);
+
+	// |number| = mantissa * 2^exponent, exactly.
+	if(exponent == 0)
+		exponent = -149;
+	else
+	{
+		mantissa |= 0x800000;
+		exponent -= 150;
+	}
+
+	if(exponent >= 0)
+		scaled = ((uint64_t)mantissa * 1000000) << exponent;
+	else if(exponent <= -64)
+		scaled = 0;
+	else
+	{
+		uint64_t	product		= (uint64_t)mantissa * 1000000;
+		int			shift		= -exponent;
+		uint64_t	remainder	= product & ((1ULL << shift) - 1);
+		uint64_t	half		= 1ULL << (shift - 1);
+
+		scaled = product >> shift;
+		if(remainder > half || (remainder == half && (scaled & 1)))
+			scaled++;
+	}
+
+	whole		= scaled / 1000000;
+	fraction	= (uint32_t)(scaled % 1000000);
+
+	if(bits >> 31)
+		*p++ = '-';
+	do
+	{
+		digits[digitCount++] = '0' + (char)(whole % 10);
+		whole /= 10;
+	}
+	while(whole);
+	while(digitCount)
+		*p++ = digits[--digitCount];
+	*p++ = '.';
+	for(i = 5; i >= 0; i--)
+	{
+		p[i]		= '0' + (char)(fraction % 10);
+		fraction	/= 10;
+	}
+	p += 6;
+	*p = '\0';
+
+	return p - buffer;
+}
+
 @implementation LDrawUtilities
 
 #pragma mark -
@@ -147,6 +223,56 @@ static NSString				*defaultAuthor		= @"anonymous";
 }//end classForDirectiveBeginningWithLine:
 
 
+//---------- classForDirectiveAtIndex:inLines: -----------------------[static]--
+//
+// Purpose:		Same as classForDirectiveBeginningWithLine:, but reads the line 
+//				code straight from the line's bytes. Only meta-command lines 
+//				(whose class depends on their text) are turned into a string. 
+//
+//				Returns Nil for empty lines, which have no directive at all.
+//
+//------------------------------------------------------------------------------
++ (Class) classForDirectiveAtIndex:(NSUInteger)index inLines:(NSArray *)lines
+{
+	const char              *lineBytes      = NULL;
+	NSUInteger              lineLength      = 0;
+	Class                   classForType    = Nil;
+	struct LDrawTokenizer   tokenizer;
+	
+	lineBytes = [self bytesForLineAtIndex:index inLines:lines length:&lineLength encoding:NULL];
+	if(lineLength == 0)
+		return Nil;
+	
+	LDrawTokenizerInit(&tokenizer, lineBytes, lineBytes + lineLength);
+	
+	switch(LDrawTokenizerNextInt(&tokenizer))
+	{
+		case 1:
+			classForType = [LDrawPart class];
+			break;
+		case 2:
+			classForType = [LDrawLine class];
+			break;
+		case 3:
+			classForType = [LDrawTriangle class];
+			break;
+		case 4:
+			classForType = [LDrawQuadrilateral class];
+			break;
+		case 5:
+			classForType = [LDrawConditionalLine class];
+			break;
+		default:
+			// Meta-commands (and garbage, which gets logged).
+			classForType = [self classForDirectiveBeginningWithLine:[lines objectAtIndex:index]];
+			break;
+	}
+	
+	return classForType;
+	
+}//end classForDirectiveAtIndex:inLines:
+
+
 //---------- parseColorFromField: ------------------------------------[static]--
 //
 // Purpose:		Returns the color code which is represented by the field.
@@ -159,15 +285,43 @@ static NSString				*defaultAuthor		= @"anonymous";
 //------------------------------------------------------------------------------
 + (LDrawColor *) parseColorFromField:(NSString *)colorField
 {
-	NSScanner   *scanner        = [NSScanner scannerWithString:colorField];
+	const char  *fieldBytes     = [colorField UTF8String];
+	
+	return [self parseColorFromFieldBytes:fieldBytes
+									  end:fieldBytes + strlen(fieldBytes)];
+	
+}//end parseColorFromField:
+
+
+//---------- parseColorFromFieldBytes:end: ---------------------------[static]--
+//
+// Purpose:		Returns the color code which is represented by the field 
+//				occupying the bytes [begin, end). 
+//
+// Notes:		This is the allocation-free version of parseColorFromField: 
+//				used by the primitive parsers, which tokenize raw line bytes. 
+//				It accepts the same syntax, including custom RGB codes. 
+//
+//------------------------------------------------------------------------------
++ (LDrawColor *) parseColorFromFieldBytes:(const char *)begin
+									  end:(const char *)end
+{
+	const char  *cursor         = begin;
 	LDrawColorT colorCode       = LDrawColorBogus;
 	unsigned    hexBytes        = 0;
+	int         hexDigit        = 0;
 	int         customCodeType  = 0;
 	GLfloat     components[4]   = {};
 	LDrawColor	*color			= nil;
+	
+	// Skip leading whitespace, as NSScanner would.
+	while(cursor < end && isspace((unsigned char)*cursor))
+		cursor++;
 
 	// Custom RGB?
-	if([scanner scanString:@"0x" intoString:nil] == YES)
+	if(		end - cursor >= 2
+	   &&	cursor[0] == '0'
+	   &&	(cursor[1] == 'x' || cursor[1] == 'X') )
 	{
 		// The integer should be of the format:
 		// 0x2RRGGBB for opaque colors
@@ -175,7 +329,14 @@ static NSString				*defaultAuthor		= @"anonymous";
 		// 0x4RGBRGB for a dither of two 12-bit RGB colors
 		// 0x5RGBxxx as a dither of one 12-bit RGB color with clear (for transparency).
 
-		[scanner scanHexInt:&hexBytes];
+		for(cursor += 2; cursor < end; cursor++)
+		{
+			hexDigit = digittoint(*cursor);
+			if(hexDigit == 0 && *cursor != '0')
+				break;
+			// Overflow saturates, like -[NSScanner scanHexInt:].
+			hexBytes = (hexBytes > (UINT_MAX >> 4)) ? UINT_MAX : (hexBytes << 4) | hexDigit;
+		}
 		customCodeType = (hexBytes >> 3*8) & 0xFF;
 		
 		switch(customCodeType)
@@ -216,15 +377,23 @@ static NSString				*defaultAuthor		= @"anonymous";
 				break;
 		}
 		
-		color = [[[LDrawColor alloc] init] autorelease];
-		[color setColorCode:LDrawColorCustomRGB];
-		[color setEdgeColorCode:LDrawBlack];
-		[color setColorRGBA:components];
+		// Models that use direct colors tend to use the same few over and 
+		// over; share one color object for each value. 
+		color = [[ColorLibrary sharedColorLibrary] colorForDirectValue:hexBytes];
+		if(color == nil)
+		{
+			color = [[[LDrawColor alloc] init] autorelease];
+			[color setColorCode:LDrawColorCustomRGB];
+			[color setEdgeColorCode:LDrawBlack];
+			[color setColorRGBA:components];
+			
+			color = [[ColorLibrary sharedColorLibrary] addDirectColor:color forValue:hexBytes];
+		}
 	}
 	else
 	{
 		// Regular, standards-compliant LDraw color code
-		colorCode   = [colorField intValue];
+		colorCode   = LDrawScanInt(cursor, end);
 		color       = [[ColorLibrary sharedColorLibrary] colorForCode:colorCode];
 		
 		if(color == nil)
@@ -238,7 +407,7 @@ static NSString				*defaultAuthor		= @"anonymous";
 		
 	return color;
 	
-}//end parseColorFromField:
+}//end parseColorFromFieldBytes:end:
 
 
 //---------- readNextField:remainder: --------------------------------[static]--
@@ -298,6 +467,92 @@ static NSString				*defaultAuthor		= @"anonymous";
 }//end readNextField
 
 
+//---------- bytesForLineAtIndex:inLines:length:encoding: ------------[static]--
+//
+// Purpose:		Returns the raw bytes of the given line, suitable for feeding to 
+//				an LDrawTokenizer. The bytes are owned by the line (or by an 
+//				autoreleased buffer); they are valid only as long as the line 
+//				itself.
+//
+//				The encoding of the bytes is returned by indirection, so that 
+//				free-text fields pulled out of the bytes can be turned back into 
+//				strings properly.
+//
+// Notes:		Lines read from disk come in an LDrawMappedLines, which hands 
+//				out slices of the mapped file directly. For ordinary arrays of 
+//				strings, Core Foundation can usually hand us its own backing 
+//				store, so neither case copies anything.
+//
+//------------------------------------------------------------------------------
++ (const char *) bytesForLineAtIndex:(NSUInteger)index
+							 inLines:(NSArray *)lines
+							  length:(NSUInteger *)length
+							encoding:(NSStringEncoding *)encoding
+{
+	NSString    *line       = nil;
+	const char  *lineBytes  = NULL;
+	
+	if([lines isKindOfClass:[LDrawMappedLines class]])
+	{
+		lineBytes = [(LDrawMappedLines *)lines bytesForLineAtIndex:index length:length];
+		if(encoding != NULL)
+			*encoding = [(LDrawMappedLines *)lines encoding];
+	}
+	else
+	{
+		line        = [lines objectAtIndex:index];
+		lineBytes   = CFStringGetCStringPtr((CFStringRef)line, kCFStringEncodingUTF8);
+		
+		if(lineBytes == NULL)
+			lineBytes = [line UTF8String];
+		
+		if(length != NULL)
+			*length = strlen(lineBytes);
+		if(encoding != NULL)
+			*encoding = NSUTF8StringEncoding;
+	}
+	
+	return lineBytes;
+	
+}//end bytesForLineAtIndex:inLines:length:encoding:
+
+
+//---------- lineAtIndex:inLines:isMetaCommand: ----------------------[static]--
+//
+// Purpose:		Returns YES if the line is the meta-command "0 <keyword> ...". 
+//				This is the byte-level equivalent of reading two fields and 
+//				comparing them, used to find step and MPD delimiters without 
+//				creating strings for every line we scan past. 
+//
+//------------------------------------------------------------------------------
++ (BOOL) lineAtIndex:(NSUInteger)index
+			 inLines:(NSArray *)lines
+	   isMetaCommand:(NSString *)keyword
+{
+	const char              *lineBytes      = NULL;
+	NSUInteger              lineLength      = 0;
+	const char              *fieldBegin     = NULL;
+	const char              *fieldEnd       = NULL;
+	const char              *keywordBytes   = [keyword UTF8String];
+	size_t                  keywordLength   = strlen(keywordBytes);
+	struct LDrawTokenizer   tokenizer;
+	
+	lineBytes = [self bytesForLineAtIndex:index inLines:lines length:&lineLength encoding:NULL];
+	LDrawTokenizerInit(&tokenizer, lineBytes, lineBytes + lineLength);
+	
+	// Line code must be exactly "0".
+	LDrawTokenizerNextField(&tokenizer, &fieldBegin, &fieldEnd);
+	if(fieldEnd - fieldBegin != 1 || *fieldBegin != '0')
+		return NO;
+	
+	LDrawTokenizerNextField(&tokenizer, &fieldBegin, &fieldEnd);
+	
+	return (	(size_t)(fieldEnd - fieldBegin) == keywordLength
+			&&	memcmp(fieldBegin, keywordBytes, keywordLength) == 0 );
+	
+}//end lineAtIndex:inLines:isMetaCommand:
+
+
 //---------- scanQuotableToken: --------------------------------------[static]--
 //
 // Purpose:		Scans a field which allows embedded whitespace if the field is 
@@ -403,83 +658,116 @@ static NSString				*defaultAuthor		= @"anonymous";
 // Purpose:		Returns the string representing the color code which should be 
 //				written out in a file. 
 //
+//------------------------------------------------------------------------------
++ (NSString *) outputStringForColor:(LDrawColor *)color
+{
+	char        formattedColor[LDRAW_OUTPUT_FIELD_SIZE];
+	NSUInteger  length          = [self formatColor:color toBuffer:formattedColor];
+	
+	return [[[NSString alloc] initWithBytes:formattedColor length:length encoding:NSASCIIStringEncoding] autorelease];
+
+}//end outputStringForColorCode:RGB:
+
+
+//---------- outputStringForFloat: -----------------------------------[static]--
+//
+// Purpose:		Returns a formatted float appropriate for inserting into an 
+//				LDraw file. 
+//
+//------------------------------------------------------------------------------
++ (NSString *) outputStringForFloat:(float)number
+{
+	char        formattedFloat[LDRAW_OUTPUT_FIELD_SIZE];
+	NSUInteger  length          = [self formatFloat:number toBuffer:formattedFloat];
+	
+	return [[[NSString alloc] initWithBytes:formattedFloat length:length encoding:NSASCIIStringEncoding] autorelease];
+
+}//end outputStringForFloat:
+
+
+//---------- formatColor:toBuffer: -----------------------------------[static]--
+//
+// Purpose:		Writes the color code which should be written out in a file 
+//				into buffer, which must be LDRAW_OUTPUT_FIELD_SIZE bytes. 
+//				Returns the length written, not counting the terminating NUL. 
+//
 // Notes:		This supports the non-standard custom RGB extension.
 //
 //------------------------------------------------------------------------------
-+ (NSString *) outputStringForColor:(LDrawColor *)color
++ (NSUInteger) formatColor:(LDrawColor *)color toBuffer:(char *)buffer
 {
-	NSString        *outputString   = nil;
 	GLfloat			components[4]	= {};
 	LDrawColorT		colorCode		= LDrawColorBogus;
+	int				length			= 0;
 	
 	colorCode = [color colorCode];
-	[color getColorRGBA:components];
 
 	if(colorCode == LDrawColorCustomRGB)
 	{
+		[color getColorRGBA:components];
+		
 		// Opaque?
-		if(components[3] == 1.0)
-		{
-			outputString = [NSString stringWithFormat:@"0x2%02X%02X%02X",
-													   (uint8_t)(components[0] * 255),
-													   (uint8_t)(components[1] * 255),
-													   (uint8_t)(components[2] * 255) ];
-		}
-		else
-		{
-			outputString = [NSString stringWithFormat:@"0x3%02X%02X%02X",
-													   (uint8_t)(components[0] * 255),
-													   (uint8_t)(components[1] * 255),
-													   (uint8_t)(components[2] * 255) ];
-		}
+		length = snprintf(buffer, LDRAW_OUTPUT_FIELD_SIZE, "0x%d%02X%02X%02X",
+															(components[3] == 1.0) ? 2 : 3,
+															(uint8_t)(components[0] * 255),
+															(uint8_t)(components[1] * 255),
+															(uint8_t)(components[2] * 255) );
 	}
 	else
 	{
 		if(ColumnizesOutput == YES)
-		{
-			outputString = [NSString stringWithFormat:@"%3d", colorCode];
-		}
+			length = snprintf(buffer, LDRAW_OUTPUT_FIELD_SIZE, "%3d", colorCode);
 		else
-		{
-			outputString = [NSString stringWithFormat:@"%d", colorCode];
-		}
-
+			length = snprintf(buffer, LDRAW_OUTPUT_FIELD_SIZE, "%d", colorCode);
 	}
 	
-	return outputString;
+	return length;
 
-}//end outputStringForColorCode:RGB:
+}//end formatColor:toBuffer:
 
 
-//---------- outputStringForFloat: -----------------------------------[static]--
+//---------- formatFloat:toBuffer: -----------------------------------[static]--
 //
-// Purpose:		Returns a formatted float appropriate for inserting into an 
-//				LDraw file. 
+// Purpose:		Writes a float formatted for an LDraw file into buffer, which
+//				must be LDRAW_OUTPUT_FIELD_SIZE bytes. Returns the length 
+//				written, not counting the terminating NUL. 
+//
+// Notes:		The output must stay byte-for-byte what it has always been, 
+//				so this reproduces "%f" (optionally "%12f") exactly, including 
+//				the old 16-byte formatting buffer which truncated very large 
+//				numbers. It just doesn't call printf to do it; printf is most 
+//				of the cost of saving a big model.
 //
 //------------------------------------------------------------------------------
-+ (NSString *) outputStringForFloat:(float)number
++ (NSUInteger) formatFloat:(float)number toBuffer:(char *)buffer
 {
-	NSString        *outputString   = nil;
+	size_t  fullLength          = format_fixed(buffer, number);
+	char    *endOfString        = NULL;
 	
 	if(ColumnizesOutput == YES)
 	{
 		// Make a nice wide fixed-width string which will force the numbers into 
 		// columns. 
-		outputString = [NSString stringWithFormat:@"%12f", number];
+		if(fullLength < 12)
+		{
+			memmove(buffer + 12 - fullLength, buffer, fullLength + 1);
+			memset(buffer, ' ', 12 - fullLength);
+			fullLength = 12;
+		}
 	}
 	else
 	{
 		// Remove all trailing zeroes (and the decimal point if an integer).
+		// We could wind up with something like "50.090000".
 		
-		char    formattedFloat[16]  = "";
-		char    *endOfString        = NULL;
-		size_t  fullLength          = 0;
-		
-		// First format the number into a string. We could wind up with 
-		// something like "50.090000".
-		snprintf(formattedFloat, sizeof(formattedFloat), "%f", number);
-		fullLength  = strlen(formattedFloat);
-		endOfString = &formattedFloat[fullLength - 1];
+		// Numbers were formatted into a 16-byte buffer, so anything longer got
+		// cut short.
+		if(fullLength > 15)
+		{
+			fullLength = 15;
+			buffer[fullLength] = '\0';
+		}
+		endOfString = &buffer[fullLength - 1];
 		
 		// Back up past all the zeroes that may be at the end of the number
 		while(*endOfString == '0')
@@ -494,12 +782,12 @@ static NSString				*defaultAuthor		= @"anonymous";
 		}
 		
 		*endOfString = '\0';
-		outputString = [NSString stringWithUTF8String:formattedFloat];
+		fullLength = endOfString - buffer;
 	}
 	
-	return outputString;
+	return fullLength;
 
-}//end outputStringForFloat:
+}//end formatFloat:toBuffer:
 
 
 #pragma mark -
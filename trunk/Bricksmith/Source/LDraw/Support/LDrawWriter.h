@@ -0,0 +1,64 @@
+//==============================================================================
+//
+// File:		LDrawWriter.h
+//
+// Purpose:		Accumulates the UTF-8 text of an LDraw file in a single growable
+//				byte buffer.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import <Foundation/Foundation.h>
+
+@class LDrawColor;
+@class LDrawDirective;
+
+// Streaming writer - THEORY OF OPERATION
+//
+// -[LDrawDirective write] returns each directive as an NSString, and every
+// container builds its own string out of its children's, so saving a file
+// copies every line once per level of nesting (file, model, step), and every
+// number goes through -stringWithFormat: on the way.
+//
+// Instead, directives can -writeToStream: an LDrawWriter, which appends
+// straight into one buffer.  Numbers and colors are formatted into a stack
+// buffer by +[LDrawUtilities formatFloat:toBuffer:] and copied in; strings
+// are transcoded to UTF-8 directly into the buffer.  When the document is
+// done, the buffer is handed off as NSData with no further copy.
+//
+// The stream output is, by definition, identical to -write: the directives
+// which write to a stream implement -write by streaming into a fresh writer.
+// Directives which don't override -writeToStream: simply append -write.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// class LDrawWriter
+//
+////////////////////////////////////////////////////////////////////////////////
+@interface LDrawWriter : NSObject
+{
+	char		*bytes;
+	NSUInteger	length;
+	NSUInteger	capacity;
+}
+
+// Initialization
++ (NSString *) stringByWritingDirective:(LDrawDirective *)directive;
+
+// Appending
+- (void) appendBytes:(const char *)source length:(NSUInteger)count;
+- (void) appendCString:(const char *)string;
+- (void) appendData:(NSData *)data;
+- (void) appendString:(NSString *)string;
+- (void) appendCRLF;
+- (void) appendColor:(LDrawColor *)color;
+- (void) appendFloat:(float)number;
+
+// Output
+- (void) trimTrailingWhitespace;
+- (void) removeAllBytes;
+- (NSString *) string;
+- (NSData *) data;
+- (NSData *) takeData;
+
+@end
@@ -0,0 +1,332 @@
+//==============================================================================
+//
+// File:		LDrawWriter.m
+//
+// Purpose:		Accumulates the UTF-8 text of an LDraw file in a single growable
+//				byte buffer.
+//
+//  Created by bsupnik on 10/16/26.
+//  Copyright 2026. All rights reserved.
+//==============================================================================
+#import "LDrawWriter.h"
+
+#import "LDrawDirective.h"
+#import "LDrawUtilities.h"
+
+// A 50k-part model is a few megabytes; start small and double.
+#define INITIAL_CAPACITY	(64 * 1024)
+
+
+//========== trailingWhitespaceLength ==========================================
+//
+// Purpose:		Returns the number of bytes at the end of the UTF-8 buffer
+//				which are in NSCharacterSet's whitespaceAndNewlineCharacterSet:
+//				tab, LF through CR, U+0085, and the Unicode Z* categories.
+//
+//==============================================================================
+static NSUInteger trailingWhitespaceLength(const unsigned char *bytes, NSUInteger length)
+{
+	NSUInteger end = length;
+
+	while(end > 0)
+	{
+		unsigned char c = bytes[end - 1];
+
+		if(c == ' ' || (c >= '\t' && c <= '\r'))
+		{
+			end -= 1;
+		}
+		else if(end >= 2 && bytes[end - 2] == 0xC2 && (c == 0x85 || c == 0xA0))
+		{
+			end -= 2;	// U+0085, U+00A0
+		}
+		else if(end >= 3)
+		{
+			unsigned char	lead	= bytes[end - 3];
+			unsigned char	mid		= bytes[end - 2];
+
+			if(		(lead == 0xE1 && mid == 0x9A && c == 0x80)						// U+1680
+				||	(lead == 0xE2 && mid == 0x80 && c >= 0x80 && c <= 0x8A)			// U+2000 - U+200A
+				||	(lead == 0xE2 && mid == 0x80 && (c == 0xA8 || c == 0xA9))		// U+2028, U+2029
+				||	(lead == 0xE2 && mid == 0x80 && c == 0xAF)						// U+202F
+				||	(lead == 0xE2 && mid == 0x81 && c == 0x9F)						// U+205F
+				||	(lead == 0xE3 && mid == 0x80 && c == 0x80) )					// U+3000
+			{
+				end -= 3;
+			}
+			else
+				break;
+		}
+		else
+			break;
+	}
+
+	return length - end;
+}
+
+
+@implementation LDrawWriter
+
+#pragma mark -
+#pragma mark INITIALIZATION
+#pragma mark -
+
+//---------- stringByWritingDirective: -------------------------------[static]--
+//
+// Purpose:		Returns what the directive writes to a stream, as a string.
+//				This is how stream-writing directives implement -write.
+//
+//------------------------------------------------------------------------------
++ (NSString *) stringByWritingDirective:(LDrawDirective *)directive
+{
+	LDrawWriter	*writer	= [[LDrawWriter alloc] init];
+	NSString	*output	= nil;
+
+	[directive writeToStream:writer];
+	output = [writer string];
+	[writer release];
+
+	return output;
+
+}//end stringByWritingDirective:
+
+
+#pragma mark -
+#pragma mark APPENDING
+#pragma mark -
+
+//========== reserve: ==========================================================
+//
+// Purpose:		Makes room for count more bytes.
+//
+//==============================================================================
+- (void) reserve:(NSUInteger)count
+{
+	if(length + count > capacity)
+	{
+		NSUInteger newCapacity = capacity ? capacity : INITIAL_CAPACITY;
+
+		while(length + count > newCapacity)
+			newCapacity *= 2;
+
+		bytes		= realloc(bytes, newCapacity);
+		capacity	= newCapacity;
+	}
+
+}//end reserve:
+
+
+//========== appendBytes:length: ===============================================
+//
+// Purpose:		Appends raw bytes, which must be UTF-8.
+//
+//==============================================================================
+- (void) appendBytes:(const char *)source length:(NSUInteger)count
+{
+	[self reserve:count];
+	memcpy(bytes + length, source, count);
+	length += count;
+
+}//end appendBytes:length:
+
+
+//========== appendCString: ====================================================
+//
+// Purpose:		Appends a NUL-terminated UTF-8 string.
+//
+//==============================================================================
+- (void) appendCString:(const char *)string
+{
+	[self appendBytes:string length:strlen(string)];
+
+}//end appendCString:
+
+
+//========== appendData: =======================================================
+//
+// Purpose:		Appends output taken from another writer.
+//
+//==============================================================================
+- (void) appendData:(NSData *)data
+{
+	[self appendBytes:[data bytes] length:[data length]];
+
+}//end appendData:
+
+
+//========== appendString: =====================================================
+//
+// Purpose:		Appends the string encoded as UTF-8.
+//
+// Notes:		The characters are transcoded straight into our buffer; no
+//				intermediate C string is made.
+//
+//==============================================================================
+- (void) appendString:(NSString *)string
+{
+	NSUInteger	stringLength	= [string length];
+	NSUInteger	usedLength		= 0;
+
+	if(stringLength == 0)
+		return;
+
+	[self reserve:[string maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding]];
+	[string getBytes:bytes + length
+		   maxLength:capacity - length
+		  usedLength:&usedLength
+			encoding:NSUTF8StringEncoding
+			 options:0
+			   range:NSMakeRange(0, stringLength)
+	  remainingRange:NULL];
+	length += usedLength;
+
+}//end appendString:
+
+
+//========== appendCRLF ========================================================
+//
+// Purpose:		Appends a DOS line ending, which LDraw is supposed to use.
+//
+//==============================================================================
+- (void) appendCRLF
+{
+	[self appendBytes:"\r\n" length:2];
+
+}//end appendCRLF
+
+
+//========== appendColor: ======================================================
+//
+// Purpose:		Appends a color code as +[LDrawUtilities outputStringForColor:]
+//				would write it.
+//
+//==============================================================================
+- (void) appendColor:(LDrawColor *)color
+{
+	[self reserve:LDRAW_OUTPUT_FIELD_SIZE];
+	length += [LDrawUtilities formatColor:color toBuffer:bytes + length];
+
+}//end appendColor:
+
+
+//========== appendFloat: ======================================================
+//
+// Purpose:		Appends a number as +[LDrawUtilities outputStringForFloat:]
+//				would write it.
+//
+//==============================================================================
+- (void) appendFloat:(float)number
+{
+	[self reserve:LDRAW_OUTPUT_FIELD_SIZE];
+	length += [LDrawUtilities formatFloat:number toBuffer:bytes + length];
+
+}//end appendFloat:
+
+
+#pragma mark -
+#pragma mark OUTPUT
+#pragma mark -
+
+//========== trimTrailingWhitespace ============================================
+//
+// Purpose:		Removes whitespace and newlines from the end of the output, as
+//				-stringByTrimmingCharactersInSet: would.
+//
+//==============================================================================
+- (void) trimTrailingWhitespace
+{
+	length -= trailingWhitespaceLength((const unsigned char *)bytes, length);
+
+}//end trimTrailingWhitespace
+
+
+//========== removeAllBytes ====================================================
+//
+// Purpose:		Empties the writer but keeps its buffer, so that it can be 
+//				reused for another file of about the same size.
+//
+//==============================================================================
+- (void) removeAllBytes
+{
+	length = 0;
+
+}//end removeAllBytes
+
+
+//========== string ============================================================
+//
+// Purpose:		Returns a copy of everything written so far.
+//
+//==============================================================================
+- (NSString *) string
+{
+	NSString *string = [[NSString alloc] initWithBytes:bytes
+												length:length
+											  encoding:NSUTF8StringEncoding];
+	return [string autorelease];
+
+}//end string
+
+
+//========== data ==============================================================
+//
+// Purpose:		Returns everything written so far as UTF-8 data, without 
+//				copying it.
+//
+// Notes:		The data points into our buffer, so it is only good until the 
+//				writer is next changed.
+//
+//==============================================================================
+- (NSData *) data
+{
+	if(bytes == NULL)
+		return [NSData data];
+
+	return [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:NO];
+
+}//end data
+
+
+//========== takeData ==========================================================
+//
+// Purpose:		Hands over everything written so far as UTF-8 data, without
+//				copying it. The writer is left empty.
+//
+//==============================================================================
+- (NSData *) takeData
+{
+	NSData *data = nil;
+
+	if(bytes == NULL)
+		return [NSData data];
+
+	data = [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:YES];
+
+	bytes		= NULL;
+	length		= 0;
+	capacity	= 0;
+
+	return data;
+
+}//end takeData
+
+
+#pragma mark -
+#pragma mark DESTRUCTOR
+#pragma mark -
+
+//========== dealloc ===========================================================
+//
+// Purpose:		Free the buffer, if nobody took it.
+//
+//==============================================================================
+- (void) dealloc
+{
+	free(bytes);
+
+	[super dealloc];
+
+}//end dealloc
+
+
+@end
@@ -14,6 +14,43 @@
 #import "PartLibrary.h"
 #import "StringCategory.h"
 
+#import <fcntl.h>
+#import <sys/stat.h>
+#import <unistd.h>
+
+#import "LDrawTokenizer.h"
+
+// Manifest keys. The manifest records the size and modification date of every
+// file the catalog was built from, so that a reload only has to read the ones
+// that changed.
+#define MANIFEST_CATALOG_VERSION_KEY	@"CatalogVersion"	// VERSION_KEY of the catalog it describes
+#define MANIFEST_SEARCH_PATHS_KEY		@"SearchPaths"		// search path records, in search order
+#define MANIFEST_FILES_KEY				@"Files"			// per search path: file name -> (size, date)
+
+// Catalog info only comes from the header, so that is all we read of each file.
+#define HEADER_READ_CHUNK				8192
+#define HEADER_READ_LIMIT				(256 * 1024)		// give up on absurdly long headers
+
+
+//========== isHeaderLine ======================================================
+//
+// Purpose:		Returns YES if the line could be part of a file header; that
+//				is, it is blank or a comment/meta-command.
+//
+//==============================================================================
+static BOOL isHeaderLine(const char *lineStart, const char *lineEnd)
+{
+	struct LDrawTokenizer	tokenizer;
+	const char				*fieldStart	= NULL;
+	const char				*fieldEnd	= NULL;
+	
+	LDrawTokenizerInit(&tokenizer, lineStart, lineEnd);
+	if(LDrawTokenizerNextField(&tokenizer, &fieldStart, &fieldEnd) == 0)
+		return YES;
+	
+	return (fieldEnd - fieldStart == 1 && *fieldStart == '0');
+}
+
 @implementation PartCatalogBuilder
 
 //========== makePartCatalogWithDelegate: ======================================
@@ -25,6 +62,11 @@
 ///
 ///				Is it fast? No. Is it easy to code? Yes.
 ///
+///				Well, the first time. Alongside the catalog we save a manifest
+///				of the size and date of every file it came from; later reloads
+///				only read files that were added, removed or changed, and patch
+///				the saved catalog.
+///
 ///				Someday in the rosy future, this method should be recoded to
 ///				simply traverse the directory tree and deal with subfolders on
 ///				the fly. But that's not how it is now. Instead, I'm doing it
@@ -51,10 +93,10 @@
 /// 										thread) to indicate the total number
 /// 										of objects to be loaded.
 ///
-/// @param 		progressIncrementHandler	Will be called (on a background
-/// 										thread) to indicate an object has
-/// 										been processed toward the max load
-/// 										count.
+/// @param 		progressIncrementHandler	Will be called (on background
+/// 										threads, possibly several at once)
+/// 										to indicate an object has been
+/// 										processed toward the max load count.
 ///
 /// @param 		completionHandler 			Will be called (on a background
 /// 										thread) to when the catalog has
@@ -69,10 +111,6 @@
 	NSFileManager	*fileManager			= [[[NSFileManager alloc] init] autorelease];
 	LDrawPaths		*paths					= [[[LDrawPaths alloc] init] autorelease];
 	NSString		*ldrawPath				= [paths preferredLDrawPath];
-	NSMutableArray	*searchPaths			= [NSMutableArray array];
-	
-	NSString		*prefix_primitives48	= [NSString stringWithFormat:@"%@\\", PRIMITIVES_48_DIRECTORY_NAME];
-	NSString		*prefix_subparts		= [NSString stringWithFormat:@"%@\\", SUBPARTS_DIRECTORY_NAME];
 	
 	//make sure the LDraw folder is still valid; otherwise, why bother doing anything?
 	if([paths validateLDrawFolder:ldrawPath] == NO)
@@ -84,258 +122,719 @@
 	dispatch_queue_t catalogAccessQueue = dispatch_queue_create("com.AllenSmith.Bricksmith.CatalogLoader", NULL);
 	dispatch_async(catalogAccessQueue, ^{
 		
-		// Parts
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths partsPathForDomain:LDrawUserOfficial],				@"path",
-									nil]];
-
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths partsPathForDomain:LDrawUserUnofficial],				@"path",
-									nil]];
-
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths partsPathForDomain:LDrawInternalOfficial],			@"path",
-									nil]];
-
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths partsPathForDomain:LDrawInternalUnofficial],			@"path",
-									nil]];
-
-		// Primitives
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths primitivesPathForDomain:LDrawUserOfficial],			@"path",
-									NSLocalizedString(Category_Primitives, nil),				@"category",
-									nil]];
-									
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths primitivesPathForDomain:LDrawUserUnofficial],		@"path",
-									NSLocalizedString(Category_Primitives, nil),				@"category",
-									nil]];
+		NSArray								*searchPaths		= [self searchPathsWithPaths:paths];
+		NSString							*partCatalogPath	= [paths partCatalogPath];
+		NSString							*manifestPath		= [paths partCatalogManifestPath];
+		NSString							*version			= [[[NSBundle mainBundle] infoDictionary] objectForKey:@"CFBundleVersion"];
+		NSArray								*fileStamps			= nil;
+		NSMutableDictionary<NSString*, id>	*newPartCatalog 	= nil;
+		BOOL								catalogChanged		= YES;
+		
+		NSUInteger							partCount			= 0;
+		
+		// Take the size and date of every file BEFORE reading any of them. A
+		// file edited while we scan then still looks changed next time.
+		fileStamps = [self fileStampsForSearchPaths:searchPaths];
+		
+		// Patch the existing catalog if we can; that only reads new and
+		// changed files.
+		newPartCatalog = [self catalogByUpdatingCatalogAtPath:partCatalogPath
+											   manifestAtPath:manifestPath
+												  searchPaths:searchPaths
+												   fileStamps:fileStamps
+													  version:version
+										  maxLoadCountHandler:maxLoadCountHandler
+									 progressIncrementHandler:progressIncrementHandler
+													  changed:&catalogChanged];
+		if(newPartCatalog == nil)
+		{
+			newPartCatalog = [NSMutableDictionary dictionary];
+			
+			// Start the progress bar so that we know what's happening.
+			for(NSString *path in [searchPaths valueForKey:@"path"])
+			{
+				partCount += [[fileManager contentsOfDirectoryAtPath:path error:NULL] count];
+			}
+			if(maxLoadCountHandler)
+			{
+				maxLoadCountHandler(partCount);
+			}
+			
+			// Create the new part catalog. We will then fill it with folder contents.
+			[newPartCatalog setObject:[NSMutableDictionary dictionary] forKey:PARTS_CATALOG_KEY];
+			[newPartCatalog setObject:[NSMutableDictionary dictionary] forKey:PARTS_LIST_KEY];
+			
+			// Scan all the part folders.
+			[self addPartsInSearchPaths:searchPaths
+							  toCatalog:newPartCatalog
+			   progressIncrementHandler:progressIncrementHandler];
+			
+			[newPartCatalog setObject:version forKey:VERSION_KEY];
+			[newPartCatalog setObject:@"1.0"  forKey:COMPATIBILITY_VERSION_KEY];
+		}
 		
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths primitivesPathForDomain:LDrawInternalOfficial],		@"path",
-									NSLocalizedString(Category_Primitives, nil),				@"category",
-									nil]];
-									
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths primitivesPathForDomain:LDrawInternalUnofficial],	@"path",
-									NSLocalizedString(Category_Primitives, nil),				@"category",
-									nil]];
+		if(catalogChanged)
+		{
+			// Drop the old manifest first; if we die before the new one is
+			// written, the next reload must not trust it against a newer
+			// catalog.
+			[fileManager removeItemAtPath:manifestPath error:NULL];
+			
+			//Save the part catalog out for future reference.
+			if([newPartCatalog writeToFile:partCatalogPath atomically:YES])
+			{
+				[self writeManifestToPath:manifestPath
+							  searchPaths:searchPaths
+							   fileStamps:fileStamps
+								  version:version];
+			}
+		}
 		
-		// Primitives 48
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths primitives48PathForDomain:LDrawUserOfficial],		@"path",
-									NSLocalizedString(Category_Primitives, nil),				@"category",
-									prefix_primitives48,										@"prefix",
-									nil]];
-
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths primitives48PathForDomain:LDrawUserUnofficial],		@"path",
-									NSLocalizedString(Category_Primitives, nil),				@"category",
-									prefix_primitives48,										@"prefix",
-									nil]];
-
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths primitives48PathForDomain:LDrawInternalOfficial],	@"path",
-									NSLocalizedString(Category_Primitives, nil),				@"category",
-									prefix_primitives48,										@"prefix",
-									nil]];
-
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths primitives48PathForDomain:LDrawInternalUnofficial],	@"path",
-									NSLocalizedString(Category_Primitives, nil),				@"category",
-									prefix_primitives48,										@"prefix",
-									nil]];
-
-		// Subparts
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths subpartsPathForDomain:LDrawUserOfficial],			@"path",
-									NSLocalizedString(Category_Subparts, nil),					@"category",
-									prefix_subparts,											@"prefix",
-									nil]];
-
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths subpartsPathForDomain:LDrawUserUnofficial],			@"path",
-									NSLocalizedString(Category_Subparts, nil),					@"category",
-									prefix_subparts,											@"prefix",
-									nil]];
-
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths subpartsPathForDomain:LDrawInternalOfficial],		@"path",
-									NSLocalizedString(Category_Subparts, nil),					@"category",
-									prefix_subparts,											@"prefix",
-									nil]];
-
-		[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
-									[paths subpartsPathForDomain:LDrawInternalUnofficial],		@"path",
-									NSLocalizedString(Category_Subparts, nil),					@"category",
-									prefix_subparts,											@"prefix",
-									nil]];
+		// We succeeded in loading the parts!
+		completionHandler(newPartCatalog);
+	});
+	
+}//end reloadParts:
 
-		NSString							*partCatalogPath	= [paths partCatalogPath];
-		NSMutableDictionary<NSString*, id>	*newPartCatalog 	= [NSMutableDictionary dictionary];
+
+//========== searchPathsWithPaths: =============================================
+//
+// Purpose:		Returns the folders to catalog, in search order. Each record
+//				has the folder "path", and optionally a "category" to file
+//				everything in it under and a part name "prefix".
+//
+//				Earlier folders win when two of them have the same part.
+//
+//==============================================================================
+- (NSArray *) searchPathsWithPaths:(LDrawPaths *)paths
+{
+	NSMutableArray	*searchPaths			= [NSMutableArray array];
+	
+	NSString		*prefix_primitives48	= [NSString stringWithFormat:@"%@\\", PRIMITIVES_48_DIRECTORY_NAME];
+	NSString		*prefix_subparts		= [NSString stringWithFormat:@"%@\\", SUBPARTS_DIRECTORY_NAME];
+	
+	// Parts
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths partsPathForDomain:LDrawUserOfficial],				@"path",
+								nil]];
+
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths partsPathForDomain:LDrawUserUnofficial],				@"path",
+								nil]];
+
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths partsPathForDomain:LDrawInternalOfficial],			@"path",
+								nil]];
+
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths partsPathForDomain:LDrawInternalUnofficial],			@"path",
+								nil]];
+
+	// Primitives
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths primitivesPathForDomain:LDrawUserOfficial],			@"path",
+								NSLocalizedString(Category_Primitives, nil),				@"category",
+								nil]];
+								
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths primitivesPathForDomain:LDrawUserUnofficial],		@"path",
+								NSLocalizedString(Category_Primitives, nil),				@"category",
+								nil]];
+	
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths primitivesPathForDomain:LDrawInternalOfficial],		@"path",
+								NSLocalizedString(Category_Primitives, nil),				@"category",
+								nil]];
+								
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths primitivesPathForDomain:LDrawInternalUnofficial],	@"path",
+								NSLocalizedString(Category_Primitives, nil),				@"category",
+								nil]];
+	
+	// Primitives 48
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths primitives48PathForDomain:LDrawUserOfficial],		@"path",
+								NSLocalizedString(Category_Primitives, nil),				@"category",
+								prefix_primitives48,										@"prefix",
+								nil]];
+
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths primitives48PathForDomain:LDrawUserUnofficial],		@"path",
+								NSLocalizedString(Category_Primitives, nil),				@"category",
+								prefix_primitives48,										@"prefix",
+								nil]];
+
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths primitives48PathForDomain:LDrawInternalOfficial],	@"path",
+								NSLocalizedString(Category_Primitives, nil),				@"category",
+								prefix_primitives48,										@"prefix",
+								nil]];
+
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths primitives48PathForDomain:LDrawInternalUnofficial],	@"path",
+								NSLocalizedString(Category_Primitives, nil),				@"category",
+								prefix_primitives48,										@"prefix",
+								nil]];
+
+	// Subparts
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths subpartsPathForDomain:LDrawUserOfficial],			@"path",
+								NSLocalizedString(Category_Subparts, nil),					@"category",
+								prefix_subparts,											@"prefix",
+								nil]];
+
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths subpartsPathForDomain:LDrawUserUnofficial],			@"path",
+								NSLocalizedString(Category_Subparts, nil),					@"category",
+								prefix_subparts,											@"prefix",
+								nil]];
+
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths subpartsPathForDomain:LDrawInternalOfficial],		@"path",
+								NSLocalizedString(Category_Subparts, nil),					@"category",
+								prefix_subparts,											@"prefix",
+								nil]];
+
+	[searchPaths addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+								[paths subpartsPathForDomain:LDrawInternalUnofficial],		@"path",
+								NSLocalizedString(Category_Subparts, nil),					@"category",
+								prefix_subparts,											@"prefix",
+								nil]];
+	return searchPaths;
+	
+}//end searchPathsWithPaths:
+
+
+//========== readableFileTypes =================================================
+//
+// Purpose:		File extensions we catalog.
+//
+//==============================================================================
+- (NSArray *) readableFileTypes
+{
+// Not working for some reason. Why?
+//	NSArray 			*readableFileTypes = [NSDocument readableTypes];
+//	NSLog(@"readable types: %@", readableFileTypes);
+	return [NSArray arrayWithObjects:@"dat", @"ldr", nil];
+	
+}//end readableFileTypes
+
+
+//========== fileStampsForSearchPaths: =========================================
+//
+// Purpose:		Returns, for each search path, a dictionary of file name ->
+//				(size, modification date) for every catalogable file in it.
+//
+// Notes:		This is one directory listing and one stat per file; no file
+//				is opened.
+//
+//==============================================================================
+- (NSArray *) fileStampsForSearchPaths:(NSArray *)searchPaths
+{
+	NSFileManager		*fileManager		= [[[NSFileManager alloc] init] autorelease];
+	NSArray				*readableFileTypes	= [self readableFileTypes];
+	NSMutableArray		*allStamps			= [NSMutableArray arrayWithCapacity:[searchPaths count]];
+	
+	for(NSString *folderPath in [searchPaths valueForKey:@"path"])
+	{
+		NSAutoreleasePool	*pool		= [[NSAutoreleasePool alloc] init];
+		NSArray				*fileNames	= [fileManager contentsOfDirectoryAtPath:folderPath error:NULL];
+		NSMutableDictionary	*stamps		= [NSMutableDictionary dictionaryWithCapacity:[fileNames count]];
+		NSString			*filePath	= nil;
+		struct stat			info;
 		
-		NSUInteger							partCount			= 0;
+		for(NSString *fileName in fileNames)
+		{
+			if([readableFileTypes containsObject:[fileName pathExtension]] == NO)
+				continue;
+			
+			filePath = [folderPath stringByAppendingPathComponent:fileName];
+			if(stat([filePath fileSystemRepresentation], &info) == 0)
+			{
+				[stamps setObject:[NSArray arrayWithObjects:
+										[NSNumber numberWithLongLong:info.st_size],
+										[NSNumber numberWithLongLong:info.st_mtime],
+										nil]
+						   forKey:fileName];
+			}
+		}
+		[allStamps addObject:stamps];
+		[pool drain];
+	}
+	
+	return allStamps;
+	
+}//end fileStampsForSearchPaths:
+
 
-		// Start the progress bar so that we know what's happening.
-		for(NSString *path in [searchPaths valueForKey:@"path"])
+//========== catalogByUpdatingCatalogAtPath:... ================================
+//
+// Purpose:		Brings the saved catalog up to date by re-reading only the
+//				files which were added, removed or changed since it was built.
+//
+// Returns:		The updated catalog, or nil if there is no usable catalog and
+//				manifest, in which case the caller must do a full scan.
+//				changed is set to NO if nothing on disk differed.
+//
+// Notes:		Work is done per part number rather than per file. Each part
+//				number touched by a changed file is taken out of the catalog,
+//				then given back to the first file in search order which
+//				still provides it. That is the same answer a full scan gives,
+//				even when the change is to a file shadowing (or shadowed by)
+//				another folder's copy of the part.
+//
+//==============================================================================
+- (NSMutableDictionary *) catalogByUpdatingCatalogAtPath:(NSString *)catalogPath
+										  manifestAtPath:(NSString *)manifestPath
+											 searchPaths:(NSArray *)searchPaths
+											  fileStamps:(NSArray *)fileStamps
+												 version:(NSString *)version
+									 maxLoadCountHandler:(void (^)(NSUInteger maxPartCount))maxLoadCountHandler
+								progressIncrementHandler:(void (^)())progressIncrementHandler
+												 changed:(BOOL *)changed
+{
+	NSData				*catalogData		= nil;
+	NSDictionary		*manifest			= nil;
+	NSArray				*oldFileStamps		= nil;
+	NSMutableDictionary	*catalog			= nil;
+	NSMutableSet		*affectedParts		= [NSMutableSet set];
+	NSMutableArray		*filesByPartName	= [NSMutableArray arrayWithCapacity:[searchPaths count]];
+	NSUInteger			counter				= 0;
+	
+	if(catalogPath == nil || manifestPath == nil)
+		return nil;
+	
+	manifest		= [NSDictionary dictionaryWithContentsOfFile:manifestPath];
+	oldFileStamps	= [manifest objectForKey:MANIFEST_FILES_KEY];
+	
+	// The manifest only describes the catalog it was written with, and only
+	// for this exact list of folders.
+	if(		[[manifest objectForKey:MANIFEST_CATALOG_VERSION_KEY] isEqual:version] == NO
+	   ||	[[manifest objectForKey:MANIFEST_SEARCH_PATHS_KEY] isEqual:searchPaths] == NO
+	   ||	[oldFileStamps count] != [searchPaths count] )
+	{
+		return nil;
+	}
+	
+	catalogData	= [NSData dataWithContentsOfFile:catalogPath];
+	if(catalogData)
+	{
+		catalog = [NSPropertyListSerialization propertyListWithData:catalogData
+															options:NSPropertyListMutableContainers
+															 format:NULL
+															  error:NULL];
+	}
+	if(		[catalog isKindOfClass:[NSMutableDictionary class]] == NO
+	   ||	[[catalog objectForKey:VERSION_KEY] isEqual:version] == NO
+	   ||	[catalog objectForKey:PARTS_CATALOG_KEY] == nil
+	   ||	[catalog objectForKey:PARTS_LIST_KEY] == nil )
+	{
+		return nil;
+	}
+	
+	// Find every part number whose file set changed.
+	for(counter = 0; counter < [searchPaths count]; counter++)
+	{
+		NSDictionary		*oldStamps		= [oldFileStamps objectAtIndex:counter];
+		NSDictionary		*newStamps		= [fileStamps objectAtIndex:counter];
+		NSString			*namePrefix		= [[searchPaths objectAtIndex:counter] objectForKey:@"prefix"];
+		NSMutableDictionary	*partNames		= [NSMutableDictionary dictionaryWithCapacity:[newStamps count]];
+		
+		for(NSString *fileName in newStamps)
 		{
-			partCount += [[fileManager contentsOfDirectoryAtPath:path error:NULL] count];
+			if([[newStamps objectForKey:fileName] isEqual:[oldStamps objectForKey:fileName]] == NO)
+				[affectedParts addObject:[self partNumberForFileName:fileName namePrefix:namePrefix]];
+			
+			[partNames setObject:fileName forKey:[self partNumberForFileName:fileName namePrefix:namePrefix]];
 		}
-		if(maxLoadCountHandler)
+		for(NSString *fileName in oldStamps)
 		{
-			maxLoadCountHandler(partCount);
+			if([newStamps objectForKey:fileName] == nil)
+				[affectedParts addObject:[self partNumberForFileName:fileName namePrefix:namePrefix]];
 		}
+		[filesByPartName addObject:partNames];
+	}
+	
+	*changed = ([affectedParts count] > 0);
+	if(*changed == NO)
+		return catalog;
+	
+	if(maxLoadCountHandler)
+	{
+		maxLoadCountHandler([affectedParts count]);
+	}
+	
+	for(NSString *partNumber in affectedParts)
+	{
+		[self removePartNumber:partNumber fromCatalog:catalog];
+	}
+	
+	for(NSString *partNumber in affectedParts)
+	{
+		NSAutoreleasePool	*pool	= [[NSAutoreleasePool alloc] init];
 		
-		// Create the new part catalog. We will then fill it with folder contents.
-		[newPartCatalog setObject:[NSMutableDictionary dictionary] forKey:PARTS_CATALOG_KEY];
-		[newPartCatalog setObject:[NSMutableDictionary dictionary] forKey:PARTS_LIST_KEY];
-		
-		// Scan for each part folder.
-		for(NSDictionary *record in searchPaths)
+		for(counter = 0; counter < [searchPaths count]; counter++)
 		{
-			[self addPartsInFolder:[record objectForKey:@"path"]
-						 toCatalog:newPartCatalog
-					 underCategory:[record objectForKey:@"category"] //override all internal categories
-						namePrefix:[record objectForKey:@"prefix"]
-		  progressIncrementHandler:progressIncrementHandler];
+			NSDictionary		*record			= [searchPaths objectAtIndex:counter];
+			NSString			*fileName		= [[filesByPartName objectAtIndex:counter] objectForKey:partNumber];
+			NSMutableDictionary	*categoryRecord	= nil;
+			
+			if(fileName == nil)
+				continue;
+			
+			categoryRecord = [self catalogRecordForFileAtPath:[[record objectForKey:@"path"] stringByAppendingPathComponent:fileName]
+												underCategory:[record objectForKey:@"category"]
+												   namePrefix:[record objectForKey:@"prefix"]];
+			if([self addRecord:categoryRecord toCatalog:catalog])
+				break;
 		}
 		
-		NSString *version = [[[NSBundle mainBundle] infoDictionary] objectForKey:@"CFBundleVersion"];
-		[newPartCatalog setObject:version forKey:VERSION_KEY];
-		[newPartCatalog setObject:@"1.0"  forKey:COMPATIBILITY_VERSION_KEY];
+		if(progressIncrementHandler)
+		{
+			progressIncrementHandler();
+		}
+		[pool drain];
+	}
+	
+	return catalog;
+	
+}//end catalogByUpdatingCatalogAtPath:...
+
+
+//========== writeManifestToPath:searchPaths:fileStamps:version: ===============
+//
+// Purpose:		Saves the list of files the catalog was just built from.
+//
+//==============================================================================
+- (void) writeManifestToPath:(NSString *)manifestPath
+				 searchPaths:(NSArray *)searchPaths
+				  fileStamps:(NSArray *)fileStamps
+					 version:(NSString *)version
+{
+	NSDictionary	*manifest	= nil;
+	NSData			*data		= nil;
+	
+	if(manifestPath == nil || version == nil)
+		return;
+	
+	manifest = [NSDictionary dictionaryWithObjectsAndKeys:
+							version,		MANIFEST_CATALOG_VERSION_KEY,
+							searchPaths,	MANIFEST_SEARCH_PATHS_KEY,
+							fileStamps,		MANIFEST_FILES_KEY,
+							nil ];
+	
+	// Binary, since it has an entry for every file in the library.
+	data = [NSPropertyListSerialization dataWithPropertyList:manifest
+													  format:NSPropertyListBinaryFormat_v1_0
+													 options:0
+													   error:NULL];
+	[data writeToFile:manifestPath atomically:YES];
+	
+}//end writeManifestToPath:searchPaths:fileStamps:version:
+
+
+//========== addPartsInSearchPaths:toCatalog:progressIncrementHandler: =========
+//
+// Purpose:		Scans all the parts in every search folder and adds them to the
+//				given catalog.
+//
+// Notes:		Reading part headers is the slow bit, and every file is
+//				independent, so they are read in parallel across all the
+//				folders at once. The results are then filed in folder and
+//				directory order on this thread, so which copy of a duplicated
+//				part wins (and the order of each category) is the same as a
+//				one-file-at-a-time scan.
+//
+//				progressIncrementHandler is called from the worker threads,
+//				possibly several at once.
+//
+//==============================================================================
+- (void) addPartsInSearchPaths:(NSArray *)searchPaths
+					 toCatalog:(NSMutableDictionary *)catalog
+	  progressIncrementHandler:(void (^)())progressIncrementHandler
+{
+	NSFileManager		*fileManager			= [[[NSFileManager alloc] init] autorelease];
+	NSArray 			*readableFileTypes		= [self readableFileTypes];
+	NSMutableArray		*filePaths				= [NSMutableArray array];
+	NSMutableArray		*fileSearchPaths		= [NSMutableArray array];	// search path record for each of filePaths
+	NSUInteger			skippedCount			= 0;
+	NSUInteger			fileCount				= 0;
+	NSUInteger			counter					= 0;
+	NSMutableDictionary	**records				= NULL;
+	
+	// Gather up the work.
+	for(NSDictionary *record in searchPaths)
+	{
+		NSString *folderPath = [record objectForKey:@"path"];
 		
-		//Save the part catalog out for future reference.
-		[newPartCatalog writeToFile:partCatalogPath atomically:YES];
+		for(NSString *fileName in [fileManager contentsOfDirectoryAtPath:folderPath error:NULL])
+		{
+			if([readableFileTypes containsObject:[fileName pathExtension]] == YES)
+			{
+				[filePaths addObject:[folderPath stringByAppendingPathComponent:fileName]];
+				[fileSearchPaths addObject:record];
+			}
+			else
+				skippedCount++;
+		}
+	}
+	
+	// The progress count includes everything in the folders.
+	if(progressIncrementHandler)
+	{
+		for(counter = 0; counter < skippedCount; counter++)
+			progressIncrementHandler();
+	}
+	
+	// Read. Each iteration writes only its own slot.
+	fileCount	= [filePaths count];
+	records		= calloc(fileCount, sizeof(NSMutableDictionary *));
+	
+	dispatch_apply(fileCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index)
+	{
+		NSAutoreleasePool	*pool	= [[NSAutoreleasePool alloc] init];
+		NSDictionary		*record	= [fileSearchPaths objectAtIndex:index];
 		
-		// We succeeded in loading the parts!
-		completionHandler(newPartCatalog);
+		records[index] = [[self catalogRecordForFileAtPath:[filePaths objectAtIndex:index]
+											 underCategory:[record objectForKey:@"category"] //override all internal categories
+												namePrefix:[record objectForKey:@"prefix"]] retain];
+		if(progressIncrementHandler)
+		{
+			progressIncrementHandler();
+		}
+		[pool drain];
 	});
 	
-}//end reloadParts:
+	// File.
+	for(counter = 0; counter < fileCount; counter++)
+	{
+		[self addRecord:records[counter] toCatalog:catalog];
+		[records[counter] release];
+	}
+	free(records);
+	
+}//end addPartsInSearchPaths:toCatalog:progressIncrementHandler:
 
 
-//========== addPartsInFolder:toCatalog:underCategory: =========================
+//========== catalogRecordForFileAtPath:underCategory:namePrefix: ==============
 //
-// Purpose:		Scans all the parts in folderPath and adds them to the given
-//				catalog, filing them under the given category. Pass nil for
-//				category if you wish to use the categories defined in the parts
-//				themselves.
+// Purpose:		Returns the catalog info for one file, as it is to be filed
+//				from its folder, or nil if the file is not a valid part.
 //
-// Parameters:	categoryOverride	- force all parts in the folder to be filed
-//									  under this category, rather than the one
-//									  defined inside the part.
-//				namePrefix			- appends this prefix to each part scanned.
+// Parameters:	categoryOverride	- force the part to be filed under this
+//									  category, rather than the one defined
+//									  inside the part. Pass nil to use the
+//									  part's own category.
+//				namePrefix			- appends this prefix to the part name.
 //									  Part references in LDraw/parts/s should be
 //									  prefixed with the DOS path "s\". Pass nil
 //									  to ignore the prefix.
 //
 //==============================================================================
-- (void) addPartsInFolder:(NSString *)folderPath
-				toCatalog:(NSMutableDictionary *)catalog
-			underCategory:(NSString *)categoryOverride
-			   namePrefix:(NSString *)namePrefix
- progressIncrementHandler:(void (^)())progressIncrementHandler
+- (NSMutableDictionary *) catalogRecordForFileAtPath:(NSString *)filePath
+									   underCategory:(NSString *)categoryOverride
+										  namePrefix:(NSString *)namePrefix
 {
-	NSFileManager		*fileManager			= [[[NSFileManager alloc] init] autorelease];
-// Not working for some reason. Why?
-//	NSArray 			*readableFileTypes = [NSDocument readableTypes];
-//	NSLog(@"readable types: %@", readableFileTypes);
-	NSArray 			*readableFileTypes		= [NSArray arrayWithObjects:@"dat", @"ldr", nil];
+	NSMutableDictionary *categoryRecord = [self catalogInfoForFileAtPath:filePath];
+	
+	// Make sure the part file was valid!
+	if(categoryRecord == nil || [categoryRecord count] == 0)
+		return nil;
 	
-	NSArray 			*partNames				= [fileManager contentsOfDirectoryAtPath:folderPath error:NULL];
-	NSUInteger			numberOfParts			= [partNames count];
-	NSUInteger			counter;
+	if(categoryOverride)
+		[categoryRecord setObject:categoryOverride forKey:PART_CATEGORY_KEY];
+	
+	// Parts in subfolders of LDraw/parts must have a name prefix of
+	// their subpath, e.g., "s\partname.dat" for a part in the
+	// LDraw/parts/s folder.
+	if(namePrefix != nil)
+	{
+		NSString *partNumber = nil;
+		partNumber	= [categoryRecord objectForKey:PART_NUMBER_KEY];
+		partNumber	= [namePrefix stringByAppendingString:partNumber];
+		[categoryRecord setObject:partNumber forKey:PART_NUMBER_KEY];
+	}
 	
-	NSString			*currentPath			= nil;
-	NSMutableDictionary *categoryRecord 		= nil;
+	return categoryRecord;
 	
+}//end catalogRecordForFileAtPath:underCategory:namePrefix:
+
+
+//========== addRecord:toCatalog: ==============================================
+//
+// Purpose:		Files the part described by categoryRecord in the catalog,
+//				unless the catalog already has a part by that name.
+//
+// Returns:		YES if the part was added.
+//
+//==============================================================================
+- (BOOL) addRecord:(NSDictionary *)categoryRecord toCatalog:(NSMutableDictionary *)catalog
+{
 	//Get the subreference tables out of the main catalog (they should already exist!).
 	NSMutableDictionary *catalog_partNumbers	= [catalog objectForKey:PARTS_LIST_KEY]; //lookup parts by number
 	NSMutableDictionary *catalog_categories 	= [catalog objectForKey:PARTS_CATALOG_KEY]; //lookup parts by category
 	NSMutableArray		*catalog_category		= nil;
+	NSString			*category				= [categoryRecord objectForKey:PART_CATEGORY_KEY];
+	NSString			*partNumber				= [categoryRecord objectForKey:PART_NUMBER_KEY];
 	
+	if(category == nil)
+		return NO;
 	
+	// Check for dupe parts and reject later ones.  If we don't and the unofficial
+	// library has a part that has had its category edited, we'll end up with the
+	// part in BOTH categories.  This can hose us when the library changes which
+	// part is canonical vs alias.
+	if([catalog_partNumbers objectForKey:partNumber] != nil)
+	{
+		//NSLog(@"Skipped part %s - duplicate part ID.\n", [partNumber UTF8String]);
+		return NO;
+	}
+	
+	catalog_category = [catalog_categories objectForKey:category];
+	if(catalog_category == nil)
+	{
+		//We haven't encountered this category yet. Initialize it now.
+		catalog_category = [NSMutableArray array];
+		[catalog_categories setObject:catalog_category forKey:category ];
+	}
+	
+	// For some reason, I made each entry in the category a
+	// dictionary with part info. This was a database design
+	// mistake; it should have been an array of part reference
+	// numbers, if not just built up at runtime.
+	NSDictionary *categoryEntry = [NSDictionary dictionaryWithObject:partNumber
+															  forKey:PART_NUMBER_KEY];
+	
+	[catalog_category addObject:categoryEntry];
+	
+	// Also file the part in a master list by reference name.
+	[catalog_partNumbers setObject:categoryRecord forKey:partNumber];
+	
+	return YES;
+	
+}//end addRecord:toCatalog:
+
+
+//========== removePartNumber:fromCatalog: =====================================
+//
+// Purpose:		Takes a part out of both the part list and its category.
+//				Categories left empty are removed, as a full scan would never
+//				have created them.
+//
+//==============================================================================
+- (void) removePartNumber:(NSString *)partNumber fromCatalog:(NSMutableDictionary *)catalog
+{
+	NSMutableDictionary *catalog_partNumbers	= [catalog objectForKey:PARTS_LIST_KEY];
+	NSMutableDictionary *catalog_categories 	= [catalog objectForKey:PARTS_CATALOG_KEY];
+	NSString			*category				= [[catalog_partNumbers objectForKey:partNumber] objectForKey:PART_CATEGORY_KEY];
+	NSMutableArray		*catalog_category		= [catalog_categories objectForKey:category];
+	NSInteger			counter					= 0;
+	
+	for(counter = [catalog_category count] - 1; counter >= 0; counter--)
+	{
+		if([[[catalog_category objectAtIndex:counter] objectForKey:PART_NUMBER_KEY] isEqualToString:partNumber])
+			[catalog_category removeObjectAtIndex:counter];
+	}
+	if(catalog_category != nil && [catalog_category count] == 0)
+		[catalog_categories removeObjectForKey:category];
+	
+	[catalog_partNumbers removeObjectForKey:partNumber];
+	
+}//end removePartNumber:fromCatalog:
+
+
+//========== partNumberForFileName:namePrefix: =================================
+//
+// Purpose:		The name a file in a search folder is cataloged under. This
+//				must match what -catalogRecordForFileAtPath:... produces.
+//
+//==============================================================================
+- (NSString *) partNumberForFileName:(NSString *)fileName namePrefix:(NSString *)namePrefix
+{
+	NSString *partNumber = [fileName lowercaseString];
+	
+	if(namePrefix != nil)
+		partNumber = [namePrefix stringByAppendingString:partNumber];
+	
+	return partNumber;
+	
+}//end partNumberForFileName:namePrefix:
+
+
+//========== headerOfFileAtPath: ===============================================
+//
+// Purpose:		Returns the beginning of the file, up to and including the first
+//				line which is not blank or a comment. Nothing after that can be
+//				catalog information, so it is not read at all.
+//
+// Notes:		The file is read a chunk at a time until a geometry line turns
+//				up, so a typical part costs one small read rather than loading
+//				all of its (possibly very large) body.
+//
+//				The encoding is sniffed from the header alone, the same way
+//				+[LDrawUtilities stringFromFileData:] does for a whole file.
+//
+//==============================================================================
+- (NSString *) headerOfFileAtPath:(NSString *)filePath
+{
+	int			fd			= open([filePath fileSystemRepresentation], O_RDONLY);
+	char		*buffer		= NULL;
+	size_t		capacity	= 0;
+	size_t		length		= 0;
+	size_t		scanned		= 0;	// start of the first line not yet examined
+	ssize_t		bytesRead	= 0;
+	BOOL		foundEnd	= NO;
 	
-	//Loop through the entire contents of the directory and extract the
-	// information for every part therein.
-	for(counter = 0; counter < numberOfParts; counter++)
+	if(fd < 0)
+		return nil;
+	
+	while(foundEnd == NO && length < HEADER_READ_LIMIT)
 	{
-		currentPath = [folderPath stringByAppendingPathComponent:[partNames objectAtIndex:counter]];
+		if(capacity - length < HEADER_READ_CHUNK)
+		{
+			capacity	= capacity ? capacity * 2 : HEADER_READ_CHUNK;
+			buffer		= realloc(buffer, capacity);
+		}
+		bytesRead = read(fd, buffer + length, HEADER_READ_CHUNK);
+		if(bytesRead <= 0)
+			break;
+		length += bytesRead;
+		
+		// A UTF-8 byte order mark would keep the first line from looking 
+		// like a comment. 
+		if(scanned == 0 && length >= 3 && memcmp(buffer, "\xEF\xBB\xBF", 3) == 0)
+			scanned = 3;
 		
-		if([readableFileTypes containsObject:[currentPath pathExtension]] == YES)
+		// Look at each complete line we have not seen yet.
+		while(foundEnd == NO)
 		{
-			categoryRecord		= [self catalogInfoForFileAtPath:currentPath];
+			char *lineEnd = buffer + scanned;
 			
-			// Make sure the part file was valid!
-			if(categoryRecord != nil && [categoryRecord count] > 0)
+			while(lineEnd < buffer + length && *lineEnd != '\n' && *lineEnd != '\r')
+				lineEnd++;
+			if(lineEnd == buffer + length)
+				break;	// partial line; go read some more.
+			
+			if(isHeaderLine(buffer + scanned, lineEnd))
+				scanned = lineEnd + 1 - buffer;
+			else
 			{
-				//---------- Alter catalog info --------------------------------
-				
-				if(categoryOverride)
-					[categoryRecord setObject:categoryOverride forKey:PART_CATEGORY_KEY];
-				
-				// Parts in subfolders of LDraw/parts must have a name prefix of
-				// their subpath, e.g., "s\partname.dat" for a part in the
-				// LDraw/parts/s folder.
-				if(namePrefix != nil)
-				{
-					NSString *partNumber = nil;
-					partNumber	= [categoryRecord objectForKey:PART_NUMBER_KEY];
-					partNumber	= [namePrefix stringByAppendingString:partNumber];
-					[categoryRecord setObject:partNumber forKey:PART_NUMBER_KEY];
-				}
-				
-				//---------- Catalog the part ----------------------------------
-				
-				NSString *category = [categoryRecord objectForKey:PART_CATEGORY_KEY];
-				if(category)
-				{
-					// Check for dupe parts and reject later ones.  If we don't and the unofficial
-					// library has a part that has had its category edited, we'll end up with the
-					// part in BOTH categories.  This can hose us when the library changes which
-					// part is canonical vs alias.
-					NSString * partNumber = [categoryRecord objectForKey:PART_NUMBER_KEY];
-					if([catalog_partNumbers objectForKey:partNumber] == nil)
-					{
-						catalog_category = [catalog_categories objectForKey:category];
-						if(catalog_category == nil)
-						{
-							//We haven't encountered this category yet. Initialize it now.
-							catalog_category = [NSMutableArray array];
-							[catalog_categories setObject:catalog_category forKey:category ];
-						}
-						
-						// For some reason, I made each entry in the category a
-						// dictionary with part info. This was a database design
-						// mistake; it should have been an array of part reference
-						// numbers, if not just built up at runtime.
-						NSDictionary *categoryEntry = [NSDictionary dictionaryWithObject:[categoryRecord objectForKey:PART_NUMBER_KEY]
-																			  forKey:PART_NUMBER_KEY];
-																			  
-						[catalog_category addObject:categoryEntry];
-						
-						// Also file the part in a master list by reference name.
-						[catalog_partNumbers setObject:categoryRecord
-												forKey:[categoryRecord objectForKey:PART_NUMBER_KEY] ];
-					}
-					else
-					{
-						//NSLog(@"Skipped part %s at path %s - duplicate part ID.\n", [partNumber UTF8String],[currentPath UTF8String]);
-					}
-				}
-										
-//				NSLog(@"processed %@", [partNames objectAtIndex:counter]);
+				length		= lineEnd - buffer;
+				foundEnd	= YES;
 			}
 		}
-		if(progressIncrementHandler)
-		{
-			progressIncrementHandler();
-		}
-		
-	}//end loop through files
+	}
+	close(fd);
+	
+	if(length == 0)
+	{
+		free(buffer);
+		return @"";
+	}
+	
+	return [LDrawUtilities stringFromFileData:[NSData dataWithBytesNoCopy:buffer length:length freeWhenDone:YES]];
 	
-}//end addPartsInFolder:toCatalog:underCategory:
+}//end headerOfFileAtPath:
 
 
 //========== catalogInfoForFileAtPath: =========================================
@@ -361,7 +860,7 @@
 {
 	NSAutoreleasePool	*pool				= [[NSAutoreleasePool alloc] init];
 
-	NSString			*fileContents		= [LDrawUtilities stringFromFile:filepath];
+	NSString			*fileContents		= [self headerOfFileAtPath:filepath];
 	NSCharacterSet		*whitespace 		= [NSCharacterSet whitespaceAndNewlineCharacterSet];
 	
 	NSString            *partNumber         = nil;
@@ -9,8 +9,10 @@
 //  Copyright 2005. All rights reserved.
 //==============================================================================
 #import <Foundation/Foundation.h>
+#import <pthread.h>
 
 #import "ColorLibrary.h"
+#import "LDrawSymbolTable.h"
 
 @class LDrawDirective;
 @class LDrawModel;
@@ -43,6 +45,46 @@ extern NSString *Category_Moved;
 extern NSString	*Category_Primitives;
 extern NSString	*Category_Subparts;
 
+// Model cache - THEORY OF OPERATION
+//
+// Every library part ever resolved used to stay loaded (with its display
+// list) for the life of the process.  Now the loaded models share a memory
+// budget.  Each model's cost is estimated (-[LDrawModel estimatedMemoryUsage])
+// and when loading a new model takes the total over budget, the least
+// recently used models are evicted until it is 10% under.
+//
+// A model can only be evicted if nothing is using it.  Resolved LDrawParts
+// pin their library model (-pinModel:/-unpinModel:), so anything on screen
+// stays put.  Evicting a model drops it from loadedFiles and clears the symbol
+// table's cached pointer to it.  The next lookup reads it back in, from the
+// part cache if it's there.
+//
+// Eviction happens on whatever thread loads a model, which may not have a GL
+// context.  So an evicted model with a display list is queued, and the list
+// is thrown away by -discardEvictedDisplayLists, which the GL renderer calls
+// before each frame.
+//
+// A model's size is estimated when it is loaded and again once it has a
+// display list - on its next lookup, when its last pin goes, or when we look
+// for something to evict - so models drawn without a pin are budgeted too.
+//
+// Evicted models are autoreleased, not released, so a caller who just looked
+// one up keeps it until the autorelease pool drains.
+
+// What the model cache has been doing.
+typedef struct
+{
+	NSUInteger	hits;				// lookups that found the model loaded
+	NSUInteger	misses;				// lookups that had to read it
+	NSUInteger	reloads;			// models read again after being evicted
+	NSUInteger	evictions;
+	NSUInteger	residentModels;
+	NSUInteger	pinnedModels;
+	NSUInteger	residentBytes;		// estimated
+	NSUInteger	memoryBudget;		// 0 means unlimited
+
+} PartLibraryCacheStatistics;
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -60,6 +102,19 @@ extern NSString	*Category_Subparts;
 	NSMutableDictionary     *optimizedRepresentations;	// access stored vertex objects by part name, then color.
 	dispatch_queue_t        catalogAccessQueue;			// serial queue to mutex changes to the part catalog
 	NSMutableDictionary     *parsingGroups;				// arrays of dispatch_group_t's which have requested each file currently being parsed
+	
+	pthread_mutex_t			cacheMutex;					// guards the model cache bookkeeping below
+	CFMutableDictionaryRef	modelRecords;				// LDrawModel -> LibraryModelRecord, for everything in loadedFiles
+	NSMutableSet			*evictedNames;				// names of models evicted and not read back yet
+	NSMutableArray			*evictedModels;				// evicted models whose display lists are still to go
+	NSUInteger				memoryBudget;
+	NSUInteger				residentBytes;
+	NSUInteger				trimThreshold;				// don't look for models to evict until residentBytes passes this
+	uint64_t				useClock;
+	NSUInteger				cacheHits;
+	NSUInteger				cacheMisses;
+	NSUInteger				cacheReloads;
+	NSUInteger				cacheEvictions;
 }
 
 // Initialization
@@ -98,8 +153,18 @@ extern NSString	*Category_Subparts;
 - (CGImageRef) imageFromNeighboringFileForTexture:(LDrawTexture *)texture;
 - (LDrawModel *) modelForName:(NSString *) partName;
 - (LDrawModel *) modelForName_threadSafe:(NSString *) partName;
+- (LDrawModel *) modelForSymbol:(LDrawSymbol)partSymbol;
 
 - (LDrawDirective *) optimizedDrawableForPart:(LDrawPart *) part color:(LDrawColor *)color;
+
+// Model Cache
+- (NSUInteger) memoryBudget;
+- (void) setMemoryBudget:(NSUInteger)budgetBytes;
+- (PartLibraryCacheStatistics) cacheStatistics;
+- (void) pinModel:(LDrawModel *)model;
+- (void) unpinModel:(LDrawModel *)model;
+- (void) trimToMemoryBudget;
+- (void) discardEvictedDisplayLists;
 - (GLuint) textureTagForTexture:(LDrawTexture*)texture;
 
 // Utilites
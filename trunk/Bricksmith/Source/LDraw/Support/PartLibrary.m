@@ -18,7 +18,9 @@
 
 #import "LDrawFile.h"
 #import "LDrawKeywords.h"
+#import "LDrawMappedLines.h"
 #import "LDrawModel.h"
+#import "LDrawPartCache.h"
 #import "LDrawPart.h"
 #import "LDrawPathNames.h"
 #import "LDrawPaths.h"
@@ -68,6 +70,55 @@ NSString	*Category_Moved 			= @"Moved";
 NSString	*Category_Primitives		= @"Primitives";
 NSString	*Category_Subparts			= @"Subparts";
 
+// Library models are kept until their estimated size adds up to this.
+#define DEFAULT_MEMORY_BUDGET		(512 * 1024 * 1024)
+
+// The model cache's bookkeeping for one model in loadedFiles.
+typedef struct
+{
+	NSString		*name;			// its key in loadedFiles
+	LDrawSymbol		symbol;
+	NSInteger		pins;			// resolved parts using it
+	uint64_t		lastUse;
+	NSUInteger		bytes;			// estimated as of the last use
+	BOOL			sizedWithDL;	// bytes includes the display list
+
+} LibraryModelRecord;
+
+// An eviction candidate.
+typedef struct
+{
+	uint64_t		lastUse;
+	LDrawModel		*model;
+
+} EvictionCandidate;
+
+
+//========== compareEvictionCandidates =========================================
+//
+// Purpose:		qsort comparator putting the least recently used model first.
+//
+//==============================================================================
+static int compareEvictionCandidates(const void *lhs, const void *rhs)
+{
+	uint64_t	lhsUse	= ((const EvictionCandidate *)lhs)->lastUse;
+	uint64_t	rhsUse	= ((const EvictionCandidate *)rhs)->lastUse;
+	
+	return (lhsUse < rhsUse) ? -1 : (lhsUse > rhsUse);
+}
+
+
+@interface PartLibrary ()
+
+- (LDrawModel *) cachedModelForName:(NSString *)partName;
+- (void) registerModel:(LDrawModel *)model forName:(NSString *)partName;
+- (void) noteUseOfModel:(LDrawModel *)model;
+- (void) resizeRecord:(LibraryModelRecord *)record forModel:(LDrawModel *)model;
+- (void) evictModel:(LDrawModel *)model;
+
+@end
+
+
 @implementation PartLibrary
 
 static PartLibrary *SharedPartLibrary = nil;
@@ -114,6 +165,13 @@ static PartLibrary *SharedPartLibrary = nil;
 #endif
 	parsingGroups               = [[NSMutableDictionary alloc] init];
 	
+	pthread_mutex_init(&cacheMutex, NULL);
+	modelRecords				= CFDictionaryCreateMutable(NULL, 0, NULL, NULL);
+	evictedNames				= [[NSMutableSet alloc] init];
+	evictedModels				= [[NSMutableArray alloc] init];
+	memoryBudget				= DEFAULT_MEMORY_BUDGET;
+	trimThreshold				= DEFAULT_MEMORY_BUDGET;
+	
 	[self setPartCatalog:[NSDictionary dictionary]];
 	
 	return self;
@@ -696,7 +754,7 @@ static PartLibrary *SharedPartLibrary = nil;
 		BOOL            alreadyParsing      = NO;	// another thread is already parsing partName
 	
 		// Already been parsed?
-		model = [self->loadedFiles objectForKey:partName];
+		model = [self cachedModelForName:partName];
 		if(model == nil)
 		{
 #if USE_BLOCKS
@@ -740,7 +798,7 @@ static PartLibrary *SharedPartLibrary = nil;
 						^{
 							if(model != nil)
 							{
-								[self->loadedFiles setObject:model forKey:partName];
+								[self registerModel:model forName:partName];
 							}
 							
 							// Notify waiting threads we are finished parsing this part.
@@ -757,7 +815,7 @@ static PartLibrary *SharedPartLibrary = nil;
 					model = [self readModelAtPath:partPath asynchronously:NO completionHandler:NULL];
 					if(model != nil)
 					{
-						[self->loadedFiles setObject:model forKey:partName];
+						[self registerModel:model forName:partName];
 					}
 #endif //-----------------------------------------------------------------------
 #if USE_BLOCKS
@@ -910,7 +968,7 @@ static PartLibrary *SharedPartLibrary = nil;
 	NSString	*partPath	= nil;
 	
 	// Has it already been parsed?
-	model = [self->loadedFiles objectForKey:imageName];
+	model = [self cachedModelForName:imageName];
 
 
 	if(model == nil)
@@ -922,7 +980,7 @@ static PartLibrary *SharedPartLibrary = nil;
 		model		= [self readModelAtPath:partPath asynchronously:NO completionHandler:NULL];
 		
 		if(model != nil)
-			[self->loadedFiles setObject:model forKey:imageName];
+			[self registerModel:model forName:imageName];
 	}
 
 	return model;
@@ -950,13 +1008,12 @@ static PartLibrary *SharedPartLibrary = nil;
 //==============================================================================
 - (LDrawModel *) modelForPartInternal:(LDrawPart *) part
 {
-	NSString	*imageName	= [part referenceName];
 	LDrawModel	*model		= nil;
 	
 	//Try to get a live link if we have parsed this part off disk already.
 	//Ben sez: This routine is currently authorized to load on demand, but 
 	//I never see that code run and I don't think it is suppose to.
-	model = [self modelForName:imageName];
+	model = [self modelForSymbol:[part partSymbol]];
 	
 	if(model == nil) {
 		// We didn't find it in the LDraw folder. Hopefully this is a reference 
@@ -985,7 +1042,7 @@ static PartLibrary *SharedPartLibrary = nil;
 #if USE_BLOCKS
 	dispatch_sync(self->catalogAccessQueue, ^{
 #endif	
-		model = [self->loadedFiles objectForKey:imageName];
+		model = [self cachedModelForName:imageName];
 #if USE_BLOCKS		
 	});
 #endif	
@@ -993,6 +1050,39 @@ static PartLibrary *SharedPartLibrary = nil;
 	return model;
 }
 
+
+//========== modelForSymbol: ===================================================
+//
+// Purpose:		Returns the library model for an interned part name, loading 
+//				it if need be, or nil if it isn't in the LDraw folder. 
+//
+//				NOT THREAD SAFE!
+//
+// Notes:		The model is remembered on the symbol, so every later resolve 
+//				of the same part is an array index rather than a string hash. 
+//				Evicting a model clears the symbol's weak reference to it. 
+//
+//==============================================================================
+- (LDrawModel *) modelForSymbol:(LDrawSymbol)partSymbol
+{
+	LDrawSymbolTable	*symbolTable	= [LDrawSymbolTable sharedSymbolTable];
+	LDrawModel			*model			= [symbolTable libraryModelForSymbol:partSymbol];
+	
+	if(model != nil)
+	{
+		[self noteUseOfModel:model];
+	}
+	else if(partSymbol != LDrawSymbolNone)
+	{
+		model = [self modelForName:[symbolTable partNameForSymbol:partSymbol]];
+		[symbolTable setLibraryModel:model forSymbol:partSymbol];
+	}
+	
+	return model;
+	
+}//end modelForSymbol:
+
+
 #pragma mark -
 
 //========== optimizedDrawableForPart:color: ==================================
@@ -1016,6 +1106,412 @@ static PartLibrary *SharedPartLibrary = nil;
 }//end optimizedDrawableForPart:color:
 
 
+#pragma mark -
+#pragma mark MODEL CACHE
+#pragma mark -
+
+//========== memoryBudget ======================================================
+//
+// Purpose:		Returns how many bytes of library models we try to keep loaded.
+//
+//==============================================================================
+- (NSUInteger) memoryBudget
+{
+	return self->memoryBudget;
+	
+}//end memoryBudget
+
+
+//========== setMemoryBudget: ==================================================
+//
+// Purpose:		Sets how many bytes of library models to keep loaded, or 0 for 
+//				no limit, and evicts down to the new budget. 
+//
+//==============================================================================
+- (void) setMemoryBudget:(NSUInteger)budgetBytes
+{
+	pthread_mutex_lock(&cacheMutex);
+	{
+		self->memoryBudget	= budgetBytes;
+		self->trimThreshold	= budgetBytes;
+	}
+	pthread_mutex_unlock(&cacheMutex);
+	
+	[self trimToMemoryBudget];
+	
+}//end setMemoryBudget:
+
+
+//========== cacheStatistics ===================================================
+//
+// Purpose:		Returns the model cache's counters and current size.
+//
+//==============================================================================
+- (PartLibraryCacheStatistics) cacheStatistics
+{
+	PartLibraryCacheStatistics	statistics;
+	const void					**records	= NULL;
+	CFIndex						count		= 0;
+	CFIndex						counter		= 0;
+	
+	memset(&statistics, 0, sizeof(statistics));
+	
+	pthread_mutex_lock(&cacheMutex);
+	{
+		count	= CFDictionaryGetCount(self->modelRecords);
+		records	= malloc(count * sizeof(void *));
+		CFDictionaryGetKeysAndValues(self->modelRecords, NULL, records);
+		
+		for(counter = 0; counter < count; counter++)
+		{
+			if(((const LibraryModelRecord *)records[counter])->pins > 0)
+				statistics.pinnedModels++;
+		}
+		free(records);
+		
+		statistics.hits				= self->cacheHits;
+		statistics.misses			= self->cacheMisses;
+		statistics.reloads			= self->cacheReloads;
+		statistics.evictions		= self->cacheEvictions;
+		statistics.residentModels	= count;
+		statistics.residentBytes	= self->residentBytes;
+		statistics.memoryBudget		= self->memoryBudget;
+	}
+	pthread_mutex_unlock(&cacheMutex);
+	
+	return statistics;
+	
+}//end cacheStatistics
+
+
+//========== pinModel: =========================================================
+//
+// Purpose:		Marks a library model as in use, so it won't be evicted. Pins 
+//				are counted; each needs a matching -unpinModel:. 
+//
+//				Models that didn't come from the library are ignored. 
+//
+//==============================================================================
+- (void) pinModel:(LDrawModel *)model
+{
+	LibraryModelRecord	*record	= NULL;
+	
+	pthread_mutex_lock(&cacheMutex);
+	{
+		record = (LibraryModelRecord *)CFDictionaryGetValue(self->modelRecords, model);
+		if(record != NULL)
+			record->pins++;
+	}
+	pthread_mutex_unlock(&cacheMutex);
+	
+}//end pinModel:
+
+
+//========== unpinModel: =======================================================
+//
+// Purpose:		Releases a pin. The last one makes the model evictable, and 
+//				counts as its most recent use. 
+//
+//==============================================================================
+- (void) unpinModel:(LDrawModel *)model
+{
+	LibraryModelRecord	*record	= NULL;
+	
+	pthread_mutex_lock(&cacheMutex);
+	{
+		record = (LibraryModelRecord *)CFDictionaryGetValue(self->modelRecords, model);
+		if(record != NULL)
+		{
+			assert(record->pins > 0);
+			record->pins--;
+			
+			if(record->pins == 0)
+			{
+				// It has probably been drawn since we last sized it.
+				[self resizeRecord:record forModel:model];
+				record->lastUse			= ++self->useClock;
+			}
+		}
+	}
+	pthread_mutex_unlock(&cacheMutex);
+	
+}//end unpinModel:
+
+
+//========== trimToMemoryBudget ================================================
+//
+// Purpose:		Evicts unpinned models, least recently used first, until we're 
+//				10% under budget (or out of unpinned models). 
+//
+// Notes:		Loading a model calls this. It can be called from any thread; 
+//				display lists are only queued here, for 
+//				-discardEvictedDisplayLists. 
+//
+//				Models drawn since they were sized are resized first, so the 
+//				budget sees their display lists. 
+//
+//==============================================================================
+- (void) trimToMemoryBudget
+{
+	EvictionCandidate	*candidates		= NULL;
+	const void			**keys			= NULL;
+	const void			**records		= NULL;
+	LibraryModelRecord	*record			= NULL;
+	NSUInteger			target			= 0;
+	CFIndex				count			= 0;
+	CFIndex				counter			= 0;
+	CFIndex				candidateCount	= 0;
+	
+	pthread_mutex_lock(&cacheMutex);
+	
+	count		= CFDictionaryGetCount(self->modelRecords);
+	keys		= malloc(count * sizeof(void *));
+	records		= malloc(count * sizeof(void *));
+	CFDictionaryGetKeysAndValues(self->modelRecords, keys, records);
+	
+	for(counter = 0; counter < count; counter++)
+	{
+		record = (LibraryModelRecord *)records[counter];
+		if(record->sizedWithDL == NO && [(LDrawModel *)keys[counter] hasDisplayList])
+			[self resizeRecord:record forModel:(LDrawModel *)keys[counter]];
+	}
+	
+	if(self->memoryBudget > 0 && self->residentBytes > self->memoryBudget)
+	{
+		target = self->memoryBudget - self->memoryBudget / 10;
+		
+		candidates	= malloc(count * sizeof(EvictionCandidate));
+		
+		for(counter = 0; counter < count; counter++)
+		{
+			record = (LibraryModelRecord *)records[counter];
+			if(record->pins == 0)
+			{
+				candidates[candidateCount].lastUse	= record->lastUse;
+				candidates[candidateCount].model	= (LDrawModel *)keys[counter];
+				candidateCount++;
+			}
+		}
+		qsort(candidates, candidateCount, sizeof(EvictionCandidate), compareEvictionCandidates);
+		
+		for(counter = 0; counter < candidateCount && self->residentBytes > target; counter++)
+		{
+			[self evictModel:candidates[counter].model];
+		}
+		
+		free(candidates);
+		
+		// If too much is pinned to get under budget, don't rescan on every 
+		// load; wait until another tenth of the budget has come in. 
+		if(self->residentBytes > self->memoryBudget)
+			self->trimThreshold = self->residentBytes + self->memoryBudget / 10;
+		else
+			self->trimThreshold = self->memoryBudget;
+	}
+	
+	free(keys);
+	free(records);
+	
+	pthread_mutex_unlock(&cacheMutex);
+	
+}//end trimToMemoryBudget
+
+
+//========== discardEvictedDisplayLists ========================================
+//
+// Purpose:		Throws away the display lists of evicted models, and lets the 
+//				models go. 
+//
+// Notes:		Call this with the shared GL context current. The GL work is 
+//				done outside the cache lock, so loading threads don't wait on 
+//				it. 
+//
+//==============================================================================
+- (void) discardEvictedDisplayLists
+{
+	NSArray		*doomed	= nil;
+	
+	pthread_mutex_lock(&cacheMutex);
+	{
+		if([self->evictedModels count] > 0)
+		{
+			doomed				= self->evictedModels;
+			self->evictedModels	= [[NSMutableArray alloc] init];
+		}
+	}
+	pthread_mutex_unlock(&cacheMutex);
+	
+	for(LDrawModel *model in doomed)
+	{
+		[model discardDisplayList];
+	}
+	[doomed release];
+	
+}//end discardEvictedDisplayLists
+
+
+//========== cachedModelForName: ===============================================
+//
+// Purpose:		Returns the loaded model for the name, or nil if it has to be 
+//				read. Counts the hit or miss. 
+//
+//==============================================================================
+- (LDrawModel *) cachedModelForName:(NSString *)partName
+{
+	LDrawModel	*model	= nil;
+	
+	pthread_mutex_lock(&cacheMutex);
+	{
+		model = [self->loadedFiles objectForKey:partName];
+		if(model == nil)
+			self->cacheMisses++;
+	}
+	pthread_mutex_unlock(&cacheMutex);
+	
+	if(model != nil)
+		[self noteUseOfModel:model];
+	
+	return model;
+	
+}//end cachedModelForName:
+
+
+//========== registerModel:forName: ============================================
+//
+// Purpose:		Adds a freshly read model to loadedFiles and starts keeping 
+//				track of it, evicting others if that puts us over budget. 
+//
+//==============================================================================
+- (void) registerModel:(LDrawModel *)model forName:(NSString *)partName
+{
+	LibraryModelRecord	*record		= NULL;
+	LDrawModel			*previous	= nil;
+	BOOL				needsTrim	= NO;
+	
+	pthread_mutex_lock(&cacheMutex);
+	{
+		// Replacing a model under the same name? Forget the old one.
+		previous = [self->loadedFiles objectForKey:partName];
+		if(previous != nil && previous != model)
+			[self evictModel:previous];
+		
+		if(CFDictionaryGetValue(self->modelRecords, model) == NULL)
+		{
+			record			= calloc(1, sizeof(LibraryModelRecord));
+			record->name	= [partName copy];
+			record->symbol	= [[LDrawSymbolTable sharedSymbolTable] symbolForPartName:partName];
+			record->lastUse	= ++self->useClock;
+			
+			CFDictionarySetValue(self->modelRecords, model, record);
+			[self->loadedFiles setObject:model forKey:partName];
+			[self resizeRecord:record forModel:model];
+			
+			if([self->evictedNames containsObject:partName])
+			{
+				[self->evictedNames removeObject:partName];
+				self->cacheReloads++;
+			}
+		}
+		
+		needsTrim = (self->memoryBudget > 0 && self->residentBytes > self->trimThreshold);
+	}
+	pthread_mutex_unlock(&cacheMutex);
+	
+	if(needsTrim)
+		[self trimToMemoryBudget];
+	
+}//end registerModel:forName:
+
+
+//========== noteUseOfModel: ===================================================
+//
+// Purpose:		Counts a cache hit on the model and makes it the most recently 
+//				used. Models the cache isn't keeping track of are ignored. 
+//
+// Notes:		If the model has been drawn since it was sized, it is sized 
+//				again now; nothing else would, for a model used without a pin. 
+//
+//==============================================================================
+- (void) noteUseOfModel:(LDrawModel *)model
+{
+	LibraryModelRecord	*record	= NULL;
+	
+	pthread_mutex_lock(&cacheMutex);
+	{
+		record = (LibraryModelRecord *)CFDictionaryGetValue(self->modelRecords, model);
+		if(record != NULL)
+		{
+			if(record->sizedWithDL == NO && [model hasDisplayList])
+				[self resizeRecord:record forModel:model];
+			
+			record->lastUse = ++self->useClock;
+			self->cacheHits++;
+		}
+	}
+	pthread_mutex_unlock(&cacheMutex);
+	
+}//end noteUseOfModel:
+
+
+//========== resizeRecord:forModel: ============================================
+//
+// Purpose:		Estimates the model's size again and updates the total. Called 
+//				with cacheMutex held. 
+//
+//==============================================================================
+- (void) resizeRecord:(LibraryModelRecord *)record forModel:(LDrawModel *)model
+{
+	NSUInteger	bytes	= [model estimatedMemoryUsage];
+	
+	self->residentBytes	= self->residentBytes - record->bytes + bytes;
+	record->bytes		= bytes;
+	record->sizedWithDL	= [model hasDisplayList];
+	
+}//end resizeRecord:forModel:
+
+
+//========== evictModel: =======================================================
+//
+// Purpose:		Unloads a model. Called with cacheMutex held.
+//
+// Notes:		The model is autoreleased rather than released, in case whoever 
+//				is on the stack right now just looked it up. 
+//
+//				Its display list can't be thrown away here - we may not be on 
+//				a thread with a GL context, and we're holding the lock - so a 
+//				model with one waits in evictedModels. 
+//
+//==============================================================================
+- (void) evictModel:(LDrawModel *)model
+{
+	LDrawSymbolTable	*symbolTable	= [LDrawSymbolTable sharedSymbolTable];
+	LibraryModelRecord	*record			= (LibraryModelRecord *)CFDictionaryGetValue(self->modelRecords, model);
+	
+	[[model retain] autorelease];
+	
+	if(record != NULL)
+	{
+		if([self->loadedFiles objectForKey:record->name] == model)
+			[self->loadedFiles removeObjectForKey:record->name];
+		
+		if([symbolTable libraryModelForSymbol:record->symbol] == model)
+			[symbolTable setLibraryModel:nil forSymbol:record->symbol];
+		
+		[self->evictedNames addObject:record->name];
+		self->residentBytes -= record->bytes;
+		self->cacheEvictions++;
+		
+		CFDictionaryRemoveValue(self->modelRecords, model);
+		[record->name release];
+		free(record);
+	}
+	
+	if([model hasDisplayList])
+		[self->evictedModels addObject:model];
+	
+}//end evictModel:
+
+
 //========== textureTagForTexture: =============================================
 //
 // Purpose:		Returns the OpenGL tag necessary to draw the image represented 
@@ -1225,12 +1721,14 @@ static PartLibrary *SharedPartLibrary = nil;
 //				Otherwise, returns nil and passes the completed model via the 
 //				block instead. 
 //
+//				Parts are read from the part cache when possible, and written 
+//				to it after being parsed and optimized. 
+//
 //==============================================================================
 - (LDrawModel *) readModelAtPath:(NSString *)partPath
 				  asynchronously:(BOOL)asynchronous
 			   completionHandler:(void (^)(LDrawModel *))completionBlock
 {
-	NSString            *fileContents   = nil;
 	NSArray             *lines          = nil;
 	LDrawFile           *parsedFile     = nil;
 	dispatch_group_t    group           = NULL;
@@ -1239,6 +1737,22 @@ static PartLibrary *SharedPartLibrary = nil;
 #endif
 			LDrawModel  *model          = nil;
 	
+	// Try the precompiled part cache first. A hit skips parsing this part AND 
+	// loading everything it references. 
+	model = [LDrawPartCache modelForPartAtPath:partPath];
+	if(model != nil)
+	{
+#if USE_BLOCKS
+		if(asynchronous == YES)
+		{
+			if(completionBlock)
+				completionBlock(model);
+			return nil;
+		}
+#endif
+		return model;
+	}
+	
 #if USE_BLOCKS
 	group           = dispatch_group_create();
 #endif
@@ -1247,8 +1761,7 @@ static PartLibrary *SharedPartLibrary = nil;
 	{
 		// We found it in the LDraw folder; now all we need to do is get the 
 		// model for it. 
-		fileContents    = [LDrawUtilities stringFromFile:partPath];
-		lines           = [fileContents separateByLine];
+		lines           = [LDrawMappedLines linesWithContentsOfFile:partPath];
 		
 		parsedFile      = [[LDrawFile alloc] initWithLines:lines
 												   inRange:NSMakeRange(0, [lines count])
@@ -1262,6 +1775,7 @@ static PartLibrary *SharedPartLibrary = nil;
 #endif
 		[parsedFile optimizeStructure];
 		model = [[[[parsedFile submodels] objectAtIndex:0] retain] autorelease];
+		[LDrawPartCache saveModel:model forPartAtPath:partPath];
 		// We are "leaking" the enclosing file, but returning an internal model 
 		// without disconnecting it from its file is pretty dodgy and it would 
 		// be easy to code a bug in. We'd be better off returning the file 
@@ -1276,6 +1790,7 @@ static PartLibrary *SharedPartLibrary = nil;
 							  ^{
 								  [parsedFile optimizeStructure];
 								  model = [[[[parsedFile submodels] objectAtIndex:0] retain] autorelease];
+								  [LDrawPartCache saveModel:model forPartAtPath:partPath];
 								  
 								  if(completionBlock)
 									  completionBlock(model);
@@ -1303,6 +1818,10 @@ static PartLibrary *SharedPartLibrary = nil;
 //==============================================================================
 - (void) dealloc
 {
+	const void	**records	= NULL;
+	CFIndex		count		= 0;
+	CFIndex		counter		= 0;
+	
 	[partCatalog				release];
 	[favorites					release];
 	[loadedFiles				release];
@@ -1314,6 +1833,21 @@ static PartLibrary *SharedPartLibrary = nil;
 #endif
 	[parsingGroups		release];
 	
+	// The models go with loadedFiles; just free the bookkeeping.
+	count	= CFDictionaryGetCount(modelRecords);
+	records	= malloc(count * sizeof(void *));
+	CFDictionaryGetKeysAndValues(modelRecords, NULL, records);
+	for(counter = 0; counter < count; counter++)
+	{
+		[((LibraryModelRecord *)records[counter])->name release];
+		free((void *)records[counter]);
+	}
+	free(records);
+	CFRelease(modelRecords);
+	[evictedNames		release];
+	[evictedModels		release];
+	pthread_mutex_destroy(&cacheMutex);
+	
 	[super dealloc];
 	
 }//end dealloc
@@ -25,7 +25,9 @@
 #import "PartReport.h"
 
 #import "LDrawContainer.h"
+#import "LDrawFile.h"
 #import "LDrawKeywords.h"
+#import "LDrawMPDModel.h"
 #import "LDrawPart.h"
 #import "PartLibrary.h"
 
@@ -112,6 +114,60 @@ NSString    *PART_REPORT_PART_QUANTITY  = @"QuantityKey";
 }//end getPieceCountReport
 
 
+//========== elementsForMissingPiecesReport ====================================
+//
+// Purpose:		Returns the elements the missing-pieces report needs to look at.
+//
+// Notes:		A document's submodels may not have parsed their steps yet. 
+//				Parsing all of them just to learn every part is in the LDraw 
+//				folder would throw away the point of deferring them, so an 
+//				unparsed submodel is checked by name first. Only if one of its 
+//				parts is neither in the catalog nor another submodel of the 
+//				file - or is in the catalog as ~Moved - do we parse it and look 
+//				at the real parts. 
+//
+//==============================================================================
+- (NSArray *) elementsForMissingPiecesReport
+{
+	PartLibrary		*partLibrary		= [PartLibrary sharedPartLibrary];
+	LDrawFile		*file				= nil;
+	NSMutableArray	*elements			= nil;
+	NSArray			*partNames			= nil;
+	NSString		*category			= nil;
+	BOOL			 needsParts			= NO;
+	
+	if([self->reportedObject isKindOfClass:[LDrawFile class]] == NO)
+		return [self->reportedObject allEnclosedElements];
+	
+	file		= (LDrawFile *)self->reportedObject;
+	elements	= [NSMutableArray array];
+	
+	for(LDrawMPDModel *submodel in [file submodels])
+	{
+		partNames	= [submodel deferredPartNames];
+		needsParts	= (partNames == nil);
+		
+		for(NSString *partName in partNames)
+		{
+			category = [partLibrary categoryForPartName:partName];
+			
+			if(		(category == nil && [file modelWithName:partName] == nil)
+				||	[category isEqualToString:LDRAW_MOVED_CATEGORY] )
+			{
+				needsParts = YES;
+				break;
+			}
+		}
+		
+		if(needsParts == YES)
+			[elements addObjectsFromArray:[submodel allEnclosedElements]];
+	}
+	
+	return elements;
+	
+}//end elementsForMissingPiecesReport
+
+
 //========== getMissingPiecesReport ============================================
 //
 // Purpose:		Collects information about all the parts in the model which 
@@ -121,7 +177,7 @@ NSString    *PART_REPORT_PART_QUANTITY  = @"QuantityKey";
 - (void) getMissingPiecesReport
 {
 	PartLibrary		*partLibrary		= [PartLibrary sharedPartLibrary];
-	NSArray			*elements			= [self->reportedObject allEnclosedElements];
+	NSArray			*elements			= [self elementsForMissingPiecesReport];
 	id				 currentElement		= nil;
 //	LDrawModel		*partModel			= nil;
 	NSString		*category			= nil;
@@ -9,7 +9,13 @@
 //==============================================================================
 #import <Cocoa/Cocoa.h>
 
+#import "LDrawBenchmark.h"
+
 int main(int argc, char *argv[])
 {
+	// Benchmark runs are headless; see LDrawBenchmark.h.
+	if(argc > 1 && strcmp(argv[1], LDRAW_BENCHMARK_ARGUMENT) == 0)
+		return [LDrawBenchmark runWithArgumentCount:argc arguments:(const char **) argv];
+	
     return NSApplicationMain(argc, (const char **) argv);
 }